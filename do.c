@@ -3,6 +3,307 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <math.h>
+#include <setjmp.h>
+#include <sched.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DYNARY_API static inline
+#define DYNARY_IMPLEMENTATION
+#include "dynary.h"
+
+
+//////////////////////////////////////////////////////////////////////////////
+// ARENA
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+chunked bump allocator. memory is only released all at once, either by
+arena_reset() (keeps the chunks around for reuse, O(1)) or arena_free()
+*/
+
+#define ARENA_ALIGN (8)
+#define ARENA_MIN_CHUNK_SIZE (1<<14)
+#define ARENA_MAX_CHUNK_SIZE (1<<22)
+
+struct arena_chunk {
+	struct arena_chunk* next;
+	size_t size;
+	char data[];
+};
+
+struct arena {
+	struct arena_chunk* first;
+	struct arena_chunk* current;
+	char* cur;
+	char* end;
+
+	// stats
+	size_t bytes_allocated; // since last reset
+	size_t bytes_reserved; // sum of chunk sizes
+	int n_allocs; // since last reset
+	int n_chunks;
+};
+
+static void arena_init(struct arena* a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+static void arena_free(struct arena* a)
+{
+	struct arena_chunk* c = a->first;
+	while (c != NULL) {
+		struct arena_chunk* next = c->next;
+		free(c);
+		c = next;
+	}
+	arena_init(a);
+}
+
+static void arena_reset(struct arena* a)
+{
+	a->current = a->first;
+	if (a->current != NULL) {
+		a->cur = a->current->data;
+		a->end = a->cur + a->current->size;
+	}
+	a->bytes_allocated = 0;
+	a->n_allocs = 0;
+}
+
+static void* arena__alloc_slow(struct arena* a, size_t sz)
+{
+	// reuse the next chunk if it's big enough (they're kept after a
+	// reset), otherwise insert a new one
+	struct arena_chunk* next = a->current != NULL ? a->current->next : a->first;
+	if (next == NULL || next->size < sz) {
+		size_t chunk_sz = a->current != NULL ? a->current->size * 2 : ARENA_MIN_CHUNK_SIZE;
+		if (chunk_sz > ARENA_MAX_CHUNK_SIZE) chunk_sz = ARENA_MAX_CHUNK_SIZE;
+		if (chunk_sz < sz) chunk_sz = sz;
+		struct arena_chunk* c = malloc(sizeof(*c) + chunk_sz);
+		assert(c != NULL);
+		c->size = chunk_sz;
+		c->next = next;
+		if (a->current != NULL) {
+			a->current->next = c;
+		} else {
+			a->first = c;
+		}
+		a->bytes_reserved += chunk_sz;
+		a->n_chunks++;
+		next = c;
+	}
+	a->current = next;
+	a->cur = next->data + sz;
+	a->end = next->data + next->size;
+	return next->data;
+}
+
+static inline void* arena_alloc(struct arena* a, size_t sz)
+{
+	sz = (sz + (ARENA_ALIGN-1)) & ~(size_t)(ARENA_ALIGN-1);
+	a->bytes_allocated += sz;
+	a->n_allocs++;
+	if ((size_t)(a->end - a->cur) >= sz) {
+		void* p = a->cur;
+		a->cur += sz;
+		return p;
+	}
+	return arena__alloc_slow(a, sz);
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// SYMBOLS
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+identifier interning. the lexer gives every distinct identifier a dense id
+(starting at 1; 0 means "no symbol") the first time it sees it, so later
+stages can compare names as integers.
+
+there is one table for the process (symtab), shared by every thread, so ids
+mean the same everywhere (trees and programs move between threads: the
+driver's workers, the C backend). lookups take no lock: slots are published
+atomically, slot arrays outgrown by a shard stay around until symtab_free(),
+and symbols live in chunks that never move. inserting locks one of
+SYMTAB_N_SHARDS shards, picked by hash, and looks again
+*/
+
+#define SYMTAB_MIN_SLOTS (1<<8)
+#define SYMTAB_SHARD_BITS (4)
+#define SYMTAB_N_SHARDS (1<<SYMTAB_SHARD_BITS)
+#define SYMTAB_CHUNK_LOG (8) // chunk k holds 256<<k symbols
+
+struct symbol {
+	char* name; // NUL-terminated copy
+	uint32_t len;
+	uint32_t hash;
+};
+
+struct symtab_slots {
+	struct symtab_slots* prev; // outgrown
+	uint32_t mask;
+	uint64_t slots[]; // hash << 32 | id, 0 if free; open addressing, linear probing
+};
+
+struct symtab_shard {
+	int lock; // see symtab__lock()
+	struct symtab_slots* slots; // set atomically
+	uint32_t n_syms;
+	struct arena names;
+} __attribute__((aligned(64)));
+
+// all zeros is an empty table
+struct symtab {
+	struct symtab_shard shards[SYMTAB_N_SHARDS];
+	struct symbol* chunks[32 - SYMTAB_CHUNK_LOG]; // set atomically
+	uint32_t n_syms; // accessed atomically
+};
+
+struct symtab symtab;
+
+static inline uint32_t symtab_hash(const char* s, size_t len)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void symtab_init(struct symtab* st)
+{
+	memset(st, 0, sizeof(*st));
+}
+
+// no other thread may be using st
+static void symtab_free(struct symtab* st)
+{
+	for (int i = 0; i < SYMTAB_N_SHARDS; i++) {
+		for (struct symtab_slots* t = st->shards[i].slots; t != NULL; ) {
+			struct symtab_slots* prev = t->prev;
+			free(t);
+			t = prev;
+		}
+		arena_free(&st->shards[i].names);
+	}
+	for (int k = 0; k < 32 - SYMTAB_CHUNK_LOG; k++) free(st->chunks[k]);
+	memset(st, 0, sizeof(*st));
+}
+
+static int symtab_n_symbols(struct symtab* st)
+{
+	return __atomic_load_n(&st->n_syms, __ATOMIC_RELAXED);
+}
+
+static void symtab__lock(int* lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static void symtab__unlock(int* lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+// the symbol of id, allocating its chunk if need be
+static inline struct symbol* symtab__sym(struct symtab* st, uint32_t id)
+{
+	uint32_t i = id + (1u << SYMTAB_CHUNK_LOG);
+	int k = 31 - __builtin_clz(i) - SYMTAB_CHUNK_LOG;
+	struct symbol* chunk = __atomic_load_n(&st->chunks[k], __ATOMIC_ACQUIRE);
+	if (chunk == NULL) {
+		struct symbol* fresh = calloc((size_t)1 << (k + SYMTAB_CHUNK_LOG), sizeof(*fresh));
+		assert(fresh != NULL);
+		if (__atomic_compare_exchange_n(&st->chunks[k], &chunk, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			chunk = fresh;
+		} else {
+			free(fresh);
+		}
+	}
+	return &chunk[i - (1u << (k + SYMTAB_CHUNK_LOG))];
+}
+
+// the id of s in t, or 0 with *end at the free slot the probe ended on
+static inline uint32_t symtab__find(struct symtab* st, struct symtab_slots* t, uint32_t h, const char* s, size_t len, uint32_t* end)
+{
+	for (uint32_t i = h & t->mask; ; i = (i + 1) & t->mask) {
+		uint64_t slot = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+		if (slot == 0) {
+			*end = i;
+			return 0;
+		}
+		if ((uint32_t)(slot >> 32) != h) continue;
+		struct symbol* sym = symtab__sym(st, (uint32_t)slot);
+		if (sym->len == len && memcmp(sym->name, s, len) == 0) return (uint32_t)slot;
+	}
+}
+
+static struct symtab_slots* symtab__grow(struct symtab_shard* sh)
+{
+	struct symtab_slots* old = sh->slots;
+	uint32_t n_slots = old == NULL ? SYMTAB_MIN_SLOTS : (old->mask + 1) * 2;
+	struct symtab_slots* t = calloc(1, sizeof(*t) + n_slots * sizeof(*t->slots));
+	assert(t != NULL);
+	t->prev = old;
+	t->mask = n_slots - 1;
+	for (uint32_t j = 0; old != NULL && j <= old->mask; j++) {
+		if (old->slots[j] == 0) continue;
+		uint32_t i = (uint32_t)(old->slots[j] >> 32) & t->mask;
+		while (t->slots[i] != 0) i = (i + 1) & t->mask;
+		t->slots[i] = old->slots[j];
+	}
+	// lookups still probing old finish there
+	__atomic_store_n(&sh->slots, t, __ATOMIC_RELEASE);
+	return t;
+}
+
+static uint32_t symtab_intern(struct symtab* st, const char* s, size_t len)
+{
+	uint32_t h = symtab_hash(s, len);
+	struct symtab_shard* sh = &st->shards[h >> (32 - SYMTAB_SHARD_BITS)];
+	uint32_t end = 0;
+	struct symtab_slots* t = __atomic_load_n(&sh->slots, __ATOMIC_ACQUIRE);
+	uint32_t id = t != NULL ? symtab__find(st, t, h, s, len, &end) : 0;
+	if (id != 0) return id;
+
+	symtab__lock(&sh->lock);
+	t = sh->slots;
+	// keep load factor <= 1/2
+	if (t == NULL || (sh->n_syms + 1) * 2 > t->mask) t = symtab__grow(sh);
+	id = symtab__find(st, t, h, s, len, &end);
+	if (id == 0) {
+		id = __atomic_add_fetch(&st->n_syms, 1, __ATOMIC_RELAXED);
+		struct symbol* sym = symtab__sym(st, id);
+		sym->name = arena_alloc(&sh->names, len + 1);
+		memcpy(sym->name, s, len);
+		sym->name[len] = 0;
+		sym->len = len;
+		sym->hash = h;
+		__atomic_store_n(&t->slots[end], (uint64_t)h << 32 | id, __ATOMIC_RELEASE);
+		sh->n_syms++;
+	}
+	symtab__unlock(&sh->lock);
+	return id;
+}
+
+// ids reach other threads through whatever hands them the tree or program,
+// which orders the symbol's writes before this
+static inline struct symbol* symtab_get(struct symtab* st, uint32_t id)
+{
+	assert(id > 0 && id <= symtab_n_symbols(st));
+	return symtab__sym(st, id);
+}
+
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -14,11 +315,6 @@ struct str {
 	size_t len;
 };
 
-static void str_cstr(struct str* s, char* cs)
-{
-	s->ptr = cs;
-	s->len = strlen(cs);
-};
 
 #if 0
 static void str_print(struct str* s)
@@ -103,6 +399,8 @@ enum token_type {
 
 	T_WHITESPACE,
 
+	T_ERROR, // a character that starts no token
+
 	T_EOF
 };
 
@@ -113,343 +411,367 @@ static int tt_is_type(enum token_type tt)
 
 struct token {
 	enum token_type type;
+	uint32_t sym; // when type==T_IDENTIFIER; see symtab_intern()
 	union {
 		int v[4]; // when type==T__META
 		struct str str; // when type!=T__META
 	};
 };
 
-struct lexer;
-
-// (returns lexer_state_fn* but I can't do recursive typedefs :-/ )
-typedef void* (*lexer_state_fn)(struct lexer*);
-
 struct lexer {
 	struct str src;
-	int line, previous_token_line, column;
+	int line, previous_token_line;
+	int line_start; // column is pos - line_start
 	int pos;
 	int start;
-	struct token token, previous_token;
-	int has_token;
-	lexer_state_fn state_fn;
+	struct token token;
+	enum token_type previous_token_type;
 };
 
-static void* lex_main(struct lexer* l);
-
-static void lexer_init(struct lexer* l, char* src)
-{
-	memset(l, 0, sizeof(*l));
-	str_cstr(&l->src, src);
-	l->state_fn = lex_main;
-}
-
-static int lexer_ch(struct lexer* l)
-{
-	if (l->pos >= l->src.len) {
-		l->pos++;
-		return -1;
-	}
-
-	int ch = l->src.ptr[l->pos]; // TODO proper utf8 decode?
-	if (ch == '\n') {
-		l->line++;
-		l->column = 0;
-	} else {
-		l->column++;
-	}
-	l->pos++;
-	return ch;
-}
-
-static void lexer_backup(struct lexer* l)
-{
-	l->pos--;
-}
-
-static int lexer_accept_char(struct lexer* l, char valid)
-{
-	int ch = lexer_ch(l);
-	if (ch == valid) return 1;
-	lexer_backup(l);
-	return 0;
-}
-
-static int char_in(char ch, const char* valid)
-{
-	size_t valid_length = strlen(valid);
-	for (int i = 0; i < valid_length; i++) if (valid[i] == ch) return 1;
-	return 0;
-}
+// character classes (see char_class[])
+#define CC_WS    (1<<0)
+#define CC_ALPHA (1<<1)
+#define CC_DIGIT (1<<2)
+#define CC_HEX   (1<<3)
+#define CC_IDENT (CC_ALPHA | CC_DIGIT)
+
+static const unsigned char char_class[256] = {
+	[' '] = CC_WS,
+	['\t'] = CC_WS,
+	['\n'] = CC_WS,
+	['\r'] = CC_WS,
+	['0' ... '9'] = CC_DIGIT | CC_HEX,
+	['a' ... 'f'] = CC_ALPHA | CC_HEX,
+	['g' ... 'z'] = CC_ALPHA,
+	['A' ... 'F'] = CC_ALPHA | CC_HEX,
+	['G' ... 'Z'] = CC_ALPHA,
+	['_'] = CC_ALPHA,
+};
 
-static int lexer_accept(struct lexer* l, const char* valid)
-{
-	int ch = lexer_ch(l);
-	if (char_in(ch, valid)) return 1;
-	lexer_backup(l);
-	return 0;
-}
+// single character punctuation; multi character punctuation and comments
+// are special cased in lexer_scan()
+static const unsigned char punct_tt[256] = {
+	[','] = T_COMMA,
+	[';'] = T_SEMICOLON,
+	['.'] = T_DOT,
+	['='] = T_ASSIGN,
+	['+'] = T_PLUS,
+	['-'] = T_MINUS,
+	['*'] = T_MUL,
+	['/'] = T_DIV,
+	['%'] = T_MOD,
+	['('] = T_LPAREN,
+	[')'] = T_RPAREN,
+	['{'] = T_LCURLY,
+	['}'] = T_RCURLY,
+	['['] = T_LBRACKET,
+	[']'] = T_RBRACKET,
+};
 
-static int lexer_accept_fn(struct lexer* l, int(*fn)(int))
+static inline int cc_is(int ch, int cc)
 {
-	int ch = lexer_ch(l);
-	if (fn(ch)) return 1;
-	lexer_backup(l);
-	return 0;
+	return char_class[(unsigned char)ch] & cc;
 }
 
-
-static int lexer_accept_run(struct lexer* l, const char* valid)
+static void lexer_init_n(struct lexer* l, char* src, size_t len)
 {
-	int i = 0;
-	while (lexer_accept(l, valid)) i++;
-	return i;
+	memset(l, 0, sizeof(*l));
+	l->src.ptr = src;
+	l->src.len = len;
 }
 
-static void lexer_accept_run_fn(struct lexer* l, int(*fn)(int))
+static void lexer_init(struct lexer* l, char* src)
 {
-	while (lexer_accept_fn(l, fn)) {}
+	lexer_init_n(l, src, strlen(src));
 }
 
-static void lexer_eat(struct lexer* l)
+static inline int lexer_at(struct lexer* l, int pos)
 {
-	l->start = l->pos;
+	return pos < l->src.len ? (unsigned char)l->src.ptr[pos] : -1;
 }
 
-static void lexer_emit(struct lexer* l, enum token_type type)
+static void lexer_count_lines(struct lexer* l, int pos, int end)
 {
-	l->token.type = type;
-	l->token.str.ptr = l->src.ptr + l->start;
-	l->token.str.len = l->pos - l->start;
-
-	l->has_token = 1;
-
-	lexer_eat(l);
-}
-
-static void* lex_eof(struct lexer* l) {
-	lexer_eat(l);
-	lexer_emit(l, T_EOF);
-	return lex_eof;
+	const char* s = l->src.ptr;
+	const char* p = s + pos;
+	const char* e = s + end;
+	while (p < e && (p = memchr(p, '\n', e - p)) != NULL) {
+		p++;
+		l->line++;
+		l->line_start = p - s;
+	}
 }
 
-static void* lex_number(struct lexer* l)
+// the wide scanners are kept out of line so that the short-run fast paths
+// below stay small enough to be inlined into lexer_scan()
+static __attribute__((noinline)) int lexer_scan_whitespace_wide(struct lexer* l, int pos)
 {
-	lexer_accept(l, "+-");
-	const char* dec_digits = "0123456789";
-	const char* hex_digits = "0123456789abcdefABCDEF";
-	const char* digits = lexer_accept_char(l, '0') && lexer_accept(l, "xX") ? hex_digits : dec_digits;
-	lexer_accept_run(l, digits);
-	if (lexer_accept_char(l, '.')) {
-		lexer_accept_run(l, digits);
+	const char* s = l->src.ptr;
+	int len = l->src.len;
+	#ifdef __SSE2__
+	while (pos + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + pos));
+		__m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+		__m128i ws = _mm_or_si128(
+			_mm_or_si128(nl, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+		unsigned wsm = _mm_movemask_epi8(ws);
+		unsigned nlm = _mm_movemask_epi8(nl);
+		int n = wsm == 0xffff ? 16 : __builtin_ctz(~wsm);
+		nlm &= (1u << n) - 1;
+		if (nlm) {
+			l->line += __builtin_popcount(nlm);
+			l->line_start = pos + 32 - __builtin_clz(nlm);
+		}
+		pos += n;
+		if (n < 16) return pos;
 	}
-	if (lexer_accept(l, "eE")) {
-		lexer_accept(l, "+-");
-		lexer_accept_run(l, dec_digits);
+	#endif
+	while (pos < len && cc_is(s[pos], CC_WS)) {
+		if (s[pos] == '\n') {
+			l->line++;
+			l->line_start = pos + 1;
+		}
+		pos++;
 	}
-	lexer_emit(l, T_NUMBER);
-	return lex_main;
+	return pos;
 }
 
-static void* lex_ignore_line(struct lexer* l)
+static __attribute__((noinline)) int lexer_scan_identifier_wide(struct lexer* l, int pos)
 {
-	int curline = l->line;
-	while (l->line == curline) if (lexer_ch(l) == -1) return lex_eof;
-	return lex_main;
+	const char* s = l->src.ptr;
+	int len = l->src.len;
+	#ifdef __SSE2__
+	while (pos + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + pos));
+		__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+		__m128i alpha = _mm_and_si128(
+			_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			_mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+		__m128i digit = _mm_and_si128(
+			_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+			_mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+		__m128i underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+		unsigned m = _mm_movemask_epi8(_mm_or_si128(alpha, _mm_or_si128(digit, underscore)));
+		if (m != 0xffff) return pos + __builtin_ctz(~m);
+		pos += 16;
+	}
+	#endif
+	while (pos < len && cc_is(s[pos], CC_IDENT)) pos++;
+	return pos;
 }
 
-static void* lex_multiline_comment(struct lexer* l)
+// most whitespace runs are a single space or a newline plus a little
+// indentation, and most identifiers are short, so these scan the first 16
+// bytes one at a time before going wide
+#define LEXER_SCALAR_RUN (16)
+
+static inline int lexer_scan_whitespace(struct lexer* l, int pos)
 {
-	for (;;) {
-		int ch = lexer_ch(l);
-		if (ch == -1) {
-			return lex_eof;
-		} else if (ch == '*') {
-			if (lexer_accept_char(l, '/')) {
-				return lex_main;
-			}
+	const char* s = l->src.ptr;
+	int end = pos + LEXER_SCALAR_RUN;
+	if (end > l->src.len) end = l->src.len;
+	while (pos < end) {
+		int ch = s[pos];
+		if (!cc_is(ch, CC_WS)) return pos;
+		if (ch == '\n') {
+			l->line++;
+			l->line_start = pos + 1;
 		}
+		pos++;
 	}
+	return lexer_scan_whitespace_wide(l, pos);
 }
 
-static int is_alpha(int ch)
-{
-	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
-}
-
-static int is_num(int ch)
+static inline int lexer_scan_identifier(struct lexer* l, int pos)
 {
-	return ch >= '0' && ch <= '9';
+	const char* s = l->src.ptr;
+	int end = pos + LEXER_SCALAR_RUN;
+	if (end > l->src.len) end = l->src.len;
+	while (pos < end) {
+		if (!cc_is(s[pos], CC_IDENT)) return pos;
+		pos++;
+	}
+	return lexer_scan_identifier_wide(l, pos);
 }
 
-static int is_identifier(int ch)
+static int lexer_scan_digits(struct lexer* l, int pos, int cc)
 {
-	return is_alpha(ch) || is_num(ch);
+	while (pos < l->src.len && cc_is(l->src.ptr[pos], cc)) pos++;
+	return pos;
 }
 
-static void* lex_identifier(struct lexer* l)
+static int lexer_scan_number(struct lexer* l, int pos)
 {
-	lexer_accept_run_fn(l, is_identifier);
-	lexer_emit(l, T_IDENTIFIER);
-	return lex_main;
+	int digits = CC_DIGIT;
+	if (lexer_at(l, pos) == '0' && (lexer_at(l, pos+1) | 0x20) == 'x') {
+		digits = CC_HEX;
+		pos += 2;
+	}
+	pos = lexer_scan_digits(l, pos, digits);
+	if (lexer_at(l, pos) == '.') {
+		pos = lexer_scan_digits(l, pos+1, digits);
+	}
+	if ((lexer_at(l, pos) | 0x20) == 'e') {
+		pos++;
+		int sign = lexer_at(l, pos);
+		if (sign == '+' || sign == '-') pos++;
+		pos = lexer_scan_digits(l, pos, CC_DIGIT);
+	}
+	return pos;
 }
 
-static void* lex_main(struct lexer* l)
+// scans one raw token at l->pos and returns its type; sets l->start/l->pos
+// to its extent. comments are skipped, and so are whitespace runs unless
+// they're candidates for promote_ws_to_semicolon()
+static enum token_type lexer_scan(struct lexer* l)
 {
-	if (lexer_ch(l) == -1) return lex_eof;
-	lexer_backup(l);
-
-	const char* ws = " \t\n\r";
-	if (lexer_accept_run(l, ws)) {
-		lexer_emit(l, T_WHITESPACE);
-		return lex_main;
-	}
-
-	// eat comments
-	if (lexer_accept_char(l, '/')) {
-		if (lexer_accept_char(l, '/')) {
-			return lex_ignore_line;
-		} else if (lexer_accept_char(l, '*')) {
-			return lex_multiline_comment;
-		} else {
-			lexer_backup(l);
+	const char* s = l->src.ptr;
+	int len = l->src.len;
+	for (;;) {
+		int pos = l->start = l->pos;
+		if (pos >= len) return T_EOF;
+
+		int ch = (unsigned char)s[pos];
+		int cc = char_class[ch];
+		if (cc & CC_WS) {
+			l->pos = lexer_scan_whitespace(l, pos);
+			// whitespace can only become a semicolon when the line
+			// changed since the previous token (see
+			// promote_ws_to_semicolon())
+			if (l->line == l->previous_token_line) continue;
+			return T_WHITESPACE;
+		} else if (cc & CC_ALPHA) {
+			l->pos = lexer_scan_identifier(l, pos+1);
+			return T_IDENTIFIER;
+		} else if (cc & CC_DIGIT) {
+			l->pos = lexer_scan_number(l, pos);
+			return T_NUMBER;
 		}
-	}
 
-	{
-		struct {
-			const char* str;
-			enum token_type tt;
-		} pnct[] = {
-			{"==", T_EQ},
-			{"!=", T_NEQ},
-			{"++", T_INC},
-			{"--", T_DEC},
-			// TODO
-			{NULL}
-		};
-		for (int i = 0; pnct[i].str; i++) {
-			const char* str = pnct[i].str;
-			enum token_type tt = pnct[i].tt;
-			size_t len = strlen(str);
-			int n;
-			for (n = 0; n < len; n++) {
-				if (!lexer_accept_char(l, str[n])) {
-					break;
+		int ch1 = lexer_at(l, pos+1);
+		enum token_type tt2 = 0;
+		switch (ch) {
+		case '/':
+			if (ch1 == '/') {
+				const char* nl = memchr(s + pos + 2, '\n', len - pos - 2);
+				if (nl == NULL) {
+					l->pos = len;
+					continue;
 				}
+				l->pos = nl - s + 1;
+				l->line++;
+				l->line_start = l->pos;
+				continue;
+			} else if (ch1 == '*') {
+				int end = pos + 2;
+				for (;;) {
+					const char* star = memchr(s + end, '*', len - end);
+					if (star == NULL) {
+						end = len;
+						break;
+					}
+					end = star - s + 1;
+					if (end < len && s[end] == '/') {
+						end++;
+						break;
+					}
+				}
+				lexer_count_lines(l, pos + 2, end);
+				l->pos = end;
+				continue;
 			}
-			if (n == len) {
-				lexer_emit(l, tt);
-				return lex_main;
-			}
-			for (int j = 0; j < n; j++) lexer_backup(l);
+			break;
+		case '=': if (ch1 == '=') tt2 = T_EQ; break;
+		case '!': if (ch1 == '=') tt2 = T_NEQ; break;
+		case '+': if (ch1 == '+') tt2 = T_INC; break;
+		case '-': if (ch1 == '-') tt2 = T_DEC; break;
+		}
+		if (tt2) {
+			l->pos = pos + 2;
+			return tt2;
 		}
-	}
 
-	{
-		struct {
-			char ch;
-			enum token_type tt;
-		} pnct[] = {
-			{',', T_COMMA},
-			{';', T_SEMICOLON},
-			{'.', T_DOT},
-			{'=', T_ASSIGN},
-			{'+', T_PLUS},
-			{'-', T_MINUS},
-			{'*', T_MUL},
-			{'/', T_DIV},
-			{'%', T_MOD},
-			{'(', T_LPAREN},
-			{')', T_RPAREN},
-			{'{', T_LCURLY},
-			{'}', T_RCURLY},
-			{'[', T_LBRACKET},
-			{']', T_RBRACKET},
-			// TODO
-			{0}
-		};
-		for (int i = 0; pnct[i].ch; i++) {
-			char ch = pnct[i].ch;
-			enum token_type tt = pnct[i].tt;
-			if (lexer_accept_char(l, ch)) {
-				lexer_emit(l, tt);
-				return lex_main;
-			}
+		if (punct_tt[ch]) {
+			l->pos = pos + 1;
+			return punct_tt[ch];
 		}
-	}
 
-	// eat number
-	if (lexer_accept(l, ".+-0123456789")) {
-		lexer_backup(l);
-		return lex_number;
+		l->pos = pos + 1;
+		return T_ERROR;
 	}
+}
 
-	// eat identifier
-	if (lexer_accept_fn(l, is_identifier)) {
-		return lex_identifier;
-	}
+struct keyword {
+	const char* str;
+	size_t len;
+	enum token_type tt;
+};
 
-	assert(!"lexer error");
-	return NULL;
+#define KEYWORD_MIN_LEN (2)
+#define KEYWORD_MAX_LEN (11)
+#define KEYWORD_HASH_SIZE (64)
+
+// perfect hash for the keywords in keyword_table[]; the coefficients were
+// found by brute force search, so adding a keyword means searching again
+// (the TEST build verifies that every keyword hashes to its own slot)
+static inline unsigned keyword_hash(const char* s, size_t len)
+{
+	const unsigned char* u = (const unsigned char*)s;
+	return (u[0]*7 + u[1] + u[len-1]*33 + len*5) & (KEYWORD_HASH_SIZE-1);
 }
 
-#define PRM(s,e) \
-	{ \
-		size_t l = strlen(s); \
-		if (l == t->str.len && memcmp(t->str.ptr, s, l) == 0) { \
-			t->type = e; \
-		} \
-	}
+static const struct keyword keyword_table[KEYWORD_HASH_SIZE] = {
+	[1] = { "out", 3, T_OUT },
+	[4] = { "break", 5, T_BREAK },
+	[5] = { "in", 2, T_IN },
+	[8] = { "else", 4, T_ELSE },
+	[9] = { "false", 5, T_FALSE },
+	[10] = { "fallthrough", 11, T_FALLTHROUGH },
+	[11] = { "float32", 7, T_FLOAT32 },
+	[13] = { "float64", 7, T_FLOAT64 },
+	[15] = { "return", 6, T_RETURN },
+	[16] = { "int", 3, T_INT },
+	[17] = { "continue", 8, T_CONTINUE },
+	[22] = { "func", 4, T_FUNC },
+	[24] = { "int32", 5, T_INT32 },
+	[25] = { "int8", 4, T_INT8 },
+	[26] = { "int64", 5, T_INT64 },
+	[28] = { "var", 3, T_VAR },
+	[29] = { "bool", 4, T_BOOL },
+	[34] = { "switch", 6, T_SWITCH },
+	[35] = { "goto", 4, T_GOTO },
+	[36] = { "uint", 4, T_UINT },
+	[41] = { "typeof", 6, T_TYPEOF },
+	[43] = { "struct", 6, T_STRUCT },
+	[44] = { "uint32", 6, T_UINT32 },
+	[45] = { "uint8", 5, T_UINT8 },
+	[46] = { "uint64", 6, T_UINT64 },
+	[47] = { "case", 4, T_CASE },
+	[49] = { "const", 5, T_CONST },
+	[53] = { "if", 2, T_IF },
+	[55] = { "true", 4, T_TRUE },
+	[56] = { "default", 7, T_DEFAULT },
+	[58] = { "for", 3, T_FOR },
+	[62] = { "type", 4, T_TYPE },
+};
+
 static void promote_identifer_if_keyword(struct token* t)
 {
 	if (t->type != T_IDENTIFIER) return;
-
-	PRM("true", T_TRUE);
-	PRM("false", T_FALSE);
-
-	PRM("bool", T_BOOL);
-	PRM("int", T_INT);
-	PRM("uint", T_UINT);
-	PRM("int8", T_INT8);
-	PRM("uint8", T_UINT8);
-	PRM("int32", T_INT32);
-	PRM("uint32", T_UINT32);
-	PRM("int64", T_INT64);
-	PRM("uint64", T_UINT64);
-
-	PRM("float32", T_FLOAT32);
-	PRM("float64", T_FLOAT64);
-	PRM("return", T_RETURN);
-	PRM("if", T_IF);
-	PRM("else", T_ELSE);
-	PRM("for", T_FOR);
-	PRM("break", T_BREAK);
-	PRM("continue", T_CONTINUE);
-	PRM("fallthrough", T_FALLTHROUGH);
-	PRM("goto", T_GOTO);
-	PRM("switch", T_SWITCH);
-	PRM("case", T_CASE);
-	PRM("default", T_DEFAULT);
-
-	PRM("typeof", T_TYPEOF);
-
-	PRM("type", T_TYPE);
-
-	PRM("const", T_CONST);
-	PRM("var", T_VAR);
-	PRM("func", T_FUNC);
-	PRM("struct", T_STRUCT);
-
-	PRM("in", T_IN);
-	PRM("out", T_OUT);
-}
-#undef PRM
+	size_t len = t->str.len;
+	if (len < KEYWORD_MIN_LEN || len > KEYWORD_MAX_LEN) return;
+	const struct keyword* kw = &keyword_table[keyword_hash(t->str.ptr, len)];
+	if (kw->len != len) return;
+	for (int i = 0; i < len; i++) if (kw->str[i] != t->str.ptr[i]) return;
+	t->type = kw->tt;
+}
 
 static int promote_ws_to_semicolon(struct lexer* l)
 {
 	if (l->previous_token_line == l->line) return 0;
 
-	enum token_type tt = l->previous_token.type;
+	enum token_type tt = l->previous_token_type;
 	int promote =
 		   tt == T_IDENTIFIER
 		|| tt == T_NUMBER
@@ -470,16 +792,16 @@ static int promote_ws_to_semicolon(struct lexer* l)
 static struct token lexer_next(struct lexer* l)
 {
 	for (;;) {
-		assert(l->state_fn != NULL);
-		l->state_fn = l->state_fn(l);
-		if (l->has_token) {
-			if (l->token.type == T_WHITESPACE && !promote_ws_to_semicolon(l)) continue;
-			promote_identifer_if_keyword(&l->token);
-			l->has_token = 0;
-			l->previous_token = l->token;
-			l->previous_token_line = l->line;
-			return l->token;
-		}
+		struct token* t = &l->token;
+		t->type = lexer_scan(l);
+		t->str.ptr = l->src.ptr + l->start;
+		t->str.len = l->pos - l->start;
+		if (t->type == T_WHITESPACE && !promote_ws_to_semicolon(l)) continue;
+		promote_identifer_if_keyword(t);
+		t->sym = t->type == T_IDENTIFIER ? symtab_intern(&symtab, t->str.ptr, t->str.len) : 0;
+		l->previous_token_type = t->type;
+		l->previous_token_line = l->line;
+		return *t;
 	}
 }
 
@@ -495,11 +817,18 @@ static struct token lexer_next(struct lexer* l)
 #define SEXPR_TYPE_MASK (1)
 #define SEXPR_TYPEOF(e) ((e)->flags & SEXPR_TYPE_MASK)
 
+struct sem_type;
+
 struct sexpr {
 	int flags;
 	union {
 		struct token atom;
-		struct sexpr* list;
+		struct {
+			struct sexpr* list;
+			// type lists are annotated by the semantic pass
+			struct sem_type* type;
+			enum token_type mod; // T_IN, T_OUT or 0
+		};
 	};
 	struct sexpr* next;
 };
@@ -515,24 +844,24 @@ static inline int sexpr_is_list(struct sexpr* e)
 	return SEXPR_TYPEOF(e) == SEXPR_TYPE_LIST;
 }
 
-static struct sexpr* _sexpr_new()
+static struct sexpr* _sexpr_new(struct arena* a)
 {
-	struct sexpr* e = calloc(1, sizeof(*e));
-	assert(e != NULL);
+	struct sexpr* e = arena_alloc(a, sizeof(*e));
+	memset(e, 0, sizeof(*e));
 	return e;
 }
 
-static struct sexpr* sexpr_new_atom(struct token atom)
+static struct sexpr* sexpr_new_atom(struct arena* a, struct token atom)
 {
-	struct sexpr* e = _sexpr_new();
+	struct sexpr* e = _sexpr_new(a);
 	e->flags = SEXPR_TYPE_ATOM;
 	e->atom = atom;
 	return e;
 }
 
-static struct sexpr* sexpr_new_list(struct sexpr* head, ...)
+static struct sexpr* sexpr_new_list(struct arena* a, struct sexpr* head, ...)
 {
-	struct sexpr* e = _sexpr_new();
+	struct sexpr* e = _sexpr_new(a);
 	e->flags = SEXPR_TYPE_LIST;
 	e->list = head;
 
@@ -552,9 +881,9 @@ static struct sexpr* sexpr_new_list(struct sexpr* head, ...)
 	return e;
 }
 
-static struct sexpr* sexpr_new_empty_list()
+static struct sexpr* sexpr_new_empty_list(struct arena* a)
 {
-	return sexpr_new_list(NULL);
+	return sexpr_new_list(a, NULL);
 }
 
 static struct sexpr** sexpr_get_append_cursor(struct sexpr* e)
@@ -576,92 +905,325 @@ static void sexpr_append(struct sexpr*** append_cursor, struct sexpr* e)
 
 
 //////////////////////////////////////////////////////////////////////////////
-// PARSER
+// FLAT AST
 //////////////////////////////////////////////////////////////////////////////
 
-struct parser {
-	struct lexer lexer;
-	struct token current_token, next_token, stashed_token;
-	int can_rewind, has_stashed_token;
+/*
+compact alternative to struct sexpr; all nodes live in one array in
+preorder and refer to each other by 32-bit index, and atoms refer to their
+token text by offset/length into the source instead of by pointer. the
+root is node 0, so 0 also means "none" for child/next
+*/
+
+struct fnode {
+	uint32_t child_or_offset; // list: first child; atom: source offset
+	uint32_t len; // list: number of children; atom: token length
+	uint32_t next; // next sibling
+	uint8_t flags; // SEXPR_TYPE_*
+	uint8_t tt; // atom: enum token_type
+};
 
-	int err;
+struct flat {
+	struct dynary nodes_dy;
+	struct fnode* nodes;
+	char* src;
 };
 
-static void parser_errf(struct parser* p, const char* fmt, ...)
+static inline int fnode_is_atom(struct fnode* n)
 {
-	// TODO record which token caused the error?
-	// TODO error code/type?
-	// TODO snprintf -> p->err_str or something
-
-	p->err = 1;
-
-	va_list args;
-	va_start(args, fmt);
-	fprintf(stderr, "PARSER ERROR: ");
-	vfprintf(stderr, fmt, args);
-	va_end(args);
-	fprintf(stderr, "\n");
-	abort();
+	return SEXPR_TYPEOF(n) == SEXPR_TYPE_ATOM;
 }
 
-static void parser_err_unexp(struct parser* p)
+static inline int fnode_is_list(struct fnode* n)
 {
-	parser_errf(p, "unexpected token");
+	return SEXPR_TYPEOF(n) == SEXPR_TYPE_LIST;
 }
 
-static void parser_err_exp(struct parser* p, enum token_type tt)
+static inline struct token fnode_token(struct flat* f, struct fnode* n)
 {
-	parser_errf(p, "unexpected token (expected %d)", tt); // TODO token_type -> char*
+	assert(fnode_is_atom(n));
+	struct token t;
+	memset(&t, 0, sizeof(t));
+	t.type = n->tt;
+	t.str.ptr = f->src + n->child_or_offset;
+	t.str.len = n->len;
+	// symbol ids are per process, so they aren't stored in fnodes
+	if (t.type == T_IDENTIFIER) t.sym = symtab_intern(&symtab, t.str.ptr, t.str.len);
+	return t;
 }
 
-static inline struct token parser_next_token(struct parser* p)
+static void flat_init(struct flat* f, char* src)
 {
-	p->current_token = p->next_token;
-	if (p->has_stashed_token) {
-		p->next_token = p->stashed_token;
-		p->has_stashed_token = 0;
-	} else {
-		p->next_token = lexer_next(&p->lexer);
-	}
-	p->can_rewind = 1;
-	return p->current_token;
+	memset(f, 0, sizeof(*f));
+	dynary_init(&f->nodes_dy, (void**) &f->nodes, sizeof(*f->nodes));
+	f->src = src;
 }
 
-static void parser_init(struct parser* p, char* src)
+static void flat_free(struct flat* f)
 {
-	memset(p, 0, sizeof(*p));
-	lexer_init(&p->lexer, src);
-	parser_next_token(p);
+	free(f->nodes);
+	f->nodes = NULL;
+	f->nodes_dy.n = 0;
 }
 
-static inline void parser_rewind(struct parser* p)
+static uint32_t flat__append(struct flat* f, struct sexpr* e)
 {
-	assert(p->can_rewind);
-	p->stashed_token = p->next_token;
-	p->next_token = p->current_token;
-	p->can_rewind = 0;
-	p->has_stashed_token = 1;
-	memset(&p->current_token, 0, sizeof(p->current_token));
+	struct fnode* n = dynary_append(&f->nodes_dy);
+	n->flags = e->flags;
+	if (sexpr_is_atom(e)) {
+		assert(e->atom.type != T__META);
+		assert(e->atom.str.ptr >= f->src);
+		n->tt = e->atom.type;
+		n->child_or_offset = e->atom.str.ptr - f->src;
+		n->len = e->atom.str.len;
+	}
+	return f->nodes_dy.n - 1;
 }
 
-static inline int parser_accept_and_get(struct parser* p, enum token_type tt, struct token* tp)
+// appends the tree rooted at e (but not its siblings) to f; e's atoms must
+// point into f->src. returns the index of e's node
+static uint32_t flat_append_sexpr(struct flat* f, struct sexpr* e)
 {
-	struct token t = parser_next_token(p);
-	if (t.type != tt) {
-		parser_rewind(p);
-		return 0;
-	} else {
-		if (tp != NULL) *tp = t;
-		return 1;
+	struct frame {
+		struct sexpr* next_child;
+		uint32_t list, last_child;
+	};
+	struct frame* stack;
+	struct dynary stack_dy;
+	dynary_init(&stack_dy, (void**) &stack, sizeof(*stack));
+
+	uint32_t root = flat__append(f, e);
+	if (sexpr_is_list(e)) {
+		struct frame* fr = dynary_append(&stack_dy);
+		fr->next_child = e->list;
+		fr->list = root;
 	}
-}
 
-static inline int parser_accept(struct parser* p, enum token_type tt)
-{
-	return parser_accept_and_get(p, tt, NULL);
-}
+	while (stack_dy.n > 0) {
+		struct frame* top = &stack[stack_dy.n - 1];
+		struct sexpr* c = top->next_child;
+		if (c == NULL) {
+			stack_dy.n--;
+			continue;
+		}
+		top->next_child = c->next;
 
-static inline int parser_expect(struct parser* p, enum token_type tt)
+		uint32_t ci = flat__append(f, c);
+		struct fnode* list = &f->nodes[top->list];
+		if (top->last_child == 0) {
+			list->child_or_offset = ci;
+		} else {
+			f->nodes[top->last_child].next = ci;
+		}
+		list->len++;
+		top->last_child = ci;
+
+		if (sexpr_is_list(c)) {
+			uint32_t list_index = ci;
+			top = dynary_append(&stack_dy);
+			top->next_child = c->list;
+			top->list = list_index;
+		}
+	}
+
+	free(stack);
+	return root;
+}
+
+// rebuilds the sexpr tree rooted at node index i (not its siblings)
+static struct sexpr* flat_to_sexpr(struct arena* a, struct flat* f, uint32_t i)
+{
+	struct frame {
+		uint32_t next_child;
+		struct sexpr** cursor;
+	};
+	struct frame* stack;
+	struct dynary stack_dy;
+	dynary_init(&stack_dy, (void**) &stack, sizeof(*stack));
+
+	struct sexpr* root = NULL;
+	struct sexpr** root_cursor = &root;
+	struct sexpr*** cursor = &root_cursor;
+	uint32_t ni = i;
+	for (;;) {
+		struct fnode* n = &f->nodes[ni];
+		struct sexpr* e;
+		if (fnode_is_atom(n)) {
+			e = sexpr_new_atom(a, fnode_token(f, n));
+		} else {
+			e = sexpr_new_empty_list(a);
+		}
+		sexpr_append(cursor, e);
+
+		if (fnode_is_list(n) && n->len > 0) {
+			struct frame* fr = dynary_append(&stack_dy);
+			fr->next_child = n->child_or_offset;
+			fr->cursor = &e->list;
+		}
+
+		// find next node to visit
+		ni = 0;
+		while (stack_dy.n > 0) {
+			struct frame* top = &stack[stack_dy.n - 1];
+			if (top->next_child == 0) {
+				stack_dy.n--;
+				continue;
+			}
+			ni = top->next_child;
+			top->next_child = f->nodes[ni].next;
+			cursor = &top->cursor;
+			break;
+		}
+		if (ni == 0) break;
+	}
+
+	free(stack);
+	return root;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// PARSER
+//////////////////////////////////////////////////////////////////////////////
+
+struct parse_frame;
+
+struct parser {
+	struct lexer lexer;
+	struct token current_token, next_token, stashed_token;
+	int can_rewind, has_stashed_token;
+
+	// owns every sexpr produced by the parser; they're all released by
+	// parser_reset() or parser_free()
+	struct arena arena;
+
+	int err;
+
+	// if set, errors are formatted into err_msg and longjmp() here instead
+	// of aborting
+	jmp_buf* on_err;
+	char err_msg[128];
+
+	// parse_expr() frames that don't fit on the C stack; owned by the
+	// parser so an error longjmp() leaks nothing
+	struct parse_frame* frames;
+	int frames_cap;
+};
+
+static void parser_errf(struct parser* p, const char* fmt, ...)
+{
+	// TODO record which token caused the error?
+	// TODO error code/type?
+
+	p->err = 1;
+
+	va_list args;
+	va_start(args, fmt);
+	if (p->on_err != NULL) {
+		int n = snprintf(p->err_msg, sizeof(p->err_msg), "line %d: ", p->lexer.line + 1);
+		vsnprintf(p->err_msg + n, sizeof(p->err_msg) - n, fmt, args);
+		va_end(args);
+		longjmp(*p->on_err, 1);
+	}
+	fprintf(stderr, "PARSER ERROR: ");
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+static void parser_err_unexp(struct parser* p)
+{
+	parser_errf(p, "unexpected token");
+}
+
+static void parser_err_exp(struct parser* p, enum token_type tt)
+{
+	parser_errf(p, "unexpected token (expected %d)", tt); // TODO token_type -> char*
+}
+
+static inline struct token parser_next_token(struct parser* p)
+{
+	p->current_token = p->next_token;
+	if (p->has_stashed_token) {
+		p->next_token = p->stashed_token;
+		p->has_stashed_token = 0;
+	} else {
+		p->next_token = lexer_next(&p->lexer);
+	}
+	p->can_rewind = 1;
+	return p->current_token;
+}
+
+static void parser_init_n(struct parser* p, char* src, size_t len)
+{
+	memset(p, 0, sizeof(*p));
+	arena_init(&p->arena);
+	lexer_init_n(&p->lexer, src, len);
+	parser_next_token(p);
+}
+
+static void parser_init(struct parser* p, char* src)
+{
+	parser_init_n(p, src, strlen(src));
+}
+
+// releases all sexprs from the previous parse (keeping the arena chunks
+// for reuse) and starts over on src
+static void parser_reset_n(struct parser* p, char* src, size_t len)
+{
+	struct arena arena = p->arena;
+	struct parse_frame* frames = p->frames;
+	int frames_cap = p->frames_cap;
+	arena_reset(&arena);
+	memset(p, 0, sizeof(*p));
+	p->arena = arena;
+	p->frames = frames;
+	p->frames_cap = frames_cap;
+	lexer_init_n(&p->lexer, src, len);
+	parser_next_token(p);
+}
+
+static void parser_reset(struct parser* p, char* src)
+{
+	parser_reset_n(p, src, strlen(src));
+}
+
+static void parser_free(struct parser* p)
+{
+	arena_free(&p->arena);
+	free(p->frames);
+}
+
+static inline void parser_rewind(struct parser* p)
+{
+	assert(p->can_rewind);
+	p->stashed_token = p->next_token;
+	p->next_token = p->current_token;
+	p->can_rewind = 0;
+	p->has_stashed_token = 1;
+	memset(&p->current_token, 0, sizeof(p->current_token));
+}
+
+static inline int parser_accept_and_get(struct parser* p, enum token_type tt, struct token* tp)
+{
+	struct token t = parser_next_token(p);
+	if (t.type != tt) {
+		parser_rewind(p);
+		return 0;
+	} else {
+		if (tp != NULL) *tp = t;
+		return 1;
+	}
+}
+
+static inline int parser_accept(struct parser* p, enum token_type tt)
+{
+	return parser_accept_and_get(p, tt, NULL);
+}
+
+static inline int parser_expect(struct parser* p, enum token_type tt)
 {
 	if (!parser_accept(p, tt)) {
 		parser_err_exp(p, tt);
@@ -699,6 +1261,9 @@ static inline int infix_bp(enum token_type tt)
 			return 0;
 		case T_ASSIGN:
 			return 5;
+		case T_EQ:
+		case T_NEQ:
+			return 30;
 		case T_PLUS:
 		case T_MINUS:
 			return 40;
@@ -706,7 +1271,8 @@ static inline int infix_bp(enum token_type tt)
 		case T_DIV:
 			return 50;
 		case T_LPAREN:
-			return 100;
+		case T_LBRACKET:
+			return 150; // binds tighter than prefix operators
 		case T_DOT:
 			return 200;
 		default:
@@ -731,6 +1297,8 @@ static inline int is_binary_op(enum token_type tt) {
 		case T_MUL:
 		case T_DIV:
 		case T_ASSIGN:
+		case T_EQ:
+		case T_NEQ:
 			return 1;
 		default:
 			return 0;
@@ -742,87 +1310,168 @@ static inline int is_binary_op_right_associcative(enum token_type tt)
 	return 0; // TODO
 }
 
-static struct sexpr* parse_expr_rec(struct parser* p, int rbp, int depth)
+/*
+expressions are parsed by precedence climbing without recursion: what a
+recursive Pratt parser keeps on the C stack (an operator waiting for its
+right operand, and the binding power that operand is parsed at) is pushed
+on an explicit stack instead, so length and nesting are only bounded by
+memory, and each token is handled once. the trees are the ones
+prefix_bp()/infix_bp() define for the recursive formulation
+*/
+
+enum parse_op {
+	PARSE_ROOT,
+	PARSE_PREFIX, // t is the operator
+	PARSE_PAREN,
+	PARSE_BINARY, // t is the operator, left its left operand
+	PARSE_DOT,
+	PARSE_CALL, // left is the call, cursor where its next argument goes
+	PARSE_INDEX,
+};
+
+// an operand being parsed, and what to do with it once it's complete
+struct parse_frame {
+	enum parse_op op;
+	int rbp;
+	struct token t;
+	struct sexpr* left;
+	struct sexpr** cursor;
+};
+
+// frames kept on the C stack; deeper nesting moves to p->frames
+#define PARSE_EXPR_FRAMES (32)
+
+static void parse__push(struct parser* p, struct parse_frame** stack, int* n, int* cap, struct parse_frame* local, struct parse_frame f)
 {
-	if (depth >= 1024) {
-		parser_errf(p, "maximum expression recursion depth exceeded");
-		return NULL;
+	if (*n == *cap) {
+		*cap *= 2;
+		if (p->frames_cap < *cap) {
+			p->frames_cap = *cap;
+			p->frames = realloc(p->frames, p->frames_cap * sizeof(*p->frames));
+			assert(p->frames != NULL);
+		}
+		if (*stack == local) memcpy(p->frames, local, *n * sizeof(*local));
+		*stack = p->frames;
 	}
+	(*stack)[(*n)++] = f;
+}
 
-	struct token t = parser_next_token(p);
-	enum token_type tt = t.type;
+static struct sexpr* parse_expr(struct parser* p)
+{
+	struct parse_frame local[PARSE_EXPR_FRAMES];
+	struct parse_frame* stack = local;
+	int cap = PARSE_EXPR_FRAMES;
+	int n = 0;
+	parse__push(p, &stack, &n, &cap, local, (struct parse_frame){ .op = PARSE_ROOT });
 
-	// null denotation
 	struct sexpr* left = NULL;
-	{
-		int bp;
+	for (;;) {
+		// null denotation
+		struct token t = parser_next_token(p);
+		enum token_type tt = t.type;
+		int bp = prefix_bp(tt);
 		if (tt == T_NUMBER || tt == T_IDENTIFIER || tt_is_type(tt)) {
-			left = sexpr_new_atom(t);
-		} else if ((bp = prefix_bp(tt)) != -1) {
-			struct sexpr* operand = parse_expr_rec(p, bp, depth+1);
-			if (operand == NULL) return NULL;
-			if (is_unary_op(tt)) {
-				left = sexpr_new_list(sexpr_new_atom(t), operand, NULL);
-			} else if (tt == T_LPAREN) {
-				left = operand;
-				if (!parser_expect(p, T_RPAREN)) return NULL;
-			} else {
-				parser_err_unexp(p);
-				return NULL;
-			}
+			left = sexpr_new_atom(&p->arena, t);
+		} else if (bp != -1 && (is_unary_op(tt) || tt == T_LPAREN)) {
+			enum parse_op op = tt == T_LPAREN ? PARSE_PAREN : PARSE_PREFIX;
+			parse__push(p, &stack, &n, &cap, local, (struct parse_frame){ .op = op, .rbp = bp, .t = t });
+			continue;
 		} else {
 			parser_err_unexp(p);
-			return NULL;
+			left = NULL;
+			goto out;
 		}
-	}
 
-	for (;;) {
-		int lbp = infix_bp(p->next_token.type);
-		if (lbp == -1) {
-			parser_err_unexp(p);
-			return NULL;
-		}
-		if (rbp >= lbp) break;
-
-		// left denotation
-		t = parser_next_token(p);
-		tt = t.type;
-		if (is_binary_op(tt)) { // parse binary op
-			int bp = lbp;
-			if (is_binary_op_right_associcative(tt)) bp--;
-			struct sexpr* right = parse_expr_rec(p, bp, depth+1);
-			if (right == NULL) return NULL;
-			left = sexpr_new_list(sexpr_new_atom(t), left, right, NULL);
-		} else if (tt == T_DOT) { // parse member accesses
-			struct sexpr* right = parse_expr_rec(p, lbp, depth+1);
-			if (right == NULL) return NULL;
-			if (right->atom.type != T_IDENTIFIER) {
-				parser_errf(p, "expected identifer");
-				return NULL;
+		// left denotations, until one needs another operand
+		int operand = 0;
+		while (!operand) {
+			struct parse_frame* f = &stack[n-1];
+			int lbp = infix_bp(p->next_token.type);
+			if (lbp == -1) {
+				parser_err_unexp(p);
+				left = NULL;
+				goto out;
 			}
-			left = sexpr_new_list(sexpr_new_atom(t), left, right, NULL);
-		} else if (tt == T_LPAREN) { // parse call
-			left = sexpr_new_list(left, NULL);
-			struct sexpr** cursor = sexpr_get_append_cursor(left);
-			int more = !parser_accept(p, T_RPAREN);
-			while (more) {
-				struct sexpr* a = parse_expr_rec(p, 0, depth+1);
-				if (a == NULL) return NULL;
-				sexpr_append(&cursor, a);
-
-				if (p->next_token.type != T_RPAREN && p->next_token.type != T_COMMA) {
-					parser_err_unexp(p);
-					return NULL;
+
+			if (f->rbp >= lbp) {
+				// the operand f was waiting for is complete
+				n--;
+				switch (f->op) {
+					case PARSE_ROOT:
+						goto out;
+					case PARSE_PREFIX:
+						left = sexpr_new_list(&p->arena, sexpr_new_atom(&p->arena, f->t), left, NULL);
+						break;
+					case PARSE_PAREN:
+						if (!parser_expect(p, T_RPAREN)) {
+							left = NULL;
+							goto out;
+						}
+						break;
+					case PARSE_BINARY:
+						left = sexpr_new_list(&p->arena, sexpr_new_atom(&p->arena, f->t), f->left, left, NULL);
+						break;
+					case PARSE_DOT:
+						if (!sexpr_is_atom(left) || left->atom.type != T_IDENTIFIER) {
+							parser_errf(p, "expected identifer");
+							left = NULL;
+							goto out;
+						}
+						left = sexpr_new_list(&p->arena, sexpr_new_atom(&p->arena, f->t), f->left, left, NULL);
+						break;
+					case PARSE_CALL:
+						sexpr_append(&f->cursor, left);
+						if (p->next_token.type != T_RPAREN && p->next_token.type != T_COMMA) {
+							parser_err_unexp(p);
+							left = NULL;
+							goto out;
+						}
+						if (parser_next_token(p).type == T_COMMA) {
+							n++; // same frame, next argument
+							operand = 1;
+						} else {
+							left = f->left;
+						}
+						break;
+					case PARSE_INDEX:
+						if (!parser_expect(p, T_RBRACKET)) {
+							left = NULL;
+							goto out;
+						}
+						left = sexpr_new_list(&p->arena, sexpr_new_atom(&p->arena, f->t), f->left, left, NULL);
+						break;
 				}
-				more = p->next_token.type == T_COMMA;
-				parser_next_token(p);
+				continue;
 			}
-		} else {
-			parser_err_unexp(p);
-			return NULL;
+
+			t = parser_next_token(p);
+			tt = t.type;
+			struct parse_frame next = { .t = t, .left = left };
+			if (is_binary_op(tt)) {
+				next.op = PARSE_BINARY;
+				next.rbp = is_binary_op_right_associcative(tt) ? lbp - 1 : lbp;
+			} else if (tt == T_DOT) {
+				next.op = PARSE_DOT;
+				next.rbp = lbp;
+			} else if (tt == T_LPAREN) {
+				left = sexpr_new_list(&p->arena, left, NULL);
+				if (parser_accept(p, T_RPAREN)) continue;
+				next.op = PARSE_CALL;
+				next.left = left;
+				next.cursor = sexpr_get_append_cursor(left);
+			} else if (tt == T_LBRACKET) {
+				next.op = PARSE_INDEX;
+			} else {
+				parser_err_unexp(p);
+				left = NULL;
+				goto out;
+			}
+			parse__push(p, &stack, &n, &cap, local, next);
+			operand = 1;
 		}
 	}
 
+out:
 	return left;
 }
 
@@ -830,7 +1479,7 @@ static struct sexpr* parse_type_rec(struct parser* p, int depth);
 
 static struct sexpr* parse_struct_body_rec(struct parser* p, int depth)
 {
-	struct sexpr* lst = sexpr_new_empty_list();
+	struct sexpr* lst = sexpr_new_empty_list(&p->arena);
 	struct sexpr** lstc = sexpr_get_append_cursor(lst);
 
 	if (!parser_expect(p, T_LCURLY)) return NULL;
@@ -850,7 +1499,7 @@ static struct sexpr* parse_struct_body_rec(struct parser* p, int depth)
 			return NULL;
 		}
 
-		struct sexpr* m = sexpr_new_list(sexpr_new_atom(t), typ, NULL);
+		struct sexpr* m = sexpr_new_list(&p->arena, sexpr_new_atom(&p->arena, t), typ, NULL);
 		sexpr_append(&lstc, m);
 
 		if (parser_accept(p, T_RCURLY)) break;
@@ -862,7 +1511,7 @@ static struct sexpr* parse_struct_body_rec(struct parser* p, int depth)
 
 static struct sexpr* parse_type_rec(struct parser* p, int depth)
 {
-	struct sexpr* top = sexpr_new_empty_list();
+	struct sexpr* top = sexpr_new_empty_list(&p->arena);
 	struct sexpr** topc = sexpr_get_append_cursor(top);
 
 	int got_mod = 0;
@@ -874,11 +1523,11 @@ static struct sexpr* parse_type_rec(struct parser* p, int depth)
 			struct sexpr* sz = NULL;
 			struct sexpr* arr;
 			if (!parser_accept(p, T_RBRACKET)) {
-				sz = parse_expr_rec(p, 0, depth+1);
+				sz = parse_expr(p);
 				if (sz == NULL || !parser_expect(p, T_RBRACKET)) return NULL;
-				arr = sexpr_new_list(sz, NULL);
+				arr = sexpr_new_list(&p->arena, sz, NULL);
 			} else {
-				arr = sexpr_new_empty_list();
+				arr = sexpr_new_empty_list(&p->arena);
 			}
 			sexpr_append(typc, arr);
 			tmpc = sexpr_get_append_cursor(arr);
@@ -890,18 +1539,18 @@ static struct sexpr* parse_type_rec(struct parser* p, int depth)
 		enum token_type tt = t.type;
 		if (!got_mod && (tt == T_IN || tt == T_OUT)) {
 			got_mod = 1;
-			sexpr_append(typc, sexpr_new_atom(t));
+			sexpr_append(typc, sexpr_new_atom(&p->arena, t));
 			typc = &topc;
 			continue;
 		} else if (tt == T_IDENTIFIER || tt_is_type(tt)) {
 			got_typ = 1;
-			sexpr_append(typc, sexpr_new_atom(t));
+			sexpr_append(typc, sexpr_new_atom(&p->arena, t));
 			break;
 		} else if (tt == T_STRUCT) {
 			struct sexpr* body = parse_struct_body_rec(p, depth+1);
 			if (body == NULL) return NULL;
 			got_typ = 1;
-			sexpr_append(typc, sexpr_new_atom(t));
+			sexpr_append(typc, sexpr_new_atom(&p->arena, t));
 			sexpr_append(typc, body);
 			break;
 		} else {
@@ -918,146 +1567,162 @@ static struct sexpr* parse_type_rec(struct parser* p, int depth)
 	return top;
 }
 
-static struct sexpr* parse_rec(struct parser* p, int depth, int fnlvl)
-{
-	struct sexpr* ss = sexpr_new_list(NULL);
-	struct sexpr** ssc = sexpr_get_append_cursor(ss);
+static struct sexpr* parse_rec(struct parser* p, int depth, int fnlvl);
 
-	for (;;) {
-		struct token t = parser_next_token(p);
-		enum token_type tt = t.type;
+static int is_def(enum token_type tt)
+{
+	return tt == T_VAR || tt == T_CONST || tt == T_TYPE || tt == T_FUNC;
+}
 
-		if (tt == T_EOF) break;
-		if (fnlvl > 0 && tt == T_RCURLY) {
-			parser_rewind(p);
-			break;
+// parses the definition started by t (see is_def()) through its
+// terminating semicolon
+static struct sexpr* parse_def(struct parser* p, struct token t, int depth, int fnlvl)
+{
+	enum token_type tt = t.type;
+	int is_valdef = tt == T_VAR || tt == T_CONST;
+	struct token identifier = parser_next_token(p);
+	if (identifier.type != T_IDENTIFIER) {
+		parser_err_unexp(p);
+		return NULL;
+	}
+	struct sexpr* def = sexpr_new_list(&p->arena, sexpr_new_atom(&p->arena, t), sexpr_new_atom(&p->arena, identifier), NULL);
+	struct sexpr** defc = sexpr_get_append_cursor(def);
+
+	int got_semicolon = 0;
+
+	if (is_valdef) {
+		struct sexpr* type = NULL;
+		int got_assign = 0;
+		int got_type = 0;
+		int got_expr = 0;
+		if (parser_accept(p, T_ASSIGN)) {
+			got_assign = 1;
+		} else if (parser_accept(p, T_SEMICOLON)) {
+			got_semicolon = 1;
+		} else {
+			type = parse_type_rec(p, depth+1);
+			if (type == NULL) return NULL;
+			got_type = 1;
 		}
-		if (tt == T_SEMICOLON) continue; // XXX?
 
-		int is_valdef = tt == T_VAR || tt == T_CONST;
-		if (is_valdef || tt == T_TYPE || tt == T_FUNC) {
-			struct token identifier = parser_next_token(p);
-			if (identifier.type != T_IDENTIFIER) {
+		if (type == NULL) type = sexpr_new_empty_list(&p->arena);
+		sexpr_append(&defc, type);
+
+		if (!got_semicolon && (got_assign || parser_accept(p, T_ASSIGN))) {
+			struct sexpr* expr = parse_expr(p);
+			if (expr == NULL) return NULL;
+			sexpr_append(&defc, expr);
+			got_expr = 1;
+		}
+	} else if (tt == T_TYPE) {
+		struct sexpr* type = parse_type_rec(p, depth+1);
+		if (type == NULL) return NULL;
+		sexpr_append(&defc, type);
+	} else if (tt == T_FUNC) {
+		if (!parser_expect(p, T_LPAREN)) return NULL;
+
+		// parse argument list
+		struct sexpr* arglist = sexpr_new_empty_list(&p->arena);
+		struct sexpr** arglistc = sexpr_get_append_cursor(arglist);
+		for (;;) {
+			if (parser_accept(p, T_RPAREN)) break;
+			struct token id = parser_next_token(p);
+			if (id.type != T_IDENTIFIER) {
 				parser_err_unexp(p);
 				return NULL;
 			}
-			struct sexpr* def = sexpr_new_list(sexpr_new_atom(t), sexpr_new_atom(identifier), NULL);
-			struct sexpr** defc = sexpr_get_append_cursor(def);
-
-			int got_semicolon = 0;
-
-			if (is_valdef) {
-				struct sexpr* type = NULL;
-				int got_assign = 0;
-				int got_type = 0;
-				int got_expr = 0;
-				if (parser_accept(p, T_ASSIGN)) {
-					got_assign = 1;
-				} else if (parser_accept(p, T_SEMICOLON)) {
-					got_semicolon = 1;
-				} else {
-					type = parse_type_rec(p, depth+1);
-					if (type == NULL) return NULL;
-					got_type = 1;
-				}
+			struct sexpr* typ = parse_type_rec(p, depth+1);
+			if (typ == NULL) return NULL;
+			sexpr_append(&arglistc, sexpr_new_list(&p->arena, sexpr_new_atom(&p->arena, id), typ, NULL));
 
-				if (type == NULL) type = sexpr_new_empty_list();
-				sexpr_append(&defc, type);
+			if (parser_accept(p, T_COMMA)) continue;
+			if (!parser_expect(p, T_RPAREN)) return NULL;
+			break;
+		}
+		sexpr_append(&defc, arglist);
+
+		// parse return list
+		struct sexpr* retlist = sexpr_new_empty_list(&p->arena);
+		struct sexpr** retlistc = sexpr_get_append_cursor(retlist);
+		if (!parser_accept(p, T_LCURLY)) {
+			int is_list = parser_accept(p, T_LPAREN);
+			for (;;) {
+				struct sexpr* typ = parse_type_rec(p, depth+1);
+				if (typ == NULL) return NULL;
+				sexpr_append(&retlistc, typ);
+				if (is_list && parser_accept(p, T_COMMA)) continue;
+				if (!is_list) break;
+				if (!parser_expect(p, T_RPAREN)) return NULL;
+				break;
+			}
+			if (!parser_expect(p, T_LCURLY)) return NULL;
+		}
+		sexpr_append(&defc, retlist);
 
-				if (!got_semicolon && (got_assign || parser_accept(p, T_ASSIGN))) {
-					struct sexpr* expr = parse_expr_rec(p, 0, depth+1);
-					if (expr == NULL) return NULL;
-					sexpr_append(&defc, expr);
-					got_expr = 1;
-				}
-			} else if (tt == T_TYPE) {
-				struct sexpr* type = parse_type_rec(p, depth+1);
-				if (type == NULL) return NULL;
-				sexpr_append(&defc, type);
-			} else if (tt == T_FUNC) {
-				if (!parser_expect(p, T_LPAREN)) return NULL;
-
-				// parse argument list
-				struct sexpr* arglist = sexpr_new_empty_list();
-				struct sexpr** arglistc = sexpr_get_append_cursor(arglist);
-				for (;;) {
-					if (parser_accept(p, T_RPAREN)) break;
-					struct token id = parser_next_token(p);
-					if (id.type != T_IDENTIFIER) {
-						parser_err_unexp(p);
-						return NULL;
-					}
-					struct sexpr* typ = parse_type_rec(p, depth+1);
-					if (typ == NULL) return NULL;
-					sexpr_append(&arglistc, sexpr_new_list(sexpr_new_atom(id), typ, NULL));
+		struct sexpr* body = parse_rec(p, depth+1, fnlvl+1);
+		if (body == NULL) {
+			parser_err_unexp(p);
+			return NULL;
+		}
+		sexpr_append(&defc, body);
 
-					if (parser_accept(p, T_COMMA)) continue;
-					if (!parser_expect(p, T_RPAREN)) return NULL;
-					break;
-				}
-				sexpr_append(&defc, arglist);
+		if (!parser_expect(p, T_RCURLY)) return NULL;
+	} else {
+		assert(0);
+	}
 
-				// parse return list
-				struct sexpr* retlist = sexpr_new_empty_list();
-				struct sexpr** retlistc = sexpr_get_append_cursor(retlist);
-				if (!parser_accept(p, T_LCURLY)) {
-					int is_list = parser_accept(p, T_LPAREN);
-					for (;;) {
-						struct sexpr* typ = parse_type_rec(p, depth+1);
-						if (typ == NULL) return NULL;
-						sexpr_append(&retlistc, typ);
-						if (is_list && parser_accept(p, T_COMMA)) continue;
-						if (!is_list) break;
-						if (!parser_expect(p, T_RPAREN)) return NULL;
-						break;
-					}
-					if (!parser_expect(p, T_LCURLY)) return NULL;
-				}
-				sexpr_append(&defc, retlist);
+	if (!got_semicolon && !parser_expect(p, T_SEMICOLON)) return NULL;
 
-				struct sexpr* body = parse_rec(p, depth+1, fnlvl+1);
-				if (body == NULL) {
-					parser_err_unexp(p);
-					return NULL;
-				}
-				sexpr_append(&defc, body);
+	return def;
+}
 
-				if (!parser_expect(p, T_RCURLY)) return NULL;
-			} else {
-				assert(0);
-			}
+static struct sexpr* parse_rec(struct parser* p, int depth, int fnlvl)
+{
+	struct sexpr* ss = sexpr_new_list(&p->arena, NULL);
+	struct sexpr** ssc = sexpr_get_append_cursor(ss);
+
+	for (;;) {
+		struct token t = parser_next_token(p);
+		enum token_type tt = t.type;
 
-			if (!got_semicolon && !parser_expect(p, T_SEMICOLON)) return NULL;
+		if (tt == T_EOF) break;
+		if (fnlvl > 0 && tt == T_RCURLY) {
+			parser_rewind(p);
+			break;
+		}
+		if (tt == T_SEMICOLON) continue; // XXX?
 
+		if (is_def(tt)) {
+			struct sexpr* def = parse_def(p, t, depth, fnlvl);
+			if (def == NULL) return NULL;
 			sexpr_append(&ssc, def);
-
 			continue;
 		}
 
 		// function body statements
 		if (fnlvl > 0) {
-			struct sexpr* stmt = sexpr_new_empty_list();
+			struct sexpr* stmt = sexpr_new_empty_list(&p->arena);
 			struct sexpr** stmtc = sexpr_get_append_cursor(stmt);
 			switch (tt) {
 			case T_RETURN: {
-				sexpr_append(&stmtc, sexpr_new_atom(t));
+				sexpr_append(&stmtc, sexpr_new_atom(&p->arena, t));
 				for (;;) {
-					struct sexpr* expr = parse_expr_rec(p, 0, depth+1);
+					struct sexpr* expr = parse_expr(p);
 					if (expr == NULL) return NULL;
 					sexpr_append(&stmtc, expr);
 					if (!parser_accept(p, T_COMMA)) break;
 				}
 			} break;
 			case T_FOR: {
-				sexpr_append(&stmtc, sexpr_new_atom(t));
+				sexpr_append(&stmtc, sexpr_new_atom(&p->arena, t));
 				if (!parser_accept(p, T_LCURLY)) {
-					struct sexpr* f0 = parse_expr_rec(p, 0, depth+1);
+					struct sexpr* f0 = parse_expr(p);
 					if (f0 == NULL) return NULL;
 					sexpr_append(&stmtc, f0);
 					if (!parser_accept(p, T_LCURLY)) {
 						for (int i = 0; i < 2; i++) {
 							if (!parser_expect(p, T_SEMICOLON)) return NULL;
-							struct sexpr* f1 = parse_expr_rec(p, 0, depth+1);
+							struct sexpr* f1 = parse_expr(p);
 							if (f1 == NULL) return NULL;
 							sexpr_append(&stmtc, f1);
 						}
@@ -1074,8 +1739,8 @@ static struct sexpr* parse_rec(struct parser* p, int depth, int fnlvl)
 				struct sexpr*** nc = &stmtc;
 				struct sexpr** tmp;
 				for (;;) {
-					sexpr_append(nc, sexpr_new_atom(t));
-					struct sexpr* cond = parse_expr_rec(p, 0, depth+1);
+					sexpr_append(nc, sexpr_new_atom(&p->arena, t));
+					struct sexpr* cond = parse_expr(p);
 					sexpr_append(nc, cond);
 					if (!parser_expect(p, T_LCURLY)) return NULL;
 					struct sexpr* tscope = parse_rec(p, depth+1, fnlvl);
@@ -1085,8 +1750,8 @@ static struct sexpr* parse_rec(struct parser* p, int depth, int fnlvl)
 					if (parser_accept(p, T_ELSE)) {
 						if (parser_accept_and_get(p, T_IF, &t)) {
 							tt = t.type;
-							struct sexpr* fscope1 = sexpr_new_empty_list();
-							struct sexpr* fscope0 = sexpr_new_list(fscope1, NULL);
+							struct sexpr* fscope1 = sexpr_new_empty_list(&p->arena);
+							struct sexpr* fscope0 = sexpr_new_list(&p->arena, fscope1, NULL);
 							sexpr_append(nc, fscope0);
 							tmp = sexpr_get_append_cursor(fscope1);
 							nc = &tmp;
@@ -1108,11 +1773,11 @@ static struct sexpr* parse_rec(struct parser* p, int depth, int fnlvl)
 			case T_BREAK:
 			case T_CONTINUE:
 			case T_FALLTHROUGH:
-				sexpr_append(&stmtc, sexpr_new_atom(t));
+				sexpr_append(&stmtc, sexpr_new_atom(&p->arena, t));
 				break;
 			default:
 				parser_rewind(p);
-				stmt = parse_expr_rec(p, 0, depth+1);
+				stmt = parse_expr(p);
 				if (stmt == NULL) return NULL;
 				break;
 			}
@@ -1132,122 +1797,7881 @@ static struct sexpr* parse_rec(struct parser* p, int depth, int fnlvl)
 
 
 
-#ifdef TEST
+//////////////////////////////////////////////////////////////////////////////
+// INCREMENTAL PARSING
+//////////////////////////////////////////////////////////////////////////////
 
-int n_failed;
+/*
+keeps a source buffer parsed as a list of top-level definitions, each with
+its source span and its own flat AST (offsets are relative to the start of
+the span, so a definition doesn't care if text before it moves around).
+
+after an edit, parsing restarts at the end of the last definition before
+the edit and proceeds one definition at a time until it ends on an old
+definition boundary past the edit. the lexer/parser state at a definition
+boundary is the same as at the start of a buffer, so everything after that
+point is unchanged and is kept (only its span is shifted).
+
+text that doesn't parse (someone is halfway through typing) becomes an
+error span in the list instead of a definition: it runs from where the bad
+definition starts to the first old definition past both the edit and the
+point where the parser gave up, and the definitions from there on are kept.
+a later edit in or before the span parses it again
+*/
+
+struct incdecl {
+	int start, end; // [start;end) including the terminating semicolon
+	struct flat ast;
+	int mapped; // ast.nodes point into a struct pcache mapping
+	char* err; // an error span if set (then ast is empty), with its message
+	struct sexpr* tree; // see incparse_decl_sexpr()
+};
 
-#define OK "\e[32m\e[1mOK\e[0m "
-#define FAIL "\e[41m\e[33m\e[1m!!\e[0m "
+struct incparse {
+	char* src;
+	size_t src_len;
 
-#if 0
+	struct dynary decls_dy;
+	struct incdecl** decls;
+
+	struct parser parser;
+
+	// trees of the definitions, and a list of them as parse_rec(p, 0, 0)
+	// would return; the list is NULL while it's to be built from scratch
+	struct arena trees;
+	struct sexpr* list;
+	int n_live_nodes, n_dead_nodes; // in trees
+
+	int n_errors;
+
+	// stats for the last edit
+	int n_reparsed, n_removed, n_built;
+};
+
+static void incparse__drop(struct incparse* ip, int i)
+{
+	struct incdecl* d = ip->decls[i];
+	if (d->tree != NULL) {
+		ip->n_live_nodes -= d->ast.nodes_dy.n;
+		ip->n_dead_nodes += d->ast.nodes_dy.n;
+	}
+	if (d->err != NULL) ip->n_errors--;
+	if (!d->mapped) flat_free(&d->ast);
+	free(d->err);
+	free(d);
+	dynary_erase(&ip->decls_dy, i);
+	ip->n_removed++;
+}
+
+// parses the next definition at or after *pos; returns NULL at EOF, and an
+// error span ending where the parser gave up on a syntax error
+static struct incdecl* incparse__parse_decl(struct incparse* ip, int* pos)
+{
+	struct parser* p = &ip->parser;
+	parser_reset_n(p, ip->src + *pos, ip->src_len - *pos);
+	jmp_buf on_err;
+	p->on_err = &on_err;
+
+	struct incdecl* d = calloc(1, sizeof(*d));
+	assert(d != NULL);
+	d->start = *pos;
+	struct token t;
+	if (setjmp(on_err) == 0) {
+		do t = parser_next_token(p); while (t.type == T_SEMICOLON);
+		if (t.type == T_EOF) {
+			free(d);
+			return NULL;
+		}
+		d->start = t.str.ptr - ip->src;
+		if (!is_def(t.type)) parser_err_unexp(p);
+		struct sexpr* def = parse_def(p, t, 0, 0);
+		assert(def != NULL);
+		d->end = p->current_token.str.ptr + p->current_token.str.len - ip->src;
+		flat_init(&d->ast, ip->src + d->start);
+		flat_append_sexpr(&d->ast, def);
+	} else {
+		struct token* at = &p->current_token;
+		d->end = at->type == T_EOF ? (int)ip->src_len : at->str.ptr + at->str.len - ip->src;
+		if (d->end < d->start) d->end = d->start;
+		d->err = strdup(p->err_msg);
+		assert(d->err != NULL);
+		flat_init(&d->ast, NULL);
+	}
+	p->on_err = NULL;
+
+	*pos = d->end;
+	return d;
+}
+
+// the tree of a definition, over a copy of its text in ip->trees so it
+// stays valid as the buffer changes
+static struct sexpr* incparse__tree(struct incparse* ip, struct incdecl* d)
+{
+	if (d->tree != NULL || d->err != NULL) return d->tree;
+	int len = d->end - d->start;
+	char* text = arena_alloc(&ip->trees, len + 1);
+	memcpy(text, ip->src + d->start, len);
+	text[len] = 0;
+	struct flat f = d->ast;
+	f.src = text;
+	d->tree = flat_to_sexpr(&ip->trees, &f, 0);
+	ip->n_live_nodes += d->ast.nodes_dy.n;
+	ip->n_built++;
+	return d->tree;
+}
+
+// links the trees of decls [from;to) into the list, building them
+static void incparse__link(struct incparse* ip, int from, int to)
+{
+	struct sexpr** cursor = &ip->list->list;
+	for (int j = from - 1; j >= 0; j--) {
+		if (ip->decls[j]->tree == NULL) continue;
+		cursor = &ip->decls[j]->tree->next;
+		break;
+	}
+	for (int j = from; j < ip->decls_dy.n; j++) {
+		struct sexpr* tree = j < to ? incparse__tree(ip, ip->decls[j]) : ip->decls[j]->tree;
+		if (tree == NULL) continue;
+		*cursor = tree;
+		cursor = &tree->next;
+		if (j >= to) return;
+	}
+	*cursor = NULL;
+}
+
+// whether [from;to) holds nothing but blanks, comments and semicolons
+static int incparse__blank(struct incparse* ip, int from, int to)
+{
+	struct parser* p = &ip->parser;
+	parser_reset_n(p, ip->src + from, ip->src_len - from);
+	jmp_buf on_err;
+	p->on_err = &on_err;
+	int blank = 0;
+	if (setjmp(on_err) == 0) {
+		struct token t;
+		do t = parser_next_token(p); while (t.type == T_SEMICOLON);
+		blank = t.type == T_EOF || t.str.ptr - ip->src >= to;
+	}
+	p->on_err = NULL;
+	return blank;
+}
+
+static void incparse_init(struct incparse* ip)
+{
+	memset(ip, 0, sizeof(*ip));
+	dynary_init(&ip->decls_dy, (void**) &ip->decls, sizeof(*ip->decls));
+	parser_init_n(&ip->parser, "", 0);
+	arena_init(&ip->trees);
+}
+
+static void incparse_free(struct incparse* ip)
+{
+	while (ip->decls_dy.n > 0) incparse__drop(ip, ip->decls_dy.n - 1);
+	free(ip->decls);
+	parser_free(&ip->parser);
+	arena_free(&ip->trees);
+}
+
+/*
+src/src_len is the whole buffer after the edit, in which the bytes
+[start;start+old_len) of the previous buffer were replaced by new_len
+bytes. to parse a buffer from scratch, pass start=0, old_len=0 and
+new_len=src_len on an empty incparse
+*/
+static void incparse_edit(struct incparse* ip, char* src, size_t src_len, int start, int old_len, int new_len)
+{
+	int delta = new_len - old_len;
+	ip->src = src;
+	ip->src_len = src_len;
+	ip->n_reparsed = 0;
+	ip->n_removed = 0;
+	ip->n_built = 0;
+
+	// first definition overlapping the edit (a definition ending right
+	// where the edit starts is unaffected by it)
+	int lo = 0;
+	int hi = ip->decls_dy.n;
+	while (lo < hi) {
+		int mid = (lo + hi) >> 1;
+		if (ip->decls[mid]->end <= start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	int i = lo; // insertion index for reparsed definitions; old ones start here
+	int pos = i > 0 ? ip->decls[i-1]->end : 0;
+	int last_removed_end = -1;
+	int last_removed_err = 0;
+	for (;;) {
+		struct incdecl* d = incparse__parse_decl(ip, &pos);
+		if (d == NULL) {
+			// EOF; nothing left of the old definitions
+			while (i < ip->decls_dy.n) incparse__drop(ip, i);
+			break;
+		}
+		*(struct incdecl**)dynary_insert(&ip->decls_dy, i++) = d;
+		ip->n_reparsed++;
+
+		if (d->err != NULL) {
+			// keep the old definitions past both the edit and the error
+			ip->n_errors++;
+			int old_pos = d->end - delta;
+			if (old_pos < start + old_len) old_pos = start + old_len;
+			while (i < ip->decls_dy.n && ip->decls[i]->start < old_pos) incparse__drop(ip, i);
+			d->end = i < ip->decls_dy.n ? ip->decls[i]->start + delta : (int)src_len;
+			for (int j = i; j < ip->decls_dy.n; j++) {
+				ip->decls[j]->start += delta;
+				ip->decls[j]->end += delta;
+			}
+			break;
+		}
+
+		if (d->end < start + new_len) continue;
+
+		// drop old definitions overlapping what was just parsed (in old
+		// coordinates)
+		int old_pos = d->end - delta;
+		while (i < ip->decls_dy.n && ip->decls[i]->start < old_pos) {
+			last_removed_end = ip->decls[i]->end;
+			last_removed_err = ip->decls[i]->err != NULL;
+			incparse__drop(ip, i);
+		}
+
+		// an error span reaches up to the next definition, so a fixed one
+		// is in sync if only blanks are left of it
+		if (last_removed_end == old_pos || (last_removed_err && old_pos < last_removed_end && incparse__blank(ip, d->end, last_removed_end + delta))) {
+			// back in sync; the rest is unchanged apart from its position
+			for (int j = i; j < ip->decls_dy.n; j++) {
+				ip->decls[j]->start += delta;
+				ip->decls[j]->end += delta;
+			}
+			break;
+		}
+	}
+
+	if (ip->n_dead_nodes > ip->n_live_nodes + 4096) {
+		// mostly garbage; start the trees over when they're next asked for
+		arena_reset(&ip->trees);
+		for (int j = 0; j < ip->decls_dy.n; j++) ip->decls[j]->tree = NULL;
+		ip->list = NULL;
+		ip->n_live_nodes = ip->n_dead_nodes = 0;
+	}
+	if (ip->list != NULL) incparse__link(ip, lo, i);
+}
+
+// the tree of definition i, or NULL for an error span. trees are built once
+// and kept until the definition is reparsed, so passes that rewrite trees in
+// place (sem_check() folds constants) must not be given them
+static struct sexpr* incparse_decl_sexpr(struct incparse* ip, int i)
+{
+	return incparse__tree(ip, ip->decls[i]);
+}
+
+// the same tree as parse_rec(p, 0, 0) would build for the whole buffer, less
+// the error spans; after an edit, only what it reparsed is built and linked
+// in. valid until the next edit
+static struct sexpr* incparse_sexpr(struct incparse* ip)
+{
+	if (ip->list == NULL) {
+		ip->list = sexpr_new_empty_list(&ip->trees);
+		incparse__link(ip, 0, ip->decls_dy.n);
+	}
+	return ip->list;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// PARSE CACHE
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+persists what incparse_edit() produces for whole buffers, keyed by the
+BLAKE2b-256 of the buffer, so reopening a project only parses the code that
+changed since the cache was saved. the cache file is mapped read-only and a
+hit hands out definitions whose flat ASTs point straight into the mapping:
+nothing is parsed or copied (fnodes hold no pointers, atoms are source
+offsets and symbols are interned when the tree is rebuilt).
+
+file layout, native endian, every part 8-byte aligned:
+	struct pcache_header
+	struct pcache_entry[n_entries], most recently used first
+	per entry: struct pcache_decl[n_decls], then struct fnode[n_nodes]
+
+entries are stamped with the cache's clock (one tick per pcache_open())
+when they're used; pcache_save() rewrites the file with the most recently
+used entries that fit in max_bytes, so entries for old versions of buffers
+age out. the hash is strong enough that a hit isn't compared against the
+source, but hit entries are checked for being well formed, so a damaged
+file costs a reparse, not a crash
+*/
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define PCACHE_MAGIC "dopcache"
+#define PCACHE_VERSION (1) // bump when the layout or the parser output changes
+
+struct pcache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t fnode_size;
+	uint64_t clock;
+	uint64_t n_entries;
+};
+
+struct pcache_entry {
+	uint8_t hash[32];
+	uint64_t stamp;
+	uint64_t offset; // of the decls, from the start of the file
+	uint32_t src_len;
+	uint32_t n_decls;
+	uint32_t n_nodes;
+	uint32_t _pad;
+};
+
+struct pcache_decl {
+	uint32_t start, end;
+	uint32_t node, n_nodes; // range in the entry's nodes
+};
+
+struct pcache_item {
+	struct pcache_entry e;
+	struct pcache_decl* decls;
+	struct fnode* nodes;
+	int owned; // decls (and nodes, in the same block) are heap allocated
+	int dead; // failed pcache__check(); not used or saved
+	int checked;
+};
+
+struct pcache {
+	char* path;
+	size_t max_bytes;
+	uint64_t clock;
+
+	void* map;
+	size_t map_size;
+
+	struct dynary items_dy;
+	struct pcache_item* items;
+
+	// open addressing; item index + 1, 0 is empty
+	uint32_t* index;
+	int index_cap;
+
+	int n_hits, n_misses;
+};
+
+static const uint64_t blake2b__iv[8] = {
+	0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+	0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull,
+};
+
+static inline uint64_t blake2b__rotr(uint64_t x, int n)
+{
+	return (x >> n) | (x << (64 - n));
+}
+
+static inline void blake2b__g(uint64_t* v, int a, int b, int c, int d, uint64_t x, uint64_t y)
+{
+	v[a] = v[a] + v[b] + x;
+	v[d] = blake2b__rotr(v[d] ^ v[a], 32);
+	v[c] = v[c] + v[d];
+	v[b] = blake2b__rotr(v[b] ^ v[c], 24);
+	v[a] = v[a] + v[b] + y;
+	v[d] = blake2b__rotr(v[d] ^ v[a], 16);
+	v[c] = v[c] + v[d];
+	v[b] = blake2b__rotr(v[b] ^ v[c], 63);
+}
+
+static void blake2b__compress(uint64_t* h, const uint8_t* p, uint64_t t, int last)
+{
+	static const uint8_t sigma[12][16] = {
+		{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+		{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+		{ 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+		{ 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+		{ 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+		{ 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+		{ 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+		{ 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+		{ 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+		{ 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+		{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+		{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+	};
+	uint64_t m[16], v[16];
+	for (int i = 0; i < 16; i++) {
+		m[i] = 0;
+		for (int j = 7; j >= 0; j--) m[i] = (m[i] << 8) | p[i*8 + j];
+	}
+	for (int i = 0; i < 8; i++) {
+		v[i] = h[i];
+		v[i+8] = blake2b__iv[i];
+	}
+	v[12] ^= t;
+	if (last) v[14] = ~v[14];
+	for (int r = 0; r < 12; r++) {
+		const uint8_t* s = sigma[r];
+		blake2b__g(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+		blake2b__g(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+		blake2b__g(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+		blake2b__g(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+		blake2b__g(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+		blake2b__g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+		blake2b__g(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+		blake2b__g(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+	}
+	for (int i = 0; i < 8; i++) h[i] ^= v[i] ^ v[i+8];
+}
+
+// BLAKE2b with a 32-byte digest and no key (RFC 7693)
+static void blake2b_256(const void* data, size_t len, uint8_t out[32])
+{
+	uint64_t h[8];
+	memcpy(h, blake2b__iv, sizeof(h));
+	h[0] ^= 0x01010000 ^ 32;
+	const uint8_t* p = data;
+	uint64_t t = 0;
+	for (; len > 128; p += 128, len -= 128) {
+		t += 128;
+		blake2b__compress(h, p, t, 0);
+	}
+	uint8_t last[128];
+	memset(last, 0, sizeof(last));
+	memcpy(last, p, len);
+	blake2b__compress(h, last, t + len, 1);
+	for (int i = 0; i < 32; i++) out[i] = h[i/8] >> (i%8*8);
+}
+
+static inline size_t pcache__align(size_t n)
+{
+	return (n + 7) & ~(size_t)7;
+}
+
+static inline size_t pcache__payload_size(struct pcache_entry* e)
+{
+	return pcache__align(e->n_decls * sizeof(struct pcache_decl) + (size_t)e->n_nodes * sizeof(struct fnode));
+}
+
+static int pcache__find(struct pcache* pc, const uint8_t* hash)
+{
+	if (pc->index_cap == 0) return -1;
+	uint32_t mask = pc->index_cap - 1;
+	uint32_t h;
+	memcpy(&h, hash, sizeof(h));
+	for (uint32_t i = h & mask; pc->index[i] != 0; i = (i + 1) & mask) {
+		int item = pc->index[i] - 1;
+		if (memcmp(pc->items[item].e.hash, hash, 32) == 0) return item;
+	}
+	return -1;
+}
+
+static void pcache__index(struct pcache* pc, int item)
+{
+	if ((item + 1) * 2 > pc->index_cap) {
+		free(pc->index);
+		pc->index_cap = pc->index_cap ? pc->index_cap * 2 : 64;
+		pc->index = calloc(pc->index_cap, sizeof(*pc->index));
+		assert(pc->index != NULL);
+		for (int i = 0; i < item; i++) pcache__index(pc, i);
+	}
+	uint32_t mask = pc->index_cap - 1;
+	uint32_t h;
+	memcpy(&h, pc->items[item].e.hash, sizeof(h));
+	uint32_t i = h & mask;
+	while (pc->index[i] != 0) i = (i + 1) & mask;
+	pc->index[i] = item + 1;
+}
+
+// reads the whole file; mapped where possible
+static int pcache__map(struct pcache* pc)
+{
+#ifdef __unix__
+	int fd = open(pc->path, O_RDONLY);
+	if (fd < 0) return -1;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct pcache_header)) {
+		close(fd);
+		return -1;
+	}
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+	pc->map = map;
+	pc->map_size = st.st_size;
+	return 0;
+#else
+	FILE* f = fopen(pc->path, "rb");
+	if (f == NULL) return -1;
+	long size = -1;
+	if (fseek(f, 0, SEEK_END) == 0) size = ftell(f);
+	void* map = NULL;
+	if (size >= (long)sizeof(struct pcache_header) && fseek(f, 0, SEEK_SET) == 0) {
+		map = malloc(size);
+		assert(map != NULL);
+		if (fread(map, 1, size, f) != size) {
+			free(map);
+			map = NULL;
+		}
+	}
+	fclose(f);
+	if (map == NULL) return -1;
+	pc->map = map;
+	pc->map_size = size;
+	return 0;
+#endif
+}
+
+static void pcache__unmap(struct pcache* pc)
+{
+	if (pc->map == NULL) return;
+#ifdef __unix__
+	munmap(pc->map, pc->map_size);
+#else
+	free(pc->map);
+#endif
+	pc->map = NULL;
+}
+
+// opens the cache at path; a missing or unusable file gives an empty cache
+static void pcache_open(struct pcache* pc, const char* path, size_t max_bytes)
+{
+	memset(pc, 0, sizeof(*pc));
+	dynary_init(&pc->items_dy, (void**) &pc->items, sizeof(*pc->items));
+	pc->path = strdup(path);
+	assert(pc->path != NULL);
+	pc->max_bytes = max_bytes;
+	if (pcache__map(pc) != 0) return;
+
+	struct pcache_header* hd = pc->map;
+	uint64_t n = hd->n_entries;
+	size_t entries_end = sizeof(*hd) + n * sizeof(struct pcache_entry);
+	if (memcmp(hd->magic, PCACHE_MAGIC, sizeof(hd->magic)) != 0
+		|| hd->version != PCACHE_VERSION
+		|| hd->fnode_size != sizeof(struct fnode)
+		|| n > pc->map_size / sizeof(struct pcache_entry)
+		|| entries_end > pc->map_size)
+	{
+		pcache__unmap(pc);
+		return;
+	}
+
+	pc->clock = hd->clock + 1;
+	struct pcache_entry* entries = (struct pcache_entry*)(hd + 1);
+	for (uint64_t i = 0; i < n; i++) {
+		struct pcache_entry* e = &entries[i];
+		if (e->offset < entries_end || e->offset % 8 != 0
+			|| e->offset > pc->map_size
+			|| pcache__payload_size(e) > pc->map_size - e->offset
+			|| pcache__find(pc, e->hash) != -1)
+		{
+			continue;
+		}
+		struct pcache_item* it = dynary_append(&pc->items_dy);
+		it->e = *e;
+		it->decls = (struct pcache_decl*)((char*)pc->map + e->offset);
+		it->nodes = (struct fnode*)(it->decls + e->n_decls);
+		pcache__index(pc, pc->items_dy.n - 1);
+	}
+}
+
+// everything handed out by pcache_load() must be freed first
+static void pcache_free(struct pcache* pc)
+{
+	for (int i = 0; i < pc->items_dy.n; i++) {
+		if (pc->items[i].owned) free(pc->items[i].decls);
+	}
+	free(pc->items);
+	free(pc->index);
+	free(pc->path);
+	pcache__unmap(pc);
+}
+
+// the flat ASTs of an entry must stay inside their definitions: children
+// and siblings come later in preorder and atoms lie within the source span
+static int pcache__check(struct pcache_item* it)
+{
+	uint32_t prev_end = 0;
+	for (uint32_t i = 0; i < it->e.n_decls; i++) {
+		struct pcache_decl* d = &it->decls[i];
+		if (d->start < prev_end || d->end <= d->start || d->end > it->e.src_len) return 0;
+		if (d->n_nodes == 0 || d->node > it->e.n_nodes || d->n_nodes > it->e.n_nodes - d->node) return 0;
+		prev_end = d->end;
+		uint32_t span = d->end - d->start;
+		struct fnode* nodes = it->nodes + d->node;
+		for (uint32_t j = 0; j < d->n_nodes; j++) {
+			struct fnode* n = &nodes[j];
+			if (n->next != 0 && (n->next <= j || n->next >= d->n_nodes)) return 0;
+			if (fnode_is_atom(n)) {
+				if (n->child_or_offset > span || n->len > span - n->child_or_offset) return 0;
+			} else if (fnode_is_list(n)) {
+				if (n->len > 0 && (n->child_or_offset <= j || n->child_or_offset >= d->n_nodes)) return 0;
+			} else {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+// makes ip (fresh from incparse_init()) hold src, parsed; from the cache if
+// it has src, in which case the definitions point into pc's mapping and pc
+// must outlive ip. returns 1 on a hit
+static int pcache_load(struct pcache* pc, struct incparse* ip, char* src, size_t src_len)
+{
+	assert(ip->decls_dy.n == 0);
+	uint8_t hash[32];
+	blake2b_256(src, src_len, hash);
+	int i = pcache__find(pc, hash);
+	struct pcache_item* it = i >= 0 ? &pc->items[i] : NULL;
+	if (it != NULL && !it->checked) {
+		it->dead = it->e.src_len != src_len || !pcache__check(it);
+		it->checked = 1;
+	}
+	if (it == NULL || it->dead) {
+		pc->n_misses++;
+		incparse_edit(ip, src, src_len, 0, 0, src_len);
+		return 0;
+	}
+
+	pc->n_hits++;
+	it->e.stamp = pc->clock;
+	ip->src = src;
+	ip->src_len = src_len;
+	ip->n_reparsed = 0;
+	ip->n_removed = 0;
+	for (uint32_t j = 0; j < it->e.n_decls; j++) {
+		struct pcache_decl* pd = &it->decls[j];
+		struct incdecl* d = calloc(1, sizeof(*d));
+		assert(d != NULL);
+		d->start = pd->start;
+		d->end = pd->end;
+		flat_init(&d->ast, src + d->start);
+		d->ast.nodes = it->nodes + pd->node;
+		d->ast.nodes_dy.n = pd->n_nodes;
+		d->mapped = 1;
+		*(struct incdecl**)dynary_append(&ip->decls_dy) = d;
+	}
+	return 1;
+}
+
+// adds what ip holds (for its current ip->src) to the cache, or marks it as
+// used if it's already there. buffers with syntax errors aren't cached
+static void pcache_put(struct pcache* pc, struct incparse* ip)
+{
+	if (ip->src_len > UINT32_MAX || ip->n_errors > 0) return;
+	uint8_t hash[32];
+	blake2b_256(ip->src, ip->src_len, hash);
+	int i = pcache__find(pc, hash);
+	if (i >= 0 && !pc->items[i].dead) {
+		pc->items[i].e.stamp = pc->clock;
+		return;
+	}
+
+	struct pcache_entry e;
+	memset(&e, 0, sizeof(e));
+	memcpy(e.hash, hash, sizeof(e.hash));
+	e.stamp = pc->clock;
+	e.src_len = ip->src_len;
+	e.n_decls = ip->decls_dy.n;
+	for (int j = 0; j < ip->decls_dy.n; j++) e.n_nodes += ip->decls[j]->ast.nodes_dy.n;
+
+	struct pcache_decl* decls = calloc(1, pcache__payload_size(&e) + 1);
+	assert(decls != NULL);
+	struct fnode* nodes = (struct fnode*)(decls + e.n_decls);
+	uint32_t node = 0;
+	for (int j = 0; j < ip->decls_dy.n; j++) {
+		struct incdecl* d = ip->decls[j];
+		decls[j] = (struct pcache_decl){ d->start, d->end, node, d->ast.nodes_dy.n };
+		memcpy(nodes + node, d->ast.nodes, d->ast.nodes_dy.n * sizeof(*nodes));
+		node += d->ast.nodes_dy.n;
+	}
+
+	// a dead entry is replaced in place; it's already in the index
+	struct pcache_item* it = i >= 0 ? &pc->items[i] : dynary_append(&pc->items_dy);
+	if (it->owned) free(it->decls);
+	memset(it, 0, sizeof(*it));
+	it->e = e;
+	it->decls = decls;
+	it->nodes = nodes;
+	it->owned = 1;
+	it->checked = 1;
+	if (i < 0) pcache__index(pc, pc->items_dy.n - 1);
+}
+
+static int pcache__by_stamp(const void* a, const void* b)
+{
+	const struct pcache_item* x = *(const struct pcache_item**)a;
+	const struct pcache_item* y = *(const struct pcache_item**)b;
+	if (x->e.stamp != y->e.stamp) return x->e.stamp > y->e.stamp ? -1 : 1;
+	return x < y ? -1 : x > y; // keep the previous order among equals
+}
+
+// writes the most recently used entries that fit in max_bytes to the cache
+// file. the file is replaced by a rename, so the current mapping (and
+// everything pointing into it) stays valid. returns the number of entries
+// written, or -1 on error
+static int pcache_save(struct pcache* pc)
+{
+	struct pcache_item** order = malloc((pc->items_dy.n + 1) * sizeof(*order));
+	assert(order != NULL);
+	int n = 0;
+	for (int i = 0; i < pc->items_dy.n; i++) {
+		if (!pc->items[i].dead) order[n++] = &pc->items[i];
+	}
+	qsort(order, n, sizeof(*order), pcache__by_stamp);
+
+	size_t size = sizeof(struct pcache_header);
+	int n_kept = 0;
+	while (n_kept < n) {
+		size_t sz = sizeof(struct pcache_entry) + pcache__payload_size(&order[n_kept]->e);
+		if (size + sz > pc->max_bytes) break;
+		size += sz;
+		n_kept++;
+	}
+
+	size_t n_tmp = strlen(pc->path) + 32;
+	char* tmp_path = malloc(n_tmp);
+	assert(tmp_path != NULL);
+#ifdef __unix__
+	snprintf(tmp_path, n_tmp, "%s.%d.tmp", pc->path, (int)getpid());
+#else
+	snprintf(tmp_path, n_tmp, "%s.tmp", pc->path);
+#endif
+
+	int ok = 0;
+	FILE* f = fopen(tmp_path, "wb");
+	if (f != NULL) {
+		struct pcache_header hd;
+		memset(&hd, 0, sizeof(hd));
+		memcpy(hd.magic, PCACHE_MAGIC, sizeof(hd.magic));
+		hd.version = PCACHE_VERSION;
+		hd.fnode_size = sizeof(struct fnode);
+		hd.clock = pc->clock;
+		hd.n_entries = n_kept;
+		ok = fwrite(&hd, sizeof(hd), 1, f) == 1;
+
+		uint64_t offset = sizeof(hd) + n_kept * sizeof(struct pcache_entry);
+		for (int i = 0; ok && i < n_kept; i++) {
+			struct pcache_entry e = order[i]->e;
+			e.offset = offset;
+			offset += pcache__payload_size(&e);
+			ok = fwrite(&e, sizeof(e), 1, f) == 1;
+		}
+		static const uint8_t zeros[8];
+		for (int i = 0; ok && i < n_kept; i++) {
+			struct pcache_item* it = order[i];
+			size_t decls_sz = it->e.n_decls * sizeof(*it->decls);
+			size_t nodes_sz = (size_t)it->e.n_nodes * sizeof(*it->nodes);
+			size_t pad = pcache__payload_size(&it->e) - decls_sz - nodes_sz;
+			ok = fwrite(it->decls, 1, decls_sz, f) == decls_sz
+				&& fwrite(it->nodes, 1, nodes_sz, f) == nodes_sz
+				&& fwrite(zeros, 1, pad, f) == pad;
+		}
+		ok = (fclose(f) == 0) && ok;
+		ok = ok && rename(tmp_path, pc->path) == 0;
+		if (!ok) remove(tmp_path);
+	}
+
+	free(tmp_path);
+	free(order);
+	return ok ? n_kept : -1;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// SEMANTIC ANALYSIS
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+resolves and checks programs as returned by parse_rec(p, 0, 0) before they
+go anywhere else:
+ - every type list gets its resolved type and in/out qualifier attached
+   (sexpr.type/sexpr.mod); sizes, alignments and field offsets are laid
+   out the way a C compiler would, alongside the 64-bit slot layout used by
+   the VM
+ - constant expressions, including references to constants, are folded
+   into number atoms in place, so array sizes and const initializers end
+   up as literals and no arithmetic on constants is left for later stages
+ - expressions and statements are type checked
+
+folding uses the same value semantics as the VM, so a folded expression
+always gives what running it would have given. errors are fatal, like
+parse errors
+*/
+
+union vm_value {
+	int64_t i;
+	double f;
+};
+
+// integer arithmetic wraps instead of being undefined on overflow
+#define VM_WRAP(a,op,b) ((int64_t)((uint64_t)(a) op (uint64_t)(b)))
+
+static inline int64_t vm_divi(int64_t a, int64_t b)
+{
+	if (b == 0) return 0;
+	if (b == -1) return VM_WRAP(0, -, a);
+	return a / b;
+}
+
+enum sem_kind {
+	SEM_VOID = 1,
+	SEM_INT, // all integer types and bool
+	SEM_FLOAT,
+	SEM_STRUCT,
+	SEM_ARRAY,
+};
+
+struct sem_field {
+	uint32_t sym;
+	int offset; // in bytes
+	int slot; // in VM slots
+	struct sem_type* type;
+};
+
+struct sem_type {
+	enum sem_kind kind;
+	enum token_type tt; // builtin scalar type, or 0
+	int size, align; // in bytes
+	int n_slots;
+	int n; // struct: number of fields; array: length
+	union {
+		struct sem_field* fields;
+		struct sem_type* elem;
+	};
+};
+
+#define SEM_SCALAR(t,k,sz) [t] = { .kind = k, .tt = t, .size = sz, .align = sz, .n_slots = 1 }
+static struct sem_type sem_scalars[T__TYPMAX] = {
+	SEM_SCALAR(T_BOOL, SEM_INT, 1),
+	SEM_SCALAR(T_INT, SEM_INT, 8),
+	SEM_SCALAR(T_UINT, SEM_INT, 8),
+	SEM_SCALAR(T_INT8, SEM_INT, 1),
+	SEM_SCALAR(T_UINT8, SEM_INT, 1),
+	SEM_SCALAR(T_INT32, SEM_INT, 4),
+	SEM_SCALAR(T_UINT32, SEM_INT, 4),
+	SEM_SCALAR(T_INT64, SEM_INT, 8),
+	SEM_SCALAR(T_UINT64, SEM_INT, 8),
+	SEM_SCALAR(T_FLOAT32, SEM_FLOAT, 4),
+	SEM_SCALAR(T_FLOAT64, SEM_FLOAT, 8),
+};
+#undef SEM_SCALAR
+
+static struct sem_type sem_void = { .kind = SEM_VOID, .align = 1 };
+
+static inline struct sem_type* sem_builtin(enum token_type tt)
+{
+	assert(tt_is_type(tt));
+	return &sem_scalars[tt];
+}
+
+static inline int sem_type_is_scalar(struct sem_type* t)
+{
+	return t->kind == SEM_INT || t->kind == SEM_FLOAT;
+}
+
+struct sem_func {
+	uint32_t sym;
+	int n_args, n_rets;
+	struct sem_type** arg_types;
+	struct sem_type** ret_types;
+};
+
+enum sem_binding_kind {
+	SEMB_VAR = 1,
+	SEMB_CONST,
+	SEMB_TYPE,
+	SEMB_FUNC,
+};
+
+struct sem_binding {
+	uint32_t sym;
+	enum sem_binding_kind kind;
+	struct sem_type* type;
+	union vm_value value; // when kind==SEMB_CONST
+	struct sem_func* func; // when kind==SEMB_FUNC
+};
+
+struct sem {
+	// owns types, signatures and the atoms of folded constants, so the
+	// checked tree must not outlive it
+	struct arena arena;
+
+	// scopes are stacked; lookups search from the top
+	struct dynary bindings_dy;
+	struct sem_binding* bindings;
+
+	// signatures in definition order
+	struct dynary funcs_dy;
+	struct sem_func** funcs;
+
+	struct sem_func* func; // being checked
+	int loop_depth;
+
+	// binary operations being checked; see sexpr_push_chain()
+	struct dynary chain_dy;
+	struct sexpr** chain;
+
+	int err;
+
+	// see struct parser
+	jmp_buf* on_err;
+	char err_msg[128];
+};
+
+static void sem_init(struct sem* s)
+{
+	memset(s, 0, sizeof(*s));
+	arena_init(&s->arena);
+	dynary_init(&s->bindings_dy, (void**) &s->bindings, sizeof(*s->bindings));
+	dynary_init(&s->funcs_dy, (void**) &s->funcs, sizeof(*s->funcs));
+	dynary_init(&s->chain_dy, (void**) &s->chain, sizeof(*s->chain));
+}
+
+static void sem_free(struct sem* s)
+{
+	free(s->bindings);
+	free(s->funcs);
+	free(s->chain);
+	arena_free(&s->arena);
+}
+
+static void sem_errf(struct sem* s, const char* fmt, ...)
+{
+	s->err = 1;
+
+	va_list args;
+	va_start(args, fmt);
+	if (s->on_err != NULL) {
+		vsnprintf(s->err_msg, sizeof(s->err_msg), fmt, args);
+		va_end(args);
+		longjmp(*s->on_err, 1);
+	}
+	fprintf(stderr, "SEMANTIC ERROR: ");
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+static inline int sexpr_is_tt(struct sexpr* e, enum token_type tt)
+{
+	return e != NULL && sexpr_is_atom(e) && e->atom.type == tt;
+}
+
+static int sexpr_list_len(struct sexpr* e)
+{
+	int n = 0;
+	for (struct sexpr* i = e->list; i != NULL; i = i->next) n++;
+	return n;
+}
+
+// arithmetic or a comparison on two operands
+static inline int sexpr_is_binary(struct sexpr* e)
+{
+	if (!sexpr_is_list(e) || e->list == NULL || !sexpr_is_atom(e->list)) return 0;
+	enum token_type tt = e->list->atom.type;
+	if (tt == T_ASSIGN || !is_binary_op(tt)) return 0;
+	struct sexpr* a = e->list->next;
+	return a != NULL && a->next != NULL && a->next->next == NULL;
+}
+
+/*
+long expressions are left-deep: x+x+...+x is (+ (+ (+ x x) x) x), nested
+as deep as it is long. so the checker and everything after it don't recurse
+on the left operands of binary operations; they push the chain of them onto
+a stack of their own (chain_dy), start at the bottom and work their way up
+in a loop. returns the operand at the bottom
+*/
+static struct sexpr* sexpr_push_chain(struct dynary* chain_dy, struct sexpr* e)
+{
+	while (sexpr_is_binary(e)) {
+		*(struct sexpr**)dynary_append(chain_dy) = e;
+		e = e->list->next;
+	}
+	return e;
+}
+
+static struct sem_binding* sem_lookup(struct sem* s, uint32_t sym)
+{
+	for (int i = s->bindings_dy.n - 1; i >= 0; i--) {
+		if (s->bindings[i].sym == sym) return &s->bindings[i];
+	}
+	return NULL;
+}
+
+static struct sem_binding* sem_bind(struct sem* s, struct sexpr* name, enum sem_binding_kind kind, struct sem_type* type)
+{
+	assert(sexpr_is_atom(name) && name->atom.type == T_IDENTIFIER);
+	struct sem_binding* b = dynary_append(&s->bindings_dy);
+	memset(b, 0, sizeof(*b));
+	b->sym = name->atom.sym;
+	b->kind = kind;
+	b->type = type;
+	return b;
+}
+
+// parses a number literal; untyped literals are int or float64
+static struct sem_type* sem_number(struct sem* s, struct token* t, union vm_value* v)
+{
+	char buf[64];
+	if (t->str.len >= sizeof(buf)) sem_errf(s, "number too long");
+	memcpy(buf, t->str.ptr, t->str.len);
+	buf[t->str.len] = 0;
+	int is_hex = t->str.len > 1 && buf[0] == '0' && (buf[1] == 'x' || buf[1] == 'X');
+	if (!is_hex && strpbrk(buf, ".eE") != NULL) {
+		v->f = strtod(buf, NULL);
+		return sem_builtin(T_FLOAT64);
+	} else {
+		v->i = strtoll(buf, NULL, 0);
+		return sem_builtin(T_INT);
+	}
+}
+
+// turns e into a number atom holding v. the text round-trips through
+// sem_number() exactly, and float constants always look like floats
+static void sem_fold(struct sem* s, struct sexpr* e, struct sem_type* t, union vm_value v)
+{
+	char buf[64];
+	int n;
+	if (t->kind == SEM_FLOAT) {
+		if (!isfinite(v.f)) sem_errf(s, "constant is not finite");
+		n = snprintf(buf, sizeof(buf), "%.17g", v.f);
+		if (strpbrk(buf, ".e") == NULL) n += snprintf(buf + n, sizeof(buf) - n, ".0");
+	} else {
+		n = snprintf(buf, sizeof(buf), "%lld", (long long)v.i);
+	}
+	char* text = arena_alloc(&s->arena, n);
+	memcpy(text, buf, n);
+
+	e->flags = SEXPR_TYPE_ATOM;
+	memset(&e->atom, 0, sizeof(e->atom));
+	e->atom.type = T_NUMBER;
+	e->atom.str.ptr = text;
+	e->atom.str.len = n;
+}
+
+static union vm_value sem_convert_value(union vm_value v, struct sem_type* from, struct sem_type* to)
+{
+	if (from->kind == SEM_INT && to->kind == SEM_FLOAT) v.f = v.i;
+	if (from->kind == SEM_FLOAT && to->kind == SEM_INT) v.i = v.f;
+	return v;
+}
+
+// type of arithmetic on a and b; mixed int/float operands are promoted to
+// float, and mixed sizes to the default int/float64
+static struct sem_type* sem_arith_type(struct sem_type* a, struct sem_type* b)
+{
+	if (a == b) return a;
+	if (a->kind == SEM_FLOAT && b->kind == SEM_FLOAT) return sem_builtin(T_FLOAT64);
+	if (a->kind == SEM_FLOAT) return a;
+	if (b->kind == SEM_FLOAT) return b;
+	return sem_builtin(T_INT);
+}
+
+// scalars convert implicitly; everything else must match exactly
+// arrays are the same if their elements are, anything else only if it's the
+// very same type
+static int sem_type_same(struct sem_type* a, struct sem_type* b)
+{
+	if (a == b) return 1;
+	return a->kind == SEM_ARRAY && b->kind == SEM_ARRAY && a->n == b->n && sem_type_same(a->elem, b->elem);
+}
+
+static void sem_check_assign(struct sem* s, struct sem_type* from, struct sem_type* to)
+{
+	if (sem_type_same(from, to) && from->kind != SEM_VOID) return;
+	if (sem_type_is_scalar(from) && sem_type_is_scalar(to)) return;
+	sem_errf(s, "type mismatch");
+}
+
+static struct sem_type* sem_type(struct sem* s, struct sexpr* e);
+static struct sem_type* sem_expr(struct sem* s, struct sexpr* e, union vm_value* v, int* is_const);
+
+// e is the list of (name type) members of a struct
+static struct sem_type* sem_struct_type(struct sem* s, struct sexpr* e)
+{
+	struct sem_type* t = arena_alloc(&s->arena, sizeof(*t));
+	memset(t, 0, sizeof(*t));
+	t->kind = SEM_STRUCT;
+	t->align = 1;
+	t->n = sexpr_list_len(e);
+	t->fields = arena_alloc(&s->arena, t->n * sizeof(*t->fields));
+	int64_t size = 0;
+	int i = 0;
+	for (struct sexpr* m = e->list; m != NULL; m = m->next, i++) {
+		struct sem_field* f = &t->fields[i];
+		f->sym = m->list->atom.sym;
+		for (int j = 0; j < i; j++) {
+			if (t->fields[j].sym == f->sym) {
+				sem_errf(s, "duplicate member '%.*s'", (int)m->list->atom.str.len, m->list->atom.str.ptr);
+			}
+		}
+		f->type = sem_type(s, m->list->next);
+		size = (size + f->type->align - 1) & ~(int64_t)(f->type->align - 1);
+		f->offset = size;
+		size += f->type->size;
+		f->slot = t->n_slots;
+		t->n_slots += f->type->n_slots;
+		if (f->type->align > t->align) t->align = f->type->align;
+		if (size > INT32_MAX) sem_errf(s, "struct too big");
+	}
+	t->size = (size + t->align - 1) & ~(int64_t)(t->align - 1);
+	return t;
+}
+
+/*
+resolves a type given the first element of its list (see parse_type_rec()).
+a qualifier ends the element list of an array early and the element type
+continues in the enclosing list, e.g. "[2]out [3]int" is ((2 out) (3 int)),
+so rest is where to continue if e runs out
+*/
+static struct sem_type* sem_type_contents(struct sem* s, struct sexpr* e, struct sexpr* rest, enum token_type* mod)
+{
+	for (;;) {
+		while (sexpr_is_tt(e, T_IN) || sexpr_is_tt(e, T_OUT)) {
+			if (*mod == 0) *mod = e->atom.type;
+			e = e->next;
+		}
+		if (e != NULL || rest == NULL) break;
+		e = rest;
+		rest = NULL;
+	}
+	if (e == NULL) {
+		sem_errf(s, "missing type");
+		return NULL;
+	}
+
+	if (sexpr_is_list(e)) {
+		struct sexpr* size = e->list;
+		if (size == NULL || size->next == NULL || sexpr_is_tt(size, T_STRUCT) || sexpr_is_tt(size, T_IN) || sexpr_is_tt(size, T_OUT)) {
+			sem_errf(s, "arrays must have a size");
+			return NULL;
+		}
+		union vm_value n;
+		int is_const;
+		struct sem_type* nt = sem_expr(s, size, &n, &is_const);
+		if (!is_const || nt->kind != SEM_INT || n.i < 1) {
+			sem_errf(s, "array size must be a positive integer constant");
+			return NULL;
+		}
+		struct sem_type* t = arena_alloc(&s->arena, sizeof(*t));
+		memset(t, 0, sizeof(*t));
+		t->kind = SEM_ARRAY;
+		t->elem = sem_type_contents(s, size->next, e->next != NULL ? e->next : rest, mod);
+		if (n.i > INT32_MAX / (t->elem->size > 0 ? t->elem->size : 1)) sem_errf(s, "array too big");
+		t->n = n.i;
+		t->size = t->n * t->elem->size;
+		t->align = t->elem->align;
+		t->n_slots = t->n * t->elem->n_slots;
+		return t;
+	}
+
+	enum token_type tt = e->atom.type;
+	if (tt_is_type(tt)) return sem_builtin(tt);
+	if (tt == T_STRUCT) return sem_struct_type(s, e->next);
+	if (tt == T_IDENTIFIER) {
+		struct sem_binding* b = sem_lookup(s, e->atom.sym);
+		if (b != NULL && b->kind == SEMB_TYPE) return b->type;
+	}
+	sem_errf(s, "unknown type '%.*s'", (int)e->atom.str.len, e->atom.str.ptr);
+	return NULL;
+}
+
+// resolves the type list e and annotates it
+static struct sem_type* sem_type(struct sem* s, struct sexpr* e)
+{
+	assert(sexpr_is_list(e));
+	if (e->type == NULL) {
+		enum token_type mod = 0;
+		e->type = sem_type_contents(s, e->list, NULL, &mod);
+		e->mod = mod;
+	}
+	return e->type;
+}
+
+static struct sem_field* sem_field(struct sem* s, struct sem_type* t, struct sexpr* name)
+{
+	if (t->kind != SEM_STRUCT) {
+		sem_errf(s, "member access on non-struct");
+		return NULL;
+	}
+	for (int i = 0; i < t->n; i++) {
+		if (t->fields[i].sym == name->atom.sym) return &t->fields[i];
+	}
+	sem_errf(s, "no member '%.*s'", (int)name->atom.str.len, name->atom.str.ptr);
+	return NULL;
+}
+
+static struct sem_type* sem_index(struct sem* s, struct sem_type* t, struct sexpr* index)
+{
+	if (t->kind != SEM_ARRAY) {
+		sem_errf(s, "indexing a non-array");
+		return NULL;
+	}
+	union vm_value v;
+	int is_const;
+	if (sem_expr(s, index, &v, &is_const)->kind != SEM_INT) sem_errf(s, "index must be an integer");
+	if (is_const && (v.i < 0 || v.i >= t->n)) sem_errf(s, "index %lld out of range", (long long)v.i);
+	return t->elem;
+}
+
+static struct sem_type* sem_value(struct sem* s, struct sexpr* e)
+{
+	union vm_value v;
+	int is_const;
+	return sem_expr(s, e, &v, &is_const);
+}
+
+static struct sem_type* sem_lvalue(struct sem* s, struct sexpr* e)
+{
+	if (sexpr_is_tt(e, T_IDENTIFIER)) {
+		struct sem_binding* b = sem_lookup(s, e->atom.sym);
+		if (b != NULL && b->kind == SEMB_VAR) return b->type;
+	} else if (sexpr_is_list(e) && sexpr_is_tt(e->list, T_DOT)) {
+		return sem_field(s, sem_lvalue(s, e->list->next), e->list->next->next)->type;
+	} else if (sexpr_is_list(e) && sexpr_is_tt(e->list, T_LBRACKET)) {
+		return sem_index(s, sem_lvalue(s, e->list->next), e->list->next->next);
+	}
+	sem_errf(s, "cannot assign to this");
+	return NULL;
+}
+
+static struct sem_type* sem_call(struct sem* s, struct sexpr* e)
+{
+	struct sexpr* head = e->list;
+	struct sem_binding* b = sem_lookup(s, head->atom.sym);
+	if (b == NULL || b->kind != SEMB_FUNC) {
+		sem_errf(s, "'%.*s' is not a function", (int)head->atom.str.len, head->atom.str.ptr);
+		return NULL;
+	}
+	struct sem_func* fn = b->func;
+	if (sexpr_list_len(e) - 1 != fn->n_args) {
+		sem_errf(s, "wrong number of arguments");
+		return NULL;
+	}
+	int i = 0;
+	for (struct sexpr* arg = head->next; arg != NULL; arg = arg->next, i++) {
+		sem_check_assign(s, sem_value(s, arg), fn->arg_types[i]);
+	}
+	return fn->n_rets > 0 ? fn->ret_types[0] : &sem_void;
+}
+
+// checks the binary operation e, and the chain of them down its left
+// operands, bottom up; like sem_expr()
+static struct sem_type* sem_binary(struct sem* s, struct sexpr* e, union vm_value* v, int* is_const)
+{
+	int base = s->chain_dy.n;
+	struct sexpr* bottom = sexpr_push_chain(&s->chain_dy, e);
+	union vm_value a;
+	int a_const;
+	struct sem_type* ta = sem_expr(s, bottom, &a, &a_const);
+	for (int i = s->chain_dy.n - 1; i >= base; i--) {
+		struct sexpr* x = s->chain[i];
+		enum token_type tt = x->list->atom.type;
+		union vm_value b;
+		int b_const;
+		struct sem_type* tb = sem_expr(s, x->list->next->next, &b, &b_const);
+		if (!sem_type_is_scalar(ta) || !sem_type_is_scalar(tb)) sem_errf(s, "expected numbers");
+		struct sem_type* t = sem_arith_type(ta, tb);
+		int is_float = t->kind == SEM_FLOAT;
+		if (a_const && b_const) {
+			a = sem_convert_value(a, ta, t);
+			b = sem_convert_value(b, tb, t);
+			switch (tt) {
+				case T_PLUS: if (is_float) a.f = a.f + b.f; else a.i = VM_WRAP(a.i, +, b.i); break;
+				case T_MINUS: if (is_float) a.f = a.f - b.f; else a.i = VM_WRAP(a.i, -, b.i); break;
+				case T_MUL: if (is_float) a.f = a.f * b.f; else a.i = VM_WRAP(a.i, *, b.i); break;
+				case T_DIV: if (is_float) a.f = a.f / b.f; else a.i = vm_divi(a.i, b.i); break;
+				case T_EQ: a.i = is_float ? a.f == b.f : a.i == b.i; break;
+				case T_NEQ: a.i = is_float ? a.f != b.f : a.i != b.i; break;
+				default:
+					sem_errf(s, "unsupported operator");
+					return NULL;
+			}
+		} else {
+			a_const = 0;
+		}
+		if (tt == T_EQ || tt == T_NEQ) t = sem_builtin(T_BOOL);
+		if (a_const) sem_fold(s, x, t, a);
+		ta = t;
+	}
+	s->chain_dy.n = base;
+	*v = a;
+	*is_const = a_const;
+	return ta;
+}
+
+// checks e and returns its type. if e is constant, *is_const is set, *v
+// gets its value and e is replaced by a number atom
+static struct sem_type* sem_expr(struct sem* s, struct sexpr* e, union vm_value* v, int* is_const)
+{
+	*is_const = 0;
+	if (sexpr_is_atom(e)) {
+		if (e->atom.type == T_NUMBER) {
+			*is_const = 1;
+			return sem_number(s, &e->atom, v);
+		}
+		if (e->atom.type != T_IDENTIFIER) {
+			sem_errf(s, "unexpected '%.*s'", (int)e->atom.str.len, e->atom.str.ptr);
+			return NULL;
+		}
+		struct sem_binding* b = sem_lookup(s, e->atom.sym);
+		if (b == NULL) {
+			sem_errf(s, "undeclared '%.*s'", (int)e->atom.str.len, e->atom.str.ptr);
+			return NULL;
+		}
+		if (b->kind == SEMB_CONST) {
+			*is_const = 1;
+			*v = b->value;
+			sem_fold(s, e, b->type, *v);
+			return b->type;
+		}
+		if (b->kind != SEMB_VAR) {
+			sem_errf(s, "'%.*s' is not a value", (int)e->atom.str.len, e->atom.str.ptr);
+			return NULL;
+		}
+		return b->type;
+	}
+
+	struct sexpr* head = e->list;
+	if (head == NULL || !sexpr_is_atom(head)) {
+		sem_errf(s, "not callable");
+		return NULL;
+	}
+	enum token_type tt = head->atom.type;
+	int n_args = sexpr_list_len(e) - 1;
+
+	if (tt == T_DOT) return sem_field(s, sem_value(s, head->next), head->next->next)->type;
+	if (tt == T_LBRACKET) return sem_index(s, sem_value(s, head->next), head->next->next);
+
+	if (tt == T_ASSIGN) {
+		struct sem_type* t = sem_lvalue(s, head->next);
+		sem_check_assign(s, sem_value(s, head->next->next), t);
+		return t;
+	}
+
+	if (tt == T_IDENTIFIER) return sem_call(s, e);
+
+	union vm_value a;
+	int a_const;
+	struct sem_type* t;
+	if (tt_is_type(tt)) {
+		if (n_args != 1) {
+			sem_errf(s, "conversions take one argument");
+			return NULL;
+		}
+		struct sem_type* from = sem_expr(s, head->next, &a, &a_const);
+		if (!sem_type_is_scalar(from)) sem_errf(s, "cannot convert to '%.*s'", (int)head->atom.str.len, head->atom.str.ptr);
+		t = sem_builtin(tt);
+		if (!a_const) return t;
+		*v = sem_convert_value(a, from, t);
+	} else if (n_args == 1 && is_unary_op(tt)) {
+		t = sem_expr(s, head->next, &a, &a_const);
+		if (!sem_type_is_scalar(t)) sem_errf(s, "expected a number");
+		if (!a_const) return t;
+		*v = a;
+		if (tt == T_MINUS) {
+			if (t->kind == SEM_FLOAT) v->f = -a.f; else v->i = VM_WRAP(0, -, a.i);
+		}
+	} else if (n_args == 2 && is_binary_op(tt)) {
+		return sem_binary(s, e, v, is_const);
+	} else {
+		sem_errf(s, "unexpected '%.*s'", (int)head->atom.str.len, head->atom.str.ptr);
+		return NULL;
+	}
+
+	*is_const = 1;
+	sem_fold(s, e, t, *v);
+	return t;
+}
+
+static void sem_def(struct sem* s, struct sexpr* def)
+{
+	enum token_type tt = def->list->atom.type;
+	struct sexpr* name = def->list->next;
+	struct sexpr* type = name->next;
+	struct sexpr* init = type->next;
+
+	if (tt == T_TYPE) {
+		sem_bind(s, name, SEMB_TYPE, sem_type(s, type));
+		return;
+	}
+
+	struct sem_type* t = type->list != NULL ? sem_type(s, type) : NULL;
+	if (t == NULL && init == NULL) {
+		sem_errf(s, "missing type");
+		return;
+	}
+
+	union vm_value v;
+	int is_const = 0;
+	struct sem_type* it = NULL;
+	if (init != NULL) {
+		it = sem_expr(s, init, &v, &is_const);
+		if (it->kind == SEM_VOID) sem_errf(s, "initializer has no value");
+		if (t == NULL) t = it;
+		sem_check_assign(s, it, t);
+	}
+
+	if (tt == T_CONST) {
+		if (!is_const) {
+			sem_errf(s, "const needs a constant initializer");
+			return;
+		}
+		if (it->kind != t->kind) {
+			v = sem_convert_value(v, it, t);
+			sem_fold(s, init, t, v);
+		}
+		sem_bind(s, name, SEMB_CONST, t)->value = v;
+		return;
+	}
+
+	assert(tt == T_VAR);
+	sem_bind(s, name, SEMB_VAR, t);
+}
+
+static void sem_block(struct sem* s, struct sexpr* block);
+
+static void sem_cond(struct sem* s, struct sexpr* e)
+{
+	if (sem_value(s, e)->kind != SEM_INT) sem_errf(s, "condition must be an integer");
+}
+
+static void sem_return(struct sem* s, struct sexpr* stmt)
+{
+	struct sem_func* fn = s->func;
+	if (sexpr_list_len(stmt) - 1 != fn->n_rets) {
+		sem_errf(s, "wrong number of return values");
+		return;
+	}
+	int i = 0;
+	for (struct sexpr* value = stmt->list->next; value != NULL; value = value->next, i++) {
+		sem_check_assign(s, sem_value(s, value), fn->ret_types[i]);
+	}
+}
+
+static void sem_for(struct sem* s, struct sexpr* stmt)
+{
+	struct sexpr* init = NULL;
+	struct sexpr* cond = NULL;
+	struct sexpr* post = NULL;
+	struct sexpr* body = stmt->list->next;
+	switch (sexpr_list_len(stmt)) {
+		case 2: break;
+		case 3: cond = body; body = body->next; break;
+		case 5: init = body; cond = init->next; post = cond->next; body = post->next; break;
+		default: assert(0);
+	}
+	if (init != NULL) sem_value(s, init);
+	if (cond != NULL) sem_cond(s, cond);
+	s->loop_depth++;
+	sem_block(s, body);
+	s->loop_depth--;
+	if (post != NULL) sem_value(s, post);
+}
+
+static void sem_stmt(struct sem* s, struct sexpr* stmt)
+{
+	struct sexpr* head = sexpr_is_list(stmt) ? stmt->list : NULL;
+	enum token_type tt = head != NULL && sexpr_is_atom(head) ? head->atom.type : 0;
+	switch (tt) {
+		case T_VAR:
+		case T_CONST:
+		case T_TYPE:
+			sem_def(s, stmt);
+			break;
+		case T_FUNC:
+			sem_errf(s, "nested functions are not supported");
+			break;
+		case T_RETURN:
+			sem_return(s, stmt);
+			break;
+		case T_IF:
+			sem_cond(s, head->next);
+			sem_block(s, head->next->next);
+			if (head->next->next->next != NULL) sem_block(s, head->next->next->next);
+			break;
+		case T_FOR:
+			sem_for(s, stmt);
+			break;
+		case T_BREAK:
+		case T_CONTINUE:
+			if (s->loop_depth == 0) sem_errf(s, "break/continue outside loop");
+			break;
+		case T_FALLTHROUGH:
+			sem_errf(s, "fallthrough is not supported");
+			break;
+		default:
+			sem_value(s, stmt);
+			break;
+	}
+}
+
+static void sem_block(struct sem* s, struct sexpr* block)
+{
+	int n_bindings = s->bindings_dy.n;
+	for (struct sexpr* stmt = block->list; stmt != NULL; stmt = stmt->next) {
+		sem_stmt(s, stmt);
+	}
+	s->bindings_dy.n = n_bindings;
+}
+
+static void sem_func_signature(struct sem* s, struct sexpr* def)
+{
+	struct sexpr* name = def->list->next;
+	struct sexpr* args = name->next;
+	struct sexpr* rets = args->next;
+
+	struct sem_func* fn = arena_alloc(&s->arena, sizeof(*fn));
+	memset(fn, 0, sizeof(*fn));
+	fn->sym = name->atom.sym;
+
+	fn->n_args = sexpr_list_len(args);
+	fn->arg_types = arena_alloc(&s->arena, fn->n_args * sizeof(*fn->arg_types));
+	int i = 0;
+	for (struct sexpr* a = args->list; a != NULL; a = a->next, i++) {
+		fn->arg_types[i] = sem_type(s, a->list->next);
+	}
+
+	fn->n_rets = sexpr_list_len(rets);
+	fn->ret_types = arena_alloc(&s->arena, fn->n_rets * sizeof(*fn->ret_types));
+	i = 0;
+	for (struct sexpr* r = rets->list; r != NULL; r = r->next, i++) {
+		fn->ret_types[i] = sem_type(s, r);
+	}
+
+	struct sem_func** p = dynary_append(&s->funcs_dy);
+	*p = fn;
+	sem_bind(s, name, SEMB_FUNC, NULL)->func = fn;
+}
+
+static void sem_func_body(struct sem* s, struct sem_func* fn, struct sexpr* def)
+{
+	struct sexpr* args = def->list->next->next;
+	struct sexpr* body = args->next->next;
+	int n_bindings = s->bindings_dy.n;
+	int i = 0;
+	for (struct sexpr* a = args->list; a != NULL; a = a->next, i++) {
+		sem_bind(s, a->list, SEMB_VAR, fn->arg_types[i]);
+	}
+	s->func = fn;
+	s->loop_depth = 0;
+	sem_block(s, body);
+	s->func = NULL;
+	s->bindings_dy.n = n_bindings;
+}
+
+// the checker and everything after it walk trees recursively, except down
+// chains of binary operations (see sexpr_push_chain()), while parse_expr()
+// takes expressions of any depth; trees nesting deeper than this otherwise,
+// e.g. -(-(...)) or f(f(...)), are refused up front rather than
+// overflowing the C stack
+#define SEM_MAX_DEPTH (2048)
+
+static void sem_check_depth(struct sem* s, struct sexpr* defs)
+{
+	struct level {
+		struct sexpr* next; // node to visit
+		int depth; // of the lists at this level
+	};
+	struct level* stack;
+	struct dynary stack_dy;
+	dynary_init(&stack_dy, (void**) &stack, sizeof(*stack));
+	*(struct level*)dynary_append(&stack_dy) = (struct level){ defs, 0 };
+	while (stack_dy.n > 0) {
+		struct level* top = &stack[stack_dy.n - 1];
+		struct sexpr* e = top->next;
+		if (e == NULL) {
+			stack_dy.n--;
+			continue;
+		}
+		top->next = e->next;
+		int depth = top->depth;
+		for (;;) {
+			if (!sexpr_is_list(e) || e->list == NULL) break;
+			if (depth == SEM_MAX_DEPTH) {
+				free(stack);
+				sem_errf(s, "nested more than %d levels deep", SEM_MAX_DEPTH);
+			}
+			if (!sexpr_is_binary(e)) {
+				*(struct level*)dynary_append(&stack_dy) = (struct level){ e->list, depth + 1 };
+				break;
+			}
+			// the left operand stays at this depth
+			*(struct level*)dynary_append(&stack_dy) = (struct level){ e->list->next->next, depth + 1 };
+			e = e->list->next;
+		}
+	}
+	free(stack);
+}
+
+// checks, annotates and folds a program as returned by parse_rec(p, 0, 0) in
+// place. functions may call each other regardless of order, everything else
+// must be defined before it's used
+static int sem_check(struct sem* s, struct sexpr* defs)
+{
+	sem_check_depth(s, defs);
+
+	// types, constants and function signatures
+	for (struct sexpr* def = defs->list; def != NULL; def = def->next) {
+		switch (def->list->atom.type) {
+			case T_TYPE:
+			case T_CONST:
+				sem_def(s, def);
+				break;
+			case T_FUNC:
+				sem_func_signature(s, def);
+				break;
+			case T_VAR:
+				break;
+			default:
+				assert(0);
+		}
+	}
+
+	// globals
+	for (struct sexpr* def = defs->list; def != NULL; def = def->next) {
+		if (def->list->atom.type == T_VAR) sem_def(s, def);
+	}
+
+	// function bodies
+	int fi = 0;
+	for (struct sexpr* def = defs->list; def != NULL; def = def->next) {
+		if (def->list->atom.type == T_FUNC) sem_func_body(s, s->funcs[fi++], def);
+	}
+
+	return s->err ? -1 : 0;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// BYTECODE
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+register based bytecode for programs as returned by parse_rec(p, 0, 0).
+
+instructions are 32 bits; the low 8 bits are the opcode, followed by the
+8-bit operands A, B and C, or by A and a 16-bit operand Bx (sBx when
+signed) in place of B and C. registers are relative to the frame base, and
+a call just moves the base up to where the caller put the arguments, so
+the callee finds its arguments in R[0..] and leaves its return values in
+R[0..] too, i.e. where the caller put the arguments.
+
+every value occupies one or more consecutive 64-bit slots; scalars take
+one, structs and fixed size arrays are flattened. all integer types are
+evaluated as int64_t (wrapping, and division by zero gives zero) and all
+float types as double for now
+
+array elements at a non-constant index are reached through GETX/SETX
+(registers) or GETGX/SETGX (globals) after a CHECK of the index. the vector
+ops run one operation over n consecutive slots; loops the compiler could
+prove safe to vectorize (see vmc_vectorize()) become a handful of them.
+some instructions take more operands than fit in 32 bits, so they're
+followed by an OP_ARG word:
+  GETX, SETX:  A..A+Bx are the registers the index may reach
+  SETGX:       A is the value
+  vector ops:  Bx is n, A is VM_ARG_* flags
+*/
+
+#define VM_OPS(X) \
+	X(OP_MOV)   /* R[A] = R[B] */ \
+	X(OP_LOADI) /* R[A].i = sBx */ \
+	X(OP_LOADK) /* R[A] = K[Bx] */ \
+	X(OP_GETG)  /* R[A] = G[Bx] */ \
+	X(OP_SETG)  /* G[Bx] = R[A] */ \
+	X(OP_ADDI)  /* R[A].i = R[B].i + R[C].i */ \
+	X(OP_SUBI) \
+	X(OP_MULI) \
+	X(OP_DIVI) \
+	X(OP_NEGI)  /* R[A].i = -R[B].i */ \
+	X(OP_EQI)   /* R[A].i = R[B].i == R[C].i */ \
+	X(OP_NEI) \
+	X(OP_ADDF)  /* R[A].f = R[B].f + R[C].f */ \
+	X(OP_SUBF) \
+	X(OP_MULF) \
+	X(OP_DIVF) \
+	X(OP_NEGF) \
+	X(OP_EQF)   /* R[A].i = R[B].f == R[C].f */ \
+	X(OP_NEF) \
+	X(OP_ITOF)  /* R[A].f = R[B].i */ \
+	X(OP_FTOI)  /* R[A].i = R[B].f */ \
+	X(OP_CHECK) /* fail with VM_ERR_INDEX unless 0 <= R[A].i < Bx */ \
+	X(OP_GETX)  /* R[A] = R[B+R[C].i] */ \
+	X(OP_SETX)  /* R[A+R[B].i] = R[C] */ \
+	X(OP_GETGX) /* R[A] = G[Bx+R[A].i] */ \
+	X(OP_SETGX) /* G[Bx+R[A].i] = R[arg A] */ \
+	X(OP_VMOV)  /* R[A..A+n) = R[B..B+n) */ \
+	X(OP_VADDI) /* R[A..A+n).i = R[B..B+n).i + R[C..C+n).i */ \
+	X(OP_VSUBI) \
+	X(OP_VADDF) /* R[A..A+n).f = R[B..B+n).f + R[C..C+n).f */ \
+	X(OP_VSUBF) \
+	X(OP_VMULF) \
+	X(OP_VDIVF) \
+	X(OP_VGETG) /* R[A..A+n) = G[Bx..Bx+n) */ \
+	X(OP_VSETG) /* G[Bx..Bx+n) = R[A..A+n) */ \
+	X(OP_ARG)   /* operands of the instruction before; never executed */ \
+	X(OP_JMP)   /* pc += sBx */ \
+	X(OP_JZ)    /* if (R[A].i == 0) pc += sBx */ \
+	X(OP_JNZ)   /* if (R[A].i != 0) pc += sBx */ \
+	X(OP_CALL)  /* call function Bx with its frame at R[A] */ \
+	X(OP_RET)   /* R[0..B) = R[A..A+B); return */
+
+enum vm_op {
+	#define X(op) op,
+	VM_OPS(X)
+	#undef X
+	VM_N_OPS
+};
+
+#define INS_ABC(op,a,b,c) ((uint32_t)(op) | ((uint32_t)(a) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 24))
+#define INS_ABX(op,a,bx) ((uint32_t)(op) | ((uint32_t)(a) << 8) | ((uint32_t)(bx) << 16))
+#define INS_ASBX(op,a,sbx) INS_ABX(op, a, (uint16_t)(int16_t)(sbx))
+#define INS_OP(i) ((i) & 0xff)
+#define INS_A(i) (((i) >> 8) & 0xff)
+#define INS_B(i) (((i) >> 16) & 0xff)
+#define INS_C(i) ((i) >> 24)
+#define INS_BX(i) ((i) >> 16)
+#define INS_SBX(i) ((int32_t)(i) >> 16)
+
+// OP_ARG flags of vector ops
+enum {
+	VM_ARG_SB = 1, // B is a single slot used for every element
+	VM_ARG_SC = 2, // same for C
+};
+
+#define VM_MAX_FRAME_REGS (256)
+#define VM_MAX_REGS (1<<16)
+#define VM_MAX_FRAMES (1<<12)
+
+struct vm_func {
+	uint32_t sym;
+	uint32_t* code;
+	int n_code;
+	int n_regs; // frame size
+	int n_args, n_rets;
+	struct sem_type** arg_types;
+	struct sem_type** ret_types;
+	int n_arg_slots, n_ret_slots;
+};
+
+// what the vectorizer made of a for loop; see vm_print_vec_reports()
+struct vm_vec_report {
+	uint32_t func; // symbol
+	int loop; // numbers the loops of a function from 1, in source order
+	int n_loops; // perfectly nested loops collapsed into one
+	int n_stmts;
+	int n; // elements each statement runs over
+	int is_float;
+	const char* reason; // why it wasn't vectorized, or NULL
+};
+
+// what the SSA passes did to a function; see vm_print_ssa_reports()
+struct vm_ssa_report {
+	uint32_t func; // symbol
+	const char* pass; // NULL if the function wasn't compiled through SSA
+	int before, after; // instructions
+	int n_changed; // instructions folded, forwarded, merged, hoisted or removed
+	const char* reason; // why not, when pass is NULL
+};
+
+struct vm_prog {
+	struct dynary funcs_dy;
+	struct vm_func* funcs;
+
+	struct dynary consts_dy;
+	union vm_value* consts;
+
+	int n_global_slots;
+	int init_func; // runs the global initializers, or -1
+
+	// one per for loop compiled, unless vectorization was disabled
+	struct dynary vec_reports_dy;
+	struct vm_vec_report* vec_reports;
+
+	// per function and pass, unless SSA was disabled
+	struct dynary ssa_reports_dy;
+	struct vm_ssa_report* ssa_reports;
+
+	// owns types and signatures
+	struct sem sem;
+
+	char err_msg[128]; // why vm_compile() failed
+};
+
+static void vm_prog_init(struct vm_prog* prog)
+{
+	memset(prog, 0, sizeof(*prog));
+	dynary_init(&prog->funcs_dy, (void**) &prog->funcs, sizeof(*prog->funcs));
+	dynary_init(&prog->consts_dy, (void**) &prog->consts, sizeof(*prog->consts));
+	dynary_init(&prog->vec_reports_dy, (void**) &prog->vec_reports, sizeof(*prog->vec_reports));
+	dynary_init(&prog->ssa_reports_dy, (void**) &prog->ssa_reports, sizeof(*prog->ssa_reports));
+	sem_init(&prog->sem);
+	prog->init_func = -1;
+}
+
+static void vm_prog_free(struct vm_prog* prog)
+{
+	for (int i = 0; i < prog->funcs_dy.n; i++) free(prog->funcs[i].code);
+	free(prog->funcs);
+	free(prog->consts);
+	free(prog->vec_reports);
+	free(prog->ssa_reports);
+	sem_free(&prog->sem);
+}
+
+// returns the index of the function called name, or -1
+static int vm_prog_find_func(struct vm_prog* prog, const char* name)
+{
+	uint32_t sym = symtab_intern(&symtab, name, strlen(name));
+	for (int i = 0; i < prog->funcs_dy.n; i++) {
+		if (prog->funcs[i].sym == sym) return i;
+	}
+	return -1;
+}
+
+
+// compiler
+
+enum vm_binding_kind {
+	VMB_LOCAL = 1, // index is a register
+	VMB_GLOBAL, // index is a global slot
+	VMB_CONST, // a literal; only used by struct vm_loc
+	VMB_FUNC, // index is a function
+};
+
+struct vm_binding {
+	uint32_t sym;
+	enum vm_binding_kind kind;
+	int index;
+	struct sem_type* type;
+};
+
+// where a value lives; identifiers, and members and elements of them, can
+// be resolved to one. only indexing by a non-constant needs code (see
+// vmc_index())
+struct vm_loc {
+	enum vm_binding_kind kind; // VMB_LOCAL, VMB_GLOBAL or VMB_CONST
+	int index;
+	struct sem_type* type;
+	union vm_value value; // when kind==VMB_CONST
+	int dyn; // register with a slot offset added at run time, -1 if none, or VM_LOC_PENDING
+	int root, root_n; // VMB_LOCAL with dyn: the registers dyn may reach
+};
+
+#define VM_LOC_PENDING (-2)
+
+// break/continue jump waiting for its loop to be finished
+struct vm_patch {
+	int pc;
+	int loop;
+	int is_break;
+};
+
+struct vm_compiler {
+	struct vm_prog* prog;
+
+	// scopes are stacked; lookups search from the top
+	struct dynary bindings_dy;
+	struct vm_binding* bindings;
+
+	// function being compiled
+	struct dynary code_dy;
+	uint32_t* code;
+	int func;
+	int reg_top, max_regs;
+
+	struct dynary patches_dy;
+	struct vm_patch* patches;
+	int loop_depth;
+	int n_loops;
+
+	// binary operations being compiled; see sexpr_push_chain()
+	struct dynary chain_dy;
+	struct sexpr** chain;
+
+	int flags; // VMC_*
+	int err;
+
+	// see struct parser
+	jmp_buf* on_err;
+	char err_msg[128];
+};
+
+// vm_compile() flags
+enum {
+	VMC_NO_VECTORIZE = 1,
+	VMC_NO_SSA = 2, // compile functions from the tree only
+};
+
+static void vmc_errf(struct vm_compiler* c, const char* fmt, ...)
+{
+	c->err = 1;
+
+	va_list args;
+	va_start(args, fmt);
+	if (c->on_err != NULL) {
+		vsnprintf(c->err_msg, sizeof(c->err_msg), fmt, args);
+		va_end(args);
+		longjmp(*c->on_err, 1);
+	}
+	fprintf(stderr, "COMPILE ERROR: ");
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+static inline int vmc_emit(struct vm_compiler* c, uint32_t ins)
+{
+	uint32_t* p = dynary_append(&c->code_dy);
+	*p = ins;
+	return c->code_dy.n - 1;
+}
+
+static inline int vmc_here(struct vm_compiler* c)
+{
+	return c->code_dy.n;
+}
+
+static void vmc_patch(struct vm_compiler* c, int pc, int target)
+{
+	int offset = target - (pc + 1);
+	if (offset < INT16_MIN || offset > INT16_MAX) vmc_errf(c, "jump too far");
+	uint32_t ins = c->code[pc];
+	c->code[pc] = INS_ASBX(INS_OP(ins), INS_A(ins), offset);
+}
+
+static void vmc_set_reg_top(struct vm_compiler* c, int top)
+{
+	if (top > VM_MAX_FRAME_REGS) vmc_errf(c, "function needs too many registers");
+	c->reg_top = top;
+	if (top > c->max_regs) c->max_regs = top;
+}
+
+static int vmc_reg_alloc(struct vm_compiler* c, int n)
+{
+	int r = c->reg_top;
+	vmc_set_reg_top(c, r + n);
+	return r;
+}
+
+static struct vm_binding* vmc_lookup(struct vm_compiler* c, uint32_t sym)
+{
+	for (int i = c->bindings_dy.n - 1; i >= 0; i--) {
+		if (c->bindings[i].sym == sym) return &c->bindings[i];
+	}
+	return NULL;
+}
+
+static struct vm_binding* vmc_bind(struct vm_compiler* c, struct sexpr* name, enum vm_binding_kind kind, int index, struct sem_type* type)
+{
+	assert(sexpr_is_atom(name) && name->atom.type == T_IDENTIFIER);
+	struct vm_binding* b = dynary_append(&c->bindings_dy);
+	memset(b, 0, sizeof(*b));
+	b->sym = name->atom.sym;
+	b->kind = kind;
+	b->index = index;
+	b->type = type;
+	return b;
+}
+
+static enum vm_op vmc_binop(struct vm_compiler* c, enum token_type tt, int is_float)
+{
+	switch (tt) {
+		case T_PLUS: return is_float ? OP_ADDF : OP_ADDI;
+		case T_MINUS: return is_float ? OP_SUBF : OP_SUBI;
+		case T_MUL: return is_float ? OP_MULF : OP_MULI;
+		case T_DIV: return is_float ? OP_DIVF : OP_DIVI;
+		case T_EQ: return is_float ? OP_EQF : OP_EQI;
+		case T_NEQ: return is_float ? OP_NEF : OP_NEI;
+		default:
+			vmc_errf(c, "unsupported operator");
+			return 0;
+	}
+}
+
+static struct sem_field* vmc_field(struct vm_compiler* c, struct sem_type* t, struct sexpr* name)
+{
+	return sem_field(&c->prog->sem, t, name);
+}
+
+static void vmc_index(struct vm_compiler* c, struct vm_loc* loc, struct sexpr* idx, int emit);
+
+// resolves e to a location if it's a literal or a variable, or a member or
+// element of one; returns 0 otherwise. code for non-constant indices is only
+// emitted if emit is set, otherwise dyn is left at VM_LOC_PENDING
+static int vmc_loc(struct vm_compiler* c, struct sexpr* e, struct vm_loc* loc, int emit)
+{
+	memset(loc, 0, sizeof(*loc));
+	loc->dyn = -1;
+	if (sexpr_is_atom(e)) {
+		if (e->atom.type == T_NUMBER) {
+			loc->kind = VMB_CONST;
+			loc->type = sem_number(&c->prog->sem, &e->atom, &loc->value);
+			return 1;
+		}
+		if (e->atom.type != T_IDENTIFIER) return 0;
+		struct vm_binding* b = vmc_lookup(c, e->atom.sym);
+		if (b == NULL) {
+			vmc_errf(c, "undeclared '%.*s'", (int)e->atom.str.len, e->atom.str.ptr);
+			return 0;
+		}
+		if (b->kind != VMB_LOCAL && b->kind != VMB_GLOBAL) {
+			vmc_errf(c, "'%.*s' is not a value", (int)e->atom.str.len, e->atom.str.ptr);
+			return 0;
+		}
+		loc->kind = b->kind;
+		loc->index = b->index;
+		loc->type = b->type;
+		return 1;
+	}
+
+	struct sexpr* head = e->list;
+	if (sexpr_is_tt(head, T_DOT)) {
+		if (!vmc_loc(c, head->next, loc, emit)) return 0;
+		struct sem_field* f = vmc_field(c, loc->type, head->next->next);
+		loc->index += f->slot;
+		loc->type = f->type;
+		return 1;
+	}
+	if (sexpr_is_tt(head, T_LBRACKET)) {
+		if (!vmc_loc(c, head->next, loc, emit)) return 0;
+		vmc_index(c, loc, head->next->next, emit);
+		return 1;
+	}
+	return 0;
+}
+
+static void vmc_loadk(struct vm_compiler* c, int dst, union vm_value v, struct sem_type* t)
+{
+	if (t->kind == SEM_INT && v.i >= INT16_MIN && v.i <= INT16_MAX) {
+		vmc_emit(c, INS_ASBX(OP_LOADI, dst, v.i));
+		return;
+	}
+	if (c->prog->consts_dy.n > UINT16_MAX) vmc_errf(c, "too many constants");
+	union vm_value* k = dynary_append(&c->prog->consts_dy);
+	*k = v;
+	vmc_emit(c, INS_ABX(OP_LOADK, dst, c->prog->consts_dy.n - 1));
+}
+
+static void vmc_move(struct vm_compiler* c, int dst, int src, int n)
+{
+	if (dst == src) return;
+	if (dst < src) {
+		for (int i = 0; i < n; i++) vmc_emit(c, INS_ABC(OP_MOV, dst+i, src+i, 0));
+	} else {
+		for (int i = n-1; i >= 0; i--) vmc_emit(c, INS_ABC(OP_MOV, dst+i, src+i, 0));
+	}
+}
+
+// c->reg_top must be at or past dst+n_slots if loc->dyn is set
+static void vmc_load(struct vm_compiler* c, struct vm_loc* loc, int dst)
+{
+	int n = loc->type->n_slots;
+	if (loc->dyn >= dst && loc->dyn < dst + n && n > 1) {
+		// would be overwritten before the last slot is loaded
+		int r = vmc_reg_alloc(c, 1);
+		vmc_move(c, r, loc->dyn, 1);
+		loc->dyn = r;
+	}
+	switch (loc->kind) {
+		case VMB_LOCAL:
+			if (loc->dyn == -1) {
+				vmc_move(c, dst, loc->index, n);
+				break;
+			}
+			for (int i = 0; i < n; i++) {
+				vmc_emit(c, INS_ABC(OP_GETX, dst+i, loc->index+i, loc->dyn));
+				vmc_emit(c, INS_ABX(OP_ARG, loc->root, loc->root_n));
+			}
+			break;
+		case VMB_GLOBAL:
+			for (int i = 0; i < n; i++) {
+				if (loc->dyn == -1) {
+					vmc_emit(c, INS_ABX(OP_GETG, dst+i, loc->index+i));
+				} else {
+					vmc_move(c, dst+i, loc->dyn, 1);
+					vmc_emit(c, INS_ABX(OP_GETGX, dst+i, loc->index+i));
+				}
+			}
+			break;
+		case VMB_CONST:
+			vmc_loadk(c, dst, loc->value, loc->type);
+			break;
+		default:
+			assert(0);
+	}
+}
+
+// emits code converting the value of type from in src to type to in dst
+static void vmc_convert(struct vm_compiler* c, int dst, int src, struct sem_type* from, struct sem_type* to)
+{
+	if (from->kind == to->kind) {
+		vmc_move(c, dst, src, to->n_slots);
+	} else if (from->kind == SEM_INT && to->kind == SEM_FLOAT) {
+		vmc_emit(c, INS_ABC(OP_ITOF, dst, src, 0));
+	} else if (from->kind == SEM_FLOAT && to->kind == SEM_INT) {
+		vmc_emit(c, INS_ABC(OP_FTOI, dst, src, 0));
+	} else {
+		vmc_errf(c, "type mismatch");
+	}
+}
+
+static struct sem_type* vmc_expr_into(struct vm_compiler* c, struct sexpr* e, int dst);
+
+// like vmc_expr_into(), except that variables aren't copied; *reg is set to
+// the first register holding the value, and c->reg_top is moved past it if
+// it's a temporary
+static struct sem_type* vmc_expr(struct vm_compiler* c, struct sexpr* e, int* reg)
+{
+	struct vm_loc loc;
+	if (vmc_loc(c, e, &loc, 0) && loc.kind == VMB_LOCAL && loc.dyn == -1) {
+		*reg = loc.index;
+		return loc.type;
+	}
+	*reg = c->reg_top;
+	struct sem_type* t = vmc_expr_into(c, e, *reg);
+	vmc_set_reg_top(c, *reg + t->n_slots);
+	return t;
+}
+
+// applies the index idx to loc, which must be an array
+static void vmc_index(struct vm_compiler* c, struct vm_loc* loc, struct sexpr* idx, int emit)
+{
+	struct sem_type* t = loc->type;
+	struct sem_type* elem = t->elem;
+	assert(t->kind == SEM_ARRAY);
+	loc->type = elem;
+	if (sexpr_is_atom(idx) && idx->atom.type == T_NUMBER) {
+		// range checked by the semantic pass
+		union vm_value v;
+		sem_number(&c->prog->sem, &idx->atom, &v);
+		loc->index += v.i * elem->n_slots;
+		return;
+	}
+	if (!emit) {
+		loc->dyn = VM_LOC_PENDING;
+		return;
+	}
+
+	if (loc->dyn == -1) {
+		loc->root = loc->index;
+		loc->root_n = t->n_slots;
+	}
+	int r;
+	vmc_expr(c, idx, &r);
+	vmc_emit(c, INS_ABX(OP_CHECK, r, t->n));
+	if (elem->n_slots != 1) {
+		int k = vmc_reg_alloc(c, 1);
+		vmc_loadk(c, k, (union vm_value){ .i = elem->n_slots }, sem_builtin(T_INT));
+		vmc_emit(c, INS_ABC(OP_MULI, k, r, k));
+		r = k;
+	}
+	if (loc->dyn >= 0) {
+		int sum = vmc_reg_alloc(c, 1);
+		vmc_emit(c, INS_ABC(OP_ADDI, sum, loc->dyn, r));
+		r = sum;
+	}
+	loc->dyn = r;
+}
+
+static int vmc_has_assign(struct sexpr* e)
+{
+	// the first operand is followed in the loop, so chains don't recurse
+	for (; sexpr_is_list(e) && e->list != NULL; e = e->list->next) {
+		if (sexpr_is_tt(e->list, T_ASSIGN)) return 1;
+		if (vmc_has_assign(e->list)) return 1;
+		if (e->list->next == NULL) break;
+		for (struct sexpr* i = e->list->next->next; i != NULL; i = i->next) {
+			if (vmc_has_assign(i)) return 1;
+		}
+	}
+	return 0;
+}
+
+// compiles an assignment; *reg is set to the first register the assigned
+// value can be read from right after
+static struct sem_type* vmc_assign(struct vm_compiler* c, struct sexpr* e, int* reg)
+{
+	struct sexpr* lhs = e->list->next;
+	struct sexpr* rhs = lhs->next;
+	int top = c->reg_top;
+	struct vm_loc loc;
+	if (!vmc_loc(c, lhs, &loc, 1) || loc.kind == VMB_CONST) {
+		vmc_errf(c, "cannot assign to this");
+		return NULL;
+	}
+	if (loc.kind == VMB_LOCAL && loc.dyn == -1) {
+		struct sem_type* t = vmc_expr_into(c, rhs, loc.index);
+		vmc_convert(c, loc.index, loc.index, t, loc.type);
+		*reg = loc.index;
+		return loc.type;
+	}
+
+	if (loc.dyn >= 0 && loc.dyn < top && vmc_has_assign(rhs)) {
+		// the index is a variable the right hand side may change
+		int r = vmc_reg_alloc(c, 1);
+		vmc_move(c, r, loc.dyn, 1);
+		loc.dyn = r;
+	}
+	int r;
+	struct sem_type* t = vmc_expr(c, rhs, &r);
+	if (t->kind != loc.type->kind) {
+		int tmp = vmc_reg_alloc(c, 1);
+		vmc_convert(c, tmp, r, t, loc.type);
+		r = tmp;
+	}
+	for (int i = 0; i < loc.type->n_slots; i++) {
+		if (loc.kind == VMB_LOCAL) {
+			vmc_emit(c, INS_ABC(OP_SETX, loc.index+i, loc.dyn, r+i));
+			vmc_emit(c, INS_ABX(OP_ARG, loc.root, loc.root_n));
+		} else if (loc.dyn >= 0) {
+			vmc_emit(c, INS_ABX(OP_SETGX, loc.dyn, loc.index+i));
+			vmc_emit(c, INS_ABX(OP_ARG, r+i, 0));
+		} else {
+			vmc_emit(c, INS_ABX(OP_SETG, r+i, loc.index+i));
+		}
+	}
+	c->reg_top = top;
+	*reg = r;
+	return loc.type;
+}
+
+static struct sem_type* vmc_call(struct vm_compiler* c, struct sexpr* e, int dst)
+{
+	struct sexpr* head = e->list;
+	struct vm_binding* b = vmc_lookup(c, head->atom.sym);
+	if (b == NULL || b->kind != VMB_FUNC) {
+		vmc_errf(c, "'%.*s' is not a function", (int)head->atom.str.len, head->atom.str.ptr);
+		return NULL;
+	}
+	int fi = b->index;
+	struct vm_func* fn = &c->prog->funcs[fi];
+	if (sexpr_list_len(e) - 1 != fn->n_args) {
+		vmc_errf(c, "wrong number of arguments");
+		return NULL;
+	}
+
+	int top = c->reg_top;
+	int base = top;
+	int i = 0;
+	for (struct sexpr* arg = head->next; arg != NULL; arg = arg->next, i++) {
+		struct sem_type* want = fn->arg_types[i];
+		struct sem_type* t = vmc_expr_into(c, arg, c->reg_top);
+		vmc_convert(c, c->reg_top, c->reg_top, t, want);
+		vmc_set_reg_top(c, c->reg_top + want->n_slots);
+	}
+	vmc_set_reg_top(c, base + fn->n_ret_slots);
+	vmc_emit(c, INS_ABX(OP_CALL, base, fi));
+	c->reg_top = top;
+
+	struct sem_type* t = fn->n_rets > 0 ? fn->ret_types[0] : &sem_void;
+	vmc_move(c, dst, base, t->n_slots);
+	return t;
+}
+
+// compiles e into the registers [dst;dst+n_slots) and returns its type.
+// dst is either below c->reg_top or equal to it; registers from c->reg_top
+// and up may be clobbered
+// compiles the binary operation e, and the chain of them down its left
+// operands, bottom up; like vmc_expr_into(). each operation below e leaves
+// its result in the first free register, where the one above reads it from
+static struct sem_type* vmc_binary(struct vm_compiler* c, struct sexpr* e, int dst)
+{
+	int top = c->reg_top;
+	int base = c->chain_dy.n;
+	struct sexpr* bottom = sexpr_push_chain(&c->chain_dy, e);
+	int ra;
+	struct sem_type* ta = vmc_expr(c, bottom, &ra);
+	for (int i = c->chain_dy.n - 1; i >= base; i--) {
+		enum token_type tt = c->chain[i]->list->atom.type;
+		int rb;
+		struct sem_type* tb = vmc_expr(c, c->chain[i]->list->next->next, &rb);
+		if (!sem_type_is_scalar(ta) || !sem_type_is_scalar(tb)) {
+			vmc_errf(c, "expected numbers");
+			return NULL;
+		}
+		// mixed int/float operands are promoted to float
+		struct sem_type* t = sem_arith_type(ta, tb);
+		int is_float = t->kind == SEM_FLOAT;
+		if (is_float && ta->kind == SEM_INT) {
+			int tmp = vmc_reg_alloc(c, 1);
+			vmc_convert(c, tmp, ra, ta, t);
+			ra = tmp;
+		}
+		if (is_float && tb->kind == SEM_INT) {
+			int tmp = vmc_reg_alloc(c, 1);
+			vmc_convert(c, tmp, rb, tb, t);
+			rb = tmp;
+		}
+		enum vm_op op = vmc_binop(c, tt, is_float);
+		int d = i == base ? dst : top;
+		vmc_emit(c, INS_ABC(op, d, ra, rb));
+		c->reg_top = top;
+		if (i > base) vmc_set_reg_top(c, top + 1);
+		ra = d;
+		ta = tt == T_EQ || tt == T_NEQ ? sem_builtin(T_BOOL) : t;
+	}
+	c->chain_dy.n = base;
+	c->reg_top = top;
+	return ta;
+}
+
+static struct sem_type* vmc_expr_into(struct vm_compiler* c, struct sexpr* e, int dst)
+{
+	int top = c->reg_top;
+	struct vm_loc loc;
+	if (vmc_loc(c, e, &loc, 0)) {
+		if (loc.dyn != -1) {
+			// compute the offset past dst
+			if (c->reg_top < dst + loc.type->n_slots) vmc_set_reg_top(c, dst + loc.type->n_slots);
+			vmc_loc(c, e, &loc, 1);
+		}
+		vmc_load(c, &loc, dst);
+		c->reg_top = top;
+		return loc.type;
+	}
+
+	if (sexpr_is_atom(e)) {
+		vmc_errf(c, "unexpected '%.*s'", (int)e->atom.str.len, e->atom.str.ptr);
+		return NULL;
+	}
+
+	struct sexpr* head = e->list;
+	if (head == NULL || !sexpr_is_atom(head)) {
+		vmc_errf(c, "not callable");
+		return NULL;
+	}
+	enum token_type tt = head->atom.type;
+	int n_args = sexpr_list_len(e) - 1;
+
+	if (tt == T_DOT) {
+		// member of something that isn't a variable, e.g. a call result
+		int r;
+		struct sem_type* t = vmc_expr(c, head->next, &r);
+		struct sem_field* f = vmc_field(c, t, head->next->next);
+		vmc_move(c, dst, r + f->slot, f->type->n_slots);
+		c->reg_top = top;
+		return f->type;
+	}
+
+	if (tt == T_LBRACKET) {
+		// element of something that isn't a variable
+		memset(&loc, 0, sizeof(loc));
+		loc.kind = VMB_LOCAL;
+		loc.type = vmc_expr(c, head->next, &loc.index);
+		loc.dyn = -1;
+		vmc_index(c, &loc, head->next->next, 1);
+		vmc_load(c, &loc, dst);
+		c->reg_top = top;
+		return loc.type;
+	}
+
+	if (tt == T_ASSIGN) {
+		int r;
+		struct sem_type* t = vmc_assign(c, e, &r);
+		vmc_move(c, dst, r, t->n_slots);
+		return t;
+	}
+
+	if (tt == T_IDENTIFIER) return vmc_call(c, e, dst);
+
+	if (tt_is_type(tt)) {
+		if (n_args != 1) {
+			vmc_errf(c, "conversions take one argument");
+			return NULL;
+		}
+		int r;
+		struct sem_type* t = vmc_expr(c, head->next, &r);
+		struct sem_type* to = sem_builtin(tt);
+		vmc_convert(c, dst, r, t, to);
+		c->reg_top = top;
+		return to;
+	}
+
+	if (n_args == 1 && is_unary_op(tt)) {
+		int r;
+		struct sem_type* t = vmc_expr(c, head->next, &r);
+		if (!sem_type_is_scalar(t)) {
+			vmc_errf(c, "expected a number");
+			return NULL;
+		}
+		if (tt == T_MINUS) {
+			vmc_emit(c, INS_ABC(t->kind == SEM_FLOAT ? OP_NEGF : OP_NEGI, dst, r, 0));
+		} else {
+			vmc_move(c, dst, r, 1);
+		}
+		c->reg_top = top;
+		return t;
+	}
+
+	if (n_args == 2 && is_binary_op(tt)) return vmc_binary(c, e, dst);
+
+	vmc_errf(c, "unexpected '%.*s'", (int)head->atom.str.len, head->atom.str.ptr);
+	return NULL;
+}
+
+static void vmc_block(struct vm_compiler* c, struct sexpr* block);
+
+static void vmc_expr_stmt(struct vm_compiler* c, struct sexpr* e)
+{
+	int top = c->reg_top;
+	if (sexpr_is_list(e) && sexpr_is_tt(e->list, T_ASSIGN)) {
+		int r;
+		vmc_assign(c, e, &r);
+	} else {
+		int r;
+		vmc_expr(c, e, &r);
+	}
+	c->reg_top = top;
+}
+
+static int vmc_cond(struct vm_compiler* c, struct sexpr* e)
+{
+	int r;
+	if (vmc_expr(c, e, &r)->kind != SEM_INT) vmc_errf(c, "condition must be an integer");
+	return r;
+}
+
+// types and constants were resolved and folded by the semantic pass, so
+// only variables are left to do
+static void vmc_local_def(struct vm_compiler* c, struct sexpr* def)
+{
+	enum token_type tt = def->list->atom.type;
+	struct sexpr* name = def->list->next;
+	struct sexpr* type = name->next;
+	struct sexpr* init = type->next;
+	if (tt != T_VAR) return;
+
+	struct sem_type* t = type->type;
+	int reg;
+	if (init == NULL) {
+		reg = vmc_reg_alloc(c, t->n_slots);
+		for (int i = 0; i < t->n_slots; i++) vmc_emit(c, INS_ASBX(OP_LOADI, reg+i, 0));
+	} else if (t != NULL) {
+		reg = vmc_reg_alloc(c, t->n_slots);
+		struct sem_type* it = vmc_expr_into(c, init, reg);
+		vmc_convert(c, reg, reg, it, t);
+	} else {
+		reg = c->reg_top;
+		t = vmc_expr_into(c, init, reg);
+		vmc_set_reg_top(c, reg + t->n_slots);
+	}
+	vmc_bind(c, name, VMB_LOCAL, reg, t);
+}
+
+static void vmc_return(struct vm_compiler* c, struct sexpr* stmt)
+{
+	struct vm_func* fn = &c->prog->funcs[c->func];
+	if (sexpr_list_len(stmt) - 1 != fn->n_rets) {
+		vmc_errf(c, "wrong number of return values");
+		return;
+	}
+
+	struct sexpr* value = stmt->list->next;
+	if (fn->n_rets == 1) {
+		// return straight from wherever the value is
+		int r;
+		struct sem_type* t = vmc_expr(c, value, &r);
+		if (t->kind != fn->ret_types[0]->kind) {
+			int tmp = vmc_reg_alloc(c, 1);
+			vmc_convert(c, tmp, r, t, fn->ret_types[0]);
+			r = tmp;
+		}
+		vmc_emit(c, INS_ABC(OP_RET, r, fn->n_ret_slots, 0));
+		return;
+	}
+
+	int base = c->reg_top;
+	for (int i = 0; value != NULL; value = value->next, i++) {
+		struct sem_type* t = vmc_expr_into(c, value, c->reg_top);
+		vmc_convert(c, c->reg_top, c->reg_top, t, fn->ret_types[i]);
+		vmc_set_reg_top(c, c->reg_top + fn->ret_types[i]->n_slots);
+	}
+	vmc_emit(c, INS_ABC(OP_RET, base, fn->n_ret_slots, 0));
+}
+
+static void vmc_if(struct vm_compiler* c, struct sexpr* stmt)
+{
+	struct sexpr* cond = stmt->list->next;
+	struct sexpr* tscope = cond->next;
+	struct sexpr* fscope = tscope->next;
+
+	int top = c->reg_top;
+	int jz = vmc_emit(c, INS_ASBX(OP_JZ, vmc_cond(c, cond), 0));
+	c->reg_top = top;
+	vmc_block(c, tscope);
+	if (fscope != NULL) {
+		int jmp = vmc_emit(c, INS_ASBX(OP_JMP, 0, 0));
+		vmc_patch(c, jz, vmc_here(c));
+		vmc_block(c, fscope);
+		vmc_patch(c, jmp, vmc_here(c));
+	} else {
+		vmc_patch(c, jz, vmc_here(c));
+	}
+}
+
+/*
+vectorizer. a counted loop (for i = K; i != N; i = i + 1, K and N constants)
+whose body only assigns to array elements indexed by i becomes a sequence of
+vector ops, each running over all N-K elements (or as many as fit in the
+free registers at a time). perfectly nested counted loops whose inner loops
+cover whole dimensions are collapsed into one first, so a[i][j] loops over
+contiguous slots too.
+
+the ops of one statement run for all elements before the next statement
+starts, so any element a statement reads must either be written by no
+statement, or only at the very same index; that rules out loop-carried
+dependencies. subexpressions without elements are loop invariant and
+computed once, before everything else
+*/
+
+#define VMC_VEC_MAX_DEPTH (4)
+#define VMC_VEC_MAX_ACCESSES (64)
+#define VMC_VEC_MAX_INVARIANTS (64)
+// the vectorizer recurses on both operands, chains included
+#define VMC_VEC_MAX_EXPR_DEPTH (256)
+
+// slots read or written by the loop
+struct vmc_vec_access {
+	enum vm_binding_kind kind; // VMB_LOCAL or VMB_GLOBAL
+	int start, n;
+	struct sem_type* type; // of an element
+	int is_write;
+	int is_scalar; // invariant read
+};
+
+struct vmc_vec {
+	struct vm_compiler* c;
+
+	// loops, outermost first
+	int depth;
+	struct vm_binding* vars[VMC_VEC_MAX_DEPTH];
+	int64_t start[VMC_VEC_MAX_DEPTH], end[VMC_VEC_MAX_DEPTH];
+	struct sexpr* body;
+	int n; // elements
+
+	struct vmc_vec_access acc[VMC_VEC_MAX_ACCESSES];
+	int n_acc;
+
+	// most temporary vectors and scalars any statement needs at once
+	int n_vec_temps, n_scalar_temps;
+	int stmt_vec_temps, stmt_scalar_temps;
+
+	int inv_regs[VMC_VEC_MAX_INVARIANTS];
+	int n_inv, i_inv;
+
+	int expr_depth; // of vmc_vec_check()
+
+	const char* reason;
+};
+
+struct vmc_vec_operand {
+	int reg;
+	int is_scalar;
+	int is_temp;
+};
+
+static int vmc_vec_reject(struct vmc_vec* v, const char* reason)
+{
+	if (v->reason == NULL) v->reason = reason;
+	return 0;
+}
+
+static int vmc_vec_int_literal(struct vmc_vec* v, struct sexpr* e, int64_t* out)
+{
+	if (!sexpr_is_atom(e) || e->atom.type != T_NUMBER) return 0;
+	union vm_value val;
+	if (sem_number(&v->c->prog->sem, &e->atom, &val)->kind != SEM_INT) return 0;
+	*out = val.i;
+	return 1;
+}
+
+static int vmc_vec_is_ident(struct sexpr* e, uint32_t sym)
+{
+	return sexpr_is_atom(e) && e->atom.type == T_IDENTIFIER && e->atom.sym == sym;
+}
+
+// matches for i = K; i != N; i = i + 1 { ... }
+static int vmc_vec_counted(struct vmc_vec* v, struct sexpr* stmt)
+{
+	if (v->depth == VMC_VEC_MAX_DEPTH) return vmc_vec_reject(v, "nested too deep");
+	if (sexpr_list_len(stmt) != 5) return vmc_vec_reject(v, "not a counted loop");
+	struct sexpr* init = stmt->list->next;
+	struct sexpr* cond = init->next;
+	struct sexpr* post = cond->next;
+
+	if (!sexpr_is_list(init) || !sexpr_is_tt(init->list, T_ASSIGN) || !sexpr_is_tt(init->list->next, T_IDENTIFIER)) {
+		return vmc_vec_reject(v, "not a counted loop");
+	}
+	struct sexpr* var = init->list->next;
+	uint32_t sym = var->atom.sym;
+	struct vm_binding* b = vmc_lookup(v->c, sym);
+	if (b == NULL || b->kind != VMB_LOCAL || b->type->kind != SEM_INT) {
+		return vmc_vec_reject(v, "loop variable isn't a local integer");
+	}
+	for (int i = 0; i < v->depth; i++) {
+		if (v->vars[i] == b) return vmc_vec_reject(v, "nested loops share a variable");
+	}
+
+	int64_t start, end, step;
+	if (!vmc_vec_int_literal(v, var->next, &start)) return vmc_vec_reject(v, "start isn't constant");
+	if (!sexpr_is_list(cond) || !sexpr_is_tt(cond->list, T_NEQ) || !vmc_vec_is_ident(cond->list->next, sym)) {
+		return vmc_vec_reject(v, "condition isn't i != N");
+	}
+	if (!vmc_vec_int_literal(v, cond->list->next->next, &end)) return vmc_vec_reject(v, "trip count isn't constant");
+	struct sexpr* inc = post != NULL && sexpr_is_list(post) && sexpr_is_tt(post->list, T_ASSIGN) ? post->list->next : NULL;
+	if (inc == NULL || !vmc_vec_is_ident(inc, sym) || !sexpr_is_list(inc->next)
+		|| !sexpr_is_tt(inc->next->list, T_PLUS) || !vmc_vec_is_ident(inc->next->list->next, sym)
+		|| !vmc_vec_int_literal(v, inc->next->list->next->next, &step) || step != 1)
+	{
+		return vmc_vec_reject(v, "step isn't i = i + 1");
+	}
+	if (start < 0 || start > end) return vmc_vec_reject(v, "start is negative or past the end");
+
+	v->vars[v->depth] = b;
+	v->start[v->depth] = start;
+	v->end[v->depth] = end;
+	v->depth++;
+	v->body = post->next;
+	return 1;
+}
+
+// resolves X[i]..[j], indexed by all loop variables in order, where X is a
+// variable or a member of one, to the slots it covers over the whole loop
+static int vmc_vec_range(struct vmc_vec* v, struct sexpr* e, struct vmc_vec_access* a)
+{
+	struct sexpr* x = e;
+	for (int d = v->depth - 1; d >= 0; d--) {
+		if (!sexpr_is_list(x) || !sexpr_is_tt(x->list, T_LBRACKET)) return vmc_vec_reject(v, "element isn't indexed by every loop variable");
+		if (!vmc_vec_is_ident(x->list->next->next, v->vars[d]->sym)) return vmc_vec_reject(v, "index isn't a loop variable");
+		x = x->list->next;
+	}
+	struct vm_loc loc;
+	if (!vmc_loc(v->c, x, &loc, 0) || loc.dyn != -1) return vmc_vec_reject(v, "array isn't a variable or a member of one");
+
+	struct sem_type* t = loc.type;
+	int stride = 1;
+	for (int d = 0; d < v->depth; d++) {
+		if (d == 0 && v->end[0] > t->n) return vmc_vec_reject(v, "index out of range");
+		if (d > 0 && v->end[d] != t->n) return vmc_vec_reject(v, "inner loop doesn't cover a whole dimension");
+		if (d == 0) stride = t->elem->n_slots;
+		t = t->elem;
+	}
+	if (!sem_type_is_scalar(t)) return vmc_vec_reject(v, "element isn't a scalar");
+
+	memset(a, 0, sizeof(*a));
+	a->kind = loc.kind;
+	a->start = loc.index + v->start[0] * stride;
+	a->n = v->n;
+	a->type = t;
+	return 1;
+}
+
+static struct vmc_vec_access* vmc_vec_add_access(struct vmc_vec* v)
+{
+	if (v->n_acc == VMC_VEC_MAX_ACCESSES) {
+		vmc_vec_reject(v, "too many operands");
+		return NULL;
+	}
+	return &v->acc[v->n_acc++];
+}
+
+// whether e reads elements, i.e. isn't loop invariant
+static int vmc_vec_varying(struct sexpr* e)
+{
+	if (!sexpr_is_list(e)) return 0;
+	if (sexpr_is_tt(e->list, T_LBRACKET)) return 1;
+	for (struct sexpr* i = e->list; i != NULL; i = i->next) {
+		if (vmc_vec_varying(i)) return 1;
+	}
+	return 0;
+}
+
+// an invariant read of a variable, or a member of one
+static int vmc_vec_scalar(struct vmc_vec* v, struct sexpr* e, enum sem_kind* kind)
+{
+	for (int d = 0; d < v->depth; d++) {
+		if (vmc_vec_is_ident(e, v->vars[d]->sym)) return vmc_vec_reject(v, "loop variable used as a value");
+	}
+	struct vm_loc loc;
+	if (vmc_vec_varying(e) || !vmc_loc(v->c, e, &loc, 0) || !sem_type_is_scalar(loc.type)) {
+		return vmc_vec_reject(v, "operand isn't a scalar or an element");
+	}
+	struct vmc_vec_access* a = vmc_vec_add_access(v);
+	if (a == NULL) return 0;
+	memset(a, 0, sizeof(*a));
+	a->kind = loc.kind;
+	a->start = loc.index;
+	a->n = 1;
+	a->type = loc.type;
+	a->is_scalar = 1;
+	*kind = loc.type->kind;
+	return 1;
+}
+
+enum {
+	VMC_VEC_INVARIANT = 1,
+	VMC_VEC_VARYING,
+};
+
+static int vmc_vec_check(struct vmc_vec* v, struct sexpr* e, enum sem_kind* kind);
+
+static int vmc_vec_check_expr(struct vmc_vec* v, struct sexpr* e, enum sem_kind* kind)
+{
+	if (sexpr_is_atom(e)) {
+		if (e->atom.type == T_NUMBER) {
+			union vm_value val;
+			*kind = sem_number(&v->c->prog->sem, &e->atom, &val)->kind;
+			return VMC_VEC_INVARIANT;
+		}
+		return vmc_vec_scalar(v, e, kind) ? VMC_VEC_INVARIANT : 0;
+	}
+
+	struct sexpr* head = e->list;
+	if (!sexpr_is_atom(head)) return vmc_vec_reject(v, "unsupported expression");
+	enum token_type tt = head->atom.type;
+	int n_args = sexpr_list_len(e) - 1;
+
+	if (tt == T_DOT) return vmc_vec_scalar(v, e, kind) ? VMC_VEC_INVARIANT : 0;
+
+	if (tt == T_LBRACKET) {
+		struct vmc_vec_access* a = vmc_vec_add_access(v);
+		if (a == NULL || !vmc_vec_range(v, e, a)) return 0;
+		if (a->kind == VMB_GLOBAL) v->stmt_vec_temps++;
+		*kind = a->type->kind;
+		return VMC_VEC_VARYING;
+	}
+
+	if (tt_is_type(tt) && n_args == 1) {
+		enum sem_kind k;
+		int r = vmc_vec_check(v, head->next, &k);
+		if (r == VMC_VEC_VARYING) return vmc_vec_reject(v, "converts elements");
+		*kind = sem_builtin(tt)->kind;
+		return r;
+	}
+
+	if (n_args == 1 && is_unary_op(tt)) {
+		int r = vmc_vec_check(v, head->next, kind);
+		if (r == VMC_VEC_VARYING && tt == T_MINUS) {
+			// 0 - x
+			v->stmt_vec_temps++;
+			v->stmt_scalar_temps++;
+		}
+		return r;
+	}
+
+	if (n_args == 2 && (tt == T_PLUS || tt == T_MINUS || tt == T_MUL || tt == T_DIV)) {
+		enum sem_kind ka, kb;
+		int ra = vmc_vec_check(v, head->next, &ka);
+		if (ra == 0) return 0;
+		int rb = vmc_vec_check(v, head->next->next, &kb);
+		if (rb == 0) return 0;
+		*kind = ka == SEM_FLOAT || kb == SEM_FLOAT ? SEM_FLOAT : SEM_INT;
+		if (ra == VMC_VEC_INVARIANT && rb == VMC_VEC_INVARIANT) return VMC_VEC_INVARIANT;
+		if ((ra == VMC_VEC_VARYING && ka != *kind) || (rb == VMC_VEC_VARYING && kb != *kind)) {
+			return vmc_vec_reject(v, "integer elements in float arithmetic");
+		}
+		if (*kind == SEM_INT && (tt == T_MUL || tt == T_DIV)) return vmc_vec_reject(v, "no SIMD integer multiply or divide");
+		v->stmt_vec_temps++;
+		return VMC_VEC_VARYING;
+	}
+
+	if (tt == T_IDENTIFIER) return vmc_vec_reject(v, "calls a function");
+	if (tt == T_ASSIGN) return vmc_vec_reject(v, "assignment inside an expression");
+	return vmc_vec_reject(v, "unsupported operator");
+}
+
+// returns 0 (rejected), VMC_VEC_INVARIANT or VMC_VEC_VARYING, and the kind
+// of e's value in *kind
+static int vmc_vec_check(struct vmc_vec* v, struct sexpr* e, enum sem_kind* kind)
+{
+	if (v->expr_depth == VMC_VEC_MAX_EXPR_DEPTH) return vmc_vec_reject(v, "expression nested too deep");
+	v->expr_depth++;
+	int r = vmc_vec_check_expr(v, e, kind);
+	v->expr_depth--;
+	return r;
+}
+
+static int vmc_vec_stmt(struct vmc_vec* v, struct sexpr* stmt)
+{
+	if (!sexpr_is_list(stmt) || !sexpr_is_tt(stmt->list, T_ASSIGN)) return vmc_vec_reject(v, "body isn't only assignments");
+	struct sexpr* lhs = stmt->list->next;
+	if (!sexpr_is_list(lhs) || !sexpr_is_tt(lhs->list, T_LBRACKET)) {
+		struct vm_loc loc;
+		if (vmc_loc(v->c, lhs, &loc, 0) && loc.dyn == -1) return vmc_vec_reject(v, "loop-carried dependency through a scalar");
+		return vmc_vec_reject(v, "assigns to something other than an element");
+	}
+
+	v->stmt_vec_temps = 0;
+	v->stmt_scalar_temps = 0;
+	struct vmc_vec_access* a = vmc_vec_add_access(v);
+	if (a == NULL || !vmc_vec_range(v, lhs, a)) return 0;
+	a->is_write = 1;
+	if (a->kind == VMB_GLOBAL) v->stmt_vec_temps++;
+
+	enum sem_kind kind;
+	int r = vmc_vec_check(v, lhs->next, &kind);
+	if (r == 0) return 0;
+	if (r == VMC_VEC_VARYING && kind != a->type->kind) return vmc_vec_reject(v, "elements need a conversion");
+	if (v->stmt_vec_temps > v->n_vec_temps) v->n_vec_temps = v->stmt_vec_temps;
+	if (v->stmt_scalar_temps > v->n_scalar_temps) v->n_scalar_temps = v->stmt_scalar_temps;
+	return 1;
+}
+
+// every slot written must only be accessed at the very same index
+static int vmc_vec_independent(struct vmc_vec* v)
+{
+	for (int i = 0; i < v->n_acc; i++) {
+		struct vmc_vec_access* w = &v->acc[i];
+		if (!w->is_write) continue;
+		for (int j = 0; j < v->n_acc; j++) {
+			struct vmc_vec_access* a = &v->acc[j];
+			if (a->kind != w->kind || a->start >= w->start + w->n || w->start >= a->start + a->n) continue;
+			if (a->is_scalar || a->start != w->start || a->n != w->n) {
+				return vmc_vec_reject(v, "possible loop-carried dependency");
+			}
+		}
+	}
+	return 1;
+}
+
+// kind of a checked expression's value
+static enum sem_kind vmc_vec_kind(struct vmc_vec* v, struct sexpr* e)
+{
+	if (sexpr_is_list(e)) {
+		enum token_type tt = e->list->atom.type;
+		if (tt_is_type(tt)) return sem_builtin(tt)->kind;
+		if (is_binary_op(tt) && sexpr_list_len(e) == 3) {
+			int is_float = vmc_vec_kind(v, e->list->next) == SEM_FLOAT || vmc_vec_kind(v, e->list->next->next) == SEM_FLOAT;
+			return is_float ? SEM_FLOAT : SEM_INT;
+		}
+		if (is_unary_op(tt) && sexpr_list_len(e) == 2) return vmc_vec_kind(v, e->list->next);
+	}
+	struct vm_loc loc;
+	vmc_loc(v->c, e, &loc, 0);
+	return loc.type->kind;
+}
+
+static struct sem_type* vmc_vec_kind_type(enum sem_kind kind)
+{
+	return sem_builtin(kind == SEM_FLOAT ? T_FLOAT64 : T_INT);
+}
+
+// computes the loop invariant subexpressions of e into registers, as kind
+static int vmc_vec_hoist(struct vmc_vec* v, struct sexpr* e, enum sem_kind kind)
+{
+	struct vm_compiler* c = v->c;
+	if (!vmc_vec_varying(e)) {
+		if (v->n_inv == VMC_VEC_MAX_INVARIANTS) return vmc_vec_reject(v, "too many operands");
+		int r = vmc_reg_alloc(c, 1);
+		struct sem_type* t = vmc_expr_into(c, e, r);
+		if (t->kind != kind) vmc_convert(c, r, r, t, vmc_vec_kind_type(kind));
+		v->inv_regs[v->n_inv++] = r;
+		return 1;
+	}
+	enum token_type tt = e->list->atom.type;
+	if (tt == T_LBRACKET) return 1;
+	kind = vmc_vec_kind(v, e);
+	for (struct sexpr* arg = e->list->next; arg != NULL; arg = arg->next) {
+		if (!vmc_vec_hoist(v, arg, kind)) return 0;
+	}
+	return 1;
+}
+
+// emits op over len elements, into dst if it's not -1
+static struct vmc_vec_operand vmc_vec_op(struct vmc_vec* v, enum vm_op op, struct vmc_vec_operand a, struct vmc_vec_operand b, int len, int dst)
+{
+	struct vmc_vec_operand r = { .reg = dst };
+	if (dst == -1) {
+		r.is_temp = 1;
+		if (a.is_temp) {
+			r.reg = a.reg;
+		} else if (b.is_temp) {
+			r.reg = b.reg;
+		} else {
+			r.reg = vmc_reg_alloc(v->c, len);
+		}
+	}
+	int flags = (a.is_scalar ? VM_ARG_SB : 0) | (b.is_scalar ? VM_ARG_SC : 0);
+	vmc_emit(v->c, INS_ABC(op, r.reg, a.reg, b.reg));
+	vmc_emit(v->c, INS_ABX(OP_ARG, flags, len));
+	return r;
+}
+
+// emits e for the elements [off;off+len), leaving the result in dst if it's
+// not -1 and it takes an op to compute it
+static struct vmc_vec_operand vmc_vec_gen(struct vmc_vec* v, struct sexpr* e, int off, int len, int dst)
+{
+	struct vm_compiler* c = v->c;
+	struct vmc_vec_operand r = {0};
+	if (!vmc_vec_varying(e)) {
+		r.reg = v->inv_regs[v->i_inv++];
+		r.is_scalar = 1;
+		return r;
+	}
+
+	enum token_type tt = e->list->atom.type;
+	int is_float = vmc_vec_kind(v, e) == SEM_FLOAT;
+	if (tt == T_LBRACKET) {
+		struct vmc_vec_access a;
+		vmc_vec_range(v, e, &a);
+		if (a.kind == VMB_LOCAL) {
+			r.reg = a.start + off;
+		} else {
+			r.reg = vmc_reg_alloc(c, len);
+			r.is_temp = 1;
+			vmc_emit(c, INS_ABX(OP_VGETG, r.reg, a.start + off));
+			vmc_emit(c, INS_ABX(OP_ARG, 0, len));
+		}
+		return r;
+	}
+
+	struct sexpr* arg = e->list->next;
+	if (arg->next == NULL) {
+		struct vmc_vec_operand x = vmc_vec_gen(v, arg, off, len, -1);
+		if (tt == T_PLUS) return x;
+		// -0.0 - x is -x for every x but NaN
+		struct vmc_vec_operand zero = { .reg = vmc_reg_alloc(c, 1), .is_scalar = 1 };
+		vmc_loadk(c, zero.reg, is_float ? (union vm_value){ .f = -0.0 } : (union vm_value){ .i = 0 }, vmc_vec_kind_type(is_float ? SEM_FLOAT : SEM_INT));
+		return vmc_vec_op(v, is_float ? OP_VSUBF : OP_VSUBI, zero, x, len, dst);
+	}
+
+	struct vmc_vec_operand a = vmc_vec_gen(v, arg, off, len, -1);
+	struct vmc_vec_operand b = vmc_vec_gen(v, arg->next, off, len, -1);
+	enum vm_op op;
+	switch (tt) {
+		case T_PLUS: op = is_float ? OP_VADDF : OP_VADDI; break;
+		case T_MINUS: op = is_float ? OP_VSUBF : OP_VSUBI; break;
+		case T_MUL: op = OP_VMULF; break;
+		default: op = OP_VDIVF; break;
+	}
+	return vmc_vec_op(v, op, a, b, len, dst);
+}
+
+static void vmc_vec_gen_stmt(struct vmc_vec* v, struct sexpr* stmt, int off, int len)
+{
+	struct vm_compiler* c = v->c;
+	int top = c->reg_top;
+	struct sexpr* lhs = stmt->list->next;
+	struct vmc_vec_access a;
+	vmc_vec_range(v, lhs, &a);
+	int dst = a.kind == VMB_LOCAL ? a.start + off : vmc_reg_alloc(c, len);
+	struct vmc_vec_operand r = vmc_vec_gen(v, lhs->next, off, len, dst);
+	if (r.reg != dst || r.is_scalar) {
+		vmc_emit(c, INS_ABC(OP_VMOV, dst, r.reg, 0));
+		vmc_emit(c, INS_ABX(OP_ARG, r.is_scalar ? VM_ARG_SB : 0, len));
+	}
+	if (a.kind == VMB_GLOBAL) {
+		vmc_emit(c, INS_ABX(OP_VSETG, dst, a.start + off));
+		vmc_emit(c, INS_ABX(OP_ARG, 0, len));
+	}
+	c->reg_top = top;
+}
+
+// compiles the for loop stmt into vector ops if it can, and reports why not
+// otherwise
+static int vmc_vectorize(struct vm_compiler* c, struct sexpr* stmt)
+{
+	struct vmc_vec* v = calloc(1, sizeof(*v));
+	assert(v != NULL);
+	v->c = c;
+	// errors free v on their way out
+	jmp_buf on_err;
+	jmp_buf* outer = c->on_err;
+	if (outer != NULL) {
+		c->on_err = &on_err;
+		if (setjmp(on_err) != 0) {
+			free(v);
+			c->on_err = outer;
+			longjmp(*outer, 1);
+		}
+	}
+	int n_stmts = 0;
+	int pc0 = vmc_here(c);
+	int top = c->reg_top;
+	int ok = vmc_vec_counted(v, stmt);
+	while (ok && sexpr_list_len(v->body) == 1 && sexpr_is_list(v->body->list) && sexpr_is_tt(v->body->list->list, T_FOR)) {
+		ok = vmc_vec_counted(v, v->body->list);
+		if (ok && v->start[v->depth-1] != 0) ok = vmc_vec_reject(v, "inner loop doesn't start at 0");
+	}
+	if (ok) {
+		v->n = v->end[0] - v->start[0];
+		for (int d = 1; d < v->depth; d++) v->n *= v->end[d];
+		for (struct sexpr* s = v->body->list; ok && s != NULL; s = s->next, n_stmts++) ok = vmc_vec_stmt(v, s);
+		if (ok && n_stmts == 0) ok = vmc_vec_reject(v, "empty body");
+	}
+	if (ok) ok = vmc_vec_independent(v);
+
+	if (ok) {
+		for (struct sexpr* s = v->body->list; ok && s != NULL; s = s->next) {
+			struct vm_loc loc;
+			vmc_loc(c, s->list->next, &loc, 0);
+			ok = vmc_vec_hoist(v, s->list->next->next, loc.type->kind);
+		}
+	}
+	// elements per op; as many as the free registers allow
+	int m = v->n;
+	if (ok && v->n_vec_temps > 0) {
+		int free = VM_MAX_FRAME_REGS - c->reg_top - v->n_scalar_temps;
+		if (free < v->n_vec_temps) {
+			ok = vmc_vec_reject(v, "not enough registers");
+		} else if (free / v->n_vec_temps < m) {
+			m = free / v->n_vec_temps;
+		}
+	}
+
+	if (ok) {
+		for (int off = 0; off < v->n; off += m) {
+			int len = v->n - off < m ? v->n - off : m;
+			v->i_inv = 0;
+			for (struct sexpr* s = v->body->list; s != NULL; s = s->next) vmc_vec_gen_stmt(v, s, off, len);
+		}
+		// the loop variables end up where the loops would have left them
+		for (int d = 0; d < v->depth; d++) {
+			vmc_loadk(c, v->vars[d]->index, (union vm_value){ .i = v->end[d] }, sem_builtin(T_INT));
+			if (v->end[d] == v->start[d]) break;
+		}
+	} else {
+		c->code_dy.n = pc0;
+	}
+	c->reg_top = top;
+
+	struct vm_vec_report* r = dynary_append(&c->prog->vec_reports_dy);
+	memset(r, 0, sizeof(*r));
+	r->func = c->prog->funcs[c->func].sym;
+	r->loop = ++c->n_loops;
+	r->n_loops = v->depth;
+	r->n_stmts = n_stmts;
+	r->n = v->n;
+	r->reason = ok ? NULL : v->reason;
+	free(v);
+	c->on_err = outer;
+	return ok;
+}
+
+static void vmc_for(struct vm_compiler* c, struct sexpr* stmt)
+{
+	if (!(c->flags & VMC_NO_VECTORIZE) && vmc_vectorize(c, stmt)) return;
+
+	struct sexpr* init = NULL;
+	struct sexpr* cond = NULL;
+	struct sexpr* post = NULL;
+	struct sexpr* body = stmt->list->next;
+	switch (sexpr_list_len(stmt)) {
+		case 2: break;
+		case 3: cond = body; body = body->next; break;
+		case 5: init = body; cond = init->next; post = cond->next; body = post->next; break;
+		default: assert(0);
+	}
+
+	// the condition goes after the body, so each iteration only runs one
+	// jump:
+	//   init; jmp cond; body: ...; continue: post; cond: jnz body
+	if (init != NULL) vmc_expr_stmt(c, init);
+	int jmp_cond = cond != NULL ? vmc_emit(c, INS_ASBX(OP_JMP, 0, 0)) : -1;
+
+	int body_pc = vmc_here(c);
+	c->loop_depth++;
+	vmc_block(c, body);
+	int continue_pc = vmc_here(c);
+	if (post != NULL) vmc_expr_stmt(c, post);
+
+	if (cond != NULL) {
+		vmc_patch(c, jmp_cond, vmc_here(c));
+		int top = c->reg_top;
+		int jnz = vmc_emit(c, INS_ASBX(OP_JNZ, vmc_cond(c, cond), 0));
+		c->reg_top = top;
+		vmc_patch(c, jnz, body_pc);
+	} else {
+		vmc_patch(c, vmc_emit(c, INS_ASBX(OP_JMP, 0, 0)), body_pc);
+	}
+
+	int break_pc = vmc_here(c);
+	int n = 0;
+	for (int i = 0; i < c->patches_dy.n; i++) {
+		struct vm_patch* p = &c->patches[i];
+		if (p->loop == c->loop_depth) {
+			vmc_patch(c, p->pc, p->is_break ? break_pc : continue_pc);
+		} else {
+			c->patches[n++] = *p;
+		}
+	}
+	c->patches_dy.n = n;
+	c->loop_depth--;
+}
+
+static void vmc_stmt(struct vm_compiler* c, struct sexpr* stmt)
+{
+	struct sexpr* head = sexpr_is_list(stmt) ? stmt->list : NULL;
+	enum token_type tt = head != NULL && sexpr_is_atom(head) ? head->atom.type : 0;
+	int top = c->reg_top;
+	switch (tt) {
+		case T_VAR:
+		case T_CONST:
+		case T_TYPE:
+			vmc_local_def(c, stmt);
+			return; // keeps its registers until the end of the block
+		case T_FUNC:
+			vmc_errf(c, "nested functions are not supported");
+			return;
+		case T_RETURN:
+			vmc_return(c, stmt);
+			break;
+		case T_IF:
+			vmc_if(c, stmt);
+			break;
+		case T_FOR:
+			vmc_for(c, stmt);
+			break;
+		case T_BREAK:
+		case T_CONTINUE: {
+			if (c->loop_depth == 0) {
+				vmc_errf(c, "break/continue outside loop");
+				return;
+			}
+			struct vm_patch* p = dynary_append(&c->patches_dy);
+			p->pc = vmc_emit(c, INS_ASBX(OP_JMP, 0, 0));
+			p->loop = c->loop_depth;
+			p->is_break = tt == T_BREAK;
+		} break;
+		case T_FALLTHROUGH:
+			vmc_errf(c, "fallthrough is not supported");
+			return;
+		default:
+			vmc_expr_stmt(c, stmt);
+			break;
+	}
+	c->reg_top = top;
+}
+
+static void vmc_block(struct vm_compiler* c, struct sexpr* block)
+{
+	int n_bindings = c->bindings_dy.n;
+	int top = c->reg_top;
+	for (struct sexpr* stmt = block->list; stmt != NULL; stmt = stmt->next) {
+		vmc_stmt(c, stmt);
+	}
+	c->bindings_dy.n = n_bindings;
+	c->reg_top = top;
+}
+
+static void vmc_begin_func(struct vm_compiler* c, int fi)
+{
+	c->code_dy.n = 0;
+	c->func = fi;
+	c->reg_top = 0;
+	c->max_regs = 0;
+	c->loop_depth = 0;
+	c->n_loops = 0;
+}
+
+static void vmc_end_func(struct vm_compiler* c)
+{
+	vmc_emit(c, INS_ABC(OP_RET, 0, 0, 0));
+	struct vm_func* fn = &c->prog->funcs[c->func];
+	fn->n_code = c->code_dy.n;
+	fn->code = malloc(fn->n_code * sizeof(*fn->code));
+	assert(fn->code != NULL);
+	memcpy(fn->code, c->code, fn->n_code * sizeof(*fn->code));
+	fn->n_regs = c->max_regs;
+}
+
+static int vmc_new_func(struct vm_compiler* c, uint32_t sym)
+{
+	struct vm_func* fn = dynary_append(&c->prog->funcs_dy);
+	memset(fn, 0, sizeof(*fn));
+	fn->sym = sym;
+	if (c->prog->funcs_dy.n > UINT16_MAX) vmc_errf(c, "too many functions");
+	return c->prog->funcs_dy.n - 1;
+}
+
+static void vmc_func_signature(struct vm_compiler* c, struct sexpr* def, struct sem_func* sf)
+{
+	struct sexpr* name = def->list->next;
+	int fi = vmc_new_func(c, name->atom.sym);
+	struct vm_func* fn = &c->prog->funcs[fi];
+	fn->n_args = sf->n_args;
+	fn->arg_types = sf->arg_types;
+	for (int i = 0; i < fn->n_args; i++) fn->n_arg_slots += fn->arg_types[i]->n_slots;
+	fn->n_rets = sf->n_rets;
+	fn->ret_types = sf->ret_types;
+	for (int i = 0; i < fn->n_rets; i++) fn->n_ret_slots += fn->ret_types[i]->n_slots;
+	if (fn->n_arg_slots > VM_MAX_FRAME_REGS || fn->n_ret_slots > VM_MAX_FRAME_REGS) {
+		vmc_errf(c, "function signature too big");
+	}
+
+	vmc_bind(c, name, VMB_FUNC, fi, NULL);
+}
+
+static int ssa_compile(struct vm_compiler* c, int fi, struct sexpr* def);
+static void ssa_report_reject(struct vm_compiler* c, int fi, const char* reason);
+
+static void vmc_func_tree(struct vm_compiler* c, int fi, struct sexpr* def)
+{
+	struct sexpr* args = def->list->next->next;
+	struct sexpr* body = args->next->next;
+	struct vm_func* fn = &c->prog->funcs[fi];
+	int n_bindings = c->bindings_dy.n;
+	vmc_begin_func(c, fi);
+	int i = 0;
+	for (struct sexpr* a = args->list; a != NULL; a = a->next, i++) {
+		struct sem_type* t = fn->arg_types[i];
+		vmc_bind(c, a->list, VMB_LOCAL, vmc_reg_alloc(c, t->n_slots), t);
+	}
+	vmc_block(c, body);
+	vmc_end_func(c);
+	c->bindings_dy.n = n_bindings;
+}
+
+// the tree compiler goes first, as only it vectorizes: functions with a
+// vectorized loop keep its code, the others are compiled again through SSA
+// and keep the tree's code only if SSA can't take them
+static void vmc_func_body(struct vm_compiler* c, int fi, struct sexpr* def)
+{
+	struct vm_prog* prog = c->prog;
+	int n_reports = prog->vec_reports_dy.n;
+	vmc_func_tree(c, fi, def);
+	if (c->flags & VMC_NO_SSA) return;
+	for (int i = n_reports; i < prog->vec_reports_dy.n; i++) {
+		if (prog->vec_reports[i].reason == NULL) {
+			ssa_report_reject(c, fi, "has a vectorized loop");
+			return;
+		}
+	}
+
+	struct vm_func* fn = &prog->funcs[fi];
+	struct vm_func tree = *fn;
+	fn->code = NULL;
+	// errors free the tree's code on their way out
+	jmp_buf on_err;
+	jmp_buf* outer = c->on_err;
+	if (outer != NULL) {
+		c->on_err = &on_err;
+		if (setjmp(on_err) != 0) {
+			free(tree.code);
+			c->on_err = outer;
+			longjmp(*outer, 1);
+		}
+	}
+	if (ssa_compile(c, fi, def) == 0) {
+		free(tree.code);
+	} else {
+		*fn = tree;
+	}
+	c->on_err = outer;
+}
+
+// compiles a program as returned by parse_rec(p, 0, 0) into prog, running
+// the semantic pass on it first (which modifies defs; see sem_check()).
+// flags are VMC_*. returns -1 with the reason in prog->err_msg if the
+// program doesn't check or can't be compiled; prog must be freed either way
+static int vm_compile(struct vm_prog* prog, struct sexpr* defs, int flags)
+{
+	vm_prog_init(prog);
+
+	struct vm_compiler c;
+	memset(&c, 0, sizeof(c));
+	c.prog = prog;
+	c.flags = flags;
+	dynary_init(&c.bindings_dy, (void**) &c.bindings, sizeof(*c.bindings));
+	dynary_init(&c.code_dy, (void**) &c.code, sizeof(*c.code));
+	dynary_init(&c.patches_dy, (void**) &c.patches, sizeof(*c.patches));
+	dynary_init(&c.chain_dy, (void**) &c.chain, sizeof(*c.chain));
+
+	jmp_buf on_err;
+	c.on_err = &on_err;
+	prog->sem.on_err = &on_err;
+	if (setjmp(on_err) != 0) {
+		snprintf(prog->err_msg, sizeof(prog->err_msg), "%s", c.err ? c.err_msg : prog->sem.err_msg);
+		prog->sem.on_err = NULL;
+		free(c.bindings);
+		free(c.code);
+		free(c.patches);
+		free(c.chain);
+		return -1;
+	}
+	sem_check(&prog->sem, defs);
+
+	// function signatures
+	int n_funcs = 0;
+	for (struct sexpr* def = defs->list; def != NULL; def = def->next) {
+		if (def->list->atom.type == T_FUNC) vmc_func_signature(&c, def, prog->sem.funcs[n_funcs++]);
+	}
+
+	// globals; their initializers go into prog->init_func
+	int init_func = vmc_new_func(&c, 0);
+	vmc_begin_func(&c, init_func);
+	for (struct sexpr* def = defs->list; def != NULL; def = def->next) {
+		if (def->list->atom.type != T_VAR) continue;
+		struct sexpr* name = def->list->next;
+		struct sexpr* type = name->next;
+		struct sexpr* init = type->next;
+		struct sem_type* t = type->type;
+		if (init != NULL) {
+			int r;
+			struct sem_type* it = vmc_expr(&c, init, &r);
+			if (t == NULL) t = it;
+			if (t->kind != it->kind) {
+				int tmp = vmc_reg_alloc(&c, 1);
+				vmc_convert(&c, tmp, r, it, t);
+				r = tmp;
+			}
+			for (int i = 0; i < t->n_slots; i++) {
+				vmc_emit(&c, INS_ABX(OP_SETG, r+i, prog->n_global_slots+i));
+			}
+			c.reg_top = 0;
+		}
+		if (prog->n_global_slots + t->n_slots > UINT16_MAX) vmc_errf(&c, "too many globals");
+		vmc_bind(&c, name, VMB_GLOBAL, prog->n_global_slots, t);
+		prog->n_global_slots += t->n_slots;
+	}
+	vmc_end_func(&c);
+	if (prog->funcs[init_func].n_code > 1) prog->init_func = init_func;
+
+	// function bodies
+	int fi = 0;
+	for (struct sexpr* def = defs->list; def != NULL; def = def->next) {
+		if (def->list->atom.type != T_FUNC) continue;
+		vmc_func_body(&c, fi++, def);
+	}
+
+	prog->sem.on_err = NULL;
+	free(c.bindings);
+	free(c.code);
+	free(c.patches);
+	free(c.chain);
+	return 0;
+}
+
+static void vm_print_vec_reports(FILE* f, struct vm_prog* prog)
+{
+	for (int i = 0; i < prog->vec_reports_dy.n; i++) {
+		struct vm_vec_report* r = &prog->vec_reports[i];
+		fprintf(f, "%s: loop %d: ", symtab_get(&symtab, r->func)->name, r->loop);
+		if (r->reason != NULL) {
+			fprintf(f, "not vectorized: %s\n", r->reason);
+		} else {
+			fprintf(f, "vectorized, %d statement(s) over %d element(s)", r->n_stmts, r->n);
+			if (r->n_loops > 1) fprintf(f, ", %d loops collapsed", r->n_loops);
+			fprintf(f, "\n");
+		}
+	}
+}
+
+
+// interpreter
+
+enum vm_status {
+	VM_OK = 0,
+	VM_ERR_STACK_OVERFLOW,
+	VM_ERR_INDEX,
+};
+
+struct vm_frame {
+	const uint32_t* pc;
+	union vm_value* R;
+};
+
+/*
+all memory the interpreter needs is allocated by vm_init(), so vm_call()
+never allocates
+*/
+struct vm {
+	struct vm_prog* prog;
+	union vm_value* globals;
+	union vm_value* regs; // VM_MAX_REGS
+	struct vm_frame* frames; // VM_MAX_FRAMES
+};
+
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO
+#endif
+
+// runs the vector op op over n slots; a may be b or c, but mustn't overlap
+// them otherwise
+static void vm_vector(int op, union vm_value* a, const union vm_value* b, const union vm_value* c, int flags, int n)
+{
+	int sb = (flags & VM_ARG_SB) ? 0 : 1;
+	int sc = (flags & VM_ARG_SC) ? 0 : 1;
+	int k = 0;
+
+	#ifdef __SSE2__
+	#define VM_VEC_I(expr) \
+		for (; k + 2 <= n; k += 2) { \
+			__m128i x = sb ? _mm_loadu_si128((const __m128i*)&b[k]) : _mm_set1_epi64x(b->i); \
+			__m128i y = sc ? _mm_loadu_si128((const __m128i*)&c[k]) : _mm_set1_epi64x(c->i); \
+			(void)y; \
+			_mm_storeu_si128((__m128i*)&a[k], expr); \
+		}
+	#define VM_VEC_F(expr) \
+		for (; k + 2 <= n; k += 2) { \
+			__m128d x = sb ? _mm_loadu_pd(&b[k].f) : _mm_set1_pd(b->f); \
+			__m128d y = sc ? _mm_loadu_pd(&c[k].f) : _mm_set1_pd(c->f); \
+			_mm_storeu_pd(&a[k].f, expr); \
+		}
+	switch (op) {
+		case OP_VMOV: VM_VEC_I(x); break;
+		case OP_VADDI: VM_VEC_I(_mm_add_epi64(x, y)); break;
+		case OP_VSUBI: VM_VEC_I(_mm_sub_epi64(x, y)); break;
+		case OP_VADDF: VM_VEC_F(_mm_add_pd(x, y)); break;
+		case OP_VSUBF: VM_VEC_F(_mm_sub_pd(x, y)); break;
+		case OP_VMULF: VM_VEC_F(_mm_mul_pd(x, y)); break;
+		case OP_VDIVF: VM_VEC_F(_mm_div_pd(x, y)); break;
+	}
+	#undef VM_VEC_F
+	#undef VM_VEC_I
+	#endif
+
+	for (; k < n; k++) {
+		union vm_value x = b[k*sb];
+		union vm_value y = c[k*sc];
+		switch (op) {
+			case OP_VMOV: a[k] = x; break;
+			case OP_VADDI: a[k].i = VM_WRAP(x.i, +, y.i); break;
+			case OP_VSUBI: a[k].i = VM_WRAP(x.i, -, y.i); break;
+			case OP_VADDF: a[k].f = x.f + y.f; break;
+			case OP_VSUBF: a[k].f = x.f - y.f; break;
+			case OP_VMULF: a[k].f = x.f * y.f; break;
+			case OP_VDIVF: a[k].f = x.f / y.f; break;
+			default: assert(0);
+		}
+	}
+}
+
+static int vm_run(struct vm* vm, int func)
+{
+	struct vm_func* funcs = vm->prog->funcs;
+	const union vm_value* K = vm->prog->consts;
+	union vm_value* G = vm->globals;
+	union vm_value* R = vm->regs;
+	union vm_value* regs_end = vm->regs + VM_MAX_REGS;
+	struct vm_frame* frame = vm->frames;
+	struct vm_frame* frames_end = vm->frames + VM_MAX_FRAMES;
+	const uint32_t* pc = funcs[func].code;
+	uint32_t ins;
+
+	if (R + funcs[func].n_regs > regs_end) return VM_ERR_STACK_OVERFLOW;
+
+	#define RA (R[INS_A(ins)])
+	#define RB (R[INS_B(ins)])
+	#define RC (R[INS_C(ins)])
+
+	#ifdef VM_COMPUTED_GOTO
+	static const void* dispatch[] = {
+		#define X(op) &&L_##op,
+		VM_OPS(X)
+		#undef X
+	};
+	#define VM_CASE(op) L_##op:
+	#define VM_NEXT do { ins = *pc++; goto *dispatch[INS_OP(ins)]; } while (0)
+	#define VM_DISPATCH VM_NEXT;
+	#define VM_DISPATCH_END
+	#else
+	#define VM_CASE(op) case op:
+	#define VM_NEXT continue
+	#define VM_DISPATCH for (;;) { ins = *pc++; switch (INS_OP(ins)) {
+	#define VM_DISPATCH_END default: assert(!"bad opcode"); } }
+	#endif
+
+	VM_DISPATCH
+
+	VM_CASE(OP_MOV) RA = RB; VM_NEXT;
+	VM_CASE(OP_LOADI) RA.i = INS_SBX(ins); VM_NEXT;
+	VM_CASE(OP_LOADK) RA = K[INS_BX(ins)]; VM_NEXT;
+	VM_CASE(OP_GETG) RA = G[INS_BX(ins)]; VM_NEXT;
+	VM_CASE(OP_SETG) G[INS_BX(ins)] = RA; VM_NEXT;
+
+	VM_CASE(OP_ADDI) RA.i = VM_WRAP(RB.i, +, RC.i); VM_NEXT;
+	VM_CASE(OP_SUBI) RA.i = VM_WRAP(RB.i, -, RC.i); VM_NEXT;
+	VM_CASE(OP_MULI) RA.i = VM_WRAP(RB.i, *, RC.i); VM_NEXT;
+	VM_CASE(OP_DIVI) RA.i = vm_divi(RB.i, RC.i); VM_NEXT;
+	VM_CASE(OP_NEGI) RA.i = VM_WRAP(0, -, RB.i); VM_NEXT;
+	VM_CASE(OP_EQI) RA.i = RB.i == RC.i; VM_NEXT;
+	VM_CASE(OP_NEI) RA.i = RB.i != RC.i; VM_NEXT;
+
+	VM_CASE(OP_ADDF) RA.f = RB.f + RC.f; VM_NEXT;
+	VM_CASE(OP_SUBF) RA.f = RB.f - RC.f; VM_NEXT;
+	VM_CASE(OP_MULF) RA.f = RB.f * RC.f; VM_NEXT;
+	VM_CASE(OP_DIVF) RA.f = RB.f / RC.f; VM_NEXT;
+	VM_CASE(OP_NEGF) RA.f = -RB.f; VM_NEXT;
+	VM_CASE(OP_EQF) RA.i = RB.f == RC.f; VM_NEXT;
+	VM_CASE(OP_NEF) RA.i = RB.f != RC.f; VM_NEXT;
+
+	VM_CASE(OP_ITOF) RA.f = RB.i; VM_NEXT;
+	VM_CASE(OP_FTOI) RA.i = RB.f; VM_NEXT;
+
+	VM_CASE(OP_CHECK) if ((uint64_t)RA.i >= INS_BX(ins)) return VM_ERR_INDEX; VM_NEXT;
+	VM_CASE(OP_GETX) RA = R[INS_B(ins) + RC.i]; pc++; VM_NEXT;
+	VM_CASE(OP_SETX) R[INS_A(ins) + RB.i] = RC; pc++; VM_NEXT;
+	VM_CASE(OP_GETGX) RA = G[INS_BX(ins) + RA.i]; VM_NEXT;
+	VM_CASE(OP_SETGX) G[INS_BX(ins) + RA.i] = R[INS_A(*pc)]; pc++; VM_NEXT;
+
+	VM_CASE(OP_VMOV)
+	VM_CASE(OP_VADDI)
+	VM_CASE(OP_VSUBI)
+	VM_CASE(OP_VADDF)
+	VM_CASE(OP_VSUBF)
+	VM_CASE(OP_VMULF)
+	VM_CASE(OP_VDIVF) {
+		uint32_t arg = *pc++;
+		vm_vector(INS_OP(ins), &RA, &RB, &RC, INS_A(arg), INS_BX(arg));
+		VM_NEXT;
+	}
+	VM_CASE(OP_VGETG) memcpy(&RA, &G[INS_BX(ins)], INS_BX(*pc) * sizeof(*G)); pc++; VM_NEXT;
+	VM_CASE(OP_VSETG) memcpy(&G[INS_BX(ins)], &RA, INS_BX(*pc) * sizeof(*G)); pc++; VM_NEXT;
+	VM_CASE(OP_ARG) assert(!"OP_ARG executed"); VM_NEXT;
+
+	VM_CASE(OP_JMP) pc += INS_SBX(ins); VM_NEXT;
+	VM_CASE(OP_JZ) if (RA.i == 0) pc += INS_SBX(ins); VM_NEXT;
+	VM_CASE(OP_JNZ) if (RA.i != 0) pc += INS_SBX(ins); VM_NEXT;
+
+	VM_CASE(OP_CALL) {
+		struct vm_func* callee = &funcs[INS_BX(ins)];
+		union vm_value* base = &RA;
+		if (frame + 1 == frames_end || base + callee->n_regs > regs_end) {
+			return VM_ERR_STACK_OVERFLOW;
+		}
+		frame->pc = pc;
+		frame->R = R;
+		frame++;
+		R = base;
+		pc = callee->code;
+		VM_NEXT;
+	}
+
+	VM_CASE(OP_RET) {
+		int a = INS_A(ins);
+		int n = INS_B(ins);
+		for (int i = 0; i < n; i++) R[i] = R[a+i];
+		if (frame == vm->frames) return VM_OK;
+		frame--;
+		pc = frame->pc;
+		R = frame->R;
+		VM_NEXT;
+	}
+
+	VM_DISPATCH_END
+
+	#undef VM_DISPATCH_END
+	#undef VM_DISPATCH
+	#undef VM_NEXT
+	#undef VM_CASE
+	#undef RC
+	#undef RB
+	#undef RA
+
+	return VM_OK;
+}
+
+// prog must outlive vm. runs the global initializers
+static int vm_init(struct vm* vm, struct vm_prog* prog)
+{
+	memset(vm, 0, sizeof(*vm));
+	vm->prog = prog;
+	vm->globals = calloc(prog->n_global_slots + 1, sizeof(*vm->globals));
+	vm->regs = calloc(VM_MAX_REGS, sizeof(*vm->regs));
+	vm->frames = calloc(VM_MAX_FRAMES, sizeof(*vm->frames));
+	assert(vm->globals != NULL && vm->regs != NULL && vm->frames != NULL);
+	if (prog->init_func == -1) return VM_OK;
+	return vm_run(vm, prog->init_func);
+}
+
+static void vm_free(struct vm* vm)
+{
+	free(vm->globals);
+	free(vm->regs);
+	free(vm->frames);
+}
+
+// calls function func with args (func's n_arg_slots values), and stores its
+// n_ret_slots return values in rets (unless NULL)
+static int vm_call(struct vm* vm, int func, const union vm_value* args, union vm_value* rets)
+{
+	struct vm_func* fn = &vm->prog->funcs[func];
+	if (fn->n_arg_slots > 0) memcpy(vm->regs, args, fn->n_arg_slots * sizeof(*args));
+	int status = vm_run(vm, func);
+	if (status == VM_OK && rets != NULL) memcpy(rets, vm->regs, fn->n_ret_slots * sizeof(*rets));
+	return status;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// SSA
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+SSA form between the checked tree and the bytecode, used by vm_compile()
+for every function it can take and that has no vectorized loop (unless
+VMC_NO_SSA is given). a function is built straight from the tree into
+basic blocks with phis (Braun et al., "Simple and Efficient Construction of
+Static Single Assignment Form"); the slots of local variables become
+values, while globals stay in memory behind GETG/SETG. then
+
+  constprop  folds operations on constants, constant branches and index
+             checks, and drops the blocks nothing reaches any more
+  copyprop   forwards copies, and phis with one distinct operand
+  cse        merges identical pure operations along the dominator tree
+  licm       hoists loop invariant pure operations into loop preheaders
+  dce        drops whatever no side effect depends on
+
+each reporting instruction counts before and after (see
+vm_print_ssa_reports()). the result goes back out of SSA with parallel
+copies on the edges into phis and is lowered to bytecode through a linear
+scan over live intervals, so the interpreter and the JIT run the same
+optimized code.
+
+values are read where the tree compiler reads them (variable operands of
+binary operators in place, after the other operand), so both compilers give
+the same results. functions indexing locals at run time can't have those
+locals as values; they're left to the tree compiler, which is also where
+such loops get vectorized. calls are made above every register in use, so
+frames may be bigger than the tree compiler's
+*/
+
+#define SSA_OPS(X) \
+	X(SSA_CONST)  /* imm */ \
+	X(SSA_ARG)    /* argument slot aux */ \
+	X(SSA_PHI)    /* one operand per predecessor, in the same order */ \
+	X(SSA_COPY) \
+	X(SSA_ADDI)   /* same order as OP_ADDI..OP_FTOI */ \
+	X(SSA_SUBI) \
+	X(SSA_MULI) \
+	X(SSA_DIVI) \
+	X(SSA_NEGI) \
+	X(SSA_EQI) \
+	X(SSA_NEI) \
+	X(SSA_ADDF) \
+	X(SSA_SUBF) \
+	X(SSA_MULF) \
+	X(SSA_DIVF) \
+	X(SSA_NEGF) \
+	X(SSA_EQF) \
+	X(SSA_NEF) \
+	X(SSA_ITOF) \
+	X(SSA_FTOI) \
+	X(SSA_GETG)   /* G[aux] */ \
+	X(SSA_SETG)   /* G[aux] = a0 */ \
+	X(SSA_GETGX)  /* G[aux+a0] */ \
+	X(SSA_SETGX)  /* G[aux+a0] = a1 */ \
+	X(SSA_CHECK)  /* fail with VM_ERR_INDEX unless 0 <= a0 < aux */ \
+	X(SSA_CALL)   /* call function aux with the operands as argument slots */ \
+	X(SSA_RESULT) /* return slot aux of the call right before */ \
+	X(SSA_JMP)    /* to succ[0] */ \
+	X(SSA_BR)     /* to succ[0] if a0 != 0, else to succ[1] */ \
+	X(SSA_RET)    /* returns the operands */
+
+enum ssa_op {
+	#define X(op) op,
+	SSA_OPS(X)
+	#undef X
+};
+
+static const char* ssa_op_names[] = {
+	#define X(op) #op,
+	SSA_OPS(X)
+	#undef X
+};
+
+// no side effects, no memory, can't fail
+static inline int ssa_is_pure(int op)
+{
+	return op == SSA_CONST || (op >= SSA_ADDI && op <= SSA_FTOI);
+}
+
+static inline int ssa_is_unary(int op)
+{
+	return op == SSA_NEGI || op == SSA_NEGF || op == SSA_ITOF || op == SSA_FTOI;
+}
+
+struct ssa_ins {
+	uint8_t op;
+	uint8_t kind; // SEM_INT or SEM_FLOAT if it's a value, 0 otherwise
+	uint8_t dead;
+	int block;
+	int aux; // see SSA_OPS
+	union vm_value imm;
+	int n_args;
+	int* args;
+	int repl; // what it was replaced by, or -1
+
+	// lowering
+	int pos;
+	int start, end; // live interval
+	int reg;
+};
+
+struct ssa_block {
+	int* ins; // phis first, terminator last
+	int n_ins, cap_ins;
+	int* preds;
+	int n_preds, cap_preds;
+	int succ[2];
+	int n_succ;
+	int sealed; // all predecessors are known
+	int dead;
+
+	int rpo; // position in struct ssa's order, or -1 if unreachable
+	int idom;
+	int start, end; // positions of the first and past the last instruction
+	uint64_t* live_in;
+	uint64_t* live_out;
+};
+
+// the value of a variable at the end of a block
+struct ssa_def {
+	uint64_t key; // (block << 32 | var) + 1, or 0 if free
+	int value;
+};
+
+// phi added to a block before all its predecessors were known
+struct ssa_incomplete {
+	int block, var, phi;
+};
+
+struct ssa {
+	struct vm_compiler* c; // globals and functions are bound there
+	int func;
+	struct arena arena; // operands, scratch value lists, liveness
+
+	struct dynary ins_dy;
+	struct ssa_ins* ins;
+	struct dynary blocks_dy;
+	struct ssa_block* blocks; // the entry is block 0
+
+	// scopes are stacked; a VMB_LOCAL index is the variable of its first
+	// slot
+	struct dynary bindings_dy;
+	struct vm_binding* bindings;
+	struct dynary vars_dy;
+	int* vars; // kind of each variable
+
+	struct ssa_def* defs;
+	int defs_cap, n_defs;
+	struct dynary incomplete_dy;
+	struct ssa_incomplete* incomplete;
+
+	int cur; // block being built
+	int break_block, continue_block;
+
+	// binary operations being built; see sexpr_push_chain()
+	struct dynary chain_dy;
+	struct sexpr** chain;
+
+	// reachable blocks in reverse postorder; see ssa_order()
+	struct dynary order_dy;
+	int* order;
+
+	const char* reject; // why the function is left to the tree compiler
+};
+
+static void ssa__push(int** v, int* n, int* cap, int x)
+{
+	if (*n == *cap) {
+		*cap = *cap > 0 ? *cap * 2 : 4;
+		*v = realloc(*v, *cap * sizeof(**v));
+		assert(*v != NULL);
+	}
+	(*v)[(*n)++] = x;
+}
+
+static void ssa__insert(int** v, int* n, int* cap, int at, int x)
+{
+	ssa__push(v, n, cap, x);
+	memmove(*v + at + 1, *v + at, (*n - at - 1) * sizeof(**v));
+	(*v)[at] = x;
+}
+
+static void ssa_init(struct ssa* s, struct vm_compiler* c, int func)
+{
+	memset(s, 0, sizeof(*s));
+	s->c = c;
+	s->func = func;
+	arena_init(&s->arena);
+	dynary_init(&s->ins_dy, (void**) &s->ins, sizeof(*s->ins));
+	dynary_init(&s->blocks_dy, (void**) &s->blocks, sizeof(*s->blocks));
+	dynary_init(&s->bindings_dy, (void**) &s->bindings, sizeof(*s->bindings));
+	dynary_init(&s->vars_dy, (void**) &s->vars, sizeof(*s->vars));
+	dynary_init(&s->incomplete_dy, (void**) &s->incomplete, sizeof(*s->incomplete));
+	dynary_init(&s->order_dy, (void**) &s->order, sizeof(*s->order));
+	dynary_init(&s->chain_dy, (void**) &s->chain, sizeof(*s->chain));
+	s->break_block = s->continue_block = -1;
+
+	// globals and functions
+	for (int i = 0; i < c->bindings_dy.n; i++) *(struct vm_binding*)dynary_append(&s->bindings_dy) = c->bindings[i];
+}
+
+static void ssa_free(struct ssa* s)
+{
+	for (int i = 0; i < s->blocks_dy.n; i++) {
+		free(s->blocks[i].ins);
+		free(s->blocks[i].preds);
+	}
+	free(s->ins);
+	free(s->blocks);
+	free(s->bindings);
+	free(s->vars);
+	free(s->defs);
+	free(s->incomplete);
+	free(s->order);
+	free(s->chain);
+	arena_free(&s->arena);
+}
+
+static int* ssa__alloc(struct ssa* s, int n)
+{
+	return arena_alloc(&s->arena, (n > 0 ? n : 1) * sizeof(int));
+}
+
+static int ssa_new_block(struct ssa* s)
+{
+	struct ssa_block* b = dynary_append(&s->blocks_dy);
+	memset(b, 0, sizeof(*b));
+	b->rpo = -1;
+	return s->blocks_dy.n - 1;
+}
+
+static int ssa__new(struct ssa* s, int op, int kind, int n_args)
+{
+	struct ssa_ins* i = dynary_append(&s->ins_dy);
+	memset(i, 0, sizeof(*i));
+	i->op = op;
+	i->kind = kind;
+	i->n_args = n_args;
+	i->args = n_args > 0 ? ssa__alloc(s, n_args) : NULL;
+	i->block = -1;
+	i->repl = -1;
+	return s->ins_dy.n - 1;
+}
+
+// appends an instruction to block
+static int ssa_emit_in(struct ssa* s, int block, int op, int kind, int n_args)
+{
+	int id = ssa__new(s, op, kind, n_args);
+	s->ins[id].block = block;
+	struct ssa_block* b = &s->blocks[block];
+	ssa__push(&b->ins, &b->n_ins, &b->cap_ins, id);
+	return id;
+}
+
+static int ssa_emit(struct ssa* s, int op, int kind, int n_args)
+{
+	return ssa_emit_in(s, s->cur, op, kind, n_args);
+}
+
+static int ssa_const(struct ssa* s, int kind, union vm_value v)
+{
+	int id = ssa_emit(s, SSA_CONST, kind, 0);
+	s->ins[id].imm = v;
+	return id;
+}
+
+static int ssa_op1(struct ssa* s, int op, int kind, int a)
+{
+	int id = ssa_emit(s, op, kind, 1);
+	s->ins[id].args[0] = a;
+	return id;
+}
+
+static int ssa_op2(struct ssa* s, int op, int kind, int a, int b)
+{
+	int id = ssa_emit(s, op, kind, 2);
+	s->ins[id].args[0] = a;
+	s->ins[id].args[1] = b;
+	return id;
+}
+
+static int ssa_terminated(struct ssa* s, int block)
+{
+	struct ssa_block* b = &s->blocks[block];
+	if (b->n_ins == 0) return 0;
+	int op = s->ins[b->ins[b->n_ins-1]].op;
+	return op == SSA_JMP || op == SSA_BR || op == SSA_RET;
+}
+
+static void ssa__edge(struct ssa* s, int from, int to)
+{
+	struct ssa_block* b = &s->blocks[from];
+	b->succ[b->n_succ++] = to;
+	struct ssa_block* t = &s->blocks[to];
+	assert(!t->sealed);
+	ssa__push(&t->preds, &t->n_preds, &t->cap_preds, from);
+}
+
+// ends the current block, unless a return or a jump already did
+static void ssa_jump(struct ssa* s, int to)
+{
+	if (ssa_terminated(s, s->cur)) return;
+	ssa_emit(s, SSA_JMP, 0, 0);
+	ssa__edge(s, s->cur, to);
+}
+
+static void ssa_branch(struct ssa* s, int cond, int t, int f)
+{
+	ssa_op1(s, SSA_BR, 0, cond);
+	ssa__edge(s, s->cur, t);
+	ssa__edge(s, s->cur, f);
+}
+
+
+// variables (Braun et al.)
+
+static int ssa__def_find(struct ssa* s, uint64_t key)
+{
+	uint32_t mask = s->defs_cap - 1;
+	uint32_t h = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+	while (s->defs[h].key != 0 && s->defs[h].key != key) h = (h+1) & mask;
+	return h;
+}
+
+static void ssa_write(struct ssa* s, int var, int block, int value)
+{
+	if (2 * (s->n_defs + 1) > s->defs_cap) {
+		struct ssa_def* old = s->defs;
+		int old_cap = s->defs_cap;
+		s->defs_cap = old_cap > 0 ? old_cap * 2 : 64;
+		s->defs = calloc(s->defs_cap, sizeof(*s->defs));
+		assert(s->defs != NULL);
+		for (int i = 0; i < old_cap; i++) {
+			if (old[i].key != 0) s->defs[ssa__def_find(s, old[i].key)] = old[i];
+		}
+		free(old);
+	}
+	uint64_t key = ((uint64_t)block << 32 | (uint32_t)var) + 1;
+	int h = ssa__def_find(s, key);
+	if (s->defs[h].key == 0) {
+		s->defs[h].key = key;
+		s->n_defs++;
+	}
+	s->defs[h].value = value;
+}
+
+static int ssa_new_phi(struct ssa* s, int block, int kind)
+{
+	int id = ssa__new(s, SSA_PHI, kind, 0);
+	s->ins[id].block = block;
+	struct ssa_block* b = &s->blocks[block];
+	int at = 0;
+	while (at < b->n_ins && s->ins[b->ins[at]].op == SSA_PHI) at++;
+	ssa__insert(&b->ins, &b->n_ins, &b->cap_ins, at, id);
+	return id;
+}
+
+static int ssa_read(struct ssa* s, int var, int block);
+
+static void ssa__phi_operands(struct ssa* s, int phi, int var)
+{
+	int block = s->ins[phi].block;
+	int n = s->blocks[block].n_preds;
+	int* args = ssa__alloc(s, n);
+	for (int i = 0; i < n; i++) args[i] = ssa_read(s, var, s->blocks[block].preds[i]);
+	s->ins[phi].args = args;
+	s->ins[phi].n_args = n;
+}
+
+static int ssa__read_rec(struct ssa* s, int var, int block)
+{
+	int kind = s->vars[var];
+	int v;
+	if (!s->blocks[block].sealed) {
+		v = ssa_new_phi(s, block, kind);
+		struct ssa_incomplete* inc = dynary_append(&s->incomplete_dy);
+		inc->block = block;
+		inc->var = var;
+		inc->phi = v;
+	} else if (s->blocks[block].n_preds == 1) {
+		v = ssa_read(s, var, s->blocks[block].preds[0]);
+	} else if (s->blocks[block].n_preds == 0) {
+		// only in code nothing jumps to
+		v = ssa__new(s, SSA_CONST, kind, 0);
+		s->ins[v].block = block;
+		struct ssa_block* b = &s->blocks[block];
+		ssa__insert(&b->ins, &b->n_ins, &b->cap_ins, 0, v);
+	} else {
+		v = ssa_new_phi(s, block, kind);
+		ssa_write(s, var, block, v); // ends cycles through loops
+		ssa__phi_operands(s, v, var);
+	}
+	ssa_write(s, var, block, v);
+	return v;
+}
+
+// the value of var at the end of block (so far)
+static int ssa_read(struct ssa* s, int var, int block)
+{
+	if (s->defs_cap > 0) {
+		uint64_t key = ((uint64_t)block << 32 | (uint32_t)var) + 1;
+		int h = ssa__def_find(s, key);
+		if (s->defs[h].key == key) return s->defs[h].value;
+	}
+	return ssa__read_rec(s, var, block);
+}
+
+// to be called once nothing else will jump to block
+static void ssa_seal(struct ssa* s, int block)
+{
+	s->blocks[block].sealed = 1;
+	for (int i = 0; i < s->incomplete_dy.n; i++) {
+		struct ssa_incomplete inc = s->incomplete[i];
+		if (inc.block == block) ssa__phi_operands(s, inc.phi, inc.var);
+	}
+	int n = 0;
+	for (int i = 0; i < s->incomplete_dy.n; i++) {
+		if (s->incomplete[i].block != block) s->incomplete[n++] = s->incomplete[i];
+	}
+	s->incomplete_dy.n = n;
+}
+
+static uint8_t* ssa__kinds(struct sem_type* t, uint8_t* out)
+{
+	switch (t->kind) {
+		case SEM_STRUCT:
+			for (int i = 0; i < t->n; i++) out = ssa__kinds(t->fields[i].type, out);
+			return out;
+		case SEM_ARRAY:
+			for (int i = 0; i < t->n; i++) out = ssa__kinds(t->elem, out);
+			return out;
+		case SEM_VOID:
+			return out;
+		default:
+			*out++ = t->kind;
+			return out;
+	}
+}
+
+// the kind of each slot of t
+static uint8_t* ssa_kinds(struct ssa* s, struct sem_type* t)
+{
+	uint8_t* kinds = arena_alloc(&s->arena, t->n_slots + 1);
+	ssa__kinds(t, kinds);
+	return kinds;
+}
+
+// returns the variable of the first slot
+static int ssa_new_vars(struct ssa* s, struct sem_type* t)
+{
+	int var = s->vars_dy.n;
+	uint8_t* kinds = ssa_kinds(s, t);
+	for (int i = 0; i < t->n_slots; i++) *(int*)dynary_append(&s->vars_dy) = kinds[i];
+	return var;
+}
+
+
+// builder
+
+static struct vm_binding* ssa_lookup(struct ssa* s, uint32_t sym)
+{
+	for (int i = s->bindings_dy.n - 1; i >= 0; i--) {
+		if (s->bindings[i].sym == sym) return &s->bindings[i];
+	}
+	return NULL;
+}
+
+static void ssa_bind(struct ssa* s, struct sexpr* name, int var, struct sem_type* type)
+{
+	struct vm_binding* b = dynary_append(&s->bindings_dy);
+	memset(b, 0, sizeof(*b));
+	b->sym = name->atom.sym;
+	b->kind = VMB_LOCAL;
+	b->index = var;
+	b->type = type;
+}
+
+static struct sem_type* ssa_expr(struct ssa* s, struct sexpr* e, int** vals);
+
+static struct sem_type* ssa_scalar(struct ssa* s, struct sexpr* e, int* v)
+{
+	int* vals;
+	struct sem_type* t = ssa_expr(s, e, &vals);
+	*v = vals[0];
+	return t;
+}
+
+// applies the index idx to loc, which must be an array; like vmc_index(),
+// except that loc->dyn is a value
+static void ssa_index(struct ssa* s, struct vm_loc* loc, struct sexpr* idx, int emit)
+{
+	struct sem_type* t = loc->type;
+	struct sem_type* elem = t->elem;
+	assert(t->kind == SEM_ARRAY);
+	loc->type = elem;
+	if (sexpr_is_atom(idx) && idx->atom.type == T_NUMBER) {
+		union vm_value v;
+		sem_number(&s->c->prog->sem, &idx->atom, &v);
+		loc->index += v.i * elem->n_slots;
+		return;
+	}
+	if (!emit) {
+		loc->dyn = VM_LOC_PENDING;
+		return;
+	}
+	if (loc->kind != VMB_GLOBAL) {
+		s->reject = "indexes a local at run time";
+		return;
+	}
+	int r;
+	ssa_scalar(s, idx, &r);
+	int check = ssa_op1(s, SSA_CHECK, 0, r);
+	s->ins[check].aux = t->n;
+	if (elem->n_slots != 1) {
+		int k = ssa_const(s, SEM_INT, (union vm_value){ .i = elem->n_slots });
+		r = ssa_op2(s, SSA_MULI, SEM_INT, r, k);
+	}
+	if (loc->dyn >= 0) r = ssa_op2(s, SSA_ADDI, SEM_INT, loc->dyn, r);
+	loc->dyn = r;
+}
+
+// like vmc_loc(); VMB_LOCAL indices are variables
+static int ssa_loc(struct ssa* s, struct sexpr* e, struct vm_loc* loc, int emit)
+{
+	memset(loc, 0, sizeof(*loc));
+	loc->dyn = -1;
+	if (sexpr_is_atom(e)) {
+		if (e->atom.type == T_NUMBER) {
+			loc->kind = VMB_CONST;
+			loc->type = sem_number(&s->c->prog->sem, &e->atom, &loc->value);
+			return 1;
+		}
+		if (e->atom.type != T_IDENTIFIER) return 0;
+		struct vm_binding* b = ssa_lookup(s, e->atom.sym);
+		if (b == NULL || (b->kind != VMB_LOCAL && b->kind != VMB_GLOBAL)) {
+			vmc_errf(s->c, "'%.*s' is not a value", (int)e->atom.str.len, e->atom.str.ptr);
+			return 0;
+		}
+		loc->kind = b->kind;
+		loc->index = b->index;
+		loc->type = b->type;
+		return 1;
+	}
+
+	struct sexpr* head = e->list;
+	if (sexpr_is_tt(head, T_DOT)) {
+		if (!ssa_loc(s, head->next, loc, emit)) return 0;
+		struct sem_field* f = vmc_field(s->c, loc->type, head->next->next);
+		loc->index += f->slot;
+		loc->type = f->type;
+		return 1;
+	}
+	if (sexpr_is_tt(head, T_LBRACKET)) {
+		if (!ssa_loc(s, head->next, loc, emit)) return 0;
+		ssa_index(s, loc, head->next->next, emit);
+		return 1;
+	}
+	return 0;
+}
+
+static int ssa_is_var(struct ssa* s, struct sexpr* e)
+{
+	struct vm_loc loc;
+	return ssa_loc(s, e, &loc, 0) && loc.kind == VMB_LOCAL && loc.dyn == -1;
+}
+
+static int* ssa_load(struct ssa* s, struct vm_loc* loc)
+{
+	int n = loc->type->n_slots;
+	int* vals = ssa__alloc(s, n);
+	uint8_t* kinds = ssa_kinds(s, loc->type);
+	for (int i = 0; i < n; i++) {
+		switch (loc->kind) {
+			case VMB_LOCAL:
+				vals[i] = ssa_read(s, loc->index + i, s->cur);
+				break;
+			case VMB_GLOBAL:
+				if (loc->dyn == -1) {
+					vals[i] = ssa_emit(s, SSA_GETG, kinds[i], 0);
+				} else {
+					vals[i] = ssa_op1(s, SSA_GETGX, kinds[i], loc->dyn);
+				}
+				s->ins[vals[i]].aux = loc->index + i;
+				break;
+			case VMB_CONST:
+				vals[i] = ssa_const(s, loc->type->kind, loc->value);
+				break;
+			default:
+				assert(0);
+		}
+	}
+	return vals;
+}
+
+static void ssa_store(struct ssa* s, struct vm_loc* loc, int* vals)
+{
+	for (int i = 0; i < loc->type->n_slots; i++) {
+		if (loc->kind == VMB_LOCAL) {
+			ssa_write(s, loc->index + i, s->cur, vals[i]);
+			continue;
+		}
+		int id;
+		if (loc->dyn >= 0) {
+			id = ssa_op2(s, SSA_SETGX, 0, loc->dyn, vals[i]);
+		} else {
+			id = ssa_op1(s, SSA_SETG, 0, vals[i]);
+		}
+		s->ins[id].aux = loc->index + i;
+	}
+}
+
+// converts the scalar v; explicit conversions between types of the same
+// kind copy, like the tree compiler's moves
+static int ssa_convert(struct ssa* s, int v, struct sem_type* from, struct sem_type* to, int explicit)
+{
+	if (from->kind == to->kind) return explicit ? ssa_op1(s, SSA_COPY, to->kind, v) : v;
+	if (from->kind == SEM_INT && to->kind == SEM_FLOAT) return ssa_op1(s, SSA_ITOF, SEM_FLOAT, v);
+	if (from->kind == SEM_FLOAT && to->kind == SEM_INT) return ssa_op1(s, SSA_FTOI, SEM_INT, v);
+	vmc_errf(s->c, "type mismatch");
+	return v;
+}
+
+static struct sem_type* ssa_assign(struct ssa* s, struct sexpr* e, int** vals)
+{
+	struct sexpr* lhs = e->list->next;
+	struct sexpr* rhs = lhs->next;
+	struct vm_loc loc;
+	if (!ssa_loc(s, lhs, &loc, 1) || loc.kind == VMB_CONST) {
+		vmc_errf(s->c, "cannot assign to this");
+		return NULL;
+	}
+	struct sem_type* t = ssa_expr(s, rhs, vals);
+	if (t->kind != loc.type->kind) {
+		int v = ssa_convert(s, (*vals)[0], t, loc.type, 0);
+		*vals = ssa__alloc(s, 1);
+		(*vals)[0] = v;
+	}
+	ssa_store(s, &loc, *vals);
+	return loc.type;
+}
+
+static struct sem_type* ssa_call(struct ssa* s, struct sexpr* e, int** vals)
+{
+	struct sexpr* head = e->list;
+	struct vm_binding* b = ssa_lookup(s, head->atom.sym);
+	if (b == NULL || b->kind != VMB_FUNC) {
+		vmc_errf(s->c, "'%.*s' is not a function", (int)head->atom.str.len, head->atom.str.ptr);
+		return NULL;
+	}
+	int fi = b->index;
+	struct vm_func* fn = &s->c->prog->funcs[fi];
+	int* args = ssa__alloc(s, fn->n_arg_slots);
+	int n = 0;
+	int i = 0;
+	for (struct sexpr* arg = head->next; arg != NULL; arg = arg->next, i++) {
+		struct sem_type* want = fn->arg_types[i];
+		int* v;
+		struct sem_type* t = ssa_expr(s, arg, &v);
+		if (t->kind != want->kind) args[n] = ssa_convert(s, v[0], t, want, 0);
+		else memcpy(args + n, v, want->n_slots * sizeof(*v));
+		n += want->n_slots;
+	}
+	int call = ssa_emit(s, SSA_CALL, 0, n);
+	memcpy(s->ins[call].args, args, n * sizeof(*args));
+	s->ins[call].aux = fi;
+
+	struct sem_type* t = fn->n_rets > 0 ? fn->ret_types[0] : &sem_void;
+	uint8_t* kinds = ssa_kinds(s, t);
+	*vals = ssa__alloc(s, t->n_slots);
+	for (int i = 0; i < t->n_slots; i++) {
+		(*vals)[i] = ssa_emit(s, SSA_RESULT, kinds[i], 0);
+		s->ins[(*vals)[i]].aux = i;
+	}
+	return t;
+}
+
+static int ssa_binop(struct ssa* s, enum token_type tt, int is_float)
+{
+	switch (tt) {
+		case T_PLUS: return is_float ? SSA_ADDF : SSA_ADDI;
+		case T_MINUS: return is_float ? SSA_SUBF : SSA_SUBI;
+		case T_MUL: return is_float ? SSA_MULF : SSA_MULI;
+		case T_DIV: return is_float ? SSA_DIVF : SSA_DIVI;
+		case T_EQ: return is_float ? SSA_EQF : SSA_EQI;
+		case T_NEQ: return is_float ? SSA_NEF : SSA_NEI;
+		default:
+			vmc_errf(s->c, "unsupported operator");
+			return 0;
+	}
+}
+
+// builds the binary operation e, and the chain of them down its left
+// operands, bottom up, into *val; returns its type
+static struct sem_type* ssa_binary(struct ssa* s, struct sexpr* e, int* val)
+{
+	int base = s->chain_dy.n;
+	struct sexpr* ea = sexpr_push_chain(&s->chain_dy, e);
+	// a variable on the left is read in place, after the right hand side,
+	// as by the tree compiler: (x + (x = 1)) is 2
+	int late = ssa_is_var(s, ea);
+	int a = 0;
+	struct sem_type* ta = NULL;
+	if (!late) ta = ssa_scalar(s, ea, &a);
+	for (int i = s->chain_dy.n - 1; i >= base; i--) {
+		enum token_type tt = s->chain[i]->list->atom.type;
+		int b;
+		struct sem_type* tb = ssa_scalar(s, s->chain[i]->list->next->next, &b);
+		if (late) ta = ssa_scalar(s, ea, &a);
+		late = 0;
+		if (!sem_type_is_scalar(ta) || !sem_type_is_scalar(tb)) {
+			vmc_errf(s->c, "expected numbers");
+			return NULL;
+		}
+		struct sem_type* t = sem_arith_type(ta, tb);
+		a = ssa_convert(s, a, ta, t, 0);
+		b = ssa_convert(s, b, tb, t, 0);
+		int is_cmp = tt == T_EQ || tt == T_NEQ;
+		a = ssa_op2(s, ssa_binop(s, tt, t->kind == SEM_FLOAT), is_cmp ? SEM_INT : t->kind, a, b);
+		ta = is_cmp ? sem_builtin(T_BOOL) : t;
+	}
+	s->chain_dy.n = base;
+	*val = a;
+	return ta;
+}
+
+// sets *vals to the values of the slots of e and returns its type
+static struct sem_type* ssa_expr(struct ssa* s, struct sexpr* e, int** vals)
+{
+	struct vm_loc loc;
+	if (ssa_loc(s, e, &loc, 0)) {
+		if (loc.dyn != -1) ssa_loc(s, e, &loc, 1);
+		*vals = ssa_load(s, &loc);
+		return loc.type;
+	}
+
+	if (sexpr_is_atom(e) || e->list == NULL || !sexpr_is_atom(e->list)) {
+		vmc_errf(s->c, "unexpected expression");
+		return NULL;
+	}
+	struct sexpr* head = e->list;
+	enum token_type tt = head->atom.type;
+	int n_args = sexpr_list_len(e) - 1;
+
+	if (tt == T_DOT) {
+		// member of something that isn't a variable, e.g. a call result
+		struct sem_type* t = ssa_expr(s, head->next, vals);
+		struct sem_field* f = vmc_field(s->c, t, head->next->next);
+		*vals += f->slot;
+		return f->type;
+	}
+
+	if (tt == T_LBRACKET) {
+		struct sem_type* t = ssa_expr(s, head->next, vals);
+		struct sexpr* idx = head->next->next;
+		if (sexpr_is_atom(idx) && idx->atom.type == T_NUMBER) {
+			union vm_value v;
+			sem_number(&s->c->prog->sem, &idx->atom, &v);
+			*vals += v.i * t->elem->n_slots;
+		} else {
+			s->reject = "indexes a temporary at run time";
+		}
+		return t->elem;
+	}
+
+	if (tt == T_ASSIGN) return ssa_assign(s, e, vals);
+
+	if (tt == T_IDENTIFIER) return ssa_call(s, e, vals);
+
+	*vals = ssa__alloc(s, 1);
+	if (tt_is_type(tt) && n_args == 1) {
+		int v;
+		struct sem_type* t = ssa_scalar(s, head->next, &v);
+		struct sem_type* to = sem_builtin(tt);
+		(*vals)[0] = ssa_convert(s, v, t, to, 1);
+		return to;
+	}
+
+	if (n_args == 1 && is_unary_op(tt)) {
+		int v;
+		struct sem_type* t = ssa_scalar(s, head->next, &v);
+		if (tt == T_MINUS) {
+			(*vals)[0] = ssa_op1(s, t->kind == SEM_FLOAT ? SSA_NEGF : SSA_NEGI, t->kind, v);
+		} else {
+			(*vals)[0] = ssa_op1(s, SSA_COPY, t->kind, v);
+		}
+		return t;
+	}
+
+	if (n_args == 2 && is_binary_op(tt)) return ssa_binary(s, e, *vals);
+
+	vmc_errf(s->c, "unexpected '%.*s'", (int)head->atom.str.len, head->atom.str.ptr);
+	return NULL;
+}
+
+static void ssa_block(struct ssa* s, struct sexpr* block);
+
+static void ssa_local_def(struct ssa* s, struct sexpr* def)
+{
+	enum token_type tt = def->list->atom.type;
+	struct sexpr* name = def->list->next;
+	struct sexpr* type = name->next;
+	struct sexpr* init = type->next;
+	if (tt != T_VAR) return;
+
+	struct sem_type* t = type->type;
+	int* vals;
+	if (init == NULL) {
+		uint8_t* kinds = ssa_kinds(s, t);
+		vals = ssa__alloc(s, t->n_slots);
+		for (int i = 0; i < t->n_slots; i++) vals[i] = ssa_const(s, kinds[i], (union vm_value){ .i = 0 });
+	} else {
+		struct sem_type* it = ssa_expr(s, init, &vals);
+		if (t == NULL) {
+			t = it;
+		} else if (it->kind != t->kind) {
+			int v = ssa_convert(s, vals[0], it, t, 0);
+			vals = ssa__alloc(s, 1);
+			vals[0] = v;
+		}
+	}
+	int var = ssa_new_vars(s, t);
+	for (int i = 0; i < t->n_slots; i++) ssa_write(s, var + i, s->cur, vals[i]);
+	ssa_bind(s, name, var, t);
+}
+
+static void ssa_return(struct ssa* s, struct sexpr* stmt)
+{
+	struct vm_func* fn = &s->c->prog->funcs[s->func];
+	int* rets = ssa__alloc(s, fn->n_ret_slots);
+	int n = 0;
+	int i = 0;
+	for (struct sexpr* value = stmt->list->next; value != NULL; value = value->next, i++) {
+		struct sem_type* want = fn->ret_types[i];
+		int* v;
+		struct sem_type* t = ssa_expr(s, value, &v);
+		if (t->kind != want->kind) rets[n] = ssa_convert(s, v[0], t, want, 0);
+		else memcpy(rets + n, v, want->n_slots * sizeof(*v));
+		n += want->n_slots;
+	}
+	int ret = ssa_emit(s, SSA_RET, 0, n);
+	memcpy(s->ins[ret].args, rets, n * sizeof(*rets));
+}
+
+static void ssa_if(struct ssa* s, struct sexpr* stmt)
+{
+	struct sexpr* cond = stmt->list->next;
+	struct sexpr* tscope = cond->next;
+	struct sexpr* fscope = tscope->next;
+
+	int c;
+	ssa_scalar(s, cond, &c);
+	int tb = ssa_new_block(s);
+	int fb = ssa_new_block(s);
+	int join = fscope != NULL ? ssa_new_block(s) : fb;
+	ssa_branch(s, c, tb, fb);
+	ssa_seal(s, tb);
+	s->cur = tb;
+	ssa_block(s, tscope);
+	ssa_jump(s, join);
+	if (fscope != NULL) {
+		ssa_seal(s, fb);
+		s->cur = fb;
+		ssa_block(s, fscope);
+		ssa_jump(s, join);
+	}
+	ssa_seal(s, join);
+	s->cur = join;
+}
+
+static void ssa_expr_stmt(struct ssa* s, struct sexpr* e)
+{
+	int* vals;
+	ssa_expr(s, e, &vals);
+}
+
+static void ssa_for(struct ssa* s, struct sexpr* stmt)
+{
+	struct sexpr* init = NULL;
+	struct sexpr* cond = NULL;
+	struct sexpr* post = NULL;
+	struct sexpr* body = stmt->list->next;
+	switch (sexpr_list_len(stmt)) {
+		case 2: break;
+		case 3: cond = body; body = body->next; break;
+		case 5: init = body; cond = init->next; post = cond->next; body = post->next; break;
+		default: assert(0);
+	}
+
+	//   init; jmp head; head: br cond body exit; body: ...; jmp cont;
+	//   cont: post; jmp head; exit:
+	if (init != NULL) ssa_expr_stmt(s, init);
+	int head = ssa_new_block(s);
+	int body_block = ssa_new_block(s);
+	int cont = ssa_new_block(s);
+	int exit = ssa_new_block(s);
+	ssa_jump(s, head);
+	s->cur = head;
+	if (cond != NULL) {
+		int c;
+		ssa_scalar(s, cond, &c);
+		ssa_branch(s, c, body_block, exit);
+	} else {
+		ssa_jump(s, body_block);
+	}
+	ssa_seal(s, body_block);
+
+	int break_block = s->break_block;
+	int continue_block = s->continue_block;
+	s->break_block = exit;
+	s->continue_block = cont;
+	s->cur = body_block;
+	ssa_block(s, body);
+	ssa_jump(s, cont);
+	ssa_seal(s, cont);
+	s->cur = cont;
+	if (post != NULL) ssa_expr_stmt(s, post);
+	ssa_jump(s, head);
+	ssa_seal(s, head);
+	ssa_seal(s, exit);
+	s->cur = exit;
+	s->break_block = break_block;
+	s->continue_block = continue_block;
+}
+
+static void ssa_stmt(struct ssa* s, struct sexpr* stmt)
+{
+	// whatever follows a return or a jump goes into a block nothing
+	// reaches, which constprop drops
+	if (ssa_terminated(s, s->cur)) {
+		s->cur = ssa_new_block(s);
+		ssa_seal(s, s->cur);
+	}
+
+	struct sexpr* head = sexpr_is_list(stmt) ? stmt->list : NULL;
+	enum token_type tt = head != NULL && sexpr_is_atom(head) ? head->atom.type : 0;
+	switch (tt) {
+		case T_VAR:
+		case T_CONST:
+		case T_TYPE:
+			ssa_local_def(s, stmt);
+			break;
+		case T_RETURN:
+			ssa_return(s, stmt);
+			break;
+		case T_IF:
+			ssa_if(s, stmt);
+			break;
+		case T_FOR:
+			ssa_for(s, stmt);
+			break;
+		case T_BREAK:
+		case T_CONTINUE:
+			if (s->break_block < 0) {
+				vmc_errf(s->c, "break/continue outside loop");
+				return;
+			}
+			ssa_jump(s, tt == T_BREAK ? s->break_block : s->continue_block);
+			break;
+		case T_FUNC:
+		case T_FALLTHROUGH:
+			s->reject = "unsupported statement";
+			break;
+		default:
+			ssa_expr_stmt(s, stmt);
+			break;
+	}
+}
+
+static void ssa_block(struct ssa* s, struct sexpr* block)
+{
+	int n_bindings = s->bindings_dy.n;
+	for (struct sexpr* stmt = block->list; stmt != NULL && s->reject == NULL; stmt = stmt->next) {
+		ssa_stmt(s, stmt);
+	}
+	s->bindings_dy.n = n_bindings;
+}
+
+// returns -1 if the function is left to the tree compiler (see s->reject)
+static int ssa_build(struct ssa* s, struct sexpr* def)
+{
+	struct sexpr* args = def->list->next->next;
+	struct sexpr* body = args->next->next;
+	struct vm_func* fn = &s->c->prog->funcs[s->func];
+
+	s->cur = ssa_new_block(s);
+	ssa_seal(s, s->cur);
+	int slot = 0;
+	int i = 0;
+	for (struct sexpr* a = args->list; a != NULL; a = a->next, i++) {
+		struct sem_type* t = fn->arg_types[i];
+		int var = ssa_new_vars(s, t);
+		for (int j = 0; j < t->n_slots; j++) {
+			int v = ssa_emit(s, SSA_ARG, s->vars[var + j], 0);
+			s->ins[v].aux = slot++;
+			ssa_write(s, var + j, s->cur, v);
+		}
+		ssa_bind(s, a->list, var, t);
+	}
+	ssa_block(s, body);
+	if (!ssa_terminated(s, s->cur)) ssa_emit(s, SSA_RET, 0, 0);
+	return s->reject != NULL ? -1 : 0;
+}
+
+static void ssa_print(FILE* f, struct ssa* s)
+{
+	for (int bi = 0; bi < s->blocks_dy.n; bi++) {
+		struct ssa_block* b = &s->blocks[bi];
+		if (b->dead) continue;
+		fprintf(f, "b%d:", bi);
+		for (int i = 0; i < b->n_preds; i++) fprintf(f, "%s b%d", i ? "," : " <-", b->preds[i]);
+		fprintf(f, "\n");
+		for (int i = 0; i < b->n_ins; i++) {
+			struct ssa_ins* in = &s->ins[b->ins[i]];
+			if (in->dead) continue;
+			fprintf(f, "\t");
+			if (in->kind != 0) fprintf(f, "v%d = ", b->ins[i]);
+			fprintf(f, "%s", ssa_op_names[in->op] + 4);
+			if (in->op == SSA_CONST) {
+				if (in->kind == SEM_FLOAT) fprintf(f, " %g", in->imm.f);
+				else fprintf(f, " %lld", (long long)in->imm.i);
+			}
+			for (int j = 0; j < in->n_args; j++) fprintf(f, " v%d", in->args[j]);
+			if (in->op == SSA_ARG || (in->op >= SSA_GETG && in->op <= SSA_RESULT)) fprintf(f, " #%d", in->aux);
+			for (int j = 0; j < b->n_succ && (in->op == SSA_JMP || in->op == SSA_BR); j++) fprintf(f, " b%d", b->succ[j]);
+			fprintf(f, "\n");
+		}
+	}
+}
+
+
+// passes
+
+static void ssa__dfs(struct ssa* s, int block)
+{
+	struct ssa_block* b = &s->blocks[block];
+	b->rpo = -2; // visiting
+	for (int i = b->n_succ - 1; i >= 0; i--) {
+		int t = s->blocks[block].succ[i];
+		if (s->blocks[t].rpo == -1) ssa__dfs(s, t);
+	}
+	*(int*)dynary_append(&s->order_dy) = block;
+}
+
+// orders the blocks reachable from the entry in reverse postorder, with the
+// first successor of a branch right after it when possible
+static void ssa_order(struct ssa* s)
+{
+	for (int i = 0; i < s->blocks_dy.n; i++) s->blocks[i].rpo = -1;
+	s->order_dy.n = 0;
+	ssa__dfs(s, 0);
+	int n = s->order_dy.n;
+	for (int i = 0; i < n/2; i++) {
+		int tmp = s->order[i];
+		s->order[i] = s->order[n-1-i];
+		s->order[n-1-i] = tmp;
+	}
+	for (int i = 0; i < n; i++) s->blocks[s->order[i]].rpo = i;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+static void ssa_dominators(struct ssa* s)
+{
+	ssa_order(s);
+	for (int i = 0; i < s->order_dy.n; i++) s->blocks[s->order[i]].idom = -1;
+	s->blocks[0].idom = 0;
+	int changed;
+	do {
+		changed = 0;
+		for (int i = 1; i < s->order_dy.n; i++) {
+			struct ssa_block* b = &s->blocks[s->order[i]];
+			int idom = -1;
+			for (int j = 0; j < b->n_preds; j++) {
+				int p = b->preds[j];
+				if (s->blocks[p].rpo < 0 || s->blocks[p].idom == -1) continue;
+				if (idom == -1) {
+					idom = p;
+					continue;
+				}
+				int a = p;
+				while (a != idom) {
+					while (s->blocks[a].rpo > s->blocks[idom].rpo) a = s->blocks[a].idom;
+					while (s->blocks[idom].rpo > s->blocks[a].rpo) idom = s->blocks[idom].idom;
+				}
+			}
+			if (b->idom != idom) {
+				b->idom = idom;
+				changed = 1;
+			}
+		}
+	} while (changed);
+}
+
+static int ssa_dominates(struct ssa* s, int a, int b)
+{
+	for (;;) {
+		if (b == a) return 1;
+		if (b == 0) return 0;
+		b = s->blocks[b].idom;
+	}
+}
+
+static int ssa_find(struct ssa* s, int v)
+{
+	while (s->ins[v].repl >= 0) v = s->ins[v].repl;
+	return v;
+}
+
+static void ssa_replace(struct ssa* s, int v, int with)
+{
+	s->ins[v].repl = with;
+	s->ins[v].dead = 1;
+}
+
+// points operands at what they were replaced with, and drops dead
+// instructions from their blocks
+static void ssa_rewrite(struct ssa* s)
+{
+	for (int bi = 0; bi < s->blocks_dy.n; bi++) {
+		struct ssa_block* b = &s->blocks[bi];
+		int n = 0;
+		for (int i = 0; i < b->n_ins; i++) {
+			struct ssa_ins* in = &s->ins[b->ins[i]];
+			if (in->dead || b->dead) continue;
+			for (int j = 0; j < in->n_args; j++) in->args[j] = ssa_find(s, in->args[j]);
+			b->ins[n++] = b->ins[i];
+		}
+		b->n_ins = n;
+	}
+}
+
+static int ssa_count(struct ssa* s)
+{
+	int n = 0;
+	for (int bi = 0; bi < s->blocks_dy.n; bi++) {
+		struct ssa_block* b = &s->blocks[bi];
+		for (int i = 0; !b->dead && i < b->n_ins; i++) n += !s->ins[b->ins[i]].dead;
+	}
+	return n;
+}
+
+// removes the edge from pred into block, with the phi operands for it
+static void ssa_remove_pred(struct ssa* s, int block, int pred)
+{
+	struct ssa_block* b = &s->blocks[block];
+	int k = 0;
+	while (k < b->n_preds && b->preds[k] != pred) k++;
+	if (k == b->n_preds) return;
+	memmove(b->preds + k, b->preds + k + 1, (b->n_preds - k - 1) * sizeof(*b->preds));
+	b->n_preds--;
+	for (int i = 0; i < b->n_ins; i++) {
+		struct ssa_ins* in = &s->ins[b->ins[i]];
+		if (in->op != SSA_PHI) continue;
+		memmove(in->args + k, in->args + k + 1, (in->n_args - k - 1) * sizeof(*in->args));
+		in->n_args--;
+	}
+}
+
+// drops the blocks nothing reaches
+static void ssa_prune(struct ssa* s)
+{
+	ssa_order(s);
+	for (int bi = 0; bi < s->blocks_dy.n; bi++) {
+		struct ssa_block* b = &s->blocks[bi];
+		if (b->rpo >= 0 || b->dead) continue;
+		b->dead = 1;
+		for (int i = 0; i < b->n_ins; i++) s->ins[b->ins[i]].dead = 1;
+		for (int i = 0; i < b->n_succ; i++) ssa_remove_pred(s, b->succ[i], bi);
+	}
+}
+
+static union vm_value ssa_fold(int op, union vm_value a, union vm_value b)
+{
+	union vm_value v = { .i = 0 };
+	switch (op) {
+		case SSA_ADDI: v.i = VM_WRAP(a.i, +, b.i); break;
+		case SSA_SUBI: v.i = VM_WRAP(a.i, -, b.i); break;
+		case SSA_MULI: v.i = VM_WRAP(a.i, *, b.i); break;
+		case SSA_DIVI: v.i = vm_divi(a.i, b.i); break;
+		case SSA_NEGI: v.i = VM_WRAP(0, -, a.i); break;
+		case SSA_EQI: v.i = a.i == b.i; break;
+		case SSA_NEI: v.i = a.i != b.i; break;
+		case SSA_ADDF: v.f = a.f + b.f; break;
+		case SSA_SUBF: v.f = a.f - b.f; break;
+		case SSA_MULF: v.f = a.f * b.f; break;
+		case SSA_DIVF: v.f = a.f / b.f; break;
+		case SSA_NEGF: v.f = -a.f; break;
+		case SSA_EQF: v.i = a.f == b.f; break;
+		case SSA_NEF: v.i = a.f != b.f; break;
+		case SSA_ITOF: v.f = a.i; break;
+		case SSA_FTOI: v.i = a.f; break;
+		default: assert(0);
+	}
+	return v;
+}
+
+static int ssa_constprop(struct ssa* s)
+{
+	int n = 0;
+	int changed;
+	do {
+		changed = 0;
+		ssa_prune(s);
+		for (int k = 0; k < s->order_dy.n; k++) {
+			int bi = s->order[k];
+			struct ssa_block* b = &s->blocks[bi];
+			for (int i = 0; i < b->n_ins; i++) {
+				int id = b->ins[i];
+				struct ssa_ins* in = &s->ins[id];
+				if (in->dead) continue;
+				// phis fold if every other operand is the same constant
+				int all_const = in->n_args > 0;
+				int first = -1;
+				for (int j = 0; j < in->n_args; j++) {
+					int a = in->args[j] = ssa_find(s, in->args[j]);
+					if (in->op == SSA_PHI && a == id) continue;
+					if (s->ins[a].op != SSA_CONST) {
+						all_const = 0;
+					} else if (first == -1) {
+						first = a;
+					} else if (in->op == SSA_PHI && s->ins[a].imm.i != s->ins[first].imm.i) {
+						all_const = 0;
+					}
+				}
+				if (!all_const || first == -1) continue;
+				union vm_value a = s->ins[first].imm;
+				if (ssa_is_pure(in->op)) {
+					union vm_value b = in->n_args > 1 ? s->ins[in->args[1]].imm : a;
+					in->imm = ssa_fold(in->op, a, b);
+				} else if (in->op == SSA_PHI) {
+					// stays among the phis until lowered
+					in->imm = a;
+				} else if (in->op == SSA_CHECK && a.i >= 0 && a.i < in->aux) {
+					in->dead = 1;
+					n++;
+					continue;
+				} else if (in->op == SSA_BR) {
+					int keep = b->succ[a.i != 0 ? 0 : 1];
+					int drop = b->succ[a.i != 0 ? 1 : 0];
+					b->succ[0] = keep;
+					b->n_succ = 1;
+					if (drop != keep) ssa_remove_pred(s, drop, bi);
+					in->op = SSA_JMP;
+					in->n_args = 0;
+					n++;
+					changed = 1;
+					continue;
+				} else {
+					continue;
+				}
+				in->op = SSA_CONST;
+				in->n_args = 0;
+				n++;
+				changed = 1;
+			}
+		}
+	} while (changed);
+	ssa_rewrite(s);
+	return n;
+}
+
+static int ssa_copyprop(struct ssa* s)
+{
+	int n = 0;
+	int changed;
+	ssa_order(s);
+	do {
+		changed = 0;
+		for (int k = 0; k < s->order_dy.n; k++) {
+			struct ssa_block* b = &s->blocks[s->order[k]];
+			for (int i = 0; i < b->n_ins; i++) {
+				int id = b->ins[i];
+				struct ssa_ins* in = &s->ins[id];
+				if (in->dead) continue;
+				int with = -1;
+				if (in->op == SSA_COPY) {
+					with = ssa_find(s, in->args[0]);
+				} else if (in->op == SSA_PHI) {
+					for (int j = 0; j < in->n_args; j++) {
+						int a = ssa_find(s, in->args[j]);
+						if (a == id || a == with) continue;
+						if (with != -1) {
+							with = -1;
+							break;
+						}
+						with = a;
+					}
+				}
+				if (with == -1) continue;
+				ssa_replace(s, id, with);
+				n++;
+				changed = 1;
+			}
+		}
+	} while (changed);
+	ssa_rewrite(s);
+	return n;
+}
+
+static uint32_t ssa__hash(struct ssa_ins* in)
+{
+	uint64_t h = in->op * 31 + in->kind;
+	h = h * 0x100000001b3ull ^ (uint64_t)in->imm.i;
+	for (int i = 0; i < in->n_args; i++) h = h * 0x100000001b3ull ^ (uint64_t)in->args[i];
+	return (uint32_t)(h ^ h >> 32);
+}
+
+static int ssa__same(struct ssa_ins* a, struct ssa_ins* b)
+{
+	if (a->op != b->op || a->kind != b->kind || a->n_args != b->n_args || a->imm.i != b->imm.i) return 0;
+	for (int i = 0; i < a->n_args; i++) if (a->args[i] != b->args[i]) return 0;
+	return 1;
+}
+
+struct ssa_cse {
+	int* head; // per bucket
+	int* chain; // per instruction
+	uint32_t mask;
+	int* children; // dominator tree: first child per block...
+	int* sibling; // ...and the next one
+	int n;
+};
+
+static void ssa__cse(struct ssa* s, struct ssa_cse* cse, int block)
+{
+	struct ssa_block* b = &s->blocks[block];
+	int n_pushed = 0;
+	int* pushed = ssa__alloc(s, b->n_ins);
+	for (int i = 0; i < b->n_ins; i++) {
+		int id = b->ins[i];
+		struct ssa_ins* in = &s->ins[id];
+		if (in->dead || !ssa_is_pure(in->op)) continue;
+		for (int j = 0; j < in->n_args; j++) in->args[j] = ssa_find(s, in->args[j]);
+		int commutative = in->op == SSA_ADDI || in->op == SSA_MULI || in->op == SSA_EQI || in->op == SSA_NEI;
+		if (commutative && in->args[0] > in->args[1]) {
+			int tmp = in->args[0];
+			in->args[0] = in->args[1];
+			in->args[1] = tmp;
+		}
+		uint32_t h = ssa__hash(in) & cse->mask;
+		int j;
+		for (j = cse->head[h]; j >= 0; j = cse->chain[j]) {
+			if (ssa__same(&s->ins[j], in)) break;
+		}
+		if (j >= 0) {
+			ssa_replace(s, id, j);
+			cse->n++;
+			continue;
+		}
+		cse->chain[id] = cse->head[h];
+		cse->head[h] = id;
+		pushed[n_pushed++] = id;
+	}
+	for (int c = cse->children[block]; c >= 0; c = cse->sibling[c]) ssa__cse(s, cse, c);
+	for (int i = n_pushed - 1; i >= 0; i--) {
+		cse->head[ssa__hash(&s->ins[pushed[i]]) & cse->mask] = cse->chain[pushed[i]];
+	}
+}
+
+static int ssa_cse(struct ssa* s)
+{
+	ssa_dominators(s);
+	int n_ins = s->ins_dy.n;
+	int n_blocks = s->blocks_dy.n;
+	int n_buckets = 16;
+	while (n_buckets < 2 * n_ins) n_buckets *= 2;
+	struct ssa_cse cse = {
+		.head = malloc(n_buckets * sizeof(int)),
+		.chain = malloc(n_ins * sizeof(int)),
+		.mask = n_buckets - 1,
+		.children = malloc(n_blocks * sizeof(int)),
+		.sibling = malloc(n_blocks * sizeof(int)),
+	};
+	assert(cse.head != NULL && cse.chain != NULL && cse.children != NULL && cse.sibling != NULL);
+	memset(cse.head, -1, n_buckets * sizeof(int));
+	memset(cse.children, -1, n_blocks * sizeof(int));
+	for (int i = s->order_dy.n - 1; i > 0; i--) {
+		int bi = s->order[i];
+		int idom = s->blocks[bi].idom;
+		cse.sibling[bi] = cse.children[idom];
+		cse.children[idom] = bi;
+	}
+	ssa__cse(s, &cse, 0);
+	free(cse.head);
+	free(cse.chain);
+	free(cse.children);
+	free(cse.sibling);
+	ssa_rewrite(s);
+	return cse.n;
+}
+
+struct ssa_loop {
+	int header, preheader;
+	int* blocks; // in reverse postorder
+	int n_blocks;
+};
+
+static int ssa__loop_cmp(const void* a, const void* b)
+{
+	return ((const struct ssa_loop*)a)->n_blocks - ((const struct ssa_loop*)b)->n_blocks;
+}
+
+static int ssa__int_cmp(const void* a, const void* b)
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+// loops only get a preheader if the tree gave them one: the loop entry is
+// the only jump into the header from outside
+static int ssa_licm(struct ssa* s)
+{
+	ssa_dominators(s);
+	int n_blocks = s->blocks_dy.n;
+	int* in_loop = calloc(n_blocks, sizeof(int));
+	int* stack = malloc(n_blocks * sizeof(int));
+	struct ssa_loop* loops = malloc(s->order_dy.n * sizeof(*loops));
+	assert(in_loop != NULL && stack != NULL && loops != NULL);
+	int n_loops = 0;
+
+	// natural loops, merging back edges into the same header
+	int stamp = 0;
+	for (int k = 0; k < s->order_dy.n; k++) {
+		int h = s->order[k];
+		struct ssa_block* hb = &s->blocks[h];
+		int sp = 0;
+		stamp++;
+		in_loop[h] = stamp;
+		for (int i = 0; i < hb->n_preds; i++) {
+			int p = hb->preds[i];
+			if (s->blocks[p].rpo >= k && ssa_dominates(s, h, p) && in_loop[p] != stamp) {
+				in_loop[p] = stamp;
+				stack[sp++] = p;
+			}
+		}
+		if (sp == 0) continue;
+		int n = 1;
+		int* body = ssa__alloc(s, n_blocks);
+		body[0] = k;
+		while (sp > 0) {
+			int bi = stack[--sp];
+			body[n++] = s->blocks[bi].rpo;
+			for (int i = 0; i < s->blocks[bi].n_preds; i++) {
+				int p = s->blocks[bi].preds[i];
+				if (s->blocks[p].rpo < 0 || in_loop[p] == stamp) continue;
+				in_loop[p] = stamp;
+				stack[sp++] = p;
+			}
+		}
+		int preheader = -1;
+		for (int i = 0; i < hb->n_preds; i++) {
+			int p = hb->preds[i];
+			if (in_loop[p] == stamp) continue;
+			preheader = preheader == -1 ? p : -2;
+		}
+		if (preheader < 0 || s->blocks[preheader].n_succ != 1) continue;
+		qsort(body, n, sizeof(*body), ssa__int_cmp);
+		for (int i = 0; i < n; i++) body[i] = s->order[body[i]];
+		loops[n_loops++] = (struct ssa_loop){ .header = h, .preheader = preheader, .blocks = body, .n_blocks = n };
+	}
+
+	// innermost first, so what's hoisted into an inner preheader may leave
+	// the outer loop as well
+	qsort(loops, n_loops, sizeof(*loops), ssa__loop_cmp);
+	int n_hoisted = 0;
+	for (int l = 0; l < n_loops; l++) {
+		struct ssa_loop* loop = &loops[l];
+		stamp++;
+		for (int i = 0; i < loop->n_blocks; i++) in_loop[loop->blocks[i]] = stamp;
+		for (int i = 0; i < loop->n_blocks; i++) {
+			struct ssa_block* b = &s->blocks[loop->blocks[i]];
+			int n = 0;
+			for (int j = 0; j < b->n_ins; j++) {
+				int id = b->ins[j];
+				struct ssa_ins* in = &s->ins[id];
+				int invariant = !in->dead && ssa_is_pure(in->op);
+				for (int a = 0; invariant && a < in->n_args; a++) {
+					invariant = in_loop[s->ins[in->args[a]].block] != stamp;
+				}
+				if (!invariant) {
+					b->ins[n++] = id;
+					continue;
+				}
+				struct ssa_block* p = &s->blocks[loop->preheader];
+				ssa__insert(&p->ins, &p->n_ins, &p->cap_ins, p->n_ins - 1, id);
+				in->block = loop->preheader;
+				n_hoisted++;
+			}
+			b->n_ins = n;
+		}
+	}
+
+	free(in_loop);
+	free(stack);
+	free(loops);
+	return n_hoisted;
+}
+
+static int ssa_dce(struct ssa* s)
+{
+	ssa_order(s);
+	int n_ins = s->ins_dy.n;
+	char* live = calloc(n_ins, 1);
+	int* work = malloc(n_ins * sizeof(int));
+	assert(live != NULL && work != NULL);
+	int n_work = 0;
+	for (int k = 0; k < s->order_dy.n; k++) {
+		struct ssa_block* b = &s->blocks[s->order[k]];
+		for (int i = 0; i < b->n_ins; i++) {
+			int id = b->ins[i];
+			switch (s->ins[id].op) {
+				case SSA_SETG: case SSA_SETGX: case SSA_CHECK: case SSA_CALL:
+				case SSA_JMP: case SSA_BR: case SSA_RET:
+					live[id] = 1;
+					work[n_work++] = id;
+					break;
+			}
+		}
+	}
+	while (n_work > 0) {
+		struct ssa_ins* in = &s->ins[work[--n_work]];
+		for (int i = 0; i < in->n_args; i++) {
+			int a = in->args[i];
+			if (live[a]) continue;
+			live[a] = 1;
+			work[n_work++] = a;
+		}
+	}
+	int n = 0;
+	for (int k = 0; k < s->order_dy.n; k++) {
+		struct ssa_block* b = &s->blocks[s->order[k]];
+		for (int i = 0; i < b->n_ins; i++) {
+			struct ssa_ins* in = &s->ins[b->ins[i]];
+			if (live[b->ins[i]] || in->dead) continue;
+			in->dead = 1;
+			n++;
+		}
+	}
+	free(live);
+	free(work);
+	ssa_rewrite(s);
+	return n;
+}
+
+static const struct {
+	const char* name;
+	int (*run)(struct ssa* s); // returns how many instructions it changed
+} ssa_passes[] = {
+	{ "constprop", ssa_constprop },
+	{ "copyprop", ssa_copyprop },
+	{ "cse", ssa_cse },
+	{ "licm", ssa_licm },
+	{ "dce", ssa_dce },
+};
+
+#define SSA_N_PASSES (int)(sizeof(ssa_passes) / sizeof(ssa_passes[0]))
+
+
+// lowering
+
+static void ssa__bit_set(uint64_t* set, int i)
+{
+	set[i >> 6] |= 1ull << (i & 63);
+}
+
+static void ssa__bit_clear(uint64_t* set, int i)
+{
+	set[i >> 6] &= ~(1ull << (i & 63));
+}
+
+static void ssa__extend(struct ssa_ins* in, int pos)
+{
+	if (pos < in->start) in->start = pos;
+	if (pos > in->end) in->end = pos;
+}
+
+static int ssa__pred_index(struct ssa_block* b, int pred)
+{
+	for (int i = 0; i < b->n_preds; i++) if (b->preds[i] == pred) return i;
+	assert(0);
+	return -1;
+}
+
+static int ssa_has_phi(struct ssa* s, int block)
+{
+	struct ssa_block* b = &s->blocks[block];
+	for (int i = 0; i < b->n_ins; i++) if (s->ins[b->ins[i]].op == SSA_PHI) return 1;
+	return 0;
+}
+
+// splits the edges from branches into blocks with phis, so the copies out
+// of SSA have a block of their own
+static void ssa_split_edges(struct ssa* s)
+{
+	ssa_order(s);
+	int n = s->order_dy.n;
+	for (int k = 0; k < n; k++) {
+		int bi = s->order[k];
+		if (s->blocks[bi].n_succ != 2) continue;
+		for (int i = 0; i < 2; i++) {
+			int t = s->blocks[bi].succ[i];
+			if (s->blocks[t].n_preds < 2 && !ssa_has_phi(s, t)) continue;
+			int m = ssa_new_block(s);
+			ssa_emit_in(s, m, SSA_JMP, 0, 0);
+			struct ssa_block* mb = &s->blocks[m];
+			mb->succ[0] = t;
+			mb->n_succ = 1;
+			mb->sealed = 1;
+			ssa__push(&mb->preds, &mb->n_preds, &mb->cap_preds, bi);
+			struct ssa_block* tb = &s->blocks[t];
+			tb->preds[ssa__pred_index(tb, bi)] = m;
+			s->blocks[bi].succ[i] = m;
+		}
+	}
+	ssa_order(s);
+}
+
+static void ssa_liveness(struct ssa* s)
+{
+	int words = (s->ins_dy.n + 63) / 64;
+	size_t sz = words * sizeof(uint64_t);
+	for (int k = 0; k < s->order_dy.n; k++) {
+		struct ssa_block* b = &s->blocks[s->order[k]];
+		b->live_in = arena_alloc(&s->arena, sz);
+		b->live_out = arena_alloc(&s->arena, sz);
+		memset(b->live_in, 0, sz);
+		memset(b->live_out, 0, sz);
+	}
+	uint64_t* in = malloc(sz + 1);
+	assert(in != NULL);
+	int changed;
+	do {
+		changed = 0;
+		for (int k = s->order_dy.n - 1; k >= 0; k--) {
+			int bi = s->order[k];
+			struct ssa_block* b = &s->blocks[bi];
+			for (int i = 0; i < b->n_succ; i++) {
+				struct ssa_block* t = &s->blocks[b->succ[i]];
+				for (int w = 0; w < words; w++) b->live_out[w] |= t->live_in[w];
+				int p = -1;
+				for (int j = 0; j < t->n_ins; j++) {
+					struct ssa_ins* phi = &s->ins[t->ins[j]];
+					if (phi->op != SSA_PHI) continue;
+					if (p < 0) p = ssa__pred_index(t, bi);
+					ssa__bit_set(b->live_out, phi->args[p]);
+				}
+			}
+			memcpy(in, b->live_out, sz);
+			for (int i = b->n_ins - 1; i >= 0; i--) {
+				struct ssa_ins* ins = &s->ins[b->ins[i]];
+				if (ins->kind != 0) ssa__bit_clear(in, b->ins[i]);
+				if (ins->op == SSA_PHI) continue;
+				for (int j = 0; j < ins->n_args; j++) ssa__bit_set(in, ins->args[j]);
+			}
+			if (memcmp(in, b->live_in, sz) != 0) {
+				memcpy(b->live_in, in, sz);
+				changed = 1;
+			}
+		}
+	} while (changed);
+	free(in);
+}
+
+// one interval per value, from the first to the last position it's live
+// at; phis are written at the end of each predecessor
+static void ssa_intervals(struct ssa* s)
+{
+	int pos = 0;
+	for (int k = 0; k < s->order_dy.n; k++) {
+		struct ssa_block* b = &s->blocks[s->order[k]];
+		b->start = pos;
+		for (int i = 0; i < b->n_ins; i++) {
+			s->ins[b->ins[i]].pos = pos;
+			pos += 2;
+		}
+		b->end = pos - 1;
+	}
+	for (int i = 0; i < s->ins_dy.n; i++) {
+		s->ins[i].start = INT32_MAX;
+		s->ins[i].end = -1;
+		s->ins[i].reg = -1;
+	}
+
+	int words = (s->ins_dy.n + 63) / 64;
+	for (int k = 0; k < s->order_dy.n; k++) {
+		struct ssa_block* b = &s->blocks[s->order[k]];
+		for (int w = 0; w < words; w++) {
+			for (uint64_t m = b->live_in[w]; m != 0; m &= m - 1) ssa__extend(&s->ins[w*64 + __builtin_ctzll(m)], b->start);
+			for (uint64_t m = b->live_out[w]; m != 0; m &= m - 1) ssa__extend(&s->ins[w*64 + __builtin_ctzll(m)], b->end);
+		}
+		for (int i = 0; i < b->n_ins; i++) {
+			struct ssa_ins* in = &s->ins[b->ins[i]];
+			if (in->op == SSA_PHI) {
+				ssa__extend(in, b->start);
+				for (int j = 0; j < b->n_preds; j++) {
+					int end = s->blocks[b->preds[j]].end;
+					ssa__extend(in, end);
+					ssa__extend(&s->ins[in->args[j]], end);
+				}
+				continue;
+			}
+			for (int j = 0; j < in->n_args; j++) ssa__extend(&s->ins[in->args[j]], in->pos);
+			if (in->kind != 0) ssa__extend(in, in->pos + 1);
+			// in its register from the start
+			if (in->op == SSA_ARG) ssa__extend(in, 0);
+		}
+	}
+}
+
+// returns the number of registers used, or -1 if there are too many
+static int ssa_allocate(struct ssa* s)
+{
+	int n_pos = 0;
+	for (int k = 0; k < s->order_dy.n; k++) n_pos = s->blocks[s->order[k]].end + 2;
+	int* first = malloc(n_pos * sizeof(int));
+	int* next = malloc(s->ins_dy.n * sizeof(int) + 1);
+	assert(first != NULL && next != NULL);
+	memset(first, -1, n_pos * sizeof(int));
+	for (int i = s->ins_dy.n - 1; i >= 0; i--) {
+		struct ssa_ins* in = &s->ins[i];
+		if (in->end < 0 || in->kind == 0) continue;
+		next[i] = first[in->start];
+		first[in->start] = i;
+	}
+
+	int reg_end[VM_MAX_FRAME_REGS];
+	for (int r = 0; r < VM_MAX_FRAME_REGS; r++) reg_end[r] = -1;
+	int n_regs = 0;
+	for (int p = 0; p < n_pos && n_regs >= 0; p++) {
+		for (int i = first[p]; i >= 0; i = next[i]) {
+			struct ssa_ins* in = &s->ins[i];
+			int r = 0;
+			if (in->op == SSA_ARG) {
+				r = in->aux;
+				assert(reg_end[r] < in->start);
+			} else {
+				while (r < VM_MAX_FRAME_REGS && reg_end[r] >= in->start) r++;
+				if (r == VM_MAX_FRAME_REGS) {
+					n_regs = -1;
+					break;
+				}
+			}
+			reg_end[r] = in->end;
+			in->reg = r;
+			if (r + 1 > n_regs) n_regs = r + 1;
+		}
+	}
+	free(first);
+	free(next);
+	return n_regs;
+}
+
+// emits the copies into the phis of block to for the edge from from, as if
+// all at once
+static void ssa_phi_copies(struct ssa* s, int from, int to, int scratch)
+{
+	struct ssa_block* t = &s->blocks[to];
+	int* dst = ssa__alloc(s, t->n_ins);
+	int* src = ssa__alloc(s, t->n_ins);
+	int n = 0;
+	int k = -1;
+	for (int i = 0; i < t->n_ins; i++) {
+		struct ssa_ins* phi = &s->ins[t->ins[i]];
+		if (phi->op != SSA_PHI) continue;
+		if (k < 0) k = ssa__pred_index(t, from);
+		int r = s->ins[phi->args[k]].reg;
+		if (r == phi->reg) continue;
+		dst[n] = phi->reg;
+		src[n] = r;
+		n++;
+	}
+	while (n > 0) {
+		int i;
+		for (i = 0; i < n; i++) {
+			int blocked = 0;
+			for (int j = 0; j < n && !blocked; j++) blocked = j != i && src[j] == dst[i];
+			if (!blocked) break;
+		}
+		if (i < n) {
+			vmc_move(s->c, dst[i], src[i], 1);
+			n--;
+			dst[i] = dst[n];
+			src[i] = src[n];
+			continue;
+		}
+		// only cycles left; break one
+		int r = src[0];
+		vmc_move(s->c, scratch, r, 1);
+		for (int j = 0; j < n; j++) if (src[j] == r) src[j] = scratch;
+	}
+}
+
+// returns -1 if the function needs too many registers
+static int ssa_lower(struct ssa* s)
+{
+	struct vm_compiler* c = s->c;
+	struct vm_prog* prog = c->prog;
+	struct vm_func* fn = &prog->funcs[s->func];
+
+	ssa_split_edges(s);
+	ssa_liveness(s);
+	ssa_intervals(s);
+	int n_regs = ssa_allocate(s);
+	if (n_regs < 0) return -1;
+
+	// calls, multiple return values and cycles of phi copies use the
+	// registers past everything else
+	int base = n_regs > fn->n_arg_slots ? n_regs : fn->n_arg_slots;
+	int top = base + 1;
+	for (int i = 0; i < s->ins_dy.n; i++) {
+		struct ssa_ins* in = &s->ins[i];
+		if (in->dead || in->block < 0 || s->blocks[in->block].rpo < 0) continue;
+		int n = 0;
+		if (in->op == SSA_CALL) {
+			struct vm_func* callee = &prog->funcs[in->aux];
+			n = callee->n_arg_slots > callee->n_ret_slots ? callee->n_arg_slots : callee->n_ret_slots;
+		} else if (in->op == SSA_RET) {
+			n = in->n_args;
+		}
+		if (base + n > top) top = base + n;
+	}
+	if (top > VM_MAX_FRAME_REGS) return -1;
+
+	vmc_begin_func(c, s->func);
+	int* block_pc = ssa__alloc(s, s->blocks_dy.n);
+	int* jumps = ssa__alloc(s, 2 * s->order_dy.n);
+	int n_jumps = 0;
+	for (int k = 0; k < s->order_dy.n; k++) {
+		int bi = s->order[k];
+		int next = k + 1 < s->order_dy.n ? s->order[k+1] : -1;
+		struct ssa_block* b = &s->blocks[bi];
+		block_pc[bi] = vmc_here(c);
+		for (int i = 0; i < b->n_ins; i++) {
+			struct ssa_ins* in = &s->ins[b->ins[i]];
+			int d = in->reg;
+			int r0 = in->n_args > 0 ? s->ins[in->args[0]].reg : 0;
+			int r1 = in->n_args > 1 ? s->ins[in->args[1]].reg : 0;
+			switch (in->op) {
+				case SSA_PHI:
+					break;
+				case SSA_CONST:
+					vmc_loadk(c, d, in->imm, sem_builtin(in->kind == SEM_FLOAT ? T_FLOAT64 : T_INT));
+					break;
+				case SSA_ARG:
+					assert(d == in->aux);
+					break;
+				case SSA_COPY:
+					vmc_move(c, d, r0, 1);
+					break;
+				case SSA_GETG:
+					vmc_emit(c, INS_ABX(OP_GETG, d, in->aux));
+					break;
+				case SSA_SETG:
+					vmc_emit(c, INS_ABX(OP_SETG, r0, in->aux));
+					break;
+				case SSA_GETGX:
+					vmc_move(c, d, r0, 1);
+					vmc_emit(c, INS_ABX(OP_GETGX, d, in->aux));
+					break;
+				case SSA_SETGX:
+					vmc_emit(c, INS_ABX(OP_SETGX, r0, in->aux));
+					vmc_emit(c, INS_ABX(OP_ARG, r1, 0));
+					break;
+				case SSA_CHECK:
+					vmc_emit(c, INS_ABX(OP_CHECK, r0, in->aux));
+					break;
+				case SSA_CALL:
+					for (int j = 0; j < in->n_args; j++) vmc_move(c, base + j, s->ins[in->args[j]].reg, 1);
+					vmc_emit(c, INS_ABX(OP_CALL, base, in->aux));
+					break;
+				case SSA_RESULT:
+					vmc_move(c, d, base + in->aux, 1);
+					break;
+				case SSA_JMP:
+					ssa_phi_copies(s, bi, b->succ[0], base);
+					if (b->succ[0] != next) {
+						jumps[n_jumps++] = vmc_emit(c, INS_ASBX(OP_JMP, 0, 0));
+						jumps[n_jumps++] = b->succ[0];
+					}
+					break;
+				case SSA_BR:
+					if (b->succ[1] == next) {
+						jumps[n_jumps++] = vmc_emit(c, INS_ASBX(OP_JNZ, r0, 0));
+						jumps[n_jumps++] = b->succ[0];
+						break;
+					}
+					jumps[n_jumps++] = vmc_emit(c, INS_ASBX(OP_JZ, r0, 0));
+					jumps[n_jumps++] = b->succ[1];
+					if (b->succ[0] != next) {
+						jumps[n_jumps++] = vmc_emit(c, INS_ASBX(OP_JMP, 0, 0));
+						jumps[n_jumps++] = b->succ[0];
+					}
+					break;
+				case SSA_RET:
+					if (in->n_args == 1) {
+						vmc_emit(c, INS_ABC(OP_RET, r0, 1, 0));
+						break;
+					}
+					for (int j = 0; j < in->n_args; j++) vmc_move(c, base + j, s->ins[in->args[j]].reg, 1);
+					vmc_emit(c, INS_ABC(OP_RET, in->n_args > 0 ? base : 0, in->n_args, 0));
+					break;
+				default:
+					assert(ssa_is_pure(in->op));
+					vmc_emit(c, INS_ABC(OP_ADDI + (in->op - SSA_ADDI), d, r0, ssa_is_unary(in->op) ? 0 : r1));
+					break;
+			}
+		}
+	}
+	for (int i = 0; i < n_jumps; i += 2) vmc_patch(c, jumps[i], block_pc[jumps[i+1]]);
+	c->max_regs = top;
+	vmc_end_func(c);
+	return 0;
+}
+
+static void ssa_report_reject(struct vm_compiler* c, int fi, const char* reason)
+{
+	struct vm_ssa_report* r = dynary_append(&c->prog->ssa_reports_dy);
+	memset(r, 0, sizeof(*r));
+	r->func = c->prog->funcs[fi].sym;
+	r->reason = reason;
+}
+
+// compiles function fi through SSA; returns -1, emitting nothing, if it's
+// left to the tree compiler
+static int ssa_compile(struct vm_compiler* c, int fi, struct sexpr* def)
+{
+	struct vm_prog* prog = c->prog;
+	struct ssa s;
+	ssa_init(&s, c, fi);
+	// errors free s on their way out
+	jmp_buf on_err;
+	jmp_buf* outer = c->on_err;
+	if (outer != NULL) {
+		c->on_err = &on_err;
+		if (setjmp(on_err) != 0) {
+			ssa_free(&s);
+			c->on_err = outer;
+			longjmp(*outer, 1);
+		}
+	}
+	struct vm_ssa_report reports[SSA_N_PASSES];
+	int ok = ssa_build(&s, def) == 0;
+	for (int i = 0; ok && i < SSA_N_PASSES; i++) {
+		struct vm_ssa_report* r = &reports[i];
+		memset(r, 0, sizeof(*r));
+		r->func = prog->funcs[fi].sym;
+		r->pass = ssa_passes[i].name;
+		r->before = ssa_count(&s);
+		r->n_changed = ssa_passes[i].run(&s);
+		r->after = ssa_count(&s);
+	}
+	if (ok && ssa_lower(&s) != 0) {
+		ok = 0;
+		s.reject = "needs too many registers";
+	}
+
+	if (ok) {
+		for (int i = 0; i < SSA_N_PASSES; i++) *(struct vm_ssa_report*)dynary_append(&prog->ssa_reports_dy) = reports[i];
+	} else {
+		ssa_report_reject(c, fi, s.reject);
+	}
+	ssa_free(&s);
+	c->on_err = outer;
+	return ok ? 0 : -1;
+}
+
+static void vm_print_ssa_reports(FILE* f, struct vm_prog* prog)
+{
+	for (int i = 0; i < prog->ssa_reports_dy.n; i++) {
+		struct vm_ssa_report* r = &prog->ssa_reports[i];
+		fprintf(f, "%s: ", symtab_get(&symtab, r->func)->name);
+		if (r->pass == NULL) {
+			fprintf(f, "not compiled through SSA: %s\n", r->reason);
+		} else {
+			fprintf(f, "%s: %d -> %d instructions, %d changed\n", r->pass, r->before, r->after, r->n_changed);
+		}
+	}
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// JIT
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+native code for every function of a compiled program. the backend lowers
+bytecode rather than the tree, so it runs exactly what the interpreter runs
+and the interpreter can serve as its reference (see jit_diff_test()).
+programs are small, so everything is compiled up front by jit_init(); on
+platforms without a backend (or if that fails) jit_call() just interprets
+*/
+
+struct jit_ctx {
+	union vm_value* regs_end;
+	union vm_value* globals;
+	int frames_left; // see VM_MAX_FRAMES
+};
+
+typedef int (*jit_fn)(union vm_value* R, struct jit_ctx* ctx);
+
+struct jit {
+	struct vm* vm; // globals and register stack are shared with it
+	void* mem;
+	size_t mem_size;
+	jit_fn* funcs; // NULL when falling back to the interpreter
+	// calls running, by the parity of epoch when they started; see cgen_free()
+	int n_calls[2];
+	int epoch;
+};
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(JIT_NO_NATIVE)
+#include "do_jit_x64.h"
+#else
+static int jit__compile(struct jit* j)
+{
+	return -1;
+}
+
+static void jit__release(struct jit* j)
+{
+}
+#endif
+
+// returns 0 when running native code, -1 when falling back to the interpreter
+static int jit_init(struct jit* j, struct vm* vm)
+{
+	memset(j, 0, sizeof(*j));
+	j->vm = vm;
+	return jit__compile(j);
+}
+
+static void jit_free(struct jit* j)
+{
+	jit__release(j);
+	free(j->funcs);
+}
+
+// same as vm_call()
+static int jit_call(struct jit* j, int func, const union vm_value* args, union vm_value* rets)
+{
+	// swapped under running calls by the C backend (see cgen_start()),
+	// which counts them before it unloads what they may be running
+	int e = __atomic_load_n(&j->epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&j->n_calls[e], 1, __ATOMIC_SEQ_CST);
+	jit_fn* funcs = __atomic_load_n(&j->funcs, __ATOMIC_SEQ_CST);
+	int status;
+	if (funcs == NULL) {
+		status = vm_call(j->vm, func, args, rets);
+	} else {
+		struct vm* vm = j->vm;
+		struct vm_func* fn = &vm->prog->funcs[func];
+		struct jit_ctx ctx;
+		ctx.regs_end = vm->regs + VM_MAX_REGS;
+		ctx.globals = vm->globals;
+		ctx.frames_left = VM_MAX_FRAMES;
+
+		if (fn->n_arg_slots > 0) memcpy(vm->regs, args, fn->n_arg_slots * sizeof(*args));
+		status = funcs[func](vm->regs, &ctx);
+		if (status == VM_OK && rets != NULL) memcpy(rets, vm->regs, fn->n_ret_slots * sizeof(*rets));
+	}
+	__atomic_sub_fetch(&j->n_calls[e], 1, __ATOMIC_RELEASE);
+	return status;
+}
+
+static uint64_t jit__rand(uint64_t* state)
+{
+	// xorshift64*
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dull;
+}
+
+// fills the slots of a value of type t with random, often nasty, values
+static void jit__rand_value(struct sem_type* t, union vm_value** slot, uint64_t* rng)
+{
+	switch (t->kind) {
+		case SEM_INT: {
+			static const int64_t edge[] = { 0, 1, -1, 2, 7, -7, INT64_MAX, INT64_MIN };
+			uint64_t r = jit__rand(rng);
+			switch (r & 3) {
+				case 0: (*slot)->i = edge[(r >> 8) % (sizeof(edge) / sizeof(edge[0]))]; break;
+				case 1: (*slot)->i = (int64_t)(r >> 8) % 100; break;
+				case 2: (*slot)->i = (int64_t)(r >> 8) % 100000 - 50000; break;
+				default: (*slot)->i = jit__rand(rng); break;
+			}
+			(*slot)++;
+		} break;
+		case SEM_FLOAT: {
+			static const double edge[] = { 0.0, -0.0, 1.0, -1.0, 0.5, 1e300, -1e-300, 1.0/0.0 };
+			uint64_t r = jit__rand(rng);
+			switch (r & 3) {
+				case 0: (*slot)->f = edge[(r >> 8) % (sizeof(edge) / sizeof(edge[0]))]; break;
+				case 1: (*slot)->f = (double)((int64_t)(r >> 8) % 200 - 100) / 8.0; break;
+				default: (*slot)->f = ((double)(r >> 11) / (double)(1ull << 53) - 0.5) * 2000.0; break;
+			}
+			(*slot)++;
+		} break;
+		case SEM_STRUCT:
+			for (int i = 0; i < t->n; i++) jit__rand_value(t->fields[i].type, slot, rng);
+			break;
+		case SEM_ARRAY:
+			for (int i = 0; i < t->n; i++) jit__rand_value(t->elem, slot, rng);
+			break;
+		default:
+			break;
+	}
+}
+
+// compares bit patterns, except that all NaNs are equal
+static int jit__same(union vm_value a, union vm_value b)
+{
+	if (a.i == b.i) return 1;
+	return a.f != a.f && b.f != b.f;
+}
+
+/*
+differential testing: calls func n times with random arguments, through
+both the interpreter and native code starting from the same globals, and
+counts the calls where status, return values or globals differ
+*/
+static int jit_diff_test(struct jit* j, int func, int n, uint64_t seed)
+{
+	struct vm* vm = j->vm;
+	struct vm_prog* prog = vm->prog;
+	struct vm_func* fn = &prog->funcs[func];
+	size_t globals_sz = prog->n_global_slots * sizeof(union vm_value);
+	union vm_value args[VM_MAX_FRAME_REGS], vm_rets[VM_MAX_FRAME_REGS], jit_rets[VM_MAX_FRAME_REGS];
+	union vm_value* globals0 = malloc(globals_sz + 1);
+	union vm_value* vm_globals = malloc(globals_sz + 1);
+	assert(globals0 != NULL && vm_globals != NULL);
+	uint64_t rng = seed | 1;
+
+	int n_mismatches = 0;
+	for (int iter = 0; iter < n; iter++) {
+		union vm_value* slot = args;
+		for (int i = 0; i < fn->n_args; i++) jit__rand_value(fn->arg_types[i], &slot, &rng);
+
+		memcpy(globals0, vm->globals, globals_sz);
+		int vm_status = vm_call(vm, func, args, vm_rets);
+		memcpy(vm_globals, vm->globals, globals_sz);
+		memcpy(vm->globals, globals0, globals_sz);
+		int jit_status = jit_call(j, func, args, jit_rets);
+
+		int same = vm_status == jit_status;
+		for (int i = 0; same && vm_status == VM_OK && i < fn->n_ret_slots; i++) {
+			same = jit__same(vm_rets[i], jit_rets[i]);
+		}
+		for (int i = 0; same && i < prog->n_global_slots; i++) {
+			same = jit__same(vm_globals[i], vm->globals[i]);
+		}
+		if (!same) n_mismatches++;
+	}
+
+	free(globals0);
+	free(vm_globals);
+	return n_mismatches;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+// C BACKEND
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+translates a checked program (see vm_compile()) into a standalone C
+translation unit, has the system C compiler build it into a shared object
+in the background, and swaps it in under a struct jit once it's loaded, so
+calls go from the interpreter or the JIT to optimized C without the caller
+waiting for cc.
+
+the generated code follows the VM to the bit: integers are int64_t and
+wrap, division by zero gives zero, floats are doubles and can't be
+contracted into FMAs, values are laid out in 64-bit slots (so structs and
+arrays map straight onto the globals) and operands are evaluated in the
+same order, including local variables being read in place. every function
+also tracks the frame the VM would have given it, so stack overflows and
+index errors come out as the same VM_* status.
+
+shared objects are cached on disk, keyed by a BLAKE2b hash of the checked
+tree, of the frame layout it mirrors and of the compiler (its version, and
+the target its flags select), so reopening a project loads the previous
+build without running cc. an object that doesn't load is rebuilt
+*/
+
+#if defined(__unix__) && !defined(CGEN_NO_CC)
+#define CGEN_NATIVE
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+enum cgen_state {
+	CGEN_PENDING = 0,
+	CGEN_READY, // swapped in
+	CGEN_FAILED, // the jit keeps running what it ran before
+};
+
+struct cgen {
+	struct jit* jit;
+	uint8_t hash[32];
+	char* so_path;
+	char* src; // translation unit, built unless the cached object loads
+	size_t src_len;
+	int n_funcs;
+	int state; // CGEN_*; accessed atomically
+	int from_cache;
+	void* dl;
+	jit_fn* funcs;
+	jit_fn* prev; // jit->funcs before the swap
+#ifdef CGEN_NATIVE
+	pthread_t thread;
+	int has_thread;
+#endif
+};
+
+#ifdef CGEN_NATIVE
+
+// compile flags; part of the cache key
+static const char* cgen_cc_argv[] = {
+	"cc", "-O2", "-march=native", "-ffp-contract=off", "-fno-strict-aliasing",
+	"-fPIC", "-shared", "-w",
+};
+#define CGEN_N_CC_ARGS (sizeof(cgen_cc_argv) / sizeof(cgen_cc_argv[0]))
+
+// bump whenever the generated code changes
+#define CGEN_VERSION "do-cgen-1"
+
+static const char cgen_preamble[] =
+	"#include <stdint.h>\n"
+	"#include <string.h>\n"
+	"union vm_value { int64_t i; double f; };\n"
+	"struct jit_ctx { union vm_value* regs_end; union vm_value* globals; int frames_left; };\n"
+	"#define VM_WRAP(a,op,b) ((int64_t)((uint64_t)(a) op (uint64_t)(b)))\n"
+	"static inline int64_t vm_divi(int64_t a, int64_t b)\n"
+	"{\n"
+	"\tif (b == 0) return 0;\n"
+	"\tif (b == -1) return VM_WRAP(0, -, a);\n"
+	"\treturn a / b;\n"
+	"}\n"
+	"#define G(T,slot) (*(T*)(ctx->globals + (slot)))\n"
+	"#define CHECK(i,n) if ((uint64_t)(i) >= (uint64_t)(n)) { st = VM_ERR_INDEX; goto out; }\n"
+	"#define CALL(x) if ((st = (x)) != VM_OK) goto out\n";
+
+struct cg_val {
+	struct sem_type* type;
+	const char* s; // C expression
+	int in_place; // s is a local variable that may still change
+};
+
+// lvalues; see vmc_loc()
+struct cg_loc {
+	enum vm_binding_kind kind; // VMB_LOCAL, VMB_GLOBAL or VMB_CONST
+	struct sem_type* type;
+	const char* s;
+	int dyn; // indexed at run time
+};
+
+struct cg {
+	struct vm_prog* prog;
+	struct arena arena; // strings
+
+	FILE* decls; // types and prototypes
+	FILE* out; // function bodies
+	int depth;
+
+	// scopes are stacked; lookups search from the top. local indices
+	// number C variables
+	struct dynary bindings_dy;
+	struct vm_binding* bindings;
+
+	// struct and array types declared so far; type i is T<i>
+	struct dynary types_dy;
+	struct sem_type** types;
+
+	// binary operations being generated; see sexpr_push_chain()
+	struct dynary chain_dy;
+	struct sexpr** chain;
+
+	// function being generated
+	struct vm_func* fn;
+	int pc; // next OP_CALL to look at, see cg_call_base()
+	int n_vars, n_labels;
+	int loop_label; // continue label of the innermost loop
+};
+
+static const char* cg_strf(struct cg* g, const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	char* s = arena_alloc(&g->arena, n + 1);
+	va_start(args, fmt);
+	vsnprintf(s, n + 1, fmt, args);
+	va_end(args);
+	return s;
+}
+
+static void cg_line(struct cg* g, const char* fmt, ...)
+{
+	for (int i = 0; i < g->depth; i++) fputc('\t', g->out);
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(g->out, fmt, args);
+	va_end(args);
+	fputc('\n', g->out);
+}
+
+static struct vm_binding* cg_lookup(struct cg* g, uint32_t sym)
+{
+	for (int i = g->bindings_dy.n - 1; i >= 0; i--) {
+		if (g->bindings[i].sym == sym) return &g->bindings[i];
+	}
+	return NULL;
+}
+
+static void cg_bind(struct cg* g, struct sexpr* name, enum vm_binding_kind kind, int index, struct sem_type* type)
+{
+	struct vm_binding* b = dynary_append(&g->bindings_dy);
+	b->sym = name->atom.sym;
+	b->kind = kind;
+	b->index = index;
+	b->type = type;
+}
+
+// C type of t; structs and arrays become typedefs of structs whose members
+// are all 8 bytes, so they match the slot layout
+static const char* cg_type(struct cg* g, struct sem_type* t)
+{
+	if (t->kind == SEM_INT) return "int64_t";
+	if (t->kind == SEM_FLOAT) return "double";
+	assert(t->kind == SEM_STRUCT || t->kind == SEM_ARRAY);
+	for (int i = 0; i < g->types_dy.n; i++) {
+		if (sem_type_same(g->types[i], t)) return cg_strf(g, "T%d", i);
+	}
+
+	// members first, they have to be declared before t
+	if (t->kind == SEM_ARRAY) {
+		const char* elem = cg_type(g, t->elem);
+		fprintf(g->decls, "typedef struct { %s e[%d]; } T%d;\n", elem, t->n, g->types_dy.n);
+	} else {
+		const char** names = arena_alloc(&g->arena, t->n * sizeof(*names));
+		for (int i = 0; i < t->n; i++) names[i] = cg_type(g, t->fields[i].type);
+		fprintf(g->decls, "typedef struct {");
+		for (int i = 0; i < t->n; i++) fprintf(g->decls, " %s f%d;", names[i], i);
+		fprintf(g->decls, " } T%d;\n", g->types_dy.n);
+	}
+	struct sem_type** p = dynary_append(&g->types_dy);
+	*p = t;
+	return cg_strf(g, "T%d", g->types_dy.n - 1);
+}
+
+static const char* cg_number(struct cg* g, struct sexpr* e, struct sem_type** type)
+{
+	union vm_value v;
+	*type = sem_number(&g->prog->sem, &e->atom, &v);
+	if ((*type)->kind == SEM_FLOAT) {
+		if (isinf(v.f)) return v.f > 0 ? "(1.0/0.0)" : "(-1.0/0.0)";
+		return cg_strf(g, "(%a)", v.f);
+	}
+	if (v.i == INT64_MIN) return "INT64_MIN";
+	return cg_strf(g, "INT64_C(%lld)", (long long)v.i);
+}
+
+static const char* cg_convert(struct cg* g, struct cg_val v, struct sem_type* to)
+{
+	if (v.type->kind == SEM_INT && to->kind == SEM_FLOAT) return cg_strf(g, "(double)(%s)", v.s);
+	if (v.type->kind == SEM_FLOAT && to->kind == SEM_INT) return cg_strf(g, "(int64_t)(%s)", v.s);
+	assert(sem_type_same(v.type, to) || (sem_type_is_scalar(v.type) && sem_type_is_scalar(to)));
+	return v.s;
+}
+
+// copies s into a new temporary, i.e. reads it now
+static struct cg_val cg_temp(struct cg* g, struct sem_type* type, const char* s)
+{
+	struct cg_val v = { type, cg_strf(g, "t%d", g->n_vars++), 0 };
+	cg_line(g, "%s %s = %s;", cg_type(g, type), v.s, s);
+	return v;
+}
+
+static int cg_is_loc(struct cg* g, struct sexpr* e)
+{
+	if (sexpr_is_atom(e)) {
+		if (e->atom.type == T_NUMBER) return 1;
+		if (e->atom.type != T_IDENTIFIER) return 0;
+		struct vm_binding* b = cg_lookup(g, e->atom.sym);
+		return b != NULL && (b->kind == VMB_LOCAL || b->kind == VMB_GLOBAL);
+	}
+	struct sexpr* head = e->list;
+	if (sexpr_is_tt(head, T_DOT) || sexpr_is_tt(head, T_LBRACKET)) return cg_is_loc(g, head->next);
+	return 0;
+}
+
+static struct cg_val cg_expr(struct cg* g, struct sexpr* e);
+
+static void cg_index(struct cg* g, struct cg_loc* loc, struct sexpr* idx)
+{
+	struct sem_type* t = loc->type;
+	assert(t->kind == SEM_ARRAY);
+	loc->type = t->elem;
+	if (sexpr_is_atom(idx) && idx->atom.type == T_NUMBER) {
+		union vm_value v;
+		sem_number(&g->prog->sem, &idx->atom, &v);
+		loc->s = cg_strf(g, "%s.e[%lld]", loc->s, (long long)v.i);
+		return;
+	}
+	struct cg_val i = cg_expr(g, idx);
+	if (i.in_place) i = cg_temp(g, i.type, i.s);
+	cg_line(g, "CHECK(%s, %d);", i.s, t->n);
+	loc->s = cg_strf(g, "%s.e[%s]", loc->s, i.s);
+	loc->dyn = 1;
+}
+
+// e must satisfy cg_is_loc(); emits the index checks
+static void cg_loc(struct cg* g, struct sexpr* e, struct cg_loc* loc)
+{
+	memset(loc, 0, sizeof(*loc));
+	if (sexpr_is_atom(e)) {
+		if (e->atom.type == T_NUMBER) {
+			loc->kind = VMB_CONST;
+			loc->s = cg_number(g, e, &loc->type);
+			return;
+		}
+		struct vm_binding* b = cg_lookup(g, e->atom.sym);
+		loc->kind = b->kind;
+		loc->type = b->type;
+		if (b->kind == VMB_LOCAL) {
+			loc->s = cg_strf(g, "l%d", b->index);
+		} else {
+			loc->s = cg_strf(g, "G(%s, %d)", cg_type(g, b->type), b->index);
+		}
+		return;
+	}
+
+	struct sexpr* head = e->list;
+	cg_loc(g, head->next, loc);
+	if (sexpr_is_tt(head, T_DOT)) {
+		struct sem_field* f = sem_field(&g->prog->sem, loc->type, head->next->next);
+		loc->s = cg_strf(g, "%s.f%d", loc->s, (int)(f - loc->type->fields));
+		loc->type = f->type;
+	} else {
+		cg_index(g, loc, head->next->next);
+	}
+}
+
+// frame offset of the next call, taken from the bytecode so the frames
+// are the same as the VM's
+static int cg_call_base(struct cg* g, int fi)
+{
+	struct vm_func* fn = g->fn;
+	while (g->pc < fn->n_code && INS_OP(fn->code[g->pc]) != OP_CALL) g->pc++;
+	if (g->pc < fn->n_code && INS_BX(fn->code[g->pc]) == fi) return INS_A(fn->code[g->pc++]);
+	return fn->n_regs;
+}
+
+static struct cg_val cg_call(struct cg* g, struct sexpr* e)
+{
+	struct sexpr* head = e->list;
+	int fi = cg_lookup(g, head->atom.sym)->index;
+	struct vm_func* fn = &g->prog->funcs[fi];
+
+	const char** args = arena_alloc(&g->arena, (fn->n_args + 1) * sizeof(*args));
+	int i = 0;
+	for (struct sexpr* arg = head->next; arg != NULL; arg = arg->next, i++) {
+		struct cg_val v = cg_expr(g, arg);
+		args[i] = cg_temp(g, fn->arg_types[i], cg_convert(g, v, fn->arg_types[i])).s;
+	}
+
+	int rets = g->n_vars;
+	for (i = 0; i < fn->n_rets; i++) {
+		cg_line(g, "%s t%d;", cg_type(g, fn->ret_types[i]), g->n_vars++);
+	}
+
+	for (int i = 0; i < g->depth; i++) fputc('\t', g->out);
+	fprintf(g->out, "CALL(f%d(ctx, R + %d", fi, cg_call_base(g, fi));
+	for (i = 0; i < fn->n_rets; i++) fprintf(g->out, ", &t%d", rets + i);
+	for (i = 0; i < fn->n_args; i++) fprintf(g->out, ", %s", args[i]);
+	fprintf(g->out, "));\n");
+
+	if (fn->n_rets == 0) return (struct cg_val){ &sem_void, NULL, 0 };
+	return (struct cg_val){ fn->ret_types[0], cg_strf(g, "t%d", rets), 0 };
+}
+
+static struct cg_val cg_assign(struct cg* g, struct sexpr* e)
+{
+	struct sexpr* lhs = e->list->next;
+	struct cg_loc loc;
+	cg_loc(g, lhs, &loc);
+	struct cg_val v = cg_expr(g, lhs->next);
+	const char* s = cg_convert(g, v, loc.type);
+	cg_line(g, "%s = %s;", loc.s, s);
+	if (loc.kind == VMB_LOCAL && !loc.dyn) return (struct cg_val){ loc.type, loc.s, 1 };
+	return (struct cg_val){ loc.type, s, v.in_place };
+}
+
+// generates the binary operation e, and the chain of them down its left
+// operands, bottom up
+static struct cg_val cg_binary(struct cg* g, struct sexpr* e)
+{
+	int base = g->chain_dy.n;
+	struct cg_val a = cg_expr(g, sexpr_push_chain(&g->chain_dy, e));
+	for (int i = g->chain_dy.n - 1; i >= base; i--) {
+		enum token_type tt = g->chain[i]->list->atom.type;
+		struct cg_val b = cg_expr(g, g->chain[i]->list->next->next);
+		struct sem_type* t = sem_arith_type(a.type, b.type);
+		const char* sa = cg_convert(g, a, t);
+		const char* sb = cg_convert(g, b, t);
+		int is_float = t->kind == SEM_FLOAT;
+		const char* s = NULL;
+		switch (tt) {
+			case T_PLUS: s = is_float ? cg_strf(g, "%s + %s", sa, sb) : cg_strf(g, "VM_WRAP(%s, +, %s)", sa, sb); break;
+			case T_MINUS: s = is_float ? cg_strf(g, "%s - %s", sa, sb) : cg_strf(g, "VM_WRAP(%s, -, %s)", sa, sb); break;
+			case T_MUL: s = is_float ? cg_strf(g, "%s * %s", sa, sb) : cg_strf(g, "VM_WRAP(%s, *, %s)", sa, sb); break;
+			case T_DIV: s = is_float ? cg_strf(g, "%s / %s", sa, sb) : cg_strf(g, "vm_divi(%s, %s)", sa, sb); break;
+			case T_EQ:
+				t = sem_builtin(T_BOOL);
+				s = cg_strf(g, "(int64_t)(%s == %s)", sa, sb);
+				break;
+			case T_NEQ:
+				t = sem_builtin(T_BOOL);
+				s = cg_strf(g, "(int64_t)(%s != %s)", sa, sb);
+				break;
+			default: assert(0);
+		}
+		a = cg_temp(g, t, s);
+	}
+	g->chain_dy.n = base;
+	return a;
+}
+
+static struct cg_val cg_expr(struct cg* g, struct sexpr* e)
+{
+	if (cg_is_loc(g, e)) {
+		struct cg_loc loc;
+		cg_loc(g, e, &loc);
+		if (loc.kind == VMB_CONST) return (struct cg_val){ loc.type, loc.s, 0 };
+		if (loc.kind == VMB_LOCAL && !loc.dyn) return (struct cg_val){ loc.type, loc.s, 1 };
+		return cg_temp(g, loc.type, loc.s);
+	}
+
+	struct sexpr* head = e->list;
+	enum token_type tt = head->atom.type;
+
+	if (tt == T_DOT) {
+		// member of something that isn't a variable, e.g. a call result
+		struct cg_val v = cg_expr(g, head->next);
+		struct sem_field* f = sem_field(&g->prog->sem, v.type, head->next->next);
+		return (struct cg_val){ f->type, cg_strf(g, "%s.f%d", v.s, (int)(f - v.type->fields)), 0 };
+	}
+
+	if (tt == T_LBRACKET) {
+		struct cg_val v = cg_expr(g, head->next);
+		struct cg_loc loc = { VMB_LOCAL, v.type, v.s, 0 };
+		cg_index(g, &loc, head->next->next);
+		return cg_temp(g, loc.type, loc.s);
+	}
+
+	if (tt == T_ASSIGN) return cg_assign(g, e);
+	if (tt == T_IDENTIFIER) return cg_call(g, e);
+
+	if (tt_is_type(tt)) {
+		struct cg_val v = cg_expr(g, head->next);
+		struct sem_type* to = sem_builtin(tt);
+		return cg_temp(g, to, cg_convert(g, v, to));
+	}
+
+	if (head->next->next == NULL) {
+		struct cg_val v = cg_expr(g, head->next);
+		if (tt != T_MINUS) return cg_temp(g, v.type, v.s);
+		if (v.type->kind == SEM_FLOAT) return cg_temp(g, v.type, cg_strf(g, "-(%s)", v.s));
+		return cg_temp(g, v.type, cg_strf(g, "VM_WRAP(0, -, %s)", v.s));
+	}
+
+	return cg_binary(g, e);
+}
+
+static void cg_block(struct cg* g, struct sexpr* block);
+
+static void cg_local_def(struct cg* g, struct sexpr* def)
+{
+	struct sexpr* name = def->list->next;
+	struct sexpr* type = name->next;
+	struct sexpr* init = type->next;
+	if (def->list->atom.type != T_VAR) return;
+
+	struct sem_type* t = type->type;
+	const char* s;
+	if (init == NULL) {
+		s = sem_type_is_scalar(t) ? "0" : "{0}";
+	} else {
+		struct cg_val v = cg_expr(g, init);
+		if (t == NULL) t = v.type;
+		s = cg_convert(g, v, t);
+	}
+	int index = g->n_vars++;
+	cg_line(g, "%s l%d = %s;", cg_type(g, t), index, s);
+	cg_bind(g, name, VMB_LOCAL, index, t);
+}
+
+static void cg_return(struct cg* g, struct sexpr* stmt)
+{
+	struct vm_func* fn = g->fn;
+	const char** values = arena_alloc(&g->arena, (fn->n_rets + 1) * sizeof(*values));
+	int i = 0;
+	for (struct sexpr* value = stmt->list->next; value != NULL; value = value->next, i++) {
+		struct cg_val v = cg_expr(g, value);
+		values[i] = cg_convert(g, v, fn->ret_types[i]);
+		if (fn->n_rets > 1) values[i] = cg_temp(g, fn->ret_types[i], values[i]).s;
+	}
+	for (i = 0; i < fn->n_rets; i++) cg_line(g, "*r%d = %s;", i, values[i]);
+	cg_line(g, "goto out;");
+}
+
+// init; for (;;) { if (!cond) break; body; continue: post; }
+static void cg_for(struct cg* g, struct sexpr* stmt)
+{
+	struct sexpr* init = NULL;
+	struct sexpr* cond = NULL;
+	struct sexpr* post = NULL;
+	struct sexpr* body = stmt->list->next;
+	switch (sexpr_list_len(stmt)) {
+		case 2: break;
+		case 3: cond = body; body = body->next; break;
+		case 5: init = body; cond = init->next; post = cond->next; body = post->next; break;
+		default: assert(0);
+	}
+
+	if (init != NULL) cg_expr(g, init);
+	int outer = g->loop_label;
+	g->loop_label = g->n_labels++;
+	cg_line(g, "for (;;) {");
+	g->depth++;
+	if (cond != NULL) cg_line(g, "if (!(%s)) break;", cg_expr(g, cond).s);
+	cg_block(g, body);
+	cg_line(g, "c%d:;", g->loop_label);
+	if (post != NULL) cg_expr(g, post);
+	g->depth--;
+	cg_line(g, "}");
+	g->loop_label = outer;
+}
+
+static void cg_stmt(struct cg* g, struct sexpr* stmt)
+{
+	struct sexpr* head = sexpr_is_list(stmt) ? stmt->list : NULL;
+	enum token_type tt = head != NULL && sexpr_is_atom(head) ? head->atom.type : 0;
+	switch (tt) {
+		case T_VAR:
+		case T_CONST:
+		case T_TYPE:
+			cg_local_def(g, stmt);
+			break;
+		case T_RETURN:
+			cg_return(g, stmt);
+			break;
+		case T_IF:
+			cg_line(g, "if (%s)", cg_expr(g, head->next).s);
+			cg_block(g, head->next->next);
+			if (head->next->next->next != NULL) {
+				cg_line(g, "else");
+				cg_block(g, head->next->next->next);
+			}
+			break;
+		case T_FOR:
+			cg_for(g, stmt);
+			break;
+		case T_BREAK:
+			cg_line(g, "break;");
+			break;
+		case T_CONTINUE:
+			cg_line(g, "goto c%d;", g->loop_label);
+			break;
+		default:
+			cg_expr(g, stmt);
+			break;
+	}
+}
+
+static void cg_block(struct cg* g, struct sexpr* block)
+{
+	int n_bindings = g->bindings_dy.n;
+	cg_line(g, "{");
+	g->depth++;
+	for (struct sexpr* stmt = block->list; stmt != NULL; stmt = stmt->next) {
+		cg_stmt(g, stmt);
+	}
+	g->depth--;
+	cg_line(g, "}");
+	g->bindings_dy.n = n_bindings;
+}
+
+static void cg_proto(struct cg* g, FILE* f, int fi)
+{
+	struct vm_func* fn = &g->prog->funcs[fi];
+	// types first, f may be g->decls
+	for (int i = 0; i < fn->n_rets; i++) cg_type(g, fn->ret_types[i]);
+	for (int i = 0; i < fn->n_args; i++) cg_type(g, fn->arg_types[i]);
+	fprintf(f, "static int f%d(struct jit_ctx* ctx, union vm_value* R", fi);
+	for (int i = 0; i < fn->n_rets; i++) fprintf(f, ", %s* r%d", cg_type(g, fn->ret_types[i]), i);
+	for (int i = 0; i < fn->n_args; i++) fprintf(f, ", %s l%d", cg_type(g, fn->arg_types[i]), i);
+	fprintf(f, ")");
+}
+
+// body is a block, or a list of global definitions for the init function
+static void cg_func(struct cg* g, int fi, struct sexpr* args, struct sexpr* body)
+{
+	struct vm_func* fn = &g->prog->funcs[fi];
+	int n_bindings = g->bindings_dy.n;
+	g->fn = fn;
+	g->pc = 0;
+	g->n_vars = fn->n_args;
+	g->n_labels = 0;
+
+	cg_proto(g, g->out, fi);
+	fprintf(g->out, "\n{\n\tint st = VM_OK;\n");
+	fprintf(g->out, "\tif (--ctx->frames_left < 0 || R + %d > ctx->regs_end) {\n", fn->n_regs);
+	fprintf(g->out, "\t\tst = VM_ERR_STACK_OVERFLOW;\n\t\tgoto out;\n\t}\n");
+	g->depth = 1;
+	if (args != NULL) {
+		int i = 0;
+		for (struct sexpr* a = args->list; a != NULL; a = a->next, i++) {
+			cg_bind(g, a->list, VMB_LOCAL, i, fn->arg_types[i]);
+		}
+		cg_block(g, body);
+	} else {
+		int slot = 0;
+		for (struct sexpr* def = body->list; def != NULL; def = def->next) {
+			if (def->list->atom.type != T_VAR) continue;
+			struct sexpr* name = def->list->next;
+			struct sexpr* init = name->next->next;
+			struct sem_type* t = name->next->type;
+			if (init != NULL) {
+				struct cg_val v = cg_expr(g, init);
+				if (t == NULL) t = v.type;
+				cg_line(g, "G(%s, %d) = %s;", cg_type(g, t), slot, cg_convert(g, v, t));
+			}
+			cg_bind(g, name, VMB_GLOBAL, slot, t);
+			slot += t->n_slots;
+		}
+	}
+	fprintf(g->out, "out:\n\tctx->frames_left++;\n\treturn st;\n}\n\n");
+	if (args != NULL) g->bindings_dy.n = n_bindings;
+
+	// called like jit_fn
+	fprintf(g->out, "int do_f%d(union vm_value* R, struct jit_ctx* ctx)\n{\n", fi);
+	int slot = 0;
+	for (int i = 0; i < fn->n_args; i++) {
+		fprintf(g->out, "\t%s a%d;\n\tmemcpy(&a%d, R + %d, sizeof(a%d));\n", cg_type(g, fn->arg_types[i]), i, i, slot, i);
+		slot += fn->arg_types[i]->n_slots;
+	}
+	for (int i = 0; i < fn->n_rets; i++) fprintf(g->out, "\t%s r%d;\n", cg_type(g, fn->ret_types[i]), i);
+	fprintf(g->out, "\tint st = f%d(ctx, R", fi);
+	for (int i = 0; i < fn->n_rets; i++) fprintf(g->out, ", &r%d", i);
+	for (int i = 0; i < fn->n_args; i++) fprintf(g->out, ", a%d", i);
+	fprintf(g->out, ");\n");
+	slot = 0;
+	for (int i = 0; i < fn->n_rets; i++) {
+		fprintf(g->out, "\tif (st == VM_OK) memcpy(R + %d, &r%d, sizeof(r%d));\n", slot, i, i);
+		slot += fn->ret_types[i]->n_slots;
+	}
+	fprintf(g->out, "\treturn st;\n}\n\n");
+}
+
+// C source for a program compiled by vm_compile(prog, defs, ...); every
+// function fi of prog becomes "int do_f<fi>(union vm_value* R, struct
+// jit_ctx* ctx)", the globals initializer included. the result is
+// malloc()ed and NUL terminated
+static char* cgen_source(struct vm_prog* prog, struct sexpr* defs, size_t* len)
+{
+	struct cg g;
+	memset(&g, 0, sizeof(g));
+	g.prog = prog;
+	arena_init(&g.arena);
+	dynary_init(&g.bindings_dy, (void**) &g.bindings, sizeof(*g.bindings));
+	dynary_init(&g.types_dy, (void**) &g.types, sizeof(*g.types));
+	dynary_init(&g.chain_dy, (void**) &g.chain, sizeof(*g.chain));
+	char* decls;
+	char* out;
+	size_t decls_len, out_len;
+	g.decls = open_memstream(&decls, &decls_len);
+	g.out = open_memstream(&out, &out_len);
+	assert(g.decls != NULL && g.out != NULL);
+
+	int fi = 0;
+	for (struct sexpr* def = defs->list; def != NULL; def = def->next) {
+		if (def->list->atom.type == T_FUNC) cg_bind(&g, def->list->next, VMB_FUNC, fi++, NULL);
+	}
+	int init_func = fi;
+	assert(init_func == prog->funcs_dy.n - 1);
+	fprintf(g.decls, "enum { VM_OK = %d, VM_ERR_STACK_OVERFLOW = %d, VM_ERR_INDEX = %d };\n",
+		VM_OK, VM_ERR_STACK_OVERFLOW, VM_ERR_INDEX);
+	for (fi = 0; fi < prog->funcs_dy.n; fi++) {
+		cg_proto(&g, g.decls, fi);
+		fprintf(g.decls, ";\n");
+	}
+	fprintf(g.decls, "\n");
+
+	// binds the globals for the function bodies
+	cg_func(&g, init_func, NULL, defs);
+
+	fi = 0;
+	for (struct sexpr* def = defs->list; def != NULL; def = def->next) {
+		if (def->list->atom.type != T_FUNC) continue;
+		struct sexpr* args = def->list->next->next;
+		cg_func(&g, fi++, args, args->next->next);
+	}
+
+	fclose(g.decls);
+	fclose(g.out);
+	*len = sizeof(cgen_preamble) - 1 + decls_len + out_len;
+	char* src = malloc(*len + 1);
+	assert(src != NULL);
+	memcpy(src, cgen_preamble, sizeof(cgen_preamble) - 1);
+	memcpy(src + sizeof(cgen_preamble) - 1, decls, decls_len);
+	memcpy(src + sizeof(cgen_preamble) - 1 + decls_len, out, out_len + 1);
+	free(decls);
+	free(out);
+	free(g.bindings);
+	free(g.types);
+	free(g.chain);
+	arena_free(&g.arena);
+	return src;
+}
+
+// appends what argv prints to stdout to f
+static void cgen__cc_print(FILE* f, char** argv)
+{
+	int fds[2];
+	if (pipe(fds) != 0) return;
+	posix_spawn_file_actions_t fa;
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, fds[1], 1);
+	posix_spawn_file_actions_addclose(&fa, fds[0]);
+	pid_t pid;
+	int spawned = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ) == 0;
+	posix_spawn_file_actions_destroy(&fa);
+	close(fds[1]);
+	char buf[4096];
+	for (ssize_t n; (n = read(fds[0], buf, sizeof(buf))) > 0; ) fwrite(buf, 1, n, f);
+	close(fds[0]);
+	if (spawned) waitpid(pid, NULL, 0);
+}
+
+// what the compiler says about itself: its version, and the macros the
+// compile flags predefine, which name the target and what -march=native
+// picked. asked once per process
+static char* cgen_cc_id;
+static size_t cgen_cc_id_len;
+static pthread_once_t cgen_cc_once = PTHREAD_ONCE_INIT;
+
+static void cgen__cc_identify()
+{
+	FILE* f = open_memstream(&cgen_cc_id, &cgen_cc_id_len);
+	assert(f != NULL);
+	char* version[] = { (char*)cgen_cc_argv[0], "--version", NULL };
+	cgen__cc_print(f, version);
+	char* macros[CGEN_N_CC_ARGS + 6];
+	for (int i = 0; i < CGEN_N_CC_ARGS; i++) macros[i] = (char*)cgen_cc_argv[i];
+	char* dm[] = { "-dM", "-E", "-x", "c", "/dev/null", NULL };
+	memcpy(macros + CGEN_N_CC_ARGS, dm, sizeof(dm));
+	cgen__cc_print(f, macros);
+	fclose(f);
+}
+
+static void cgen__key_sexpr(FILE* f, struct sexpr* e)
+{
+	// the next node to write in each open list; trees can be any depth
+	struct sexpr** stack;
+	struct dynary stack_dy;
+	dynary_init(&stack_dy, (void**) &stack, sizeof(*stack));
+	for (;;) {
+		if (sexpr_is_atom(e)) {
+			uint32_t tt = e->atom.type;
+			uint32_t len = e->atom.str.len;
+			fputc('a', f);
+			fwrite(&tt, sizeof(tt), 1, f);
+			fwrite(&len, sizeof(len), 1, f);
+			fwrite(e->atom.str.ptr, 1, len, f);
+		} else {
+			fputc('(', f);
+			*(struct sexpr**)dynary_append(&stack_dy) = e->list;
+		}
+
+		e = NULL;
+		while (stack_dy.n > 0 && e == NULL) {
+			e = stack[stack_dy.n - 1];
+			if (e == NULL) {
+				fputc(')', f);
+				stack_dy.n--;
+			} else {
+				stack[stack_dy.n - 1] = e->next;
+			}
+		}
+		if (e == NULL) break;
+	}
+	free(stack);
+}
+
+// cache key of the code cgen_source() generates, as built by this compiler
+static void cgen_hash(struct vm_prog* prog, struct sexpr* defs, uint8_t hash[32])
+{
+	pthread_once(&cgen_cc_once, cgen__cc_identify);
+	char* key;
+	size_t key_len;
+	FILE* f = open_memstream(&key, &key_len);
+	assert(f != NULL);
+	fwrite(CGEN_VERSION, 1, sizeof(CGEN_VERSION), f);
+	for (int i = 0; i < CGEN_N_CC_ARGS; i++) fwrite(cgen_cc_argv[i], 1, strlen(cgen_cc_argv[i]) + 1, f);
+	uint64_t id_len = cgen_cc_id_len;
+	fwrite(&id_len, sizeof(id_len), 1, f);
+	fwrite(cgen_cc_id, 1, cgen_cc_id_len, f);
+	cgen__key_sexpr(f, defs);
+	for (int fi = 0; fi < prog->funcs_dy.n; fi++) {
+		struct vm_func* fn = &prog->funcs[fi];
+		fwrite(&fn->n_regs, sizeof(fn->n_regs), 1, f);
+		for (int pc = 0; pc < fn->n_code; pc++) {
+			if (INS_OP(fn->code[pc]) == OP_CALL) fwrite(&fn->code[pc], sizeof(fn->code[pc]), 1, f);
+		}
+	}
+	fclose(f);
+	blake2b_256(key, key_len, hash);
+	free(key);
+}
+
+// where cgen_start() caches shared objects unless told otherwise:
+// $XDG_CACHE_HOME/do or ~/.cache/do
+static void cgen_default_dir(char* buf, size_t size)
+{
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	if (xdg != NULL && xdg[0] != 0) {
+		snprintf(buf, size, "%s/do", xdg);
+	} else if (home != NULL && home[0] != 0) {
+		snprintf(buf, size, "%s/.cache/do", home);
+	} else {
+		snprintf(buf, size, "/tmp/do-cache");
+	}
+}
+
+// mkdir -p
+static int cgen__mkdirs(const char* path)
+{
+	char buf[4096];
+	size_t n = strlen(path);
+	if (n == 0 || n >= sizeof(buf)) return -1;
+	memcpy(buf, path, n + 1);
+	for (size_t i = 1; i <= n; i++) {
+		if (buf[i] != '/' && buf[i] != 0) continue;
+		char c = buf[i];
+		buf[i] = 0;
+		if (mkdir(buf, 0755) != 0 && errno != EEXIST) return -1;
+		buf[i] = c;
+	}
+	return 0;
+}
+
+// writes the source next to so_path and builds so_path from it; the object
+// is renamed into place, so other processes never see half of it
+static int cgen__build(struct cgen* g)
+{
+	size_t n = strlen(g->so_path) + 64;
+	char* c_path = malloc(n);
+	char* tmp_path = malloc(n);
+	assert(c_path != NULL && tmp_path != NULL);
+	snprintf(c_path, n, "%s.%d.c", g->so_path, (int)getpid());
+	snprintf(tmp_path, n, "%s.%d.tmp", g->so_path, (int)getpid());
+
+	int status = -1;
+	FILE* f = fopen(c_path, "wb");
+	if (f != NULL) {
+		int ok = fwrite(g->src, 1, g->src_len, f) == g->src_len;
+		if (fclose(f) == 0 && ok) {
+			char* argv[CGEN_N_CC_ARGS + 4];
+			for (int i = 0; i < CGEN_N_CC_ARGS; i++) argv[i] = (char*)cgen_cc_argv[i];
+			argv[CGEN_N_CC_ARGS] = "-o";
+			argv[CGEN_N_CC_ARGS + 1] = tmp_path;
+			argv[CGEN_N_CC_ARGS + 2] = c_path;
+			argv[CGEN_N_CC_ARGS + 3] = NULL;
+			pid_t pid;
+			int wstatus;
+			if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) == 0
+				&& waitpid(pid, &wstatus, 0) == pid
+				&& WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0
+				&& rename(tmp_path, g->so_path) == 0)
+			{
+				status = 0;
+			}
+		}
+		unlink(c_path);
+	}
+	if (status != 0) unlink(tmp_path);
+	free(c_path);
+	free(tmp_path);
+	return status;
+}
+
+static int cgen__load(struct cgen* g)
+{
+	g->dl = dlopen(g->so_path, RTLD_NOW | RTLD_LOCAL);
+	if (g->dl == NULL) return -1;
+	g->funcs = calloc(g->n_funcs, sizeof(*g->funcs));
+	assert(g->funcs != NULL);
+	for (int fi = 0; fi < g->n_funcs; fi++) {
+		char name[32];
+		snprintf(name, sizeof(name), "do_f%d", fi);
+		g->funcs[fi] = (jit_fn)dlsym(g->dl, name);
+		if (g->funcs[fi] == NULL) {
+			dlclose(g->dl);
+			g->dl = NULL;
+			free(g->funcs);
+			g->funcs = NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void* cgen__thread(void* arg)
+{
+	struct cgen* g = arg;
+	// a cached object that doesn't load (torn, or from another system
+	// sharing the directory) is built over
+	g->from_cache = g->from_cache && cgen__load(g) == 0;
+	int ok = g->from_cache || (cgen__build(g) == 0 && cgen__load(g) == 0);
+	if (ok) g->prev = __atomic_exchange_n(&g->jit->funcs, g->funcs, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&g->state, ok ? CGEN_READY : CGEN_FAILED, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+// starts building native code for the program j runs, which vm_compile()
+// compiled from defs, and returns right away; the code is swapped into j
+// when it's ready (see cgen_state()). dir is the cache directory, see
+// cgen_default_dir(). defs may be freed once this returns, j only after
+// cgen_free()
+static int cgen_start(struct cgen* g, struct jit* j, struct sexpr* defs, const char* dir)
+{
+	memset(g, 0, sizeof(*g));
+	g->jit = j;
+	struct vm_prog* prog = j->vm->prog;
+	g->n_funcs = prog->funcs_dy.n;
+	cgen_hash(prog, defs, g->hash);
+	g->state = CGEN_FAILED;
+	if (cgen__mkdirs(dir) != 0) return -1;
+
+	size_t n = strlen(dir) + 2 * sizeof(g->hash) + 8;
+	g->so_path = malloc(n);
+	assert(g->so_path != NULL);
+	char* at = g->so_path + snprintf(g->so_path, n, "%s/", dir);
+	for (int i = 0; i < sizeof(g->hash); i++) at += sprintf(at, "%02x", g->hash[i]);
+	strcpy(at, ".so");
+	struct stat st;
+	g->from_cache = stat(g->so_path, &st) == 0;
+	// defs may be gone by the time the cached object turns out not to load
+	g->src = cgen_source(prog, defs, &g->src_len);
+
+	g->state = CGEN_PENDING;
+	if (pthread_create(&g->thread, NULL, cgen__thread, g) != 0) {
+		g->state = CGEN_FAILED;
+		return -1;
+	}
+	g->has_thread = 1;
+	return 0;
+}
+
+static int cgen_state(struct cgen* g)
+{
+	return __atomic_load_n(&g->state, __ATOMIC_ACQUIRE);
+}
+
+// blocks until the build is done; returns the final CGEN_* state
+static int cgen_wait(struct cgen* g)
+{
+	if (g->has_thread) {
+		pthread_join(g->thread, NULL);
+		g->has_thread = 0;
+	}
+	return cgen_state(g);
+}
+
+// swaps the jit back to what it ran before, and waits for calls still in
+// the shared object to return before unloading it; must come before
+// jit_free()
+static void cgen_free(struct cgen* g)
+{
+	if (cgen_wait(g) == CGEN_READY) {
+		struct jit* j = g->jit;
+		__atomic_store_n(&j->funcs, g->prev, __ATOMIC_SEQ_CST);
+		// calls starting after the flip see prev; of those counted under
+		// the old parity, the ones still to load funcs see prev too
+		int e = __atomic_fetch_add(&j->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+		while (__atomic_load_n(&j->n_calls[e], __ATOMIC_SEQ_CST) > 0) sched_yield();
+	}
+	if (g->dl != NULL) dlclose(g->dl);
+	free(g->funcs);
+	free(g->src);
+	free(g->so_path);
+}
+
+#else
+
+static void cgen_default_dir(char* buf, size_t size)
+{
+	snprintf(buf, size, "/tmp/do-cache");
+}
+
+static int cgen_start(struct cgen* g, struct jit* j, struct sexpr* defs, const char* dir)
+{
+	memset(g, 0, sizeof(*g));
+	g->jit = j;
+	g->state = CGEN_FAILED;
+	return -1;
+}
+
+static int cgen_state(struct cgen* g)
+{
+	return g->state;
+}
+
+static int cgen_wait(struct cgen* g)
+{
+	return g->state;
+}
+
+static void cgen_free(struct cgen* g)
+{
+}
+
+#endif
+
+
+#ifdef TEST
+
+#include <pthread.h>
+#ifdef CGEN_NATIVE
+#include <dirent.h>
+#endif
+
+int n_failed;
+
+#define OK "\e[32m\e[1mOK\e[0m "
+#define FAIL "\e[41m\e[33m\e[1m!!\e[0m "
+
+#if 0
 static void sexpr_print(struct sexpr* e)
 {
-	if (sexpr_is_atom(e)) {
-		if (e->atom.str.ptr != NULL) {
-			str_print(&e->atom.str);
+	if (sexpr_is_atom(e)) {
+		if (e->atom.str.ptr != NULL) {
+			str_print(&e->atom.str);
+		} else {
+			assert(!"invalid atom");
+		}
+	} else if (sexpr_is_list(e)) {
+		printf("(");
+		int first = 1;
+		for (struct sexpr* i = e->sexpr; i; i = i->next) {
+			if (!first) printf(" ");
+			sexpr_print(i);
+			first = 0;
+		}
+		printf(")");
+	} else {
+		assert(!"not atom or list?!");
+	}
+}
+#endif
+
+static void wrstr(char** d, const char* s)
+{
+	strcpy(*d, s);
+	*d += strlen(s);
+}
+
+char tmpstr[65536];
+// prints e (not its siblings) into tmpstr; walks with a stack of the lists
+// being printed, so any depth goes
+static char* sexpr_str(struct sexpr* e)
+{
+	struct frame {
+		struct sexpr* next_child;
+		int first;
+	};
+	struct frame* stack; // one per open list
+	struct dynary stack_dy;
+	dynary_init(&stack_dy, (void**) &stack, sizeof(*stack));
+
+	char* sp = tmpstr;
+	for (;;) {
+		if (sexpr_is_atom(e)) {
+			assert(e->atom.str.ptr != NULL && "invalid atom");
+			memcpy(sp, e->atom.str.ptr, e->atom.str.len);
+			sp += e->atom.str.len;
+		} else if (sexpr_is_list(e)) {
+			wrstr(&sp, "(");
+			struct frame* fr = dynary_append(&stack_dy);
+			fr->next_child = e->list;
+			fr->first = 1;
+		} else {
+			assert(!"not atom or list?!");
+		}
+
+		e = NULL;
+		while (stack_dy.n > 0) {
+			struct frame* top = &stack[stack_dy.n - 1];
+			if (top->next_child == NULL) {
+				wrstr(&sp, ")");
+				stack_dy.n--;
+				continue;
+			}
+			e = top->next_child;
+			top->next_child = e->next;
+			if (!top->first) wrstr(&sp, " ");
+			top->first = 0;
+			break;
+		}
+		if (e == NULL) break;
+	}
+	*sp = 0;
+	free(stack);
+	return tmpstr;
+}
+
+static void test_lex(char* src, char* expected)
+{
+	struct lexer l;
+	lexer_init(&l, src);
+	char* s = tmpstr;
+	for (;;) {
+		struct token t = lexer_next(&l);
+		if (t.type == T_EOF) break;
+		if (s > tmpstr) *(s++) = ' ';
+		if (t.type == T_SEMICOLON) {
+			*(s++) = ';';
+		} else {
+			memcpy(s, t.str.ptr, t.str.len);
+			s += t.str.len;
+		}
+	}
+	*s = 0;
+
+	if (strcmp(tmpstr, expected) == 0) {
+		printf(OK "lex %s => %s\n", src, tmpstr);
+	} else {
+		printf(FAIL "%s lexed to '%s', expected '%s'\n", src, tmpstr, expected);
+		n_failed++;
+	}
+}
+
+static void test_keywords()
+{
+	int n = 0;
+	for (int i = 0; i < KEYWORD_HASH_SIZE; i++) {
+		const struct keyword* kw = &keyword_table[i];
+		if (kw->str == NULL) continue;
+		n++;
+		struct lexer l;
+		lexer_init(&l, (char*)kw->str);
+		struct token t = lexer_next(&l);
+		if (keyword_hash(kw->str, kw->len) != i || kw->len != strlen(kw->str) || t.type != kw->tt) {
+			printf(FAIL "keyword '%s' in slot %d does not lex to itself\n", kw->str, i);
+			n_failed++;
+		}
+	}
+	printf(OK "%d keywords\n", n);
+}
+
+#define TEST_SYMTAB_THREADS (4)
+#define TEST_SYMTAB_NAMES (20000)
+
+struct test_symtab_thread {
+	struct symtab* st;
+	int seed;
+	uint32_t ids[TEST_SYMTAB_NAMES];
+};
+
+// interns the same names as the other threads, in another order
+static void* test_symtab__thread(void* arg)
+{
+	struct test_symtab_thread* t = arg;
+	char name[32];
+	for (int k = 0; k < TEST_SYMTAB_NAMES; k++) {
+		int i = (k * 7919 + t->seed * 4099) % TEST_SYMTAB_NAMES;
+		snprintf(name, sizeof(name), "n%d", i);
+		t->ids[i] = symtab_intern(t->st, name, strlen(name));
+	}
+	return NULL;
+}
+
+static void test_symbols()
+{
+	struct lexer l;
+	lexer_init(&l, "foo bar foo int baz bar");
+	uint32_t ids[6];
+	for (int i = 0; i < 6; i++) ids[i] = lexer_next(&l).sym;
+	int ok =
+		   ids[0] != 0 && ids[0] == ids[2]
+		&& ids[1] != 0 && ids[1] == ids[5]
+		&& ids[0] != ids[1] && ids[4] != ids[0] && ids[4] != ids[1]
+		&& ids[3] == 0 // keyword
+		&& strcmp(symtab_get(&symtab, ids[4])->name, "baz") == 0;
+
+	// force the table to grow a few times
+	struct symtab st;
+	symtab_init(&st);
+	char name[32];
+	for (int i = 0; i < 10000; i++) {
+		snprintf(name, sizeof(name), "sym%d", i);
+		if (symtab_intern(&st, name, strlen(name)) != i + 1) ok = 0;
+	}
+	for (int i = 0; i < 10000; i += 7) {
+		snprintf(name, sizeof(name), "sym%d", i);
+		if (symtab_intern(&st, name, strlen(name)) != i + 1) ok = 0;
+		if (strcmp(symtab_get(&st, i + 1)->name, name) != 0) ok = 0;
+	}
+	if (symtab_n_symbols(&st) != 10000) ok = 0;
+	symtab_free(&st);
+
+	// threads share the table, and agree on every id
+	symtab_init(&st);
+	static struct test_symtab_thread threads[TEST_SYMTAB_THREADS];
+	pthread_t tids[TEST_SYMTAB_THREADS];
+	for (int t = 0; t < TEST_SYMTAB_THREADS; t++) {
+		threads[t].st = &st;
+		threads[t].seed = t;
+		pthread_create(&tids[t], NULL, test_symtab__thread, &threads[t]);
+	}
+	for (int t = 0; t < TEST_SYMTAB_THREADS; t++) pthread_join(tids[t], NULL);
+	for (int i = 0; i < TEST_SYMTAB_NAMES; i++) {
+		for (int t = 1; t < TEST_SYMTAB_THREADS; t++) if (threads[t].ids[i] != threads[0].ids[i]) ok = 0;
+		snprintf(name, sizeof(name), "n%d", i);
+		if (strcmp(symtab_get(&st, threads[0].ids[i])->name, name) != 0) ok = 0;
+	}
+	if (symtab_n_symbols(&st) != TEST_SYMTAB_NAMES) ok = 0;
+	symtab_free(&st);
+
+	if (ok) {
+		printf(OK "symbol interning\n");
+	} else {
+		printf(FAIL "symbol interning\n");
+		n_failed++;
+	}
+}
+
+static void validate(struct parser* p, char* src, struct sexpr* actual_sexpr, char* expected_sexpr_str)
+{
+	if (actual_sexpr == NULL) {
+		printf(FAIL "parse error for '%s'\n", src);
+		return;
+	}
+
+	char* actual_sexpr_str = sexpr_str(actual_sexpr);
+	if (strcmp(actual_sexpr_str, expected_sexpr_str) == 0) {
+		printf(OK "%s => %s\n", src, actual_sexpr_str);
+	} else {
+		printf(FAIL "%s parsed to '%s', expected '%s'\n", src, actual_sexpr_str, expected_sexpr_str);
+		n_failed++;
+	}
+
+	// round trip through the flat representation
+	struct flat f;
+	flat_init(&f, src);
+	flat_append_sexpr(&f, actual_sexpr);
+	actual_sexpr_str = sexpr_str(flat_to_sexpr(&p->arena, &f, 0));
+	if (strcmp(actual_sexpr_str, expected_sexpr_str) != 0) {
+		printf(FAIL "%s flat round trip gave '%s', expected '%s'\n", src, actual_sexpr_str, expected_sexpr_str);
+		n_failed++;
+	}
+	flat_free(&f);
+}
+
+static void test_parse_expr(char* src, char* expected_sexpr_str)
+{
+	struct parser p;
+	parser_init(&p, src);
+	struct sexpr* actual_sexpr = parse_expr(&p);
+	validate(&p, src, actual_sexpr, expected_sexpr_str);
+	parser_free(&p);
+}
+
+static char* test_repeat(char* dst, char* s, int n)
+{
+	size_t len = strlen(s);
+	for (int i = 0; i < n; i++, dst += len) memcpy(dst, s, len);
+	*dst = 0;
+	return dst;
+}
+
+static void test_parse_expr_long()
+{
+	// far beyond what a recursive parser's C stack (or sexpr_str()'s buffer) would take,
+	// so the shape is walked instead: n levels of (head ... child ...) around x
+	const int n = 100000;
+	struct { char* open; char* close; enum token_type head; int child, len; } cases[] = {
+		{ "f(", ")", T_IDENTIFIER, 1, 2 },
+		{ "-(", ")", T_MINUS, 1, 2 },
+		{ "a[", "]", T_LBRACKET, 2, 3 },
+		{ "", "+1", T_PLUS, 1, 3 },
+	};
+	char* src = malloc(n * 4 + 2);
+	assert(src != NULL);
+	for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		test_repeat(test_repeat(test_repeat(src, cases[i].open, n), "x", 1), cases[i].close, n);
+
+		struct parser p;
+		parser_init(&p, src);
+		struct sexpr* e = parse_expr(&p);
+		int depth = 0;
+		while (e != NULL && sexpr_is_list(e) && sexpr_is_tt(e->list, cases[i].head) && sexpr_list_len(e) == cases[i].len) {
+			e = e->list;
+			for (int k = 0; k < cases[i].child; k++) e = e->next;
+			depth++;
+		}
+		if (depth == n && sexpr_is_tt(e, T_IDENTIFIER)) {
+			printf(OK "%sx%s nested %d deep\n", cases[i].open, cases[i].close, n);
+		} else {
+			printf(FAIL "%sx%s nested %d deep parsed to depth %d\n", cases[i].open, cases[i].close, n, depth);
+			n_failed++;
+		}
+		parser_free(&p);
+	}
+	free(src);
+}
+
+static void test_parse(char* src, char* expected_sexpr_str)
+{
+	struct parser p;
+	parser_init(&p, src);
+	struct sexpr* actual_sexpr = parse_rec(&p, 0, 0);
+	validate(&p, src, actual_sexpr, expected_sexpr_str);
+	parser_free(&p);
+}
+
+static void test_parse_body(char* src, char* expected_sexpr_str)
+{
+	struct parser p;
+	parser_init(&p, src);
+	struct sexpr* actual_sexpr = parse_rec(&p, 1, 1);
+	validate(&p, src, actual_sexpr, expected_sexpr_str);
+	parser_free(&p);
+}
+
+// with on_err set, errors come back as messages instead of aborting
+static void test_check_err(char* src, char* expected)
+{
+	jmp_buf on_err;
+	struct parser p;
+	struct sem s;
+	parser_init(&p, src);
+	sem_init(&s);
+	p.on_err = &on_err;
+	s.on_err = &on_err;
+	char* actual = "ok";
+	if (setjmp(on_err) == 0) {
+		sem_check(&s, parse_rec(&p, 0, 0));
+	} else {
+		actual = p.err ? p.err_msg : s.err_msg;
+	}
+	if (strcmp(actual, expected) == 0) {
+		printf(OK "%s => %s\n", src, actual);
+	} else {
+		printf(FAIL "%s => '%s', expected '%s'\n", src, actual, expected);
+		n_failed++;
+	}
+	sem_free(&s);
+	parser_free(&p);
+}
+
+static void test_parser_reset()
+{
+	struct parser p;
+	char* src = "func fn(x int, y int) (int, int) {return x+y,x-y;};";
+	char* expected = "((func fn ((x (int)) (y (int))) ((int) (int)) ((return (+ x y) (- x y)))))";
+	parser_init(&p, src);
+	validate(&p, src, parse_rec(&p, 0, 0), expected);
+	int n_allocs = p.arena.n_allocs;
+	size_t bytes_reserved = p.arena.bytes_reserved;
+	for (int i = 0; i < 100; i++) {
+		parser_reset(&p, src);
+		parse_rec(&p, 0, 0);
+	}
+	parser_reset(&p, src);
+	validate(&p, src, parse_rec(&p, 0, 0), expected);
+	if (p.arena.n_allocs != n_allocs || p.arena.bytes_reserved != bytes_reserved) {
+		printf(FAIL "arena grew across parser_reset() (%d/%d allocs, %zd/%zd bytes)\n", n_allocs, p.arena.n_allocs, bytes_reserved, p.arena.bytes_reserved);
+		n_failed++;
+	} else {
+		printf(OK "%d sexprs, %zd/%zd bytes allocated/reserved\n", p.arena.n_allocs, p.arena.bytes_allocated, p.arena.bytes_reserved);
+	}
+	parser_free(&p);
+}
+
+static char incsrc[4096];
+
+// edits incsrc and compares with a plain parse of it, with the error spans
+// ip should have blanked out
+static void test_incparse_edit(struct incparse* ip, char* find, char* replace, int max_reparsed, int n_errors)
+{
+	char* at = strstr(incsrc, find);
+	assert(at != NULL);
+	int start = at - incsrc;
+	int old_len = strlen(find);
+	int new_len = strlen(replace);
+	memmove(at + new_len, at + old_len, strlen(at + old_len) + 1);
+	memcpy(at, replace, new_len);
+	incparse_edit(ip, incsrc, strlen(incsrc), start, old_len, new_len);
+
+	static char blanked[sizeof(incsrc)];
+	strcpy(blanked, incsrc);
+	for (int i = 0; i < ip->decls_dy.n; i++) {
+		struct incdecl* d = ip->decls[i];
+		for (int j = d->start; d->err != NULL && j < d->end; j++) {
+			if (blanked[j] != '\n') blanked[j] = ' ';
+		}
+	}
+	struct parser p;
+	parser_init(&p, blanked);
+	char* expected = strdup(sexpr_str(parse_rec(&p, 0, 0)));
+	char* actual = sexpr_str(incparse_sexpr(ip));
+	if (strcmp(actual, expected) != 0) {
+		printf(FAIL "'%s' -> '%s' incrementally parsed to '%s', expected '%s'\n", find, replace, actual, expected);
+		n_failed++;
+	} else if (ip->n_reparsed > max_reparsed || ip->n_built > max_reparsed) {
+		printf(FAIL "'%s' -> '%s' reparsed %d and built %d definitions, expected at most %d\n", find, replace, ip->n_reparsed, ip->n_built, max_reparsed);
+		n_failed++;
+	} else if (ip->n_errors != n_errors) {
+		printf(FAIL "'%s' -> '%s' left %d error spans, expected %d\n", find, replace, ip->n_errors, n_errors);
+		n_failed++;
+	} else {
+		printf(OK "'%s' -> '%s' reparsed %d/%d definitions, %d error spans\n", find, replace, ip->n_reparsed, ip->decls_dy.n, ip->n_errors);
+	}
+	free(expected);
+	parser_free(&p);
+}
+
+static void test_incparse()
+{
+	struct incparse ip;
+	incparse_init(&ip);
+	strcpy(incsrc,
+		"var a int = 1;\n"
+		"var b = 2;\n"
+		"// comment\n"
+		"type T struct { x int; y float32 };\n"
+		"func f(x int) int {\n"
+		"\treturn x*x\n"
+		"}\n"
+		"const k = 4\n"
+		"var c [k]T\n");
+	test_incparse_edit(&ip, "", "", 100, 0); // initial parse
+	test_incparse_edit(&ip, "b = 2", "b = 22", 1, 0);
+	test_incparse_edit(&ip, "func", "const c2 = 7;\nfunc", 2, 0);
+	test_incparse_edit(&ip, "var b = 22;\n", "", 1, 0);
+	test_incparse_edit(&ip, "return x*x", "return x*x+1", 1, 0);
+	test_incparse_edit(&ip, "// comment", "/* a\nlonger comment */", 1, 0);
+	test_incparse_edit(&ip, "var c [k]T\n", "var c [k]T\nvar z = 1\n", 2, 0);
+	test_incparse_edit(&ip, "var a int", "const a int", 1, 0);
+	test_incparse_edit(&ip, "const c2 = 7;", "/* const c2 = 7; */", 2, 0);
+	test_incparse_edit(&ip, "const k = 4\nvar c [k]T", "var c [4]T", 1, 0);
+	test_incparse_edit(&ip, "var c [4]T", "const k = 4\nvar c [k]T", 2, 0);
+	test_incparse_edit(&ip, "var z = 1\n", "", 1, 0);
+
+	// halfway through typing: the rest is kept, and parsed again once fixed
+	test_incparse_edit(&ip, "return x*x+1", "return x*x+", 1, 1);
+	test_incparse_edit(&ip, "return x*x+", "return x*x+1", 1, 0);
+	test_incparse_edit(&ip, "const a int =", "const a int = =", 1, 1);
+	test_incparse_edit(&ip, "return x*x+1", "return x*x+", 1, 2);
+	test_incparse_edit(&ip, "const a int = =", "const a int =", 1, 1);
+	test_incparse_edit(&ip, "return x*x+", "return x*x+1", 1, 0);
+	// an unclosed function runs into everything after it
+	test_incparse_edit(&ip, "x*x+1\n}", "x*x+1\n", 1, 1);
+	test_incparse_edit(&ip, "x*x+1\n", "x*x+1\n}", 100, 0);
+	test_incparse_edit(&ip, "const k", "const k = 4\nvar", 2, 1);
+	test_incparse_edit(&ip, "4\nvar = 4", "4", 1, 0);
+	incparse_free(&ip);
+}
+
+static void test_blake2b(char* src, char* expected)
+{
+	uint8_t h[32];
+	blake2b_256(src, strlen(src), h);
+	char actual[65];
+	for (int i = 0; i < 32; i++) sprintf(actual + i*2, "%02x", h[i]);
+	if (strcmp(actual, expected) == 0) {
+		printf(OK "blake2b-256('%s') = %s\n", src, actual);
+	} else {
+		printf(FAIL "blake2b-256('%s') = %s, expected %s\n", src, actual, expected);
+		n_failed++;
+	}
+}
+
+// loads src into ip through pc and checks the result against a plain parse
+static void test_pcache_load(struct pcache* pc, struct incparse* ip, char* src, int expect_hit)
+{
+	incparse_init(ip);
+	int hit = pcache_load(pc, ip, src, strlen(src));
+
+	struct parser p;
+	parser_init(&p, src);
+	char* expected = strdup(sexpr_str(parse_rec(&p, 0, 0)));
+	char* actual = sexpr_str(incparse_sexpr(ip));
+	if (strcmp(actual, expected) != 0) {
+		printf(FAIL "'%s' loaded as '%s', expected '%s'\n", src, actual, expected);
+		n_failed++;
+	} else if (hit != expect_hit) {
+		printf(FAIL "'%s': expected a cache %s\n", src, expect_hit ? "hit" : "miss");
+		n_failed++;
+	} else {
+		printf(OK "'%s' => %s (cache %s)\n", src, actual, hit ? "hit" : "miss");
+	}
+	free(expected);
+	parser_free(&p);
+}
+
+static void test_pcache_save(struct pcache* pc, int expected)
+{
+	int n = pcache_save(pc);
+	if (n == expected) {
+		printf(OK "saved %d cache entries\n", n);
+	} else {
+		printf(FAIL "saved %d cache entries, expected %d\n", n, expected);
+		n_failed++;
+	}
+}
+
+static void test_pcache()
+{
+	test_blake2b("", "0e5751c026e543b2e8ab2eb06099daa1d1e5df47778f7787faab45cdf12fe3a8");
+	test_blake2b("abc", "bddd813c634239723171ef3fee98579b94964e3bb1cb3e427262c8c068d52319");
+	test_blake2b("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "5f7a93da9c5621583f22e49e8e91a40cbba37536622235a380f434b9f68e49c4");
+	char block[129]; // exactly one block, which must be compressed as the last
+	memset(block, 'a', 128);
+	block[128] = 0;
+	test_blake2b(block, "ae2aa48507885c4c950fb809b2076f959cde9f8ea6da260d9a3587df33dac450");
+
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/do-test-pcache-%d", (int)getpid());
+	remove(path);
+	char* srcs[] = {
+		"var a int = 1; type T struct { x int; y float32 };",
+		"func f(x int) int { return x*x; }; const k = 4; var c [k]T;",
+		"",
+	};
+	const int n = sizeof(srcs) / sizeof(srcs[0]);
+	struct incparse ips[3];
+	struct pcache pc;
+
+	// cold
+	pcache_open(&pc, path, 1 << 20);
+	for (int i = 0; i < n; i++) {
+		test_pcache_load(&pc, &ips[i], srcs[i], 0);
+		pcache_put(&pc, &ips[i]);
+	}
+	test_pcache_save(&pc, n);
+	for (int i = 0; i < n; i++) incparse_free(&ips[i]);
+	pcache_free(&pc);
+
+	// warm; definitions loaded from the cache can be edited like any other
+	pcache_open(&pc, path, 1 << 20);
+	for (int i = 0; i < n; i++) test_pcache_load(&pc, &ips[i], srcs[i], 1);
+	strcpy(incsrc, srcs[1]);
+	char* at = strstr(incsrc, "x*x");
+	assert(at != NULL);
+	memmove(at + 2, at, strlen(at) + 1);
+	memcpy(at, "1+", 2);
+	incparse_edit(&ips[1], incsrc, strlen(incsrc), at - incsrc, 0, 2);
+	pcache_put(&pc, &ips[1]);
+	test_pcache_save(&pc, n + 1);
+	for (int i = 0; i < n; i++) incparse_free(&ips[i]);
+	pcache_free(&pc);
+
+	// the edited buffer now hits too; then only the entry used last fits
+	pcache_open(&pc, path, 1 << 20);
+	test_pcache_load(&pc, &ips[1], incsrc, 1);
+	uint8_t hash[32];
+	blake2b_256(incsrc, strlen(incsrc), hash);
+	pc.max_bytes = sizeof(struct pcache_header) + sizeof(struct pcache_entry) + pcache__payload_size(&pc.items[pcache__find(&pc, hash)].e);
+	test_pcache_save(&pc, 1);
+	incparse_free(&ips[1]);
+	pcache_free(&pc);
+
+	pcache_open(&pc, path, 1 << 20);
+	test_pcache_load(&pc, &ips[0], srcs[0], 0);
+	test_pcache_load(&pc, &ips[1], incsrc, 1);
+	incparse_free(&ips[0]);
+	incparse_free(&ips[1]);
+	pcache_free(&pc);
+
+	// damage the nodes of the only entry
+	FILE* f = fopen(path, "r+b");
+	assert(f != NULL);
+	fseek(f, -32, SEEK_END);
+	for (int i = 0; i < 32; i++) fputc(0xff, f);
+	fclose(f);
+	pcache_open(&pc, path, 1 << 20);
+	test_pcache_load(&pc, &ips[1], incsrc, 0);
+	incparse_free(&ips[1]);
+	pcache_free(&pc);
+
+	remove(path);
+}
+
+// runs fn(x) in the interpreter, or as native code if native is set
+static void test_sem(char* src, char* expected_sexpr_str)
+{
+	struct parser p;
+	parser_init(&p, src);
+	struct sexpr* defs = parse_rec(&p, 0, 0);
+	struct sem s;
+	sem_init(&s);
+	sem_check(&s, defs);
+	char* actual = sexpr_str(defs);
+	if (strcmp(actual, expected_sexpr_str) != 0) {
+		printf(FAIL "%s: expected %s, got %s\n", src, expected_sexpr_str, actual);
+		n_failed++;
+	} else {
+		printf(OK "%s => %s\n", src, actual);
+	}
+	sem_free(&s);
+	parser_free(&p);
+}
+
+// checks the layout of the type of the last definition in src, given as
+// "size/align" followed by " name@offset" for each field
+static void test_sem_layout(char* src, char* expected)
+{
+	struct parser p;
+	parser_init(&p, src);
+	struct sexpr* defs = parse_rec(&p, 0, 0);
+	struct sem s;
+	sem_init(&s);
+	sem_check(&s, defs);
+	struct sexpr* def = defs->list;
+	while (def->next != NULL) def = def->next;
+	struct sem_type* t = def->list->next->next->type;
+	char actual[1024];
+	int n = snprintf(actual, sizeof(actual), "%d/%d", t->size, t->align);
+	if (t->kind == SEM_STRUCT) {
+		for (int i = 0; i < t->n; i++) {
+			n += snprintf(actual + n, sizeof(actual) - n, " %s@%d", symtab_get(&symtab, t->fields[i].sym)->name, t->fields[i].offset);
+		}
+	}
+	if (strcmp(actual, expected) != 0) {
+		printf(FAIL "%s: expected layout %s, got %s\n", src, expected, actual);
+		n_failed++;
+	} else {
+		printf(OK "%s => %s\n", src, actual);
+	}
+	sem_free(&s);
+	parser_free(&p);
+}
+
+// how: interpreted or native (bit 0), compiled from the tree or through SSA
+// (bit 1)
+static const char* test_vm_how[] = { "vm", "jit", "ssa vm", "ssa jit" };
+
+static int test_vm_run(char* src, char* fn, int64_t x, int64_t* result, int how)
+{
+	struct parser p;
+	parser_init(&p, src);
+	struct vm_prog prog;
+	vm_compile(&prog, parse_rec(&p, 0, 0), (how & 2) ? 0 : VMC_NO_SSA);
+	struct vm vm;
+	int status = vm_init(&vm, &prog);
+	int fi = vm_prog_find_func(&prog, fn);
+	assert(fi >= 0);
+	union vm_value arg = { .i = x };
+	union vm_value ret = { .i = 0 };
+	struct jit jit;
+	jit_init(&jit, &vm);
+	if (status == VM_OK) status = (how & 1) ? jit_call(&jit, fi, &arg, &ret) : vm_call(&vm, fi, &arg, &ret);
+	*result = ret.i;
+	jit_free(&jit);
+	vm_free(&vm);
+	vm_prog_free(&prog);
+	parser_free(&p);
+	return status;
+}
+
+static void test_vm(char* src, char* fn, int64_t x, int64_t expected)
+{
+	for (int how = 0; how < 4; how++) {
+		int64_t result;
+		int status = test_vm_run(src, fn, x, &result, how);
+		if (status != VM_OK) {
+			printf(FAIL "%s: %s(%lld) failed with status %d (%s)\n", src, fn, (long long)x, status, test_vm_how[how]);
+			n_failed++;
+		} else if (result != expected) {
+			printf(FAIL "%s: %s(%lld) returned %lld, expected %lld (%s)\n", src, fn, (long long)x, (long long)result, (long long)expected, test_vm_how[how]);
+			n_failed++;
+		} else {
+			printf(OK "%s: %s(%lld) => %lld (%s)\n", src, fn, (long long)x, (long long)result, test_vm_how[how]);
+		}
+	}
+}
+
+static void test_vm_stack_overflow()
+{
+	char* src = "func f(x int) int { return f(x+1) + 1; };";
+	for (int how = 0; how < 4; how++) {
+		int64_t result;
+		int status = test_vm_run(src, "f", 0, &result, how);
+		if (status != VM_ERR_STACK_OVERFLOW) {
+			printf(FAIL "%s: expected stack overflow, got status %d\n", src, status);
+			n_failed++;
 		} else {
-			assert(!"invalid atom");
+			printf(OK "%s: stack overflow (%s)\n", src, test_vm_how[how]);
 		}
-	} else if (sexpr_is_list(e)) {
-		printf("(");
-		int first = 1;
-		for (struct sexpr* i = e->sexpr; i; i = i->next) {
-			if (!first) printf(" ");
-			sexpr_print(i);
-			first = 0;
+	}
+}
+
+static void test_vm_status(char* src, char* fn, int64_t x, int expected)
+{
+	for (int how = 0; how < 4; how++) {
+		int64_t result;
+		int status = test_vm_run(src, fn, x, &result, how);
+		if (status != expected) {
+			printf(FAIL "%s: %s(%lld) returned status %d, expected %d\n", src, fn, (long long)x, status, expected);
+			n_failed++;
+		} else {
+			printf(OK "%s: %s(%lld) => status %d (%s)\n", src, fn, (long long)x, status, test_vm_how[how]);
 		}
-		printf(")");
-	} else {
-		assert(!"not atom or list?!");
 	}
 }
-#endif
 
-static void wrstr(char** d, const char* s)
+// chains of binary operations compile and run at any length, other trees
+// as deep as sem_check() lets through; deeper ones are refused with an error
+// instead of overflowing the stack
+static void test_deep_exprs()
 {
-	strcpy(*d, s);
-	*d += strlen(s);
+	const int n_ok = SEM_MAX_DEPTH - 16;
+	const int n_deep = 100000;
+	char* src = malloc(n_deep * 4 + 64);
+	assert(src != NULL);
+	for (int shape = 0; shape < 2; shape++) {
+		for (int deep = 0; deep < 2; deep++) {
+			int n = deep ? n_deep : n_ok;
+			char* end = test_repeat(src, "func f(x int) int { return ", 1);
+			if (shape == 0) {
+				end = test_repeat(test_repeat(end, "x+", n - 1), "x", 1);
+			} else {
+				end = test_repeat(test_repeat(test_repeat(end, "-(", n), "x", 1), ")", n);
+			}
+			test_repeat(end, "; };", 1);
+			int64_t expected = shape == 0 ? 3 * n : 3;
+			const char* what = shape == 0 ? "x+x+...+x" : "-(-(...x))";
+
+			if (deep && shape == 1) {
+				jmp_buf on_err;
+				struct parser p;
+				struct sem s;
+				parser_init(&p, src);
+				sem_init(&s);
+				p.on_err = &on_err;
+				s.on_err = &on_err;
+				char* err = NULL;
+				if (setjmp(on_err) == 0) {
+					sem_check(&s, parse_rec(&p, 0, 0));
+				} else {
+					err = p.err ? p.err_msg : s.err_msg;
+				}
+				if (err == NULL || strstr(err, "levels deep") == NULL) {
+					printf(FAIL "%s %d deep: expected a nesting error, got '%s'\n", what, n, err ? err : "ok");
+					n_failed++;
+				} else {
+					printf(OK "%s %d deep => %s\n", what, n, err);
+				}
+				sem_free(&s);
+				parser_free(&p);
+				continue;
+			}
+
+			for (int how = 0; how < 4; how++) {
+				int64_t result;
+				int status = test_vm_run(src, "f", 3, &result, how);
+				if (status != VM_OK || result != expected) {
+					printf(FAIL "%s %d deep: f(3) gave status %d, result %lld, expected %lld (%s)\n", what, n, status, (long long)result, (long long)expected, test_vm_how[how]);
+					n_failed++;
+				} else {
+					printf(OK "%s %d deep: f(3) => %lld (%s)\n", what, n, (long long)result, test_vm_how[how]);
+				}
+			}
+		}
+	}
+	free(src);
 }
 
-static void sexpr_str_rec(struct sexpr* e, char** sp)
+// vm_compile() fails with a message instead of aborting, through every path
+static void test_vm_compile_err(char* src, char* expected)
 {
-	if (sexpr_is_atom(e)) {
-		if (e->atom.str.ptr != NULL) {
-			memcpy(*sp, e->atom.str.ptr, e->atom.str.len);
-			*sp += e->atom.str.len;
+	for (int flags = 0; flags <= VMC_NO_SSA; flags += VMC_NO_SSA) {
+		struct parser p;
+		parser_init(&p, src);
+		struct vm_prog prog;
+		int status = vm_compile(&prog, parse_rec(&p, 0, 0), flags);
+		if (status == 0 || strcmp(prog.err_msg, expected) != 0) {
+			printf(FAIL "%.60s: compiled with status %d, '%s', expected '%s'\n", src, status, prog.err_msg, expected);
+			n_failed++;
 		} else {
-			assert(!"invalid atom");
-		}
-	} else if (sexpr_is_list(e)) {
-		wrstr(sp, "(");
-		int first = 1;
-		for (struct sexpr* i = e->list; i; i = i->next) {
-			if (!first) wrstr(sp, " ");
-			sexpr_str_rec(i, sp);
-			first = 0;
+			printf(OK "%.60s => %s (%s)\n", src, prog.err_msg, flags ? "tree" : "ssa");
 		}
-		wrstr(sp, ")");
-	} else {
-		assert(!"not atom or list?!");
+		vm_prog_free(&prog);
+		parser_free(&p);
 	}
 }
 
-char tmpstr[65536];
-static char* sexpr_str(struct sexpr* e)
+// runs f(x) with globals, interpreted or native
+static int test_vec_run(struct vm_prog* prog, int64_t x, int native, union vm_value* ret, union vm_value* globals)
 {
-	char* s = tmpstr;
-	char* cpy = s;
-	sexpr_str_rec(e, &cpy);
-	*cpy = 0;
-	return s;
+	struct vm vm;
+	int status = vm_init(&vm, prog);
+	struct jit jit;
+	jit_init(&jit, &vm);
+	union vm_value arg = { .i = x };
+	int fi = vm_prog_find_func(prog, "f");
+	assert(fi >= 0 && prog->funcs[fi].n_ret_slots == 1);
+	if (status == VM_OK) status = native ? jit_call(&jit, fi, &arg, ret) : vm_call(&vm, fi, &arg, ret);
+	memcpy(globals, vm.globals, prog->n_global_slots * sizeof(*globals));
+	jit_free(&jit);
+	vm_free(&vm);
+	return status;
 }
 
-static void validate(struct parser* p, char* src, struct sexpr* actual_sexpr, char* expected_sexpr_str)
+// compiles src with and without the vectorizer, checks what the vectorizer
+// reported for each loop ("N:ok/elements" or "N:reason"), and that f(x)
+// returns the same and leaves the same globals either way
+static void test_vec(char* src, int64_t x, char* expected_reports)
 {
-	if (actual_sexpr == NULL) {
-		printf(FAIL "parse error for '%s'\n", src);
-		return;
+	struct parser p0, p1;
+	parser_init(&p0, src);
+	parser_init(&p1, src);
+	struct vm_prog scalar, vec;
+	vm_compile(&scalar, parse_rec(&p0, 0, 0), VMC_NO_VECTORIZE);
+	vm_compile(&vec, parse_rec(&p1, 0, 0), 0);
+
+	char reports[1024] = "";
+	int n = 0;
+	for (int i = 0; i < vec.vec_reports_dy.n; i++) {
+		struct vm_vec_report* r = &vec.vec_reports[i];
+		if (r->reason != NULL) {
+			n += snprintf(reports + n, sizeof(reports) - n, "%s%d:%s", i ? ", " : "", r->loop, r->reason);
+		} else {
+			n += snprintf(reports + n, sizeof(reports) - n, "%s%d:ok/%d", i ? ", " : "", r->loop, r->n);
+		}
 	}
-
-	char* actual_sexpr_str = sexpr_str(actual_sexpr);
-	if (strcmp(actual_sexpr_str, expected_sexpr_str) == 0) {
-		printf(OK "%s => %s\n", src, actual_sexpr_str);
+	int ok = strcmp(reports, expected_reports) == 0 && scalar.vec_reports_dy.n == 0;
+	if (!ok) printf(FAIL "%s: vectorizer reported \"%s\", expected \"%s\"\n", src, reports, expected_reports);
+
+	union vm_value want, got;
+	union vm_value* want_globals = calloc(scalar.n_global_slots + 1, sizeof(*want_globals));
+	union vm_value* got_globals = calloc(scalar.n_global_slots + 1, sizeof(*got_globals));
+	int want_status = test_vec_run(&scalar, x, 0, &want, want_globals);
+	for (int native = 0; ok && native <= 1; native++) {
+		int status = test_vec_run(&vec, x, native, &got, got_globals);
+		int same = status == want_status && (status != VM_OK || jit__same(want, got));
+		for (int i = 0; same && i < scalar.n_global_slots; i++) same = jit__same(want_globals[i], got_globals[i]);
+		if (!same) {
+			printf(FAIL "%s: f(%lld) differs when vectorized (%s)\n", src, (long long)x, native ? "jit" : "vm");
+			ok = 0;
+		}
+	}
+	if (ok) {
+		printf(OK "%s: %s\n", src, reports);
 	} else {
-		printf(FAIL "%s parsed to '%s', expected '%s'\n", src, actual_sexpr_str, expected_sexpr_str);
 		n_failed++;
 	}
+
+	free(want_globals);
+	free(got_globals);
+	vm_prog_free(&scalar);
+	vm_prog_free(&vec);
+	parser_free(&p0);
+	parser_free(&p1);
 }
 
-static void test_parse_expr(char* src, char* expected_sexpr_str)
+static void test_jit_diff(char* src, char* fn)
 {
 	struct parser p;
 	parser_init(&p, src);
-	struct sexpr* actual_sexpr = parse_expr_rec(&p, 0, 0);
-	validate(&p, src, actual_sexpr, expected_sexpr_str);
+	struct vm_prog prog;
+	vm_compile(&prog, parse_rec(&p, 0, 0), 0);
+	struct vm vm;
+	vm_init(&vm, &prog);
+	struct jit jit;
+	int native = jit_init(&jit, &vm) == 0;
+	int n = 2000;
+	int n_mismatches = jit_diff_test(&jit, vm_prog_find_func(&prog, fn), n, 42);
+	if (n_mismatches > 0) {
+		printf(FAIL "%s: %d/%d calls differ between vm and jit\n", src, n_mismatches, n);
+		n_failed++;
+	} else {
+		printf(OK "%s: %d random calls agree (%s)\n", src, n, native ? "native" : "interpreted");
+	}
+	jit_free(&jit);
+	vm_free(&vm);
+	vm_prog_free(&prog);
+	parser_free(&p);
 }
 
-static void test_parse(char* src, char* expected_sexpr_str)
+// compiles src through SSA and checks what the passes reported for fn
+// ("pass before->after/changed", or "no: reason")
+static void test_ssa(char* src, char* fn, char* expected_reports)
 {
 	struct parser p;
 	parser_init(&p, src);
-	struct sexpr* actual_sexpr = parse_rec(&p, 0, 0);
-	validate(&p, src, actual_sexpr, expected_sexpr_str);
+	struct vm_prog prog;
+	vm_compile(&prog, parse_rec(&p, 0, 0), 0);
+	uint32_t sym = prog.funcs[vm_prog_find_func(&prog, fn)].sym;
+	char reports[1024] = "";
+	int n = 0;
+	for (int i = 0; i < prog.ssa_reports_dy.n; i++) {
+		struct vm_ssa_report* r = &prog.ssa_reports[i];
+		if (r->func != sym) continue;
+		const char* sep = n > 0 ? ", " : "";
+		if (r->pass == NULL) {
+			n += snprintf(reports + n, sizeof(reports) - n, "%sno: %s", sep, r->reason);
+		} else {
+			n += snprintf(reports + n, sizeof(reports) - n, "%s%s %d->%d/%d", sep, r->pass, r->before, r->after, r->n_changed);
+		}
+	}
+	if (strcmp(reports, expected_reports) != 0) {
+		printf(FAIL "%s: SSA passes reported \"%s\", expected \"%s\"\n", src, reports, expected_reports);
+		n_failed++;
+	} else {
+		printf(OK "%s: %s\n", src, reports);
+	}
+	vm_prog_free(&prog);
+	parser_free(&p);
 }
 
-static void test_parse_body(char* src, char* expected_sexpr_str)
+// calls fn with random arguments compiled from the tree and through SSA,
+// and counts the calls where status, return values or globals differ;
+// stack overflows are skipped as the frames differ. then checks the JIT
+// against the interpreter on the SSA code
+static void test_ssa_diff(char* src, char* fn)
+{
+	struct parser p0, p1;
+	parser_init(&p0, src);
+	parser_init(&p1, src);
+	struct vm_prog tree, ssa;
+	vm_compile(&tree, parse_rec(&p0, 0, 0), VMC_NO_SSA);
+	vm_compile(&ssa, parse_rec(&p1, 0, 0), 0);
+	struct vm vm0, vm1;
+	vm_init(&vm0, &tree);
+	vm_init(&vm1, &ssa);
+	int fi = vm_prog_find_func(&tree, fn);
+	struct vm_func* f = &tree.funcs[fi];
+	union vm_value args[VM_MAX_FRAME_REGS], rets0[VM_MAX_FRAME_REGS], rets1[VM_MAX_FRAME_REGS];
+	uint64_t rng = 42;
+	int n = 2000;
+	int n_mismatches = 0;
+	for (int iter = 0; iter < n; iter++) {
+		union vm_value* slot = args;
+		for (int i = 0; i < f->n_args; i++) jit__rand_value(f->arg_types[i], &slot, &rng);
+		int status0 = vm_call(&vm0, fi, args, rets0);
+		int status1 = vm_call(&vm1, fi, args, rets1);
+		if (status0 == VM_ERR_STACK_OVERFLOW || status1 == VM_ERR_STACK_OVERFLOW) {
+			memcpy(vm1.globals, vm0.globals, tree.n_global_slots * sizeof(*vm0.globals));
+			continue;
+		}
+		int same = status0 == status1;
+		for (int i = 0; same && status0 == VM_OK && i < f->n_ret_slots; i++) same = jit__same(rets0[i], rets1[i]);
+		for (int i = 0; same && i < tree.n_global_slots; i++) same = jit__same(vm0.globals[i], vm1.globals[i]);
+		if (!same) {
+			n_mismatches++;
+			memcpy(vm1.globals, vm0.globals, tree.n_global_slots * sizeof(*vm0.globals));
+		}
+	}
+	struct jit jit;
+	jit_init(&jit, &vm1);
+	int n_jit_mismatches = jit_diff_test(&jit, fi, n, 7);
+	if (n_mismatches > 0 || n_jit_mismatches > 0) {
+		printf(FAIL "%s: %d/%d calls differ through SSA, %d/%d between its vm and jit\n", src, n_mismatches, n, n_jit_mismatches, n);
+		n_failed++;
+	} else {
+		printf(OK "%s: %d random calls agree through SSA\n", src, n);
+	}
+	jit_free(&jit);
+	vm_free(&vm0);
+	vm_free(&vm1);
+	vm_prog_free(&tree);
+	vm_prog_free(&ssa);
+	parser_free(&p0);
+	parser_free(&p1);
+}
+
+#ifdef CGEN_NATIVE
+// builds src with the C backend, caching in dir, and checks it against the
+// interpreter
+static void test_cgen(char* src, char* fn, const char* dir, int expect_cached)
 {
 	struct parser p;
 	parser_init(&p, src);
-	struct sexpr* actual_sexpr = parse_rec(&p, 1, 1);
-	validate(&p, src, actual_sexpr, expected_sexpr_str);
+	struct vm_prog prog;
+	struct sexpr* defs = parse_rec(&p, 0, 0);
+	vm_compile(&prog, defs, 0);
+	struct vm vm;
+	vm_init(&vm, &prog);
+	struct jit jit;
+	jit_init(&jit, &vm);
+	struct cgen g;
+	cgen_start(&g, &jit, defs, dir);
+	int n = 2000;
+	if (cgen_wait(&g) != CGEN_READY) {
+		printf(FAIL "%.60s: C backend failed\n", src);
+		n_failed++;
+	} else if (g.from_cache != expect_cached) {
+		printf(FAIL "%.60s: expected %s\n", src, expect_cached ? "a cache hit" : "a build");
+		n_failed++;
+	} else {
+		int n_mismatches = jit_diff_test(&jit, vm_prog_find_func(&prog, fn), n, 7);
+		if (n_mismatches > 0) {
+			printf(FAIL "%.60s: %d/%d calls differ between vm and C\n", src, n_mismatches, n);
+			n_failed++;
+		} else {
+			printf(OK "%.60s: %d random calls agree (C, %s)\n", src, n, g.from_cache ? "cached" : "built");
+		}
+	}
+	cgen_free(&g);
+	jit_free(&jit);
+	vm_free(&vm);
+	vm_prog_free(&prog);
+	parser_free(&p);
+}
+
+struct test_cgen_caller {
+	struct jit* jit;
+	int func;
+	int stop;
+	int n_calls, n_wrong;
+};
+
+static void* test_cgen__call(void* arg)
+{
+	struct test_cgen_caller* c = arg;
+	while (!__atomic_load_n(&c->stop, __ATOMIC_ACQUIRE)) {
+		union vm_value a = { .i = 20 }, r;
+		if (jit_call(c->jit, c->func, &a, &r) != VM_OK || r.i != 1 + 20*21/2) c->n_wrong++;
+		__atomic_add_fetch(&c->n_calls, 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+// cgen_free() under calls running on another thread
+static void test_cgen_running(char* src, const char* dir)
+{
+	struct parser p;
+	parser_init(&p, src);
+	struct vm_prog prog;
+	struct sexpr* defs = parse_rec(&p, 0, 0);
+	vm_compile(&prog, defs, 0);
+	struct vm vm;
+	vm_init(&vm, &prog);
+	struct jit jit;
+	jit_init(&jit, &vm);
+	struct test_cgen_caller c = { .jit = &jit, .func = vm_prog_find_func(&prog, "f") };
+	struct cgen g;
+	cgen_start(&g, &jit, defs, dir);
+	int ready = cgen_wait(&g) == CGEN_READY;
+	pthread_t thread;
+	pthread_create(&thread, NULL, test_cgen__call, &c);
+	while (__atomic_load_n(&c.n_calls, __ATOMIC_ACQUIRE) < 1000) sched_yield();
+	cgen_free(&g);
+	int n = __atomic_load_n(&c.n_calls, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n(&c.n_calls, __ATOMIC_ACQUIRE) < n + 1000) sched_yield();
+	__atomic_store_n(&c.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+	if (ready && c.n_wrong == 0) {
+		printf(OK "C backend unloaded under %d running calls\n", c.n_calls);
+	} else {
+		printf(FAIL "C backend unloaded under running calls: %s, %d wrong\n", ready ? "ready" : "failed", c.n_wrong);
+		n_failed++;
+	}
+	jit_free(&jit);
+	vm_free(&vm);
+	vm_prog_free(&prog);
+	parser_free(&p);
+}
+
+static void test_cgen_all()
+{
+	static char* tests[][2] = {
+		{ "func f(a int, b int, c float64) float64 { var x = a*b - a/b + -c; if a == b { x = x * 2.0; }; return x + float64(a) / c; };", "f" },
+		{ "type V struct { x float64; y int; z [2]float32 }; var g V; func f(v V, k int) V { g.x = v.x * k; g.y = g.y + v.y; v.z = g.z; g.z = v.z; return v; };", "f" },
+		{ "func f(n int, x float64) float64 { var i = 0; var s = 0.0; for i = 0; i != 64; i = i + 1 { if i == n { break; }; if i == n/2 { continue; }; s = s + x*i; }; return s; };", "f" },
+		{ "func f(n int) int { if n == 0 { return 1; }; return f(n-1) + n; };", "f" },
+		{ "func dm(a int, b int) (int, int) { return a/b, a - a/b*b; }; func f(a int, b int) int { var x = 0; var y = dm(a, b); x = dm(b, a) + y; return x + (x = 3) + x; };", "f" },
+		{ "var g [3][4]float64; var h = 2; func f(a [5]int, k int, x float64) [5]int { g[k][1] = x; a[k] = a[k-1] + a[4-k]; a[h] = (k = 1); return a; };", "f" },
+		{ "func f(a [10]float64, b [10]float64, k float64) [10]float64 { var i int; for i = 0; i != 10; i = i + 1 { a[i] = a[i]*k + b[i] - 1.0; }; return a; };", "f" },
+	};
+	char dir[] = "/tmp/do_cgen_XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		printf(FAIL "mkdtemp\n");
+		n_failed++;
+		return;
+	}
+	int n = sizeof(tests) / sizeof(tests[0]);
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < n; i++) test_cgen(tests[i][0], tests[i][1], dir, pass);
+	}
+	test_cgen_running(tests[3][0], dir);
+
+	// a long chain of operations, nested as deep in the tree
+	char* chain = malloc(64 + 2000 * 32);
+	assert(chain != NULL);
+	char* end = test_repeat(chain, "func f(a int, x float64) float64 { return a", 1);
+	end = test_repeat(end, " + x*a - a/3 + (a == 2)", 2000);
+	test_repeat(end, "; };", 1);
+	test_cgen(chain, "f", dir, 0);
+	free(chain);
+
+	// cached objects that don't load are built over
+	DIR* d = opendir(dir);
+	for (struct dirent* de; d != NULL && (de = readdir(d)) != NULL; ) {
+		char path[sizeof(dir) + 256];
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (de->d_name[0] != '.') truncate(path, 16);
+	}
+	if (d != NULL) closedir(d);
+	test_cgen(tests[0][0], tests[0][1], dir, 0);
+	test_cgen(tests[0][0], tests[0][1], dir, 1);
+
+	d = opendir(dir);
+	for (struct dirent* de; d != NULL && (de = readdir(d)) != NULL; ) {
+		char path[sizeof(dir) + 256];
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (de->d_name[0] != '.') unlink(path);
+	}
+	if (d != NULL) closedir(d);
+	rmdir(dir);
 }
+#endif
 
 int main(int argc, char** argv)
 {
 	#define PSZ(T) printf("sizeof(" #T ") = %zd\n", sizeof(T));
 	PSZ(struct sexpr);
+	PSZ(struct fnode);
 	#undef PSZ
 
+	test_keywords();
+	test_symbols();
+	test_lex("var x = 0x1f;", "var x = 0x1f ;");
+	test_lex("a==b != c++ --d", "a == b != c ++ -- d");
+	test_lex("1.5e+3 2E8 0.25 4x", "1.5e+3 2E8 0.25 4 x");
+	test_lex("x // comment\ny", "x y");
+	test_lex("x /* multi\nline */ y", "x ; y");
+	test_lex("a $ b", "a $ b");
+	test_lex("x\n\n\ty\n", "x ; y ;");
+	test_lex("return\n(\n)\n", "return ; ( ) ;");
+	test_lex("an_identifier_longer_than_sixteen_bytes\n                                  int32", "an_identifier_longer_than_sixteen_bytes ; int32");
+
 	test_parse_expr("123", "123");
 	test_parse_expr("foo", "foo");
 	test_parse_expr("i=0", "(= i 0)");
@@ -1275,6 +9699,10 @@ int main(int argc, char** argv)
 	test_parse_expr("x.y . z", "(. (. x y) z)");
 	test_parse_expr("(x.y) . z", "(. (. x y) z)");
 	test_parse_expr("getx() . y . z", "(. (. (getx) y) z)");
+	test_parse_expr("-x*-y", "(* (- x) (- y))");
+	test_parse_expr("a[i+1][j].k(2)", "((. ([ ([ a (+ i 1)) j) k) 2)");
+	test_parse_expr("f(g(x), (y))(z)", "((f (g x) y) z)");
+	test_parse_expr_long();
 
 	test_parse("var x = 5;", "((var x () 5))");
 	test_parse("const x = 5;", "((const x () 5))");
@@ -1321,6 +9749,127 @@ int main(int argc, char** argv)
 
 	test_parse_body("1 +\n2\n", "((+ 1 2))");
 
+
+	test_parse_expr("a == b + 1", "(== a (+ b 1))");
+	test_parse_expr("a != b == c", "(== (!= a b) c)");
+	test_parse_expr("a[i]", "([ a i)");
+	test_parse_expr("a[i][j+1] = b.c[2*k]", "(= ([ ([ a i) (+ j 1)) ([ (. b c) (* 2 k)))");
+	test_parse_expr("f(x)[2].y", "(. ([ (f x) 2) y)");
+	test_parse_expr("-a[i] - -f(x)", "(- (- ([ a i)) (- (f x)))");
+	// calls and indexing bind tighter than unary plus and minus, as in C
+	test_parse_expr("-f(x)", "(- (f x))");
+	test_parse_expr("-f(x)(y)", "(- ((f x) y))");
+	test_parse_expr("+a[i](2)", "(+ (([ a i) 2))");
+	test_parse_expr("(-f)(x)", "((- f) x)");
+	test_parse_body("for i = 0; i != 4; i = i + 1 { a[i] = b[i]*2; };", "((for (= i 0) (!= i 4) (= i (+ i 1)) ((= ([ a i) (* ([ b i) 2)))))");
+
+	test_sem("const N = 4; const K = N*2+1; var x [N*K]int;", "((const N () 4) (const K () 9) (var x ((36 int))))");
+	test_sem("const H float64 = 1; const Q = H/4; var y = -Q*2 + 1;", "((const H (float64) 1.0) (const Q () 0.25) (var y () 0.5))");
+	test_sem("const K = 2; func f(x int) int { var K = x; return K*(3-K) + (7/-2 == -3); };", "((const K () 2) (func f ((x (int))) ((int)) ((var K () x) (return (+ (* K (- 3 K)) 1)))))");
+	test_sem("func f(x float64) int { const h = 1/3.0; return int(x*(h*3)) + int(2.9) + int32(K); }; const K = 5;", "((func f ((x (float64))) ((int)) ((const h () 0.33333333333333331) (return (+ (+ (int (* x 1.0)) 2) 5)))) (const K () 5))");
+	test_sem_layout("type T struct { a int8; b float64; c int32; d [3]uint8 };", "24/8 a@0 b@8 c@16 d@20");
+	test_sem_layout("type P struct { x int32; y struct { a int8; b int32 }; z bool };", "16/4 x@0 y@4 z@12");
+	test_sem_layout("type E struct { };", "0/1");
+	test_sem_layout("const N = 3; type A [N*2]struct { a int32; b uint8 };", "48/4");
+	test_sem_layout("var x [2]out [3]int32;", "24/4");
+	test_vm("func f(x int) int { return 1 + 2*x - x/3; };", "f", 9, 16);
+	test_vm("func f(x int) int { return -x/0 + 7/-2 + 0x10; };", "f", 5, 13);
+	test_vm("func f(n int) int { var s = 0; var i = 0; for i != n { s = s + i; i = i + 1; }; return s; };", "f", 100, 4950);
+	test_vm("func f(n int) int { var s int; var i int; for i = 0; i != n; i = i + 1 { if i == 3 { continue; }; if i == 7 { break; }; s = s + i; }; return s; };", "f", 100, 18);
+	test_vm("func f(n int) int { var i = 0; for { i = i + 1; if i == n { break; }; }; return i; };", "f", 42, 42);
+	test_vm("func f(x int) int { if x == 1 { return 10; } else if x == 2 { return 20; } else { return 30; }; };", "f", 2, 20);
+	test_vm("func f(x int) int { if x == 1 { return 10; } else if x == 2 { return 20; } else { return 30; }; };", "f", 3, 30);
+	test_vm("func fib(n int) int { if n == 0 { return 0; }; if n == 1 { return 1; }; return fib(n-1) + fib(n-2); };", "fib", 20, 6765);
+	test_vm("func f(x int) int { return g(x) + 1; }; func g(x int) int { return x*2; };", "f", 5, 11);
+	test_vm("func dm(a int, b int) (int, int) { return a/b, a - a/b*b; }; func f(x int) int { return dm(x, 7); };", "f", 23, 3);
+	test_vm("func f(x int) int { var y int; var z = (y = x) + y; return z; };", "f", 4, 8);
+	test_vm("func f(x int) int { var y = x; if 1 { var y = 100; x = x + y; }; return x + y; };", "f", 1, 102);
+	test_vm("type V struct { x int; y int }; func dot(a V, b V) int { return a.x*b.x + a.y*b.y; }; func f(n int) int { var v V; v.x = n; v.y = n + 1; return dot(v, v); };", "f", 3, 25);
+	test_vm("type P struct { a int; b struct { c int; d int } }; func mk(n int) P { var p P; p.a = n; p.b.c = n*2; p.b.d = n*3; return p; }; func f(n int) int { var p = mk(n); return p.a + p.b.c*10 + mk(n+1).b.d*100; };", "f", 1, 621);
+	test_vm("const K = 3; const L = K*2+1; var g = L*2; var h [K]struct { x int }; func f(x int) int { g = g + x; return g; };", "f", 1, 15);
+	test_vm("type V struct { x float64; y int }; var v V; func f(x int) int { v.x = x; v.y = 2; return int(v.x*v.y); };", "f", 21, 42);
+	test_vm("func sq(x float64) float64 { return x*x; }; func f(x int) int { return int(sq(float64(x) + 0.5) * 4.0); };", "f", 3, 49);
+	test_vm("func f(x int) int { var y float32 = x; y = y / 2; return int(y*10); };", "f", 5, 25);
+	test_vm("func f(x int) int { const h = 0.5; return int(x*h) + (1.5 == 1.5) + (1 != 1); };", "f", 8, 5);
+	test_vm_stack_overflow();
+	test_deep_exprs();
+	test_vm_compile_err("func f(x int) int { break; return x; };", "break/continue outside loop");
+	test_vm_compile_err("var g [70000]int;", "too many globals");
+	test_vm_compile_err("func f(x int) int { var a [1000]int; return a[x]; };", "function needs too many registers");
+	test_vm_compile_err("func f(x int) int { return y; };", "undeclared 'y'");
+	test_vm("func f(x int) int { var a [5]int; var i int; for i = 0; i != 5; i = i + 1 { a[i] = i*x; }; return a[2] + a[x]; };", "f", 3, 15);
+	test_vm("type P struct { x int; y [3]int }; var g [4]P; func f(k int) int { var i int; for i = 0; i != 4; i = i + 1 { g[i].x = i; g[i].y[k] = i*10; }; return g[3].x + g[2].y[k] + g[k].y[1]; };", "f", 1, 33);
+	test_vm("func f(k int) int { var m [3][4]int; m[k][k+1] = 7; var r = m; return r[1][2] + m[k][3-1]*2; };", "f", 1, 21);
+	test_vm("type P struct { a int; b float64 }; func f(k int) int { var p [3]P; var q [3]P; p[k].a = 4; p[k].b = 0.5; q[2-k] = p[k]; var r = q[k]; return r.a + int(q[1].b*4); };", "f", 1, 6);
+	test_vm("func g(x int) [3]int { var a [3]int; a[x] = x*5; return a; }; func f(x int) int { return g(x)[x] + g(2)[2]; };", "f", 1, 15);
+	test_vm("func f(x int) int { var a [4]int; var i = 1; a[i] = (i = 3); var b [2]int; b[x] = (b[x-1] = 5); return a[1]*10 + i + b[0] + b[1]; };", "f", 1, 43);
+	test_vm_status("func f(x int) int { var a [3]int; return a[x]; };", "f", 3, VM_ERR_INDEX);
+	test_vm_status("func f(x int) int { var a [3]int; return a[x]; };", "f", -1, VM_ERR_INDEX);
+	test_vm_status("var g [2][3]float64; func f(x int) int { g[1][x] = 1.0; return 0; };", "f", 3, VM_ERR_INDEX);
+	test_vm_status("var g [2][3]float64; func f(x int) int { g[1][x] = 1.0; return 0; };", "f", 2, VM_OK);
+	test_vec("var a [67]float64; var b [67]float64; func f(x int) float64 { var i int; for i = 0; i != 67; i = i + 1 { b[i] = float64(i*x); }; for i = 0; i != 67; i = i + 1 { a[i] = b[i]*2.5 - x + a[i]; b[i] = -a[i] / 3; }; return a[66] + b[5] + i; };", 3,
+		"1:loop variable used as a value, 2:ok/67");
+	test_vec("func f(x int) int { var m [8][9]int; var n [8][9]int; var i int; var j int; for i = 0; i != 8; i = i + 1 { for j = 0; j != 9; j = j + 1 { m[i][j] = x; }; }; for i = 0; i != 8; i = i + 1 { for j = 0; j != 9; j = j + 1 { n[i][j] = m[i][j] + m[i][j] - 3; m[i][j] = -n[i][j]; }; }; return n[7][8]*100 + m[2][3] + i*10 + j; };", 5,
+		"1:ok/72, 2:ok/72");
+	test_vec("type V struct { p [5]float32; q [5]float32 }; var g V; func f(x int) int { var v V; var i int; var k = 2; for i = 1; i != 5; i = i + 1 { v.p[i] = k*0.25 + x; g.q[i] = +v.p[i] - g.p[i]; }; for i = 0; i != 0; i = i + 1 { g.p[i] = 1; }; return int(v.p[3]*8 + g.q[4]) + i; };", 2,
+		"1:ok/4, 2:ok/0");
+	test_vec("var a [4][5]int; var s int; func g(x int) int { return x; }; func f(n int) int { var i int; var j int; "
+		"for i = 1; i != 11; i = i + 2 { s = 1; }; "
+		"for i = 0; i != 4; i = i + 1 { for j = 0; j != 3; j = j + 1 { a[i][j] = 1; }; }; "
+		"for i = 0; i != 4; i = i + 1 { a[i][0] = a[i][0] * 2; }; "
+		"for i = 0; i != 5; i = i + 1 { a[0][i] = g(a[1][i]); }; "
+		"for i = 0; i != 5; i = i + 1 { s = s + a[2][i]; }; "
+		"for i = 0; i != n; i = i + 1 { a[0][i] = 1; }; "
+		"for i = 0; i == 0; i = i + 1 { a[0][i] = 1; }; "
+		"for i = 0; i != 5; i = i + 1 { a[3][i] = a[2][i]*n; }; "
+		"for i = 0; i != 6; i = i + 1 { a[0][i] = 1; }; "
+		"return s; };", 4,
+		"1:step isn't i = i + 1, 2:inner loop doesn't cover a whole dimension, 3:array isn't a variable or a member of one, "
+		"4:index isn't a loop variable, 5:calls a function, 6:loop-carried dependency through a scalar, 7:trip count isn't constant, "
+		"8:condition isn't i != N, 9:no SIMD integer multiply or divide, 10:index out of range");
+	char long_body[128 + VMC_VEC_MAX_EXPR_DEPTH * 8];
+	test_repeat(test_repeat(test_repeat(long_body, "var a [8]float64; func f(x int) int { var i int; for i = 0; i != 8; i = i + 1 { a[i] = x", 1),
+		" + a[i]", VMC_VEC_MAX_EXPR_DEPTH), "; }; return int(a[2]); };", 1);
+	test_vec(long_body, 3, "1:expression nested too deep");
+
+	test_jit_diff("func f(a int, b int, c float64) float64 { var x = a*b - a/b + -c; if a == b { x = x * 2.0; }; return x + float64(a) / c; };", "f");
+	test_jit_diff("func f(a float64, b float64) int { return (a == b) + (a != b)*2 + int(a*b) - int(-a); };", "f");
+	test_jit_diff("type V struct { x float64; y int; z [2]float32 }; var g V; func f(v V, k int) V { g.x = v.x * k; g.y = g.y + v.y; v.z = g.z; g.z = v.z; return v; };", "f");
+	test_jit_diff("func f(n int, x float64) float64 { var i = 0; var s = 0.0; for i = 0; i != 64; i = i + 1 { if i == n { break; }; if i == n/2 { continue; }; s = s + x*i; }; return s; };", "f");
+	test_jit_diff("func f(n int) int { if n == 0 { return 1; }; return f(n-1) + n; };", "f");
+	test_jit_diff("func g(x int) int { return x*3; }; func f(a int, b int) int { var c = a+b; var d = a-b; var e = a*b; var f2 = c*d; var g2 = d*e; var h = e+c; var i = f2-g2; var j = h*i; var k = g(j) + c; var l = k*d; var m = l+e; var n = m-f2; var o = n*g2; return a+b+c+d+e+f2+g2+h+i+j+k+l+m+n+o; };", "f");
+	test_jit_diff("func g(x float64) float64 { return x*0.5; }; func f(a float64, b float64) float64 { var c = a+b; var d = a-b; var e = a*b; var f2 = c*d; var g2 = d*e; var h = e+c; var i = f2-g2; var j = h*i; var k = g(j) + c; var l = k*d; var m = l+e; var n = m-f2; var o = n*g2; var p = o/a; var q = p-b; return a+b+c+d+e+f2+g2+h+i+j+k+l+m+n+o+p+q; };", "f");
+	test_jit_diff("func dm(a int, b int) (int, int) { return a/b, a - a/b*b; }; func f(a int, b int) int { var x = 0; var y = dm(a, b); x = dm(b, a) + y; return x; };", "f");
+	test_jit_diff("func f(a [10]float64, b [10]float64, k float64) [10]float64 { var i int; for i = 0; i != 10; i = i + 1 { a[i] = a[i]*k + b[i] - 1.0; }; return a; };", "f");
+	test_jit_diff("var g [7]int; func f(a [7]int, b [7]int, k int) [7]int { var i int; for i = 0; i != 7; i = i + 1 { g[i] = a[i] - k + b[i]; a[i] = k - g[i]; }; return a; };", "f");
+	test_jit_diff("var g [3][4]float64; func f(a [5]int, k int, x float64) int { g[k][1] = x; a[k] = a[k-1] + a[4-k]; return a[k]; };", "f");
+
+	test_ssa("var g int; func f(a int, b int) int { var s = 0; var i int; for i = 0; i != a; i = i + 1 { s = s + (b*b + 2*3) + b*b; }; g = s; return s; };", "f", "constprop 24->24/0, copyprop 24->22/2, cse 22->19/3, licm 19->19/4, dce 19->19/0");
+	test_ssa("func f(x int) int { var k = 4; if k == 4 { x = x + 1; } else { x = x - 1; }; var unused = x * 9; return x; };", "f", "constprop 15->12/2, copyprop 12->11/1, cse 11->9/2, licm 9->9/0, dce 9->6/3");
+	test_ssa("func f(x int) int { var y = int(x); var z = +y; return z + y; };", "f", "constprop 5->5/0, copyprop 5->3/2, cse 3->3/0, licm 3->3/0, dce 3->3/0");
+	test_ssa("func f(a [4]int, k int) int { return a[k]; };", "f", "no: indexes a local at run time");
+	test_ssa("var a [8]int; func f(x int) int { var i int; for i = 0; i != 8; i = i + 1 { a[i] = x; }; return i; };", "f", "no: has a vectorized loop");
+	test_ssa_diff("func f(a int, b int, c float64) float64 { var x = a*b - a/b + -c; if a == b { x = x * 2.0; }; return x + float64(a) / c; };", "f");
+	test_ssa_diff("type V struct { x float64; y int; z [2]float32 }; var g V; func f(v V, k int) V { g.x = v.x * k; g.y = g.y + v.y; v.z = g.z; g.z = v.z; return v; };", "f");
+	test_ssa_diff("func f(n int, x float64) float64 { var i = 0; var s = 0.0; for i = 0; i != 64; i = i + 1 { if i == n { break; }; if i == n/2 { continue; }; s = s + x*i; }; return s; };", "f");
+	test_ssa_diff("func f(n int) int { if n == 0 { return 1; }; return f(n-1) + n; };", "f");
+	test_ssa_diff("func g(x int) int { return x*3; }; func f(a int, b int) int { var c = a+b; var d = a-b; var e = a*b; var f2 = c*d; var g2 = d*e; var h = e+c; var i = f2-g2; var j = h*i; var k = g(j) + c; var l = k*d; var m = l+e; var n = m-f2; var o = n*g2; return a+b+c+d+e+f2+g2+h+i+j+k+l+m+n+o; };", "f");
+	test_ssa_diff("func dm(a int, b int) (int, int) { return a/b, a - a/b*b; }; func f(a int, b int) int { var x = 0; var y = dm(a, b); x = dm(b, a) + y; return x; };", "f");
+	test_ssa_diff("var g [3][4]float64; func f(a [5]int, k int, x float64) int { g[k][1] = x; return k; };", "f");
+	test_ssa_diff("var g [6]int; func f(a int, b int) int { var x = a; var y = b; var i int; for i = 0; i != 6; i = i + 1 { var t = x; x = y; y = t + (a*b + 1); g[i] = x - (a*b + 1); }; return x + (y + (y = 3)); };", "f");
+	test_ssa_diff("func f(a int, b int) int { var i int; var s int; for i = 0; i != 10; i = i + 1 { var j int; for j = 0; j != 10; j = j + 1 { s = s + a*b + i*b + j; if s == 77 { return 0; }; }; }; return s; };", "f");
+
+#ifdef CGEN_NATIVE
+	test_cgen_all();
+#endif
+
+	test_parser_reset();
+	test_check_err("var x = 1;\nvar y = x $ 2;", "line 2: unexpected token");
+	test_check_err("func f() int { return y; };", "undeclared 'y'");
+	test_check_err("var x int = 1; func f() int { return x; };", "ok");
+	test_incparse();
+	test_pcache();
+
 	if (n_failed) {
 		printf("\n %d TEST(S) FAILED\n", n_failed);
 		return EXIT_FAILURE;
@@ -1331,3 +9880,498 @@ int main(int argc, char** argv)
 }
 
 #endif
+
+
+#ifdef BENCH
+
+#include <time.h>
+#include <sys/resource.h>
+
+/*
+front-end throughput benchmark; generates synthetic sources of increasing
+size for a few workloads and times lexing alone and parsing end to end.
+prints one JSON object per line. symbols and process_peak_rss_kb are totals
+for the process so far, not for the phase
+*/
+
+#define BENCH_MIN_SECONDS (0.25)
+
+static double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long bench_peak_rss_kb()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static uint32_t bench_rng = 1;
+static int bench_rand(int n)
+{
+	bench_rng = bench_rng * 1103515245 + 12345;
+	return (bench_rng >> 16) % n;
+}
+
+struct bench_buf {
+	char* ptr;
+	size_t len, cap;
+};
+
+static void bench_printf(struct bench_buf* b, const char* fmt, ...)
+{
+	for (;;) {
+		va_list args;
+		va_start(args, fmt);
+		size_t room = b->cap - b->len;
+		int n = vsnprintf(b->ptr + b->len, room, fmt, args);
+		va_end(args);
+		assert(n >= 0);
+		if (n < room) {
+			b->len += n;
+			return;
+		}
+		b->cap = b->cap ? b->cap * 2 : 4096;
+		b->ptr = realloc(b->ptr, b->cap);
+		assert(b->ptr != NULL);
+	}
+}
+
+static void gen_expr(struct bench_buf* b, int depth)
+{
+	if (depth <= 0 || bench_rand(3) == 0) {
+		if (bench_rand(2)) {
+			bench_printf(b, "v%d", bench_rand(50));
+		} else {
+			bench_printf(b, "%d", bench_rand(1000));
+		}
+		return;
+	}
+	static const char* ops[] = {"+", "-", "*", "/"};
+	int paren = bench_rand(2);
+	if (paren) bench_printf(b, "(");
+	gen_expr(b, depth - 1);
+	bench_printf(b, " %s ", ops[bench_rand(4)]);
+	gen_expr(b, depth - 1);
+	if (paren) bench_printf(b, ")");
+}
+
+static void gen_exprs(struct bench_buf* b, int i)
+{
+	bench_printf(b, "var e%d = ", i);
+	if (i % 10 == 9) {
+		// deeply nested
+		int depth = 100 + bench_rand(100);
+		for (int j = 0; j < depth; j++) bench_printf(b, "(v%d * ", j);
+		bench_printf(b, "1");
+		for (int j = 0; j < depth; j++) bench_printf(b, ")");
+	} else {
+		gen_expr(b, 4 + bench_rand(6));
+	}
+	bench_printf(b, "\n");
+}
+
+static void gen_funcs(struct bench_buf* b, int i)
+{
+	bench_printf(b,
+		"func f%d(a int, b float32) float32 {\n"
+		"\tvar x = a * 3 + b\n"
+		"\tfor i = a; i; i = i - 1 {\n"
+		"\t\tx = x + g%d(i, b) * (a - 1)\n"
+		"\t\tv.pos.x = v.pos.x + x / 2.5\n"
+		"\t}\n"
+		"\tif x { return x; } else if b { return b; } else { return 0; }\n"
+		"}\n", i, i);
+}
+
+static void gen_structs(struct bench_buf* b, int i)
+{
+	bench_printf(b,
+		"type S%d struct {\n"
+		"\ta int\n"
+		"\tb [4]float32\n"
+		"\tc struct { d [N*2]int; e struct { f [2][3]int; g S%d; }; }\n"
+		"\th [8]struct { x float64; y float64 }\n"
+		"}\n", i, i > 0 ? i - 1 : 0);
+}
+
+// sexpr nodes in the tree, atoms and lists alike
+static long bench_count_nodes(struct sexpr* root)
+{
+	struct sexpr** stack;
+	struct dynary stack_dy;
+	dynary_init(&stack_dy, (void**) &stack, sizeof(*stack));
+	*(struct sexpr**)dynary_append(&stack_dy) = root;
+	long n = 0;
+	while (stack_dy.n > 0) {
+		struct sexpr* e = stack[--stack_dy.n];
+		n++;
+		if (sexpr_is_atom(e)) continue;
+		for (struct sexpr* i = e->list; i != NULL; i = i->next) *(struct sexpr**)dynary_append(&stack_dy) = i;
+	}
+	free(stack);
+	return n;
+}
+
+static void bench_report(const char* workload, size_t sz, const char* phase, int iterations, double seconds, long n_tokens, long n_nodes, long n_allocs, long n_chunks)
+{
+	double per = seconds / iterations;
+	printf("{\"workload\":\"%s\",\"bytes\":%zd,\"phase\":\"%s\",\"iterations\":%d,\"seconds\":%.6f,"
+		"\"mb_per_s\":%.2f,\"tokens_per_s\":%.0f,\"nodes_per_s\":%.0f,"
+		"\"tokens\":%ld,\"nodes\":%ld,\"arena_allocs\":%ld,\"arena_chunks\":%ld,\"symbols\":%d,\"process_peak_rss_kb\":%ld}\n",
+		workload, sz, phase, iterations, per,
+		sz / per / 1e6, n_tokens / per, n_nodes / per,
+		n_tokens, n_nodes, n_allocs, n_chunks, symtab_n_symbols(&symtab), bench_peak_rss_kb());
+	fflush(stdout);
+}
+
+static void bench_source(const char* workload, char* src, size_t sz)
+{
+	// lexer only
+	long n_tokens = 0;
+	int iterations = 0;
+	double t0 = bench_now();
+	double dt;
+	do {
+		struct lexer l;
+		lexer_init_n(&l, src, sz);
+		n_tokens = 0;
+		while (lexer_next(&l).type != T_EOF) n_tokens++;
+		iterations++;
+		dt = bench_now() - t0;
+	} while (dt < BENCH_MIN_SECONDS);
+	bench_report(workload, sz, "lex", iterations, dt, n_tokens, 0, 0, 0);
+
+	// lexer + parser
+	struct parser p;
+	parser_init_n(&p, src, sz);
+	iterations = 0;
+	t0 = bench_now();
+	struct sexpr* e;
+	do {
+		if (iterations > 0) parser_reset_n(&p, src, sz);
+		e = parse_rec(&p, 0, 0);
+		assert(e != NULL);
+		iterations++;
+		dt = bench_now() - t0;
+	} while (dt < BENCH_MIN_SECONDS);
+	bench_report(workload, sz, "parse", iterations, dt, n_tokens, bench_count_nodes(e), p.arena.n_allocs, p.arena.n_chunks);
+	parser_free(&p);
+
+	// reopening an unchanged buffer: hash it and take its definitions from
+	// the mapped parse cache
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/do-bench-pcache-%d", (int)getpid());
+	struct pcache pc;
+	struct incparse ip;
+	pcache_open(&pc, path, SIZE_MAX);
+	incparse_init(&ip);
+	pcache_load(&pc, &ip, src, sz);
+	pcache_put(&pc, &ip);
+	int saved = pcache_save(&pc);
+	assert(saved == 1);
+	incparse_free(&ip);
+	pcache_free(&pc);
+	iterations = 0;
+	t0 = bench_now();
+	do {
+		pcache_open(&pc, path, SIZE_MAX);
+		incparse_init(&ip);
+		int hit = pcache_load(&pc, &ip, src, sz);
+		assert(hit);
+		incparse_free(&ip);
+		pcache_free(&pc);
+		iterations++;
+		dt = bench_now() - t0;
+	} while (dt < BENCH_MIN_SECONDS);
+	bench_report(workload, sz, "pcache_load", iterations, dt, n_tokens, 0, 0, 0);
+	remove(path);
+}
+
+int main(int argc, char** argv)
+{
+	size_t max_sz = argc > 1 ? atol(argv[1]) : 100 << 20;
+
+	struct {
+		const char* name;
+		void(*gen)(struct bench_buf*, int);
+	} workloads[] = {
+		{"exprs", gen_exprs},
+		{"funcs", gen_funcs},
+		{"structs", gen_structs},
+		{NULL}
+	};
+
+	for (int w = 0; workloads[w].name; w++) {
+		for (size_t sz = 1000; sz <= max_sz; sz *= 10) {
+			struct bench_buf b = {0};
+			bench_rng = 1;
+			for (int i = 0; b.len < sz; i++) {
+				size_t len = b.len;
+				workloads[w].gen(&b, i);
+				if (b.len > sz) {
+					b.len = len;
+					break;
+				}
+			}
+			bench_source(workloads[w].name, b.ptr, b.len);
+			free(b.ptr);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+#endif
+
+#ifdef DRIVER
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+front-end driver:
+
+	do [-j threads] [-q] [-n] file...
+
+maps every file, then lexes, parses and checks it (see sem_check()), with
+files handed out largest first to a pool of threads. each thread has its
+own parser, whose arena is reused from file to file; they share the symbol
+table (see symtab), whose shards they rarely contend for, and the counter of
+the next file to take. with -n every file is also compiled (see
+vm_compile()) and built into native code by the C backend, cached in
+cgen_default_dir() (see cgen_start()). prints a line per file in the order
+given (unless -q), then the totals; exits with failure if any file didn't
+check or build
+*/
+
+struct drv_file {
+	const char* path;
+	size_t size;
+	double parse_s, check_s, native_s;
+	int ok;
+	int cached; // -n: the native code came from the cache
+	char err[160];
+};
+
+struct drv {
+	struct drv_file* files;
+	int* order; // largest first
+	int n_files;
+	int next; // index into order; taken atomically
+	char* cache_dir; // -n, else NULL
+};
+
+static double drv_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// compiles the checked defs and builds them with the C backend
+static void drv_native(struct drv_file* f, struct sexpr* defs, const char* cache_dir)
+{
+	struct vm_prog prog;
+	if (vm_compile(&prog, defs, 0) != 0) {
+		snprintf(f->err, sizeof(f->err), "%s", prog.err_msg);
+		f->ok = 0;
+		vm_prog_free(&prog);
+		return;
+	}
+	struct vm vm;
+	vm_init(&vm, &prog);
+	struct jit jit;
+	jit_init(&jit, &vm);
+	struct cgen g;
+	if (cgen_start(&g, &jit, defs, cache_dir) != 0 || cgen_wait(&g) != CGEN_READY) {
+		snprintf(f->err, sizeof(f->err), "C backend failed");
+		f->ok = 0;
+	}
+	f->cached = g.from_cache;
+	cgen_free(&g);
+	jit_free(&jit);
+	vm_free(&vm);
+	vm_prog_free(&prog);
+}
+
+static void drv_file(struct parser* p, struct drv_file* f, const char* cache_dir)
+{
+	int fd = open(f->path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		snprintf(f->err, sizeof(f->err), "%s", strerror(errno));
+		if (fd >= 0) close(fd);
+		return;
+	}
+	f->size = st.st_size;
+	if (f->size > INT32_MAX) {
+		snprintf(f->err, sizeof(f->err), "too large");
+		close(fd);
+		return;
+	}
+	char* src = "";
+	if (f->size > 0) src = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (src == MAP_FAILED) {
+		snprintf(f->err, sizeof(f->err), "%s", strerror(errno));
+		return;
+	}
+
+	jmp_buf on_err;
+	struct sem s;
+	sem_init(&s);
+	parser_reset_n(p, src, f->size);
+	p->on_err = &on_err;
+	s.on_err = &on_err;
+	double t0 = drv_now();
+	if (setjmp(on_err) == 0) {
+		struct sexpr* defs = parse_rec(p, 0, 0);
+		double t1 = drv_now();
+		f->parse_s = t1 - t0;
+		if (defs != NULL) {
+			f->ok = sem_check(&s, defs) == 0;
+			double t2 = drv_now();
+			f->check_s = t2 - t1;
+			// vm_compile() checks again, on a tree sem_check() left alone
+			if (f->ok && cache_dir != NULL) {
+				parser_reset_n(p, src, f->size);
+				drv_native(f, parse_rec(p, 0, 0), cache_dir);
+				f->native_s = drv_now() - t2;
+			}
+		}
+		if (!f->ok && f->err[0] == 0) snprintf(f->err, sizeof(f->err), "failed");
+	} else {
+		snprintf(f->err, sizeof(f->err), "%s", p->err ? p->err_msg : s.err_msg);
+	}
+	sem_free(&s);
+	if (f->size > 0) munmap(src, f->size);
+}
+
+static void* drv_worker(void* arg)
+{
+	struct drv* d = arg;
+	struct parser p;
+	parser_init_n(&p, "", 0);
+	for (;;) {
+		int i = __atomic_fetch_add(&d->next, 1, __ATOMIC_RELAXED);
+		if (i >= d->n_files) break;
+		drv_file(&p, &d->files[d->order[i]], d->cache_dir);
+	}
+	parser_free(&p);
+	return NULL;
+}
+
+static struct drv_file* drv_sort_files;
+static int drv_by_size(const void* a, const void* b)
+{
+	size_t x = drv_sort_files[*(const int*)a].size;
+	size_t y = drv_sort_files[*(const int*)b].size;
+	return x != y ? (x > y ? -1 : 1) : *(const int*)a - *(const int*)b;
+}
+
+static void drv_usage(const char* argv0)
+{
+	fprintf(stderr, "usage: %s [-j threads] [-q] [-n] file...\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+	int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int quiet = 0;
+	int native = 0;
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-'; argi++) {
+		if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+			n_threads = atoi(argv[++argi]);
+			if (n_threads < 1) drv_usage(argv[0]);
+		} else if (strcmp(argv[argi], "-q") == 0) {
+			quiet = 1;
+		} else if (strcmp(argv[argi], "-n") == 0) {
+			native = 1;
+		} else if (strcmp(argv[argi], "--") == 0) {
+			argi++;
+			break;
+		} else {
+			drv_usage(argv[0]);
+		}
+	}
+	if (argi == argc) drv_usage(argv[0]);
+
+	struct drv d;
+	memset(&d, 0, sizeof(d));
+	d.n_files = argc - argi;
+	d.files = calloc(d.n_files, sizeof(*d.files));
+	d.order = malloc(d.n_files * sizeof(*d.order));
+	assert(d.files != NULL && d.order != NULL);
+	char cache_dir[4096];
+	if (native) {
+		cgen_default_dir(cache_dir, sizeof(cache_dir));
+		d.cache_dir = cache_dir;
+	}
+	for (int i = 0; i < d.n_files; i++) {
+		struct stat st;
+		d.files[i].path = argv[argi + i];
+		if (stat(d.files[i].path, &st) == 0) d.files[i].size = st.st_size;
+		d.order[i] = i;
+	}
+	drv_sort_files = d.files;
+	qsort(d.order, d.n_files, sizeof(*d.order), drv_by_size);
+
+	if (n_threads > d.n_files) n_threads = d.n_files;
+	pthread_t* threads = malloc(n_threads * sizeof(*threads));
+	assert(threads != NULL);
+	double t0 = drv_now();
+	// the main thread is worker 0
+	for (int i = 1; i < n_threads; i++) {
+		if (pthread_create(&threads[i], NULL, drv_worker, &d) != 0) {
+			n_threads = i;
+			break;
+		}
+	}
+	drv_worker(&d);
+	for (int i = 1; i < n_threads; i++) pthread_join(threads[i], NULL);
+	double wall = drv_now() - t0;
+
+	int n_failed = 0;
+	size_t n_bytes = 0;
+	double busy = 0;
+	for (int i = 0; i < d.n_files; i++) {
+		struct drv_file* f = &d.files[i];
+		n_bytes += f->size;
+		busy += f->parse_s + f->check_s + f->native_s;
+		if (!f->ok) {
+			n_failed++;
+			fprintf(stderr, "%s: error: %s\n", f->path, f->err);
+		} else if (!quiet) {
+			printf("%s: %zd bytes, parse %.3f ms, check %.3f ms, %.1f MB/s",
+				f->path, f->size, f->parse_s * 1e3, f->check_s * 1e3,
+				f->size / (f->parse_s + f->check_s + 1e-9) / 1e6);
+			if (native) printf(", native %.3f ms (%s)", f->native_s * 1e3, f->cached ? "cached" : "built");
+			printf("\n");
+		}
+	}
+	// busy is the per-file time summed over files; busy / wall is how many
+	// threads were at work on average
+	printf("%d files, %d failed, %.1f MB in %.3f s on %d thread%s: %.1f MB/s, %.0f files/s, busy %.3f s, %.2fx parallel\n",
+		d.n_files, n_failed, n_bytes / 1e6, wall, n_threads, n_threads == 1 ? "" : "s",
+		n_bytes / wall / 1e6, d.n_files / wall, busy, busy / wall);
+
+	free(threads);
+	free(d.files);
+	free(d.order);
+	symtab_free(&symtab);
+	return n_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
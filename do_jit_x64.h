@@ -0,0 +1,1166 @@
+/*
+x86-64 (System V, Linux) backend for the JIT; included by do.c.
+
+every bytecode function becomes a native function
+  int fn(union vm_value* R, struct jit_ctx* ctx)
+that returns a VM_* status. R is the same frame the interpreter would use,
+and it doubles as the spill area: a VM register that doesn't get a machine
+register lives in R[v], and arguments and return values are passed in R
+exactly like the interpreter does.
+
+register allocation is linear scan (Poletto & Sarkar) over live intervals
+computed from a liveness analysis of the bytecode. VM registers only used
+as floats go into xmm registers, everything else into general purpose
+registers. intervals that cross a call prefer callee-saved registers;
+caller-saved registers that are live across a call are saved to their
+R slot around it. registers the bytecode addresses indirectly (indexed
+variables and the operands of vector ops) always stay in R.
+
+vector ops become a loop over 2 slots at a time with SSE2, or 4 with AVX
+when the CPU has it (floats and moves only; AVX has no 256-bit integer
+ops), followed by scalar code for what's left
+*/
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+enum {
+	JX_RAX, JX_RCX, JX_RDX, JX_RBX, JX_RSP, JX_RBP, JX_RSI, JX_RDI,
+	JX_R8, JX_R9, JX_R10, JX_R11, JX_R12, JX_R13, JX_R14, JX_R15,
+};
+
+// fixed registers
+#define JX_R JX_R15 // frame
+#define JX_CTX JX_R14 // struct jit_ctx*
+// rax, rcx, rdx, xmm0 and xmm1 are scratch
+
+static const int jx_gprs[] = { JX_RBX, JX_R12, JX_R13, JX_RSI, JX_RDI, JX_R8, JX_R9, JX_R10, JX_R11 };
+#define JX_N_GPRS (sizeof(jx_gprs) / sizeof(jx_gprs[0]))
+#define JX_N_CALLEE_SAVED_GPRS (3) // the first ones in jx_gprs[]
+#define JX_XMM_FIRST (2)
+#define JX_N_XMMS (16 - JX_XMM_FIRST) // all caller-saved
+
+enum jx_loc_kind {
+	JX_MEM = 0, // R[v]
+	JX_GPR,
+	JX_XMM,
+};
+
+struct jx_loc {
+	uint8_t kind;
+	uint8_t reg;
+};
+
+#define JX_LIVE_WORDS (VM_MAX_FRAME_REGS / 64)
+
+struct jx_live {
+	uint64_t in[JX_LIVE_WORDS];
+	uint64_t out[JX_LIVE_WORDS];
+};
+
+struct jx_interval {
+	int vreg;
+	int start, end;
+	int crosses_call;
+	int reg_index; // into jx_gprs[], or xmm number minus JX_XMM_FIRST
+};
+
+enum {
+	JX_LABEL_EPILOGUE = -1,
+	JX_LABEL_OVERFLOW = -2,
+	JX_LABEL_INDEX = -3,
+};
+
+struct jx_fixup {
+	uint32_t at; // offset of the rel32
+	int target; // bytecode pc or JX_LABEL_*
+};
+
+struct jx_call_fixup {
+	uint32_t at;
+	int func;
+};
+
+struct jx {
+	uint8_t* buf;
+	size_t n, cap;
+
+	struct vm_prog* prog;
+	struct vm_func* fn;
+
+	struct jx_loc locs[VM_MAX_FRAME_REGS];
+	struct jx_live* live;
+
+	uint32_t* pc_offsets; // bytecode pc -> buf offset
+	uint32_t epilogue, overflow, index_err;
+	int avx;
+
+	struct dynary fixups_dy;
+	struct jx_fixup* fixups;
+	struct dynary call_fixups_dy;
+	struct jx_call_fixup* call_fixups;
+};
+
+
+// encoding
+
+static void jx_byte(struct jx* x, uint8_t b)
+{
+	if (x->n == x->cap) {
+		x->cap = x->cap ? x->cap * 2 : (1<<16);
+		x->buf = realloc(x->buf, x->cap);
+		assert(x->buf != NULL);
+	}
+	x->buf[x->n++] = b;
+}
+
+static void jx_u32(struct jx* x, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) jx_byte(x, v >> (i*8));
+}
+
+static void jx_u64(struct jx* x, uint64_t v)
+{
+	for (int i = 0; i < 8; i++) jx_byte(x, v >> (i*8));
+}
+
+static void jx_patch32(struct jx* x, uint32_t at, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) x->buf[at+i] = v >> (i*8);
+}
+
+// [prefix] [REX] opcode: prefix is 0 or one of 0x66/0xf2/0xf3; the opcode
+// is 1-3 bytes, most significant first. index is the SIB index register, if
+// any
+static void jx_op_x(struct jx* x, int prefix, int w, uint32_t opcode, int reg, int index, int rm)
+{
+	if (prefix) jx_byte(x, prefix);
+	uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (rm >> 3);
+	if (rex != 0x40) jx_byte(x, rex);
+	if (opcode > 0xffff) jx_byte(x, opcode >> 16);
+	if (opcode > 0xff) jx_byte(x, opcode >> 8);
+	jx_byte(x, opcode);
+}
+
+static void jx_op(struct jx* x, int prefix, int w, uint32_t opcode, int reg, int rm)
+{
+	jx_op_x(x, prefix, w, opcode, reg, 0, rm);
+}
+
+// register, register
+static void jx_rr(struct jx* x, int prefix, int w, uint32_t opcode, int reg, int rm)
+{
+	jx_op(x, prefix, w, opcode, reg, rm);
+	jx_byte(x, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// register, [base+disp32]
+static void jx_rm(struct jx* x, int prefix, int w, uint32_t opcode, int reg, int base, int32_t disp)
+{
+	assert((base & 7) != JX_RSP); // would need a SIB byte
+	jx_op(x, prefix, w, opcode, reg, base);
+	jx_byte(x, 0x80 | ((reg & 7) << 3) | (base & 7));
+	jx_u32(x, disp);
+}
+
+// register, [base+index*8+disp32]
+static void jx_rmx(struct jx* x, int prefix, int w, uint32_t opcode, int reg, int base, int index, int32_t disp)
+{
+	assert(index != JX_RSP);
+	jx_op_x(x, prefix, w, opcode, reg, index, base);
+	jx_byte(x, 0x84 | ((reg & 7) << 3));
+	jx_byte(x, 0xc0 | ((index & 7) << 3) | (base & 7));
+	jx_u32(x, disp);
+}
+
+// 66-prefixed VEX instructions (L is 1 for 256 bits); map is 1 for 0f and 2
+// for 0f38. vvvv is the extra source register, 0 if unused
+static void jx_vex(struct jx* x, int map, int l, uint8_t opcode, int reg, int vvvv, int index, int rm)
+{
+	jx_byte(x, 0xc4);
+	jx_byte(x, (((reg >> 3) ^ 1) << 7) | (((index >> 3) ^ 1) << 6) | (((rm >> 3) ^ 1) << 5) | map);
+	jx_byte(x, ((~vvvv & 15) << 3) | (l << 2) | 1);
+	jx_byte(x, opcode);
+}
+
+// ymm/xmm register, [base+index*8+disp32]
+static void jx_vex_m(struct jx* x, int map, int l, uint8_t opcode, int reg, int vvvv, int base, int index, int32_t disp)
+{
+	jx_vex(x, map, l, opcode, reg, vvvv, index, base);
+	jx_byte(x, 0x84 | ((reg & 7) << 3));
+	jx_byte(x, 0xc0 | ((index & 7) << 3) | (base & 7));
+	jx_u32(x, disp);
+}
+
+static void jx_vex_r(struct jx* x, int map, int l, uint8_t opcode, int reg, int vvvv, int rm)
+{
+	jx_vex(x, map, l, opcode, reg, vvvv, 0, rm);
+	jx_byte(x, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void jx_mov_rr(struct jx* x, int dst, int src)
+{
+	if (dst != src) jx_rr(x, 0, 1, 0x8b, dst, src);
+}
+
+static void jx_mov_imm(struct jx* x, int dst, int64_t v)
+{
+	if (v == 0) {
+		jx_rr(x, 0, 0, 0x31, dst, dst); // xor r32, r32
+	} else if (v >= INT32_MIN && v <= INT32_MAX) {
+		jx_rr(x, 0, 1, 0xc7, 0, dst);
+		jx_u32(x, v);
+	} else {
+		jx_op(x, 0, 1, 0xb8 + (dst & 7), 0, dst);
+		jx_u64(x, v);
+	}
+}
+
+static void jx_push(struct jx* x, int r)
+{
+	if (r >= 8) jx_byte(x, 0x41);
+	jx_byte(x, 0x50 + (r & 7));
+}
+
+static void jx_pop(struct jx* x, int r)
+{
+	if (r >= 8) jx_byte(x, 0x41);
+	jx_byte(x, 0x58 + (r & 7));
+}
+
+// jmp/jcc rel32 to a bytecode pc or label; cc is 0 for jmp
+static void jx_jump(struct jx* x, int cc, int target)
+{
+	if (cc) {
+		jx_byte(x, 0x0f);
+		jx_byte(x, 0x80 | cc);
+	} else {
+		jx_byte(x, 0xe9);
+	}
+	struct jx_fixup* f = dynary_append(&x->fixups_dy);
+	f->at = x->n;
+	f->target = target;
+	jx_u32(x, 0);
+}
+
+#define JX_CC_AE (0x3)
+#define JX_CC_Z (0x4)
+#define JX_CC_NZ (0x5)
+#define JX_CC_A (0x7)
+#define JX_CC_S (0x8)
+
+// jcc rel8 forward; returns the offset to pass to jx_here8()
+static uint32_t jx_jump8(struct jx* x, int cc)
+{
+	jx_byte(x, cc ? 0x70 | cc : 0xeb);
+	jx_byte(x, 0);
+	return x->n;
+}
+
+static void jx_here8(struct jx* x, uint32_t from)
+{
+	int d = x->n - from;
+	assert(d < 128);
+	x->buf[from-1] = d;
+}
+
+
+// moving values between VM registers and machine registers
+
+static inline int32_t jx_slot(int v)
+{
+	return v * sizeof(union vm_value);
+}
+
+// loads the 64 bits of v into the general purpose register dst
+static void jx_load_gpr(struct jx* x, int dst, int v)
+{
+	struct jx_loc l = x->locs[v];
+	switch (l.kind) {
+		case JX_GPR: jx_mov_rr(x, dst, l.reg); break;
+		case JX_XMM: jx_rr(x, 0x66, 1, 0x0f7e, l.reg, dst); break; // movq r64, xmm
+		default: jx_rm(x, 0, 1, 0x8b, dst, JX_R, jx_slot(v)); break;
+	}
+}
+
+static void jx_store_gpr(struct jx* x, int v, int src)
+{
+	struct jx_loc l = x->locs[v];
+	switch (l.kind) {
+		case JX_GPR: jx_mov_rr(x, l.reg, src); break;
+		case JX_XMM: jx_rr(x, 0x66, 1, 0x0f6e, l.reg, src); break; // movq xmm, r64
+		default: jx_rm(x, 0, 1, 0x89, src, JX_R, jx_slot(v)); break;
+	}
+}
+
+static void jx_load_xmm(struct jx* x, int dst, int v)
+{
+	struct jx_loc l = x->locs[v];
+	switch (l.kind) {
+		case JX_GPR: jx_rr(x, 0x66, 1, 0x0f6e, dst, l.reg); break;
+		case JX_XMM: if (l.reg != dst) jx_rr(x, 0x66, 0, 0x0f28, dst, l.reg); break; // movapd
+		default: jx_rm(x, 0xf2, 0, 0x0f10, dst, JX_R, jx_slot(v)); break; // movsd
+	}
+}
+
+static void jx_store_xmm(struct jx* x, int v, int src)
+{
+	struct jx_loc l = x->locs[v];
+	switch (l.kind) {
+		case JX_GPR: jx_rr(x, 0x66, 1, 0x0f7e, src, l.reg); break;
+		case JX_XMM: if (l.reg != src) jx_rr(x, 0x66, 0, 0x0f28, l.reg, src); break;
+		default: jx_rm(x, 0xf2, 0, 0x0f11, src, JX_R, jx_slot(v)); break;
+	}
+}
+
+// returns a general purpose register holding v, loading it into scratch if
+// it doesn't live in one
+static int jx_gpr_of(struct jx* x, int v, int scratch)
+{
+	if (x->locs[v].kind == JX_GPR) return x->locs[v].reg;
+	jx_load_gpr(x, scratch, v);
+	return scratch;
+}
+
+static int jx_xmm_of(struct jx* x, int v, int scratch)
+{
+	if (x->locs[v].kind == JX_XMM) return x->locs[v].reg;
+	jx_load_xmm(x, scratch, v);
+	return scratch;
+}
+
+// writes v back to R[v] if it lives in a register
+static void jx_spill(struct jx* x, int v)
+{
+	struct jx_loc l = x->locs[v];
+	if (l.kind == JX_GPR) jx_rm(x, 0, 1, 0x89, l.reg, JX_R, jx_slot(v));
+	if (l.kind == JX_XMM) jx_rm(x, 0xf2, 0, 0x0f11, l.reg, JX_R, jx_slot(v));
+}
+
+static void jx_unspill(struct jx* x, int v)
+{
+	struct jx_loc l = x->locs[v];
+	if (l.kind == JX_GPR) jx_rm(x, 0, 1, 0x8b, l.reg, JX_R, jx_slot(v));
+	if (l.kind == JX_XMM) jx_rm(x, 0xf2, 0, 0x0f10, l.reg, JX_R, jx_slot(v));
+}
+
+static int jx_is_callee_saved(struct jx_loc l)
+{
+	if (l.kind != JX_GPR) return 0;
+	for (int i = 0; i < JX_N_CALLEE_SAVED_GPRS; i++) if (jx_gprs[i] == l.reg) return 1;
+	return 0;
+}
+
+
+// liveness and register allocation
+
+static inline void jx_set(uint64_t* s, int v)
+{
+	s[v >> 6] |= (uint64_t)1 << (v & 63);
+}
+
+static inline int jx_has(uint64_t* s, int v)
+{
+	return (s[v >> 6] >> (v & 63)) & 1;
+}
+
+// calls fn for the registers read (is_def=0) or written (is_def=1) by the
+// instruction at code[0] (and its OP_ARG word, if it has one)
+static void jx_operands(struct vm_prog* prog, const uint32_t* code, void (*fn)(void* usr, int v, int is_def), void* usr)
+{
+	uint32_t ins = code[0];
+	int a = INS_A(ins), b = INS_B(ins), c = INS_C(ins);
+	switch (INS_OP(ins)) {
+		case OP_MOV: case OP_NEGI: case OP_NEGF: case OP_ITOF: case OP_FTOI:
+			fn(usr, b, 0);
+			fn(usr, a, 1);
+			break;
+		case OP_LOADI: case OP_LOADK: case OP_GETG:
+			fn(usr, a, 1);
+			break;
+		case OP_SETG: case OP_JZ: case OP_JNZ: case OP_CHECK:
+			fn(usr, a, 0);
+			break;
+		case OP_GETX:
+			for (int i = 0; i < INS_BX(code[1]); i++) fn(usr, INS_A(code[1]) + i, 0);
+			fn(usr, c, 0);
+			fn(usr, a, 1);
+			break;
+		case OP_SETX:
+			// writes one slot of the root; the others stay live
+			fn(usr, b, 0);
+			fn(usr, c, 0);
+			for (int i = 0; i < INS_BX(code[1]); i++) fn(usr, INS_A(code[1]) + i, 0);
+			break;
+		case OP_GETGX:
+			fn(usr, a, 0);
+			fn(usr, a, 1);
+			break;
+		case OP_SETGX:
+			fn(usr, a, 0);
+			fn(usr, INS_A(code[1]), 0);
+			break;
+		case OP_VMOV: case OP_VADDI: case OP_VSUBI: case OP_VADDF: case OP_VSUBF: case OP_VMULF: case OP_VDIVF: {
+			int flags = INS_A(code[1]), n = INS_BX(code[1]);
+			for (int i = 0; i < n; i++) {
+				fn(usr, (flags & VM_ARG_SB) ? b : b+i, 0);
+				if (INS_OP(ins) != OP_VMOV) fn(usr, (flags & VM_ARG_SC) ? c : c+i, 0);
+			}
+			for (int i = 0; i < n; i++) fn(usr, a+i, 1);
+		} break;
+		case OP_VGETG:
+			for (int i = 0; i < INS_BX(code[1]); i++) fn(usr, a+i, 1);
+			break;
+		case OP_VSETG:
+			for (int i = 0; i < INS_BX(code[1]); i++) fn(usr, a+i, 0);
+			break;
+		case OP_ARG:
+			break;
+		case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_DIVI: case OP_EQI: case OP_NEI:
+		case OP_ADDF: case OP_SUBF: case OP_MULF: case OP_DIVF: case OP_EQF: case OP_NEF:
+			fn(usr, b, 0);
+			fn(usr, c, 0);
+			fn(usr, a, 1);
+			break;
+		case OP_JMP:
+			break;
+		case OP_CALL: {
+			struct vm_func* callee = &prog->funcs[INS_BX(ins)];
+			for (int i = 0; i < callee->n_arg_slots; i++) fn(usr, a+i, 0);
+			for (int i = 0; i < callee->n_ret_slots; i++) fn(usr, a+i, 1);
+		} break;
+		case OP_RET:
+			for (int i = 0; i < b; i++) fn(usr, a+i, 0);
+			break;
+		default:
+			assert(0);
+	}
+}
+
+struct jx_use_def {
+	uint64_t use[JX_LIVE_WORDS];
+	uint64_t def[JX_LIVE_WORDS];
+};
+
+static void jx__use_def(void* usr, int v, int is_def)
+{
+	struct jx_use_def* ud = usr;
+	if (is_def) {
+		jx_set(ud->def, v);
+	} else if (!jx_has(ud->def, v)) {
+		jx_set(ud->use, v);
+	}
+}
+
+static void jx_liveness(struct jx* x)
+{
+	struct vm_func* fn = x->fn;
+	struct jx_use_def* ud = calloc(fn->n_code, sizeof(*ud));
+	assert(ud != NULL);
+	for (int pc = 0; pc < fn->n_code; pc++) jx_operands(x->prog, &fn->code[pc], jx__use_def, &ud[pc]);
+
+	// backwards until nothing changes
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int pc = fn->n_code - 1; pc >= 0; pc--) {
+			uint32_t ins = fn->code[pc];
+			int op = INS_OP(ins);
+			struct jx_live* l = &x->live[pc];
+			uint64_t out[JX_LIVE_WORDS] = {0};
+			if (op != OP_JMP && op != OP_RET && pc+1 < fn->n_code) {
+				for (int w = 0; w < JX_LIVE_WORDS; w++) out[w] |= x->live[pc+1].in[w];
+			}
+			if (op == OP_JMP || op == OP_JZ || op == OP_JNZ) {
+				int target = pc + 1 + INS_SBX(ins);
+				for (int w = 0; w < JX_LIVE_WORDS; w++) out[w] |= x->live[target].in[w];
+			}
+			for (int w = 0; w < JX_LIVE_WORDS; w++) {
+				uint64_t in = ud[pc].use[w] | (out[w] & ~ud[pc].def[w]);
+				if (in != l->in[w] || out[w] != l->out[w]) changed = 1;
+				l->in[w] = in;
+				l->out[w] = out[w];
+			}
+		}
+	}
+	free(ud);
+}
+
+struct jx_class_count {
+	int n_int[VM_MAX_FRAME_REGS];
+	int n_float[VM_MAX_FRAME_REGS];
+};
+
+static void jx_classify(struct jx* x, struct jx_class_count* cc)
+{
+	memset(cc, 0, sizeof(*cc));
+	for (int pc = 0; pc < x->fn->n_code; pc++) {
+		uint32_t ins = x->fn->code[pc];
+		int a = INS_A(ins), b = INS_B(ins), c = INS_C(ins);
+		switch (INS_OP(ins)) {
+			case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_DIVI: case OP_EQI: case OP_NEI:
+				cc->n_int[a]++; cc->n_int[b]++; cc->n_int[c]++;
+				break;
+			case OP_NEGI:
+				cc->n_int[a]++; cc->n_int[b]++;
+				break;
+			case OP_ADDF: case OP_SUBF: case OP_MULF: case OP_DIVF:
+				cc->n_float[a]++; cc->n_float[b]++; cc->n_float[c]++;
+				break;
+			case OP_NEGF:
+				cc->n_float[a]++; cc->n_float[b]++;
+				break;
+			case OP_EQF: case OP_NEF:
+				cc->n_int[a]++; cc->n_float[b]++; cc->n_float[c]++;
+				break;
+			case OP_ITOF:
+				cc->n_float[a]++; cc->n_int[b]++;
+				break;
+			case OP_FTOI:
+				cc->n_int[a]++; cc->n_float[b]++;
+				break;
+			case OP_LOADI: case OP_JZ: case OP_JNZ: case OP_CHECK: case OP_GETGX: case OP_SETGX:
+				cc->n_int[a]++;
+				break;
+			case OP_GETX:
+				cc->n_int[c]++;
+				break;
+			case OP_SETX:
+				cc->n_int[b]++;
+				break;
+		}
+	}
+}
+
+static int jx_interval_cmp(const void* a, const void* b)
+{
+	const struct jx_interval* ia = a;
+	const struct jx_interval* ib = b;
+	if (ia->start != ib->start) return ia->start - ib->start;
+	return ia->vreg - ib->vreg;
+}
+
+// linear scan over the intervals of one register class
+static void jx_linear_scan(struct jx* x, struct jx_interval* iv, int n, int kind)
+{
+	qsort(iv, n, sizeof(*iv), jx_interval_cmp);
+
+	int n_regs = kind == JX_GPR ? JX_N_GPRS : JX_N_XMMS;
+	int reg_free[16];
+	for (int i = 0; i < n_regs; i++) reg_free[i] = 1;
+	struct jx_interval* active[16]; // sorted by end
+	int n_active = 0;
+
+	for (int i = 0; i < n; i++) {
+		struct jx_interval* cur = &iv[i];
+
+		int k = 0;
+		for (int j = 0; j < n_active; j++) {
+			if (active[j]->end < cur->start) {
+				reg_free[active[j]->reg_index] = 1;
+			} else {
+				active[k++] = active[j];
+			}
+		}
+		n_active = k;
+
+		// callee-saved registers first for intervals crossing calls,
+		// last otherwise
+		cur->reg_index = -1;
+		for (int r = 0; r < n_regs; r++) {
+			int rr = (kind == JX_GPR && !cur->crosses_call) ? n_regs - 1 - r : r;
+			if (reg_free[rr]) {
+				cur->reg_index = rr;
+				break;
+			}
+		}
+
+		if (cur->reg_index == -1) {
+			// spill whichever ends last
+			struct jx_interval* last = active[n_active - 1];
+			if (last->end <= cur->end) continue; // cur stays in memory
+			cur->reg_index = last->reg_index;
+			x->locs[last->vreg].kind = JX_MEM;
+			n_active--;
+		}
+		reg_free[cur->reg_index] = 0;
+		x->locs[cur->vreg].kind = kind;
+		x->locs[cur->vreg].reg = kind == JX_GPR ? jx_gprs[cur->reg_index] : JX_XMM_FIRST + cur->reg_index;
+
+		// insert sorted by end
+		int j = n_active++;
+		while (j > 0 && active[j-1]->end > cur->end) {
+			active[j] = active[j-1];
+			j--;
+		}
+		active[j] = cur;
+	}
+}
+
+static void jx__interval_extend(struct jx_interval* iv, int pc)
+{
+	if (iv->start == -1 || pc < iv->start) iv->start = pc;
+	if (pc > iv->end) iv->end = pc;
+}
+
+struct jx__interval_ctx {
+	struct jx_interval* iv;
+	int pc;
+};
+
+static void jx__interval_operand(void* usr, int v, int is_def)
+{
+	struct jx__interval_ctx* ctx = usr;
+	jx__interval_extend(&ctx->iv[v], ctx->pc);
+}
+
+static void jx__pin(void* usr, int v, int is_def)
+{
+	jx_set(usr, v);
+}
+
+// registers the bytecode addresses indirectly, which have to stay in R
+static void jx_pinned(struct jx* x, uint64_t* pinned)
+{
+	const uint32_t* code = x->fn->code;
+	for (int pc = 0; pc < x->fn->n_code; pc++) {
+		switch (INS_OP(code[pc])) {
+			case OP_GETX: case OP_SETX:
+				for (int i = 0; i < INS_BX(code[pc+1]); i++) jx_set(pinned, INS_A(code[pc+1]) + i);
+				break;
+			case OP_VMOV: case OP_VADDI: case OP_VSUBI: case OP_VADDF: case OP_VSUBF: case OP_VMULF: case OP_VDIVF:
+			case OP_VGETG: case OP_VSETG:
+				jx_operands(x->prog, &code[pc], jx__pin, pinned);
+				break;
+		}
+	}
+}
+
+static void jx_allocate(struct jx* x)
+{
+	struct vm_func* fn = x->fn;
+	memset(x->locs, 0, sizeof(x->locs));
+
+	struct jx_interval iv[VM_MAX_FRAME_REGS];
+	for (int v = 0; v < VM_MAX_FRAME_REGS; v++) {
+		iv[v].vreg = v;
+		iv[v].start = -1;
+		iv[v].end = -1;
+		iv[v].crosses_call = 0;
+	}
+	for (int pc = 0; pc < fn->n_code; pc++) {
+		struct jx__interval_ctx ctx = { iv, pc };
+		jx_operands(x->prog, &fn->code[pc], jx__interval_operand, &ctx);
+		for (int v = 0; v < fn->n_regs; v++) {
+			if (jx_has(x->live[pc].in, v)) jx__interval_extend(&iv[v], pc);
+		}
+	}
+	for (int pc = 0; pc < fn->n_code; pc++) {
+		if (INS_OP(fn->code[pc]) != OP_CALL) continue;
+		for (int v = 0; v < fn->n_regs; v++) {
+			if (iv[v].start < pc && iv[v].end > pc) iv[v].crosses_call = 1;
+		}
+	}
+
+	struct jx_class_count cc;
+	jx_classify(x, &cc);
+	uint64_t pinned[JX_LIVE_WORDS] = {0};
+	jx_pinned(x, pinned);
+	struct jx_interval gpr_iv[VM_MAX_FRAME_REGS], xmm_iv[VM_MAX_FRAME_REGS];
+	int n_gpr = 0, n_xmm = 0;
+	for (int v = 0; v < fn->n_regs; v++) {
+		if (iv[v].start == -1 || jx_has(pinned, v)) continue;
+		if (cc.n_float[v] > 0 && cc.n_int[v] == 0) {
+			xmm_iv[n_xmm++] = iv[v];
+		} else {
+			gpr_iv[n_gpr++] = iv[v];
+		}
+	}
+	jx_linear_scan(x, gpr_iv, n_gpr, JX_GPR);
+	jx_linear_scan(x, xmm_iv, n_xmm, JX_XMM);
+}
+
+
+// code generation
+
+static void jx_arith_i(struct jx* x, uint32_t opcode, uint32_t ins)
+{
+	jx_load_gpr(x, JX_RAX, INS_B(ins));
+	int rc = jx_gpr_of(x, INS_C(ins), JX_RCX);
+	jx_rr(x, 0, 1, opcode, JX_RAX, rc);
+	jx_store_gpr(x, INS_A(ins), JX_RAX);
+}
+
+static void jx_arith_f(struct jx* x, uint32_t opcode, uint32_t ins)
+{
+	jx_load_xmm(x, 0, INS_B(ins));
+	int rc = jx_xmm_of(x, INS_C(ins), 1);
+	jx_rr(x, 0xf2, 0, opcode, 0, rc);
+	jx_store_xmm(x, INS_A(ins), 0);
+}
+
+// al = condition; stores it zero extended into A
+static void jx_store_flag(struct jx* x, uint32_t ins)
+{
+	jx_rr(x, 0, 0, 0x0fb6, JX_RAX, JX_RAX); // movzx eax, al
+	jx_store_gpr(x, INS_A(ins), JX_RAX);
+}
+
+static void jx_setcc(struct jx* x, int cc, int r8)
+{
+	jx_rr(x, 0, 0, 0x0f90 | cc, 0, r8);
+}
+
+// operand of a vector op: n slots at [base+disp], or one slot broadcast
+// to all of them
+struct jx_vop {
+	int base; // JX_R, or a register holding the globals
+	int32_t disp;
+	int is_scalar;
+};
+
+// xmm/ymm reg = vector or broadcast operand; [base+rcx*8+disp]
+static void jx_vload(struct jx* x, int reg, struct jx_vop* o, int is_int)
+{
+	if (x->avx && !is_int) {
+		if (o->is_scalar) {
+			jx_vex_m(x, 2, 1, 0x19, reg, 0, o->base, JX_RSP, o->disp); // vbroadcastsd, no index
+		} else {
+			jx_vex_m(x, 1, 1, 0x10, reg, 0, o->base, JX_RCX, o->disp); // vmovupd
+		}
+	} else if (o->is_scalar) {
+		jx_rm(x, is_int ? 0xf3 : 0xf2, 0, is_int ? 0x0f7e : 0x0f10, reg, o->base, o->disp); // movq/movsd
+		jx_rr(x, 0x66, 0, is_int ? 0x0f6c : 0x0f14, reg, reg); // punpcklqdq/unpcklpd
+	} else {
+		jx_rmx(x, is_int ? 0xf3 : 0x66, 0, is_int ? 0x0f6f : 0x0f10, reg, o->base, JX_RCX, o->disp); // movdqu/movupd
+	}
+}
+
+// R or G slots a[i] = b[i] op c[i] for i < n; c is NULL for moves
+static void jx_vector(struct jx* x, int op, struct jx_vop* a, struct jx_vop* b, struct jx_vop* c, int n)
+{
+	int is_int = op == OP_VADDI || op == OP_VSUBI;
+	uint8_t vop = 0;
+	switch (op) {
+		case OP_VADDI: vop = 0xd4; break; // paddq
+		case OP_VSUBI: vop = 0xfb; break; // psubq
+		case OP_VADDF: vop = 0x58; break;
+		case OP_VSUBF: vop = 0x5c; break;
+		case OP_VMULF: vop = 0x59; break;
+		case OP_VDIVF: vop = 0x5e; break;
+	}
+	int avx = x->avx && !is_int;
+	int width = avx ? 4 : 2;
+	int n_vec = n - n % width;
+
+	if (n_vec > 0) {
+		jx_rr(x, 0, 0, 0x31, JX_RCX, JX_RCX); // xor ecx, ecx
+		uint32_t loop = x->n;
+		jx_vload(x, 0, b, is_int);
+		if (c != NULL) {
+			if (avx && !c->is_scalar) {
+				jx_vex_m(x, 1, 1, vop, 0, 0, c->base, JX_RCX, c->disp);
+			} else {
+				jx_vload(x, 1, c, is_int);
+				if (avx) {
+					jx_vex_r(x, 1, 1, vop, 0, 0, 1);
+				} else {
+					jx_rr(x, 0x66, 0, 0x0f00 | vop, 0, 1);
+				}
+			}
+		}
+		if (avx) {
+			jx_vex_m(x, 1, 1, 0x11, 0, 0, a->base, JX_RCX, a->disp); // vmovupd
+		} else {
+			jx_rmx(x, is_int ? 0xf3 : 0x66, 0, is_int ? 0x0f7f : 0x0f11, 0, a->base, JX_RCX, a->disp);
+		}
+		jx_rr(x, 0, 1, 0x83, 0, JX_RCX); // add rcx, width
+		jx_byte(x, width);
+		jx_rr(x, 0, 1, 0x81, 7, JX_RCX); // cmp rcx, n_vec
+		jx_u32(x, n_vec);
+		jx_byte(x, 0x0f); // jb loop
+		jx_byte(x, 0x80 | 0x2);
+		jx_u32(x, loop - (x->n + 4));
+		if (avx) {
+			jx_byte(x, 0xc5); // vzeroupper
+			jx_byte(x, 0xf8);
+			jx_byte(x, 0x77);
+		}
+	}
+
+	for (int i = n_vec; i < n; i++) {
+		int32_t da = a->disp + i*8;
+		int32_t db = b->is_scalar ? b->disp : b->disp + i*8;
+		int32_t dc = c == NULL || c->is_scalar ? (c ? c->disp : 0) : c->disp + i*8;
+		if (c == NULL || is_int) {
+			jx_rm(x, 0, 1, 0x8b, JX_RAX, b->base, db);
+			if (c != NULL) jx_rm(x, 0, 1, op == OP_VADDI ? 0x03 : 0x2b, JX_RAX, c->base, dc);
+			jx_rm(x, 0, 1, 0x89, JX_RAX, a->base, da);
+		} else {
+			jx_rm(x, 0xf2, 0, 0x0f10, 0, b->base, db);
+			jx_rm(x, 0xf2, 0, 0x0f00 | vop, 0, c->base, dc);
+			jx_rm(x, 0xf2, 0, 0x0f11, 0, a->base, da);
+		}
+	}
+}
+
+static void jx_ins(struct jx* x, int pc, uint32_t ins)
+{
+	int a = INS_A(ins), b = INS_B(ins);
+	switch (INS_OP(ins)) {
+		case OP_MOV:
+			if (x->locs[a].kind == JX_XMM) {
+				jx_load_xmm(x, x->locs[a].reg, b);
+			} else if (x->locs[a].kind == JX_GPR) {
+				jx_load_gpr(x, x->locs[a].reg, b);
+			} else if (x->locs[b].kind == JX_XMM) {
+				jx_store_xmm(x, a, x->locs[b].reg);
+			} else {
+				jx_store_gpr(x, a, jx_gpr_of(x, b, JX_RAX));
+			}
+			break;
+
+		case OP_LOADI:
+		case OP_LOADK: {
+			int64_t v = INS_OP(ins) == OP_LOADI ? INS_SBX(ins) : x->prog->consts[INS_BX(ins)].i;
+			int r = x->locs[a].kind == JX_GPR ? x->locs[a].reg : JX_RAX;
+			jx_mov_imm(x, r, v);
+			jx_store_gpr(x, a, r);
+		} break;
+
+		case OP_GETG:
+			jx_rm(x, 0, 1, 0x8b, JX_RCX, JX_CTX, offsetof(struct jit_ctx, globals));
+			jx_rm(x, 0, 1, 0x8b, JX_RAX, JX_RCX, jx_slot(INS_BX(ins)));
+			jx_store_gpr(x, a, JX_RAX);
+			break;
+
+		case OP_SETG: {
+			jx_rm(x, 0, 1, 0x8b, JX_RCX, JX_CTX, offsetof(struct jit_ctx, globals));
+			int r = jx_gpr_of(x, a, JX_RAX);
+			jx_rm(x, 0, 1, 0x89, r, JX_RCX, jx_slot(INS_BX(ins)));
+		} break;
+
+		case OP_CHECK: {
+			// unsigned, so negative indexes fail too
+			int r = jx_gpr_of(x, a, JX_RAX);
+			jx_rr(x, 0, 1, 0x81, 7, r); // cmp r, Bx
+			jx_u32(x, INS_BX(ins));
+			jx_jump(x, JX_CC_AE, JX_LABEL_INDEX);
+		} break;
+
+		case OP_GETX: {
+			int rc = jx_gpr_of(x, INS_C(ins), JX_RCX);
+			jx_rmx(x, 0, 1, 0x8b, JX_RAX, JX_R, rc, jx_slot(b));
+			jx_store_gpr(x, a, JX_RAX);
+		} break;
+
+		case OP_SETX: {
+			int rb = jx_gpr_of(x, b, JX_RCX);
+			int rc = jx_gpr_of(x, INS_C(ins), JX_RAX);
+			jx_rmx(x, 0, 1, 0x89, rc, JX_R, rb, jx_slot(a));
+		} break;
+
+		case OP_GETGX: {
+			jx_rm(x, 0, 1, 0x8b, JX_RDX, JX_CTX, offsetof(struct jit_ctx, globals));
+			int ra = jx_gpr_of(x, a, JX_RCX);
+			jx_rmx(x, 0, 1, 0x8b, JX_RAX, JX_RDX, ra, jx_slot(INS_BX(ins)));
+			jx_store_gpr(x, a, JX_RAX);
+		} break;
+
+		case OP_SETGX: {
+			jx_rm(x, 0, 1, 0x8b, JX_RDX, JX_CTX, offsetof(struct jit_ctx, globals));
+			int ra = jx_gpr_of(x, a, JX_RCX);
+			int rv = jx_gpr_of(x, INS_A(x->fn->code[pc+1]), JX_RAX);
+			jx_rmx(x, 0, 1, 0x89, rv, JX_RDX, ra, jx_slot(INS_BX(ins)));
+		} break;
+
+		case OP_VMOV: case OP_VADDI: case OP_VSUBI: case OP_VADDF: case OP_VSUBF: case OP_VMULF: case OP_VDIVF: {
+			uint32_t arg = x->fn->code[pc+1];
+			struct jx_vop va = { JX_R, jx_slot(a), 0 };
+			struct jx_vop vb = { JX_R, jx_slot(b), INS_A(arg) & VM_ARG_SB };
+			struct jx_vop vc = { JX_R, jx_slot(INS_C(ins)), INS_A(arg) & VM_ARG_SC };
+			jx_vector(x, INS_OP(ins), &va, &vb, INS_OP(ins) == OP_VMOV ? NULL : &vc, INS_BX(arg));
+		} break;
+
+		case OP_VGETG:
+		case OP_VSETG: {
+			jx_rm(x, 0, 1, 0x8b, JX_RDX, JX_CTX, offsetof(struct jit_ctx, globals));
+			struct jx_vop r = { JX_R, jx_slot(a), 0 };
+			struct jx_vop g = { JX_RDX, jx_slot(INS_BX(ins)), 0 };
+			int n = INS_BX(x->fn->code[pc+1]);
+			if (INS_OP(ins) == OP_VGETG) {
+				jx_vector(x, OP_VMOV, &r, &g, NULL, n);
+			} else {
+				jx_vector(x, OP_VMOV, &g, &r, NULL, n);
+			}
+		} break;
+
+		case OP_ARG:
+			break;
+
+		case OP_ADDI: jx_arith_i(x, 0x03, ins); break;
+		case OP_SUBI: jx_arith_i(x, 0x2b, ins); break;
+		case OP_MULI: jx_arith_i(x, 0x0faf, ins); break;
+
+		case OP_DIVI: {
+			// see vm_divi()
+			jx_load_gpr(x, JX_RAX, b);
+			jx_load_gpr(x, JX_RCX, INS_C(ins));
+			jx_rr(x, 0, 1, 0x85, JX_RCX, JX_RCX); // test rcx, rcx
+			uint32_t jz = jx_jump8(x, JX_CC_Z);
+			jx_rr(x, 0, 1, 0x83, 7, JX_RCX); // cmp rcx, -1
+			jx_byte(x, 0xff);
+			uint32_t je = jx_jump8(x, JX_CC_Z);
+			jx_byte(x, 0x48); jx_byte(x, 0x99); // cqo
+			jx_rr(x, 0, 1, 0xf7, 7, JX_RCX); // idiv rcx
+			uint32_t done0 = jx_jump8(x, 0);
+			jx_here8(x, jz);
+			jx_rr(x, 0, 0, 0x31, JX_RAX, JX_RAX);
+			uint32_t done1 = jx_jump8(x, 0);
+			jx_here8(x, je);
+			jx_rr(x, 0, 1, 0xf7, 3, JX_RAX); // neg rax
+			jx_here8(x, done0);
+			jx_here8(x, done1);
+			jx_store_gpr(x, a, JX_RAX);
+		} break;
+
+		case OP_NEGI:
+			jx_load_gpr(x, JX_RAX, b);
+			jx_rr(x, 0, 1, 0xf7, 3, JX_RAX);
+			jx_store_gpr(x, a, JX_RAX);
+			break;
+
+		case OP_EQI:
+		case OP_NEI: {
+			int rb = jx_gpr_of(x, b, JX_RCX);
+			int rc = jx_gpr_of(x, INS_C(ins), JX_RDX);
+			jx_rr(x, 0, 1, 0x3b, rb, rc);
+			jx_setcc(x, INS_OP(ins) == OP_EQI ? JX_CC_Z : JX_CC_NZ, JX_RAX);
+			jx_store_flag(x, ins);
+		} break;
+
+		case OP_ADDF: jx_arith_f(x, 0x0f58, ins); break;
+		case OP_SUBF: jx_arith_f(x, 0x0f5c, ins); break;
+		case OP_MULF: jx_arith_f(x, 0x0f59, ins); break;
+		case OP_DIVF: jx_arith_f(x, 0x0f5e, ins); break;
+
+		case OP_NEGF:
+			jx_load_gpr(x, JX_RAX, b);
+			jx_rr(x, 0, 1, 0x0fba, 7, JX_RAX); // btc rax, 63
+			jx_byte(x, 63);
+			jx_store_gpr(x, a, JX_RAX);
+			break;
+
+		case OP_EQF:
+		case OP_NEF: {
+			jx_load_xmm(x, 0, b);
+			int rc = jx_xmm_of(x, INS_C(ins), 1);
+			jx_rr(x, 0x66, 0, 0x0f2e, 0, rc); // ucomisd
+			// unordered sets ZF and PF
+			if (INS_OP(ins) == OP_EQF) {
+				jx_setcc(x, JX_CC_Z, JX_RAX);
+				jx_setcc(x, 0xb, JX_RCX); // setnp
+				jx_rr(x, 0, 0, 0x20, JX_RCX, JX_RAX); // and al, cl
+			} else {
+				jx_setcc(x, JX_CC_NZ, JX_RAX);
+				jx_setcc(x, 0xa, JX_RCX); // setp
+				jx_rr(x, 0, 0, 0x08, JX_RCX, JX_RAX); // or al, cl
+			}
+			jx_store_flag(x, ins);
+		} break;
+
+		case OP_ITOF: {
+			int rb = jx_gpr_of(x, b, JX_RAX);
+			jx_rr(x, 0x66, 0, 0x0fef, 0, 0); // pxor xmm0, xmm0
+			jx_rr(x, 0xf2, 1, 0x0f2a, 0, rb); // cvtsi2sd
+			jx_store_xmm(x, a, 0);
+		} break;
+
+		case OP_FTOI: {
+			int rb = jx_xmm_of(x, b, 0);
+			jx_rr(x, 0xf2, 1, 0x0f2c, JX_RAX, rb); // cvttsd2si
+			jx_store_gpr(x, a, JX_RAX);
+		} break;
+
+		case OP_JMP:
+			jx_jump(x, 0, pc + 1 + INS_SBX(ins));
+			break;
+
+		case OP_JZ:
+		case OP_JNZ: {
+			int r = jx_gpr_of(x, a, JX_RAX);
+			jx_rr(x, 0, 1, 0x85, r, r);
+			jx_jump(x, INS_OP(ins) == OP_JZ ? JX_CC_Z : JX_CC_NZ, pc + 1 + INS_SBX(ins));
+		} break;
+
+		case OP_CALL: {
+			int fi = INS_BX(ins);
+			struct vm_func* callee = &x->prog->funcs[fi];
+			uint64_t* live_out = x->live[pc].out;
+			for (int i = 0; i < callee->n_arg_slots; i++) jx_spill(x, a+i);
+			for (int v = 0; v < x->fn->n_regs; v++) {
+				if (!jx_has(live_out, v)) continue;
+				if (v >= a && v < a + callee->n_ret_slots) continue;
+				assert(v < a); // the callee may overwrite R[a..]
+				if (!jx_is_callee_saved(x->locs[v])) jx_spill(x, v);
+			}
+
+			jx_rm(x, 0, 1, 0x8d, JX_RDI, JX_R, jx_slot(a)); // lea rdi, [r15+a*8]
+			jx_mov_rr(x, JX_RSI, JX_CTX);
+			jx_byte(x, 0xe8);
+			struct jx_call_fixup* f = dynary_append(&x->call_fixups_dy);
+			f->at = x->n;
+			f->func = fi;
+			jx_u32(x, 0);
+			jx_rr(x, 0, 0, 0x85, JX_RAX, JX_RAX); // test eax, eax
+			jx_jump(x, JX_CC_NZ, JX_LABEL_EPILOGUE);
+
+			for (int v = 0; v < x->fn->n_regs; v++) {
+				if (!jx_has(live_out, v)) continue;
+				if ((v >= a && v < a + callee->n_ret_slots) || !jx_is_callee_saved(x->locs[v])) jx_unspill(x, v);
+			}
+		} break;
+
+		case OP_RET: {
+			for (int i = 0; i < b; i++) {
+				int v = a + i;
+				if (x->locs[v].kind == JX_XMM) {
+					jx_rm(x, 0xf2, 0, 0x0f11, x->locs[v].reg, JX_R, jx_slot(i));
+				} else if (v != i || x->locs[v].kind != JX_MEM) {
+					int r = jx_gpr_of(x, v, JX_RAX);
+					jx_rm(x, 0, 1, 0x89, r, JX_R, jx_slot(i));
+				}
+			}
+			jx_rr(x, 0, 0, 0x31, JX_RAX, JX_RAX);
+			jx_jump(x, 0, JX_LABEL_EPILOGUE);
+		} break;
+
+		default:
+			assert(0);
+	}
+}
+
+static const int jx_saved[] = { JX_RBX, JX_R12, JX_R13, JX_R14, JX_R15 };
+#define JX_N_SAVED (sizeof(jx_saved) / sizeof(jx_saved[0]))
+
+static void jx_func(struct jx* x)
+{
+	struct vm_func* fn = x->fn;
+
+	// prologue; 5 pushes plus 8 bytes keep rsp 16-byte aligned
+	jx_push(x, JX_RBP);
+	jx_mov_rr(x, JX_RBP, JX_RSP);
+	for (int i = 0; i < JX_N_SAVED; i++) jx_push(x, jx_saved[i]);
+	jx_rr(x, 0, 1, 0x83, 5, JX_RSP); // sub rsp, 8
+	jx_byte(x, 8);
+	jx_mov_rr(x, JX_R, JX_RDI);
+	jx_mov_rr(x, JX_CTX, JX_RSI);
+
+	// same limits as the interpreter, so both overflow at the same point
+	jx_rm(x, 0, 0, 0x83, 5, JX_CTX, offsetof(struct jit_ctx, frames_left)); // sub dword [r14+..], 1
+	jx_byte(x, 1);
+	jx_jump(x, JX_CC_S, JX_LABEL_OVERFLOW);
+	jx_rm(x, 0, 1, 0x8d, JX_RAX, JX_R, jx_slot(fn->n_regs)); // lea rax, [r15+n_regs*8]
+	jx_rm(x, 0, 1, 0x3b, JX_RAX, JX_CTX, offsetof(struct jit_ctx, regs_end));
+	jx_jump(x, JX_CC_A, JX_LABEL_OVERFLOW);
+
+	for (int v = 0; v < fn->n_regs; v++) {
+		if (jx_has(x->live[0].in, v)) jx_unspill(x, v);
+	}
+
+	for (int pc = 0; pc < fn->n_code; pc++) {
+		x->pc_offsets[pc] = x->n;
+		jx_ins(x, pc, fn->code[pc]);
+	}
+
+	x->index_err = x->n;
+	jx_mov_imm(x, JX_RAX, VM_ERR_INDEX);
+	jx_jump(x, 0, JX_LABEL_EPILOGUE);
+	x->overflow = x->n;
+	jx_mov_imm(x, JX_RAX, VM_ERR_STACK_OVERFLOW);
+	x->epilogue = x->n;
+	jx_rm(x, 0, 0, 0x83, 0, JX_CTX, offsetof(struct jit_ctx, frames_left)); // add dword [r14+..], 1
+	jx_byte(x, 1);
+	jx_rr(x, 0, 1, 0x83, 0, JX_RSP); // add rsp, 8
+	jx_byte(x, 8);
+	for (int i = JX_N_SAVED - 1; i >= 0; i--) jx_pop(x, jx_saved[i]);
+	jx_pop(x, JX_RBP);
+	jx_byte(x, 0xc3);
+
+	for (int i = 0; i < x->fixups_dy.n; i++) {
+		struct jx_fixup* f = &x->fixups[i];
+		uint32_t target =
+			  f->target == JX_LABEL_EPILOGUE ? x->epilogue
+			: f->target == JX_LABEL_OVERFLOW ? x->overflow
+			: f->target == JX_LABEL_INDEX ? x->index_err
+			: x->pc_offsets[f->target];
+		jx_patch32(x, f->at, target - (f->at + 4));
+	}
+	x->fixups_dy.n = 0;
+}
+
+static int jit__compile(struct jit* j)
+{
+	struct vm_prog* prog = j->vm->prog;
+	struct jx x;
+	memset(&x, 0, sizeof(x));
+	x.prog = prog;
+#ifndef JIT_NO_AVX
+	x.avx = __builtin_cpu_supports("avx");
+#endif
+	dynary_init(&x.fixups_dy, (void**) &x.fixups, sizeof(*x.fixups));
+	dynary_init(&x.call_fixups_dy, (void**) &x.call_fixups, sizeof(*x.call_fixups));
+
+	int n_funcs = prog->funcs_dy.n;
+	uint32_t* entries = calloc(n_funcs, sizeof(*entries));
+	assert(entries != NULL);
+	for (int fi = 0; fi < n_funcs; fi++) {
+		x.fn = &prog->funcs[fi];
+		x.live = calloc(x.fn->n_code, sizeof(*x.live));
+		x.pc_offsets = calloc(x.fn->n_code, sizeof(*x.pc_offsets));
+		assert(x.live != NULL && x.pc_offsets != NULL);
+		jx_liveness(&x);
+		jx_allocate(&x);
+		while (x.n & 15) jx_byte(&x, 0xcc);
+		entries[fi] = x.n;
+		jx_func(&x);
+		free(x.live);
+		free(x.pc_offsets);
+	}
+	for (int i = 0; i < x.call_fixups_dy.n; i++) {
+		struct jx_call_fixup* f = &x.call_fixups[i];
+		jx_patch32(&x, f->at, entries[f->func] - (f->at + 4));
+	}
+
+	int status = -1;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (x.n + page - 1) & ~(page - 1);
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem != MAP_FAILED) {
+		memcpy(mem, x.buf, x.n);
+		if (mprotect(mem, size, PROT_READ | PROT_EXEC) == 0) {
+			j->mem = mem;
+			j->mem_size = size;
+			j->funcs = calloc(n_funcs, sizeof(*j->funcs));
+			assert(j->funcs != NULL);
+			for (int fi = 0; fi < n_funcs; fi++) {
+				j->funcs[fi] = (jit_fn)((uint8_t*)mem + entries[fi]);
+			}
+			status = 0;
+		} else {
+			munmap(mem, size);
+		}
+	}
+
+	free(entries);
+	free(x.buf);
+	free(x.fixups);
+	free(x.call_fixups);
+	return status;
+}
+
+static void jit__release(struct jit* j)
+{
+	if (j->mem != NULL) munmap(j->mem, j->mem_size);
+}
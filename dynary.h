@@ -91,14 +91,14 @@ DYNARY_API void* dynary_insert(struct dynary* d, int index)
 	d->n++;
 	dynary__set_cap(d, d->n * d->element_sz);
 	DYNARY_assert(dynary_is_valid_index(d, index));
-	DYNARY_memmove(*d->ptr + (index+1) * d->element_sz, *d->ptr + index * d->element_sz, (d->n - 1) * d->element_sz);
+	DYNARY_memmove(*d->ptr + (index+1) * d->element_sz, *d->ptr + index * d->element_sz, (d->n - 1 - index) * d->element_sz);
 	return dynary_clear(d, index);
 }
 
 DYNARY_API void dynary_erase(struct dynary* d, int index)
 {
 	DYNARY_assert(dynary_is_valid_index(d, index));
-	DYNARY_memmove(*d->ptr + index * d->element_sz, *d->ptr + (index+1) * d->element_sz, (d->n - 1) * d->element_sz);
+	DYNARY_memmove(*d->ptr + index * d->element_sz, *d->ptr + (index+1) * d->element_sz, (d->n - 1 - index) * d->element_sz);
 	d->n--;
 	dynary__set_cap(d, d->n * d->element_sz);
 }
@@ -1,9 +1,11 @@
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 
 #include "lsl_prg.h"
 #include "l4d.h"
+#include "l4v.h"
 
 struct lsl_rect empty_rect;
 struct l4d l4d;
@@ -18,10 +20,50 @@ struct window_timeline {
 
 struct window_graph {
 	int pdrag;
-	int px, py;
+	int px, py; // in pixels, so a container position p is at p * scale - px
+	int zoom; // in quarter octaves out from 1:1
 	struct l4d_container* container;
+	struct l4v_grid grid;
+	struct l4d_handle drag; // of the node being dragged, if any
+	int drag_x0, drag_y0; // where it was when the drag started
 };
 
+#define GRAPH_ZOOM_MIN (-8)
+#define GRAPH_ZOOM_MAX (4 * L4V_LEVELS)
+
+static float graph_scale(struct window_graph* wg)
+{
+	return exp2f(-wg->zoom / 4.0f);
+}
+
+// the mouse wheel zooms about the mouse
+static void graph_zoom(struct window_graph* wg)
+{
+	struct lsl_frame* f = lsl_frame_top();
+	// a wheel click is a press and a release of button 4 or 5
+	int steps = (f->button_cycles[4] + 1) / 2 - (f->button_cycles[3] + 1) / 2;
+	if (steps == 0 || wg->pdrag || l4d_node_of(wg->container, wg->drag) >= 0) return;
+	int zoom = wg->zoom + steps;
+	if (zoom < GRAPH_ZOOM_MIN) zoom = GRAPH_ZOOM_MIN;
+	if (zoom > GRAPH_ZOOM_MAX) zoom = GRAPH_ZOOM_MAX;
+	float s0 = graph_scale(wg);
+	wg->zoom = zoom;
+	float s1 = graph_scale(wg);
+	wg->px = (int)floorf((f->mpos.x + wg->px) * (s1 / s0) - f->mpos.x);
+	wg->py = (int)floorf((f->mpos.y + wg->py) * (s1 / s0) - f->mpos.y);
+}
+
+static struct lsl_rect graph_rect(struct window_graph* wg, float scale, int x, int y, int w, int h)
+{
+	struct lsl_rect r;
+	r.p0.x = floorf(x * scale) - wg->px;
+	r.p0.y = floorf(y * scale) - wg->py;
+	// nodes and tiles stay at least a pixel in size
+	r.dim.w = fmaxf(1, floorf(w * scale));
+	r.dim.h = fmaxf(1, floorf(h * scale));
+	return r;
+}
+
 struct window {
 	unsigned int layout; // 6 different?
 	int editor_width, editor_height;
@@ -41,20 +83,65 @@ struct window {
 static int winproc_graph(struct window* w)
 {
 	struct window_graph* wg = &w->graph;
+	// dragging writes node meta in place, so it must not be in a snapshot
+	wg->container = l4d_mutable(&l4d, NULL, 0);
 
 	if (lsl_rect_not_empty(&w->main_rect)) {
 		lsl_frame_push_clip(&w->main_rect);
 		lsl_set_color((union lsl_vec4) { .r = 0, .g = 0.2, .b = 0.3, .a = 1 });
 		lsl_clear();
 
-		lsl_set_color((union lsl_vec4) { .r = 1, .g = 0, .b = 1, .a = 1 });
-
-		for (int i = 0; i < wg->container->nodes_dy.n; i++) {
-			struct l4d_node* n = &wg->container->nodes[i];
-			struct lsl_rect r = (struct lsl_rect) { .p0 = { .x = n->meta.x - wg->px , .y = n->meta.y - wg->py }, .dim = { .w = 40, .h = 20 } };
-
+		graph_zoom(wg);
+		float scale = graph_scale(wg);
+
+		struct l4d_container* c = wg->container;
+		l4v_grid_sync(&wg->grid, c);
+		struct l4v_item* items;
+		int x0 = (int)floorf(wg->px / scale);
+		int y0 = (int)floorf(wg->py / scale);
+		int x1 = (int)ceilf((wg->px + w->main_rect.dim.w) / scale);
+		int y1 = (int)ceilf((wg->py + w->main_rect.dim.h) / scale);
+		int n_items = l4v_grid_view(&wg->grid, x0, y0, x1, y1, scale, &items);
+		for (int i = 0; i < n_items; i++) {
+			struct l4v_item* it = &items[i];
+			struct lsl_rect r = graph_rect(wg, scale, it->x, it->y, it->w, it->h);
+			if (it->node < 0) {
+				// tiles are as opaque as their nodes would cover them
+				float cover = (float)it->n * (L4V_NODE_W * L4V_NODE_H) / ((float)it->w * it->h);
+				lsl_set_color((union lsl_vec4) { .r = 1, .g = 0, .b = 1, .a = 0.25f + 0.75f * fminf(1, cover) });
+			} else {
+				lsl_set_color((union lsl_vec4) { .r = 1, .g = 0, .b = 1, .a = 1 });
+			}
 			lsl_fill_rect(&r);
-			lsl_drag(&r, &n->meta.iusr0, &n->meta.x, &n->meta.y, 1, 1);
+		}
+
+		// only the node being dragged, or else the topmost one under the
+		// mouse, can be dragged, and only if it was drawn as a node
+		union lsl_vec2 mpos = lsl_frame_top()->mpos;
+		int node = l4d_node_of(c, wg->drag);
+		if (node < 0) {
+			int hit = l4v_grid_hit(&wg->grid, (int)floorf((mpos.x + wg->px) / scale), (int)floorf((mpos.y + wg->py) / scale));
+			for (int i = n_items - 1; hit >= 0 && i >= 0 && items[i].node >= 0; i--) {
+				if (items[i].node == hit) node = hit;
+			}
+		}
+		if (node >= 0) {
+			struct l4d_node* n = &c->nodes[node];
+			struct lsl_rect r = graph_rect(wg, scale, n->meta.x, n->meta.y, L4V_NODE_W, L4V_NODE_H);
+			// lsl_drag() moves in pixels, so drag an offset from 0
+			int dx = 0, dy = 0;
+			int drag = lsl_drag(&r, &n->meta.iusr0, &dx, &dy, 1, 1);
+			if (drag == LSL_DRAG_START) {
+				wg->drag_x0 = n->meta.x;
+				wg->drag_y0 = n->meta.y;
+			}
+			if (drag) {
+				n->meta.x = wg->drag_x0 + (int)floorf(dx / scale);
+				n->meta.y = wg->drag_y0 + (int)floorf(dy / scale);
+				l4v_grid_move(&wg->grid, node, n->meta.x, n->meta.y);
+			}
+			int dragging = drag == LSL_DRAG_START || drag == LSL_DRAG_CONT;
+			wg->drag = dragging ? l4d_handle(c, node) : (struct l4d_handle) { 0, 0 };
 		}
 
 		lsl_drag(NULL, &wg->pdrag, &wg->px, &wg->py, -1, -1);
@@ -172,6 +259,8 @@ static void set_window_graph_defaults(struct window* w)
 	w->editor_height = 320;
 	w->type = WINDOW_GRAPH;
 	w->graph.container = l4d.root_container;
+	l4v_grid_init(&w->graph.grid);
+	w->graph.drag = (struct l4d_handle) { 0, 0 };
 }
 
 static struct window* clone_win(struct window* ow)
@@ -182,6 +271,10 @@ static struct window* clone_win(struct window* ow)
 		set_window_graph_defaults(w);
 	} else {
 		memcpy(w, ow, sizeof(*w));
+		if (w->type == WINDOW_GRAPH) {
+			l4v_grid_init(&w->graph.grid);
+			w->graph.drag = (struct l4d_handle) { 0, 0 };
+		}
 	}
 	w->next = windows;
 	windows = w;
@@ -1,29 +1,2116 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "l4d.h"
 
-static struct l4d_container* new_container(struct l4d* d)
+struct l4d_map {
+	void* base;
+	size_t size;
+	int refcount;
+};
+
+static void l4d__map_release(struct l4d_map* map)
+{
+	if (__atomic_sub_fetch(&map->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+	munmap(map->base, map->size);
+	free(map);
+}
+
+/*
+edges by node and a topological order; see l4d.h. an arc is one end of an
+edge: the node at the other end, and the edge's index, which is kept up to
+date as edges move. rows, as built from the edges, cover the first row_nodes
+nodes: the successors of node i are out_arcs[out_base[i] .. out_base[i+1]),
+its predecessors likewise in in_arcs. edges connected since are chained
+newest first per node, out_head[i] and in_head[i] being indices in links. a
+removed edge leaves its arcs in place with node -1.
+node_at[k] is the k'th node in the order, and ord[node_at[k]] == k; a removed
+node leaves a -1 in node_at, until l4d_order() or enough of them close the
+gaps
+*/
+struct l4d_arc {
+	int node, edge;
+};
+
+struct l4d_link {
+	struct l4d_arc arc;
+	int next;
+};
+
+struct l4d_adjacency {
+	int nodes_cap;
+
+	int row_nodes, row_edges;
+	int* out_base;
+	struct l4d_arc* out_arcs;
+	int* in_base;
+	struct l4d_arc* in_arcs;
+	int n_dead; // removed arcs
+
+	int* out_head;
+	int* in_head;
+	struct l4d_link* links;
+	int n_links, links_cap;
+
+	int* ord;
+	int* node_at;
+	int n_order, order_cap; // entries in node_at, holes included
+	int n_holes;
+	int cyclic; // no order; node_at is just a permutation
+
+	// searches; a node is visited if mark is epoch
+	int* mark;
+	int epoch;
+	int* stack;
+	int64_t* keys;
+};
+
+static void l4d__adj_free(struct l4d_adjacency* a)
+{
+	if (a == NULL) return;
+	free(a->out_base);
+	free(a->out_arcs);
+	free(a->in_base);
+	free(a->in_arcs);
+	free(a->out_head);
+	free(a->in_head);
+	free(a->links);
+	free(a->ord);
+	free(a->node_at);
+	free(a->mark);
+	free(a->stack);
+	free(a->keys);
+	free(a);
+}
+
+static void* l4d__memdup(const void* src, size_t size)
+{
+	if (src == NULL) return NULL;
+	void* dst = malloc(size);
+	assert(dst != NULL);
+	memcpy(dst, src, size);
+	return dst;
+}
+
+static struct l4d_adjacency* l4d__adj_copy(const struct l4d_adjacency* a)
+{
+	if (a == NULL) return NULL;
+	struct l4d_adjacency* copy = malloc(sizeof(*copy));
+	assert(copy != NULL);
+	*copy = *a;
+	size_t nodes = a->nodes_cap * sizeof(int);
+	copy->out_base = l4d__memdup(a->out_base, (a->row_nodes + 1) * sizeof(int));
+	copy->out_arcs = l4d__memdup(a->out_arcs, (a->row_edges + 1) * sizeof(*a->out_arcs));
+	copy->in_base = l4d__memdup(a->in_base, (a->row_nodes + 1) * sizeof(int));
+	copy->in_arcs = l4d__memdup(a->in_arcs, (a->row_edges + 1) * sizeof(*a->in_arcs));
+	copy->out_head = l4d__memdup(a->out_head, nodes);
+	copy->in_head = l4d__memdup(a->in_head, nodes);
+	copy->links = l4d__memdup(a->links, a->links_cap * sizeof(*a->links));
+	copy->ord = l4d__memdup(a->ord, nodes);
+	copy->node_at = l4d__memdup(a->node_at, a->order_cap * sizeof(int));
+	copy->mark = l4d__memdup(a->mark, nodes);
+	copy->stack = l4d__memdup(a->stack, nodes);
+	copy->keys = l4d__memdup(a->keys, a->nodes_cap * sizeof(int64_t));
+	return copy;
+}
+
+static void l4d__adj_reserve(struct l4d_adjacency* a, int n)
+{
+	if (n <= a->nodes_cap) return;
+	int cap = a->nodes_cap ? a->nodes_cap : 64;
+	while (cap < n) cap *= 2;
+	a->out_head = realloc(a->out_head, cap * sizeof(int));
+	a->in_head = realloc(a->in_head, cap * sizeof(int));
+	a->ord = realloc(a->ord, cap * sizeof(int));
+	a->mark = realloc(a->mark, cap * sizeof(int));
+	a->stack = realloc(a->stack, cap * sizeof(int));
+	a->keys = realloc(a->keys, cap * sizeof(int64_t));
+	assert(a->out_head != NULL && a->in_head != NULL && a->ord != NULL);
+	assert(a->mark != NULL && a->stack != NULL && a->keys != NULL);
+	memset(a->mark + a->nodes_cap, 0, (cap - a->nodes_cap) * sizeof(int));
+	a->nodes_cap = cap;
+}
+
+static void l4d__adj_order_reserve(struct l4d_adjacency* a, int n)
+{
+	if (n <= a->order_cap) return;
+	int cap = a->order_cap ? a->order_cap : 64;
+	while (cap < n) cap *= 2;
+	a->node_at = realloc(a->node_at, cap * sizeof(int));
+	assert(a->node_at != NULL);
+	a->order_cap = cap;
+}
+
+// closes the holes in node_at
+static void l4d__adj_compact(struct l4d_adjacency* a)
+{
+	int k = 0;
+	for (int j = 0; j < a->n_order; j++) {
+		int node = a->node_at[j];
+		if (node < 0) continue;
+		a->node_at[k] = node;
+		a->ord[node] = k++;
+	}
+	a->n_order = k;
+	a->n_holes = 0;
+}
+
+static int l4d__edge_valid(struct l4d_container* c, const struct l4d_edge* e)
+{
+	int n = c->nodes_dy.n;
+	return e->src >= 0 && e->src < n && e->dst >= 0 && e->dst < n;
+}
+
+// rows from every edge (but those naming nodes that do not exist, which only
+// a project file has, and the engine refuses)
+static void l4d__adj_rows(struct l4d_container* c, struct l4d_adjacency* a)
+{
+	int n = c->nodes_dy.n;
+	int m = c->edges_dy.n;
+	l4d__adj_reserve(a, n);
+	free(a->out_base);
+	free(a->in_base);
+	a->out_base = calloc(n + 1, sizeof(int));
+	a->in_base = calloc(n + 1, sizeof(int));
+	a->out_arcs = realloc(a->out_arcs, (m + 1) * sizeof(*a->out_arcs));
+	a->in_arcs = realloc(a->in_arcs, (m + 1) * sizeof(*a->in_arcs));
+	assert(a->out_base != NULL && a->in_base != NULL && a->out_arcs != NULL && a->in_arcs != NULL);
+	for (int i = 0; i < m; i++) {
+		struct l4d_edge* e = &c->edges[i];
+		if (!l4d__edge_valid(c, e)) continue;
+		a->out_base[e->src + 1]++;
+		a->in_base[e->dst + 1]++;
+	}
+	for (int i = 0; i < n; i++) {
+		a->out_base[i + 1] += a->out_base[i];
+		a->in_base[i + 1] += a->in_base[i];
+	}
+	int* fill = a->stack;
+	memcpy(fill, a->out_base, n * sizeof(int));
+	for (int i = 0; i < m; i++) {
+		struct l4d_edge* e = &c->edges[i];
+		if (l4d__edge_valid(c, e)) a->out_arcs[fill[e->src]++] = (struct l4d_arc) { .node = e->dst, .edge = i };
+	}
+	memcpy(fill, a->in_base, n * sizeof(int));
+	for (int i = 0; i < m; i++) {
+		struct l4d_edge* e = &c->edges[i];
+		if (l4d__edge_valid(c, e)) a->in_arcs[fill[e->dst]++] = (struct l4d_arc) { .node = e->src, .edge = i };
+	}
+	for (int i = 0; i < n; i++) a->out_head[i] = a->in_head[i] = -1;
+	a->row_nodes = n;
+	a->row_edges = m;
+	a->n_dead = 0;
+	a->n_links = 0;
+}
+
+// Kahn's algorithm over fresh rows; nodes on a cycle go last, in index order
+static void l4d__adj_sort(struct l4d_container* c, struct l4d_adjacency* a)
+{
+	int n = c->nodes_dy.n;
+	assert(a->row_nodes == n && a->n_dead == 0 && a->n_links == 0);
+	l4d__adj_order_reserve(a, n);
+	int* indegree = a->stack;
+	for (int i = 0; i < n; i++) indegree[i] = a->in_base[i + 1] - a->in_base[i];
+	int k = 0;
+	for (int i = 0; i < n; i++) if (indegree[i] == 0) a->node_at[k++] = i;
+	for (int head = 0; head < k; head++) {
+		int i = a->node_at[head];
+		for (int j = a->out_base[i]; j < a->out_base[i + 1]; j++) {
+			int v = a->out_arcs[j].node;
+			if (--indegree[v] == 0) a->node_at[k++] = v;
+		}
+	}
+	a->cyclic = k < n;
+	for (int i = 0; a->cyclic && i < n; i++) if (indegree[i] > 0) a->node_at[k++] = i;
+	for (k = 0; k < n; k++) a->ord[a->node_at[k]] = k;
+	a->n_order = n;
+	a->n_holes = 0;
+}
+
+static struct l4d_adjacency* l4d__adj(struct l4d_container* c)
+{
+	struct l4d_adjacency* a = c->adj;
+	if (a == NULL) {
+		a = c->adj = calloc(1, sizeof(*a));
+		assert(a != NULL);
+		l4d__adj_rows(c, a);
+		l4d__adj_sort(c, a);
+	}
+	return a;
+}
+
+// visits v if it is ordered in [lb, ub]; returns 1 if v is stop
+static int l4d__adj_visit(struct l4d_adjacency* a, int v, int lb, int ub, int stop, int* n_stack)
+{
+	if (v < 0) return 0; // removed
+	if (v == stop) return 1;
+	int k = a->ord[v];
+	if (k < lb || k > ub || a->mark[v] == a->epoch) return 0;
+	a->mark[v] = a->epoch;
+	a->stack[(*n_stack)++] = v;
+	return 0;
+}
+
+// visits the successors (or predecessors) of w
+static int l4d__adj_expand(struct l4d_container* c, struct l4d_adjacency* a, int w, int forward, int lb, int ub, int stop, int* n_stack)
+{
+	const int* base = forward ? a->out_base : a->in_base;
+	const struct l4d_arc* arcs = forward ? a->out_arcs : a->in_arcs;
+	if (w < a->row_nodes) {
+		for (int j = base[w]; j < base[w + 1]; j++) {
+			if (l4d__adj_visit(a, arcs[j].node, lb, ub, stop, n_stack)) return 1;
+		}
+	}
+	for (int j = (forward ? a->out_head : a->in_head)[w]; j >= 0; j = a->links[j].next) {
+		if (l4d__adj_visit(a, a->links[j].arc.node, lb, ub, stop, n_stack)) return 1;
+	}
+	return 0;
+}
+
+static int l4d__cmp_i64(const void* a, const void* b)
+{
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/*
+whether src -> dst leaves the graph acyclic, and if so, repairs the order for
+it (Pearce-Kelly). only an edge from a later node to an earlier one (dst at
+lb, src at ub) needs work: the nodes reachable from dst within [lb, ub] (if
+src is one, there is a cycle) and the nodes reaching src within [lb, ub] swap
+places, keeping their own order, in the positions they held between them
+*/
+static int l4d__adj_acyclic(struct l4d_container* c, struct l4d_adjacency* a, int src, int dst)
+{
+	if (src == dst) return 0;
+	if (++a->epoch == INT32_MAX) {
+		memset(a->mark, 0, a->nodes_cap * sizeof(int));
+		a->epoch = 1;
+	}
+	int lb = a->ord[dst];
+	int ub = a->ord[src];
+	if (a->cyclic) {
+		// no order to go by, so search everything
+		lb = 0;
+		ub = INT32_MAX;
+	} else if (lb > ub) {
+		return 1;
+	}
+
+	int n_stack = 0;
+	int n_forward = 0;
+	a->mark[dst] = a->epoch;
+	a->stack[n_stack++] = dst;
+	while (n_stack > 0) {
+		int w = a->stack[--n_stack];
+		a->keys[n_forward++] = (int64_t)a->ord[w] << 32 | w;
+		if (l4d__adj_expand(c, a, w, 1, lb, ub, src, &n_stack)) return 0;
+	}
+	if (a->cyclic) return 1;
+
+	int64_t* backward = a->keys + n_forward;
+	int n_backward = 0;
+	a->mark[src] = a->epoch;
+	a->stack[n_stack++] = src;
+	while (n_stack > 0) {
+		int w = a->stack[--n_stack];
+		backward[n_backward++] = (int64_t)a->ord[w] << 32 | w;
+		l4d__adj_expand(c, a, w, 0, lb, ub, -1, &n_stack);
+	}
+
+	int64_t* forward = a->keys;
+	qsort(forward, n_forward, sizeof(*forward), l4d__cmp_i64);
+	qsort(backward, n_backward, sizeof(*backward), l4d__cmp_i64);
+	// the positions both sets held, in order
+	int* pos = a->stack;
+	int i = 0, j = 0, k = 0;
+	while (i < n_forward || j < n_backward) {
+		if (j == n_backward || (i < n_forward && forward[i] < backward[j])) {
+			pos[k++] = forward[i++] >> 32;
+		} else {
+			pos[k++] = backward[j++] >> 32;
+		}
+	}
+	// the backward set first
+	for (k = 0; k < n_backward + n_forward; k++) {
+		int64_t key = k < n_backward ? backward[k] : forward[k - n_backward];
+		int node = (int)(uint32_t)key;
+		a->ord[node] = pos[k];
+		a->node_at[pos[k]] = node;
+	}
+	return 1;
+}
+
+static void l4d__adj_link(struct l4d_adjacency* a, int* head, struct l4d_arc arc)
+{
+	if (a->n_links == a->links_cap) {
+		a->links_cap = a->links_cap ? a->links_cap * 2 : 64;
+		a->links = realloc(a->links, a->links_cap * sizeof(*a->links));
+		assert(a->links != NULL);
+	}
+	a->links[a->n_links] = (struct l4d_link) { .arc = arc, .next = *head };
+	*head = a->n_links++;
+}
+
+// the arc of edge among the successors (or predecessors) of w
+static struct l4d_arc* l4d__adj_find(struct l4d_adjacency* a, int forward, int w, int edge)
+{
+	for (int j = (forward ? a->out_head : a->in_head)[w]; j >= 0; j = a->links[j].next) {
+		struct l4d_arc* arc = &a->links[j].arc;
+		if (arc->edge == edge && arc->node >= 0) return arc;
+	}
+	if (w < a->row_nodes) {
+		const int* base = forward ? a->out_base : a->in_base;
+		struct l4d_arc* arcs = forward ? a->out_arcs : a->in_arcs;
+		for (int j = base[w]; j < base[w + 1]; j++) {
+			if (arcs[j].edge == edge && arcs[j].node >= 0) return &arcs[j];
+		}
+	}
+	assert(!"edge not found");
+	return NULL;
+}
+
+// whether the chains and removed arcs are enough of the graph to rebuild
+static int l4d__adj_worn(struct l4d_adjacency* a)
+{
+	return (a->n_links + a->n_dead) / 2 > (a->row_nodes + a->row_edges) / 4 + 64;
+}
+
+/*
+handles; see l4d.h. slot_of[i] is the slot of node i. a free slot's node is
+-2 - the next free slot (so -1 ends the list), and its gen is what the next
+handle to it gets
+*/
+struct l4d_slot {
+	int node, gen;
+};
+
+struct l4d_slots {
+	struct l4d_slot* slots;
+	int n_slots, slots_cap;
+	int free;
+	int* slot_of;
+	int nodes_cap;
+};
+
+static void l4d__slots_free(struct l4d_slots* s)
+{
+	if (s == NULL) return;
+	free(s->slots);
+	free(s->slot_of);
+	free(s);
+}
+
+static struct l4d_slots* l4d__slots_copy(const struct l4d_slots* s)
+{
+	if (s == NULL) return NULL;
+	struct l4d_slots* copy = malloc(sizeof(*copy));
+	assert(copy != NULL);
+	*copy = *s;
+	copy->slots = l4d__memdup(s->slots, s->slots_cap * sizeof(*s->slots));
+	copy->slot_of = l4d__memdup(s->slot_of, s->nodes_cap * sizeof(int));
+	return copy;
+}
+
+static void l4d__slots_reserve(struct l4d_slots* s, int n_slots, int n_nodes)
+{
+	if (n_slots > s->slots_cap) {
+		while (s->slots_cap < n_slots) s->slots_cap = s->slots_cap ? s->slots_cap * 2 : 64;
+		s->slots = realloc(s->slots, s->slots_cap * sizeof(*s->slots));
+		assert(s->slots != NULL);
+	}
+	if (n_nodes > s->nodes_cap) {
+		while (s->nodes_cap < n_nodes) s->nodes_cap = s->nodes_cap ? s->nodes_cap * 2 : 64;
+		s->slot_of = realloc(s->slot_of, s->nodes_cap * sizeof(int));
+		assert(s->slot_of != NULL);
+	}
+}
+
+// the slots as they are while none are kept: slot i is node i
+static struct l4d_slots* l4d__slots(struct l4d_container* c)
+{
+	struct l4d_slots* s = c->slots;
+	if (s == NULL) {
+		int n = c->nodes_dy.n;
+		s = c->slots = calloc(1, sizeof(*s));
+		assert(s != NULL);
+		l4d__slots_reserve(s, n, n);
+		for (int i = 0; i < n; i++) {
+			s->slots[i] = (struct l4d_slot) { .node = i, .gen = 1 };
+			s->slot_of[i] = i;
+		}
+		s->n_slots = n;
+		s->free = -1;
+	}
+	return s;
+}
+
+struct l4d_container* l4d_container_new(struct l4d* d)
 {
 	struct l4d_container* c = calloc(1, sizeof(*c));
 	dynary_init(&c->nodes_dy, (void**) &c->nodes, sizeof(*c->nodes));
+	dynary_init(&c->edges_dy, (void**) &c->edges, sizeof(*c->edges));
+
+	c->refcount = 1;
+	if (d != NULL) {
+		c->n_users = 1;
+		c->next = d->containers;
+		d->containers = c;
+	}
+
+	return c;
+}
+
+void l4d_container_retain(struct l4d_container* c)
+{
+	__atomic_add_fetch(&c->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void l4d_code_retain(struct l4d_code* code)
+{
+	__atomic_add_fetch(&code->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void l4d_code_release(struct l4d_code* code)
+{
+	if (__atomic_sub_fetch(&code->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+	if (code->map != NULL) {
+		l4d__map_release(code->map);
+	} else {
+		free(code->code);
+	}
+	free(code);
+}
+
+static void l4d__node_retain(struct l4d_node* n)
+{
+	if (n->type == L4D_NODE_CODE && n->code != NULL) l4d_code_retain(n->code);
+	if (n->type == L4D_NODE_CONTAINER && n->container != NULL) l4d_container_retain(n->container);
+}
+
+static void l4d__node_release(struct l4d_node* n)
+{
+	if (n->type == L4D_NODE_CODE && n->code != NULL) l4d_code_release(n->code);
+	if (n->type == L4D_NODE_CONTAINER && n->container != NULL) l4d_container_release(n->container);
+}
+
+// c is only in older versions now, and so is anything only c uses
+static void l4d__freeze(struct l4d_container* c)
+{
+	if (c->frozen) return;
+	c->frozen = 1;
+	l4d_container_check(c);
+	for (int i = 0; i < c->nodes_dy.n; i++) {
+		struct l4d_node* n = &c->nodes[i];
+		if (n->type != L4D_NODE_CONTAINER || n->container == NULL) continue;
+		if (--n->container->n_users == 0) l4d__freeze(n->container);
+	}
+}
+
+// releases a reference of the current version
+static void l4d__unuse(struct l4d_container* c)
+{
+	if (--c->n_users == 0 && __atomic_load_n(&c->refcount, __ATOMIC_ACQUIRE) > 1) l4d__freeze(c);
+	l4d_container_release(c);
+}
+
+static void l4d__node_use(struct l4d_node* n)
+{
+	if (n->type == L4D_NODE_CONTAINER && n->container != NULL) n->container->n_users++;
+	l4d__node_retain(n);
+}
+
+static void l4d__node_unuse(struct l4d_node* n)
+{
+	if (n->type == L4D_NODE_CONTAINER && n->container != NULL) {
+		l4d__unuse(n->container);
+	} else {
+		l4d__node_release(n);
+	}
+}
+
+void l4d_container_release(struct l4d_container* c)
+{
+	if (__atomic_sub_fetch(&c->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
+	l4d_container_check(c);
+	// only frozen containers are released off the editing thread
+	for (int i = 0; i < c->nodes_dy.n; i++) {
+		if (c->frozen) {
+			l4d__node_release(&c->nodes[i]);
+		} else {
+			l4d__node_unuse(&c->nodes[i]);
+		}
+	}
+	if (c->map != NULL) {
+		l4d__map_release(c->map);
+	} else {
+		free(c->nodes);
+		free(c->edges);
+	}
+	l4d__adj_free(c->adj);
+	l4d__slots_free(c->slots);
+	free(c);
+}
+
+static void* l4d__dup(struct dynary* dy, void* src)
+{
+	if (src == NULL) return NULL;
+	void* dst = malloc(dynary_get_cap(dy));
+	assert(dst != NULL);
+	memcpy(dst, src, dy->n * dy->element_sz);
+	return dst;
+}
+
+// an unshared copy of c, with its own reference to everything c refers to
+static struct l4d_container* l4d__container_copy(struct l4d_container* c)
+{
+	l4d_container_check(c);
+	// field by field; readers may be releasing c (writing its refcount)
+	struct l4d_container* copy = calloc(1, sizeof(*copy));
+	assert(copy != NULL);
+	copy->nodes_dy = c->nodes_dy;
+	copy->edges_dy = c->edges_dy;
+	copy->nodes_dy.ptr = (void**) &copy->nodes;
+	copy->edges_dy.ptr = (void**) &copy->edges;
+	copy->nodes = l4d__dup(&c->nodes_dy, c->nodes);
+	copy->edges = l4d__dup(&c->edges_dy, c->edges);
+	copy->adj = l4d__adj_copy(c->adj);
+	copy->slots = l4d__slots_copy(c->slots);
+	copy->refcount = 1;
+	copy->n_users = 1;
+	for (int i = 0; i < copy->nodes_dy.n; i++) l4d__node_use(&copy->nodes[i]);
+	return copy;
+}
+
+static int l4d__shared(struct l4d_container* c)
+{
+	// a new container's first reference is the caller's, for a node to take
+	int users = c->n_users > 0 ? c->n_users : 1;
+	return c->frozen || __atomic_load_n(&c->refcount, __ATOMIC_ACQUIRE) > users;
+}
+
+struct l4d_container* l4d_snapshot(struct l4d* d)
+{
+	l4d_container_retain(d->root_container);
+	return d->root_container;
+}
+
+// replaces d's reference to c by one to nc
+static void l4d__replace_in_d(struct l4d* d, struct l4d_container* c, struct l4d_container* nc)
+{
+	struct l4d_container** p = &d->containers;
+	while (*p != c) p = &(*p)->next;
+	nc->next = c->next;
+	*p = nc;
+	if (d->root_container == c) d->root_container = nc;
+	l4d__unuse(c);
+}
+
+// c with every remapped container in it replaced by its new version; a
+// snapshot's containers are copied for that, and frozen ones are left as
+// they are, as their references aren't users
+static struct l4d_container* l4d__rewrite(struct dynary* seen_dy, struct l4d_container*** seen, struct l4d_container* c)
+{
+	if (c->remap != NULL) return c->remap;
+	c->remap = c; // a container in itself stays as it is
+	dynary_append(seen_dy);
+	(*seen)[seen_dy->n - 1] = c;
+	if (c->frozen) return c;
+	l4d_container_check(c);
+	struct l4d_container* out = c;
+	for (int i = 0; i < c->nodes_dy.n; i++) {
+		struct l4d_node* n = &c->nodes[i];
+		if (n->type != L4D_NODE_CONTAINER || n->container == NULL) continue;
+		struct l4d_container* child = l4d__rewrite(seen_dy, seen, n->container);
+		if (child == n->container) continue;
+		if (out == c && l4d__shared(c)) out = c->remap = l4d__container_copy(c);
+		struct l4d_node* dst = &out->nodes[i];
+		child->n_users++;
+		l4d_container_retain(child);
+		l4d__unuse(dst->container);
+		dst->container = child;
+	}
+	c->remap = out;
+	return out;
+}
+
+// points every reference of the current version to from at to instead
+static void l4d__redirect(struct l4d* d, struct l4d_container* from, struct l4d_container* to)
+{
+	struct l4d_container** seen;
+	struct dynary seen_dy;
+	dynary_init(&seen_dy, (void**) &seen, sizeof(*seen));
+	from->remap = to;
+	dynary_append(&seen_dy);
+	seen[0] = from;
+	for (struct l4d_container* c = d->containers; c != NULL; ) {
+		struct l4d_container* next = c->next;
+		struct l4d_container* nc = l4d__rewrite(&seen_dy, &seen, c);
+		if (nc != c) {
+			nc->n_users++;
+			l4d_container_retain(nc);
+			l4d__replace_in_d(d, c, nc);
+		}
+		c = next;
+	}
+	// the copies' first references were ours
+	for (int i = 0; i < seen_dy.n; i++) {
+		struct l4d_container* c = seen[i];
+		seen[i] = c->remap != c && c != from ? c->remap : NULL;
+		c->remap = NULL;
+	}
+	for (int i = 0; i < seen_dy.n; i++) if (seen[i] != NULL) l4d__unuse(seen[i]);
+	free(seen);
+}
+
+// a copy of c, which an older version shares, in place of c in the current
+// version; n is the node it is reached by, NULL for the root
+static struct l4d_container* l4d__fork(struct l4d* d, struct l4d_container* c, struct l4d_node* n)
+{
+	struct l4d_container* copy = l4d__container_copy(c);
+	if (c->n_users > 1) {
+		// instanced more than once: every instance sees the edit
+		l4d__redirect(d, c, copy);
+		l4d__unuse(copy);
+	} else if (n != NULL) {
+		n->container = copy;
+		l4d__unuse(c);
+	} else {
+		// the root's reference is the one in d->containers
+		l4d__replace_in_d(d, c, copy);
+	}
+	return copy;
+}
+
+struct l4d_container* l4d_mutable(struct l4d* d, const int* path, int depth)
+{
+	struct l4d_container* c = d->root_container;
+	if (l4d__shared(c)) c = l4d__fork(d, c, NULL);
+	for (int k = 0; k < depth; k++) {
+		l4d_container_check(c);
+		assert(path[k] >= 0 && path[k] < c->nodes_dy.n);
+		struct l4d_node* n = &c->nodes[path[k]];
+		assert(n->type == L4D_NODE_CONTAINER && n->container != NULL);
+		if (l4d__shared(n->container)) l4d__fork(d, n->container, n);
+		c = n->container;
+	}
+	return c;
+}
+
+// moves nodes and edges out of the project file, before they are resized
+static void l4d__own(struct l4d_container* c)
+{
+	if (c->map == NULL) return;
+	l4d_container_check(c); // refs are in the file too
+	c->nodes = l4d__dup(&c->nodes_dy, c->nodes);
+	c->edges = l4d__dup(&c->edges_dy, c->edges);
+	l4d__map_release(c->map);
+	c->map = NULL;
+}
+
+int l4d_node_add(struct l4d_container* c)
+{
+	assert(!l4d__shared(c));
+	l4d__own(c);
+	dynary_append(&c->nodes_dy);
+	int node = c->nodes_dy.n - 1;
+	struct l4d_adjacency* a = c->adj;
+	if (a != NULL) {
+		// last in the order, with no edges
+		l4d__adj_reserve(a, node + 1);
+		l4d__adj_order_reserve(a, a->n_order + 1);
+		a->ord[node] = a->n_order;
+		a->node_at[a->n_order++] = node;
+		a->out_head[node] = a->in_head[node] = -1;
+	}
+	struct l4d_slots* s = c->slots;
+	if (s != NULL) {
+		int slot = s->free;
+		if (slot >= 0) {
+			s->free = -2 - s->slots[slot].node;
+		} else {
+			l4d__slots_reserve(s, s->n_slots + 1, 0);
+			slot = s->n_slots++;
+			s->slots[slot].gen = 1;
+		}
+		l4d__slots_reserve(s, 0, node + 1);
+		s->slots[slot].node = node;
+		s->slot_of[node] = slot;
+	}
+	return node;
+}
+
+int l4d_connect(struct l4d_container* c, int src, int src_port, int dst, int dst_port)
+{
+	assert(!l4d__shared(c));
+	assert(src >= 0 && src < c->nodes_dy.n && dst >= 0 && dst < c->nodes_dy.n);
+	struct l4d_adjacency* a = l4d__adj(c);
+	if (!l4d__adj_acyclic(c, a, src, dst)) return -1;
+	l4d__own(c);
+	int edge = c->edges_dy.n;
+	struct l4d_edge* e = dynary_append(&c->edges_dy);
+	e->src = src;
+	e->src_port = src_port;
+	e->dst = dst;
+	e->dst_port = dst_port;
+	l4d__adj_link(a, &a->out_head[src], (struct l4d_arc) { .node = dst, .edge = edge });
+	l4d__adj_link(a, &a->in_head[dst], (struct l4d_arc) { .node = src, .edge = edge });
+	if (l4d__adj_worn(a)) l4d__adj_rows(c, a);
+	return edge;
+}
+
+// l4d_disconnect(), but leaves the rows to the caller
+static void l4d__disconnect(struct l4d_container* c, struct l4d_adjacency* a, int edge)
+{
+	int last = c->edges_dy.n - 1;
+	struct l4d_edge* e = &c->edges[edge];
+	if (a != NULL && l4d__edge_valid(c, e)) {
+		l4d__adj_find(a, 1, e->src, edge)->node = -1;
+		l4d__adj_find(a, 0, e->dst, edge)->node = -1;
+		a->n_dead += 2;
+	}
+	e = &c->edges[last];
+	if (a != NULL && last != edge && l4d__edge_valid(c, e)) {
+		l4d__adj_find(a, 1, e->src, last)->edge = edge;
+		l4d__adj_find(a, 0, e->dst, last)->edge = edge;
+	}
+	c->edges[edge] = c->edges[last];
+	c->edges_dy.n--;
+}
+
+// after edges or nodes are removed: rows rebuilt if worn, and the order if
+// there was none, as removing may have broken the cycle
+static void l4d__adj_tidy(struct l4d_container* c, struct l4d_adjacency* a)
+{
+	if (a->cyclic) {
+		l4d__adj_rows(c, a);
+		l4d__adj_sort(c, a);
+		return;
+	}
+	if (l4d__adj_worn(a)) l4d__adj_rows(c, a);
+	if (a->n_holes > a->n_order / 4 + 64) l4d__adj_compact(a);
+}
+
+void l4d_disconnect(struct l4d_container* c, int edge)
+{
+	assert(!l4d__shared(c));
+	assert(edge >= 0 && edge < c->edges_dy.n);
+	l4d__own(c);
+	l4d__disconnect(c, c->adj, edge);
+	if (c->adj != NULL) l4d__adj_tidy(c, c->adj);
+}
+
+// a walk over the arcs going out of (or into) a node, chain first
+struct l4d__arcs {
+	int forward;
+	int link;
+	int row, row_end;
+};
+
+static struct l4d__arcs l4d__arcs(struct l4d_adjacency* a, int forward, int w)
+{
+	struct l4d__arcs it = { .forward = forward, .link = (forward ? a->out_head : a->in_head)[w] };
+	if (w < a->row_nodes) {
+		const int* base = forward ? a->out_base : a->in_base;
+		it.row = base[w];
+		it.row_end = base[w + 1];
+	}
+	return it;
+}
+
+// the next arc not removed, or NULL
+static struct l4d_arc* l4d__arcs_next(struct l4d_adjacency* a, struct l4d__arcs* it)
+{
+	while (it->link >= 0) {
+		struct l4d_arc* arc = &a->links[it->link].arc;
+		it->link = a->links[it->link].next;
+		if (arc->node >= 0) return arc;
+	}
+	while (it->row < it->row_end) {
+		struct l4d_arc* arc = &(it->forward ? a->out_arcs : a->in_arcs)[it->row++];
+		if (arc->node >= 0) return arc;
+	}
+	return NULL;
+}
+
+// moves the arcs of node last, which is taking the index of the isolated
+// node, to it: the edges and the arcs at their other ends name node, and the
+// rows of last go into the chains of node
+static void l4d__adj_move(struct l4d_container* c, struct l4d_adjacency* a, int last, int node)
+{
+	for (int forward = 0; forward < 2; forward++) {
+		struct l4d__arcs it = l4d__arcs(a, forward, last);
+		for (struct l4d_arc* arc; (arc = l4d__arcs_next(a, &it)) != NULL; ) {
+			struct l4d_edge* e = &c->edges[arc->edge];
+			if (forward) {
+				e->src = node;
+			} else {
+				e->dst = node;
+			}
+			// a cycle may be through last itself; it is all rebuilt anyway
+			if (!a->cyclic) l4d__adj_find(a, !forward, arc->node, arc->edge)->node = node;
+		}
+	}
+	if (a->cyclic) return;
+	for (int forward = 0; forward < 2; forward++) {
+		// node's chain is all removed arcs by now
+		int* head = forward ? a->out_head : a->in_head;
+		head[node] = head[last];
+		head[last] = -1;
+		if (last >= a->row_nodes) continue;
+		const int* base = forward ? a->out_base : a->in_base;
+		struct l4d_arc* arcs = forward ? a->out_arcs : a->in_arcs;
+		for (int j = base[last]; j < base[last + 1]; j++) {
+			if (arcs[j].node < 0) continue;
+			l4d__adj_link(a, &head[node], arcs[j]);
+			arcs[j].node = -1;
+			a->n_dead++;
+		}
+	}
+	a->ord[node] = a->ord[last];
+	a->node_at[a->ord[node]] = node;
+}
+
+void l4d_node_remove(struct l4d_container* c, int node)
+{
+	assert(!l4d__shared(c));
+	assert(node >= 0 && node < c->nodes_dy.n);
+	l4d__own(c);
+	struct l4d_adjacency* a = l4d__adj(c);
+	for (int forward = 0; forward < 2; forward++) {
+		struct l4d__arcs it = l4d__arcs(a, forward, node);
+		for (struct l4d_arc* arc; (arc = l4d__arcs_next(a, &it)) != NULL; ) l4d__disconnect(c, a, arc->edge);
+	}
+
+	int last = c->nodes_dy.n - 1;
+	a->node_at[a->ord[node]] = -1;
+	a->n_holes++;
+	if (last != node) l4d__adj_move(c, a, last, node);
+
+	struct l4d_slots* s = l4d__slots(c);
+	int slot = s->slot_of[node];
+	if (++s->slots[slot].gen <= 0) s->slots[slot].gen = 1;
+	s->slots[slot].node = -2 - s->free;
+	s->free = slot;
+	if (last != node) {
+		s->slot_of[node] = s->slot_of[last];
+		s->slots[s->slot_of[node]].node = node;
+	}
+
+	l4d__node_unuse(&c->nodes[node]);
+	c->nodes[node] = c->nodes[last];
+	c->nodes_dy.n--;
+	l4d__adj_tidy(c, a);
+}
+
+struct l4d_handle l4d_handle(struct l4d_container* c, int node)
+{
+	assert(node >= 0 && node < c->nodes_dy.n);
+	struct l4d_slots* s = c->slots;
+	if (s == NULL) return (struct l4d_handle) { .slot = node, .gen = 1 };
+	int slot = s->slot_of[node];
+	return (struct l4d_handle) { .slot = slot, .gen = s->slots[slot].gen };
+}
+
+int l4d_node_of(struct l4d_container* c, struct l4d_handle h)
+{
+	struct l4d_slots* s = c->slots;
+	if (s == NULL) return h.gen == 1 && h.slot >= 0 && h.slot < c->nodes_dy.n ? h.slot : -1;
+	if (h.slot < 0 || h.slot >= s->n_slots || s->slots[h.slot].gen != h.gen) return -1;
+	int node = s->slots[h.slot].node;
+	return node >= 0 ? node : -1;
+}
+
+const int* l4d_order(struct l4d_container* c)
+{
+	assert(!l4d__shared(c));
+	struct l4d_adjacency* a = l4d__adj(c);
+	if (a->n_holes > 0) l4d__adj_compact(a);
+	return a->cyclic ? NULL : a->node_at;
+}
+
+void l4d_node_set_code(struct l4d_container* c, int node, struct l4d_code* code)
+{
+	assert(!l4d__shared(c));
+	l4d_container_check(c);
+	struct l4d_node* n = &c->nodes[node];
+	l4d__node_unuse(n);
+	n->type = L4D_NODE_CODE;
+	n->code = code;
+}
+
+void l4d_node_set_container(struct l4d_container* c, int node, struct l4d_container* child)
+{
+	assert(!l4d__shared(c));
+	l4d_container_check(c);
+	struct l4d_node* n = &c->nodes[node];
+	// the caller's reference becomes a use before the old one goes, so child
+	// isn't frozen on the way
+	if (child != NULL) child->n_users++;
+	l4d__node_unuse(n);
+	n->type = L4D_NODE_CONTAINER;
+	n->container = child;
+}
+
+void l4d_init(struct l4d* d)
+{
+	memset(d, 0, sizeof(*d));
+	d->root_container = l4d_container_new(d);
 
 	// XXX test
 	for (int i = 0; i < 20; i++) {
-		struct l4d_node* n = dynary_append(&c->nodes_dy);
+		struct l4d_node* n = &d->root_container->nodes[l4d_node_add(d->root_container)];
 		n->meta.x = i * 50;
 		n->meta.y = i * 25;
 	}
+}
+
+void l4d_free(struct l4d* d)
+{
+	for (struct l4d_container* c = d->containers; c != NULL; ) {
+		struct l4d_container* next = c->next;
+		l4d__unuse(c);
+		c = next;
+	}
+	for (struct l4d_code* c = d->codes; c != NULL; ) {
+		struct l4d_code* next = c->next;
+		l4d_code_release(c);
+		c = next;
+	}
+	memset(d, 0, sizeof(*d));
+}
+
+/*
+project files; see l4d.h. offsets are from the start of the file, and every
+section starts on a L4D_FILE_ALIGN boundary
+*/
+
+#define L4D_FILE_MAGIC "l4dproj\n"
+#define L4D_FILE_VERSION (1)
+#define L4D_FILE_ALIGN (64)
+#define L4D_FILE_NIL (~(uint64_t)0) // a NULL code or container
+
+enum {
+	L4D_SECTION_CONTAINERS = 1,
+	L4D_SECTION_NODES,
+	L4D_SECTION_EDGES,
+	L4D_SECTION_CODES,
+	L4D_SECTION_TEXT,
+	L4D_SECTION_REFS,
+	L4D_N_SECTIONS = L4D_SECTION_REFS,
+};
+
+struct l4d_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_sections;
+	uint64_t directory; // offset of n_sections struct l4d_file_section
+	uint32_t directory_crc;
+	uint32_t _pad;
+};
+
+struct l4d_file_section {
+	uint32_t id;
+	uint32_t count; // elements
+	uint64_t offset, size;
+	uint32_t crc;
+	uint32_t _pad;
+};
+
+struct l4d_file_container {
+	uint32_t node_first, n_nodes;
+	uint32_t edge_first, n_edges;
+};
+
+struct l4d_file_code {
+	uint64_t text; // offset in the text section
+	uint64_t length; // without the NUL
+};
+
+static const size_t l4d__section_element[] = {
+	[L4D_SECTION_CONTAINERS] = sizeof(struct l4d_file_container),
+	[L4D_SECTION_NODES] = sizeof(struct l4d_node),
+	[L4D_SECTION_EDGES] = sizeof(struct l4d_edge),
+	[L4D_SECTION_CODES] = sizeof(struct l4d_file_code),
+	[L4D_SECTION_TEXT] = 1,
+	[L4D_SECTION_REFS] = sizeof(uint32_t),
+};
+
+// nodes and edges are read in place, so their layout is the file's
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "project files are little-endian"
+#endif
+_Static_assert(sizeof(struct l4d_node) == 32 && sizeof(void*) == sizeof(uint64_t), "struct l4d_node is not as in project files");
+_Static_assert(sizeof(struct l4d_edge) == 16, "struct l4d_edge is not as in project files");
+
+static int l4d__is_ref(const struct l4d_node* n)
+{
+	return n->type == L4D_NODE_CODE || n->type == L4D_NODE_CONTAINER;
+}
+
+static void l4d__crc_table(uint32_t* table)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		table[i] = c;
+	}
+}
 
-	c->next = d->containers;
-	d->containers = c;
+// CRC-32 (as zlib's); crc of a then b is l4d__crc(l4d__crc(0, a), b)
+static uint32_t l4d__crc(const uint32_t* table, uint32_t crc, const void* data, size_t n)
+{
+	const uint8_t* p = data;
+	crc = ~crc;
+	for (size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
 
-	return c;
+// pointers to indices, in the order they were first seen
+struct l4d__index {
+	const void** keys;
+	int* values;
+	int cap;
+	const void** items;
+	int n;
+};
+
+static uint64_t l4d__hash(const void* p)
+{
+	uint64_t h = (uintptr_t)p;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
 }
 
-void l4d_init(struct l4d* d)
+static int l4d__index_get(struct l4d__index* ix, const void* key)
+{
+	if (2 * (ix->n + 1) > ix->cap) {
+		free(ix->keys);
+		free(ix->values);
+		ix->cap = ix->cap ? ix->cap * 2 : 64;
+		ix->keys = calloc(ix->cap, sizeof(*ix->keys));
+		ix->values = calloc(ix->cap, sizeof(*ix->values));
+		ix->items = realloc(ix->items, ix->cap / 2 * sizeof(*ix->items));
+		assert(ix->keys != NULL && ix->values != NULL && ix->items != NULL);
+		for (int j = 0; j < ix->n; j++) {
+			uint64_t i = l4d__hash(ix->items[j]) & (ix->cap - 1);
+			while (ix->keys[i] != NULL) i = (i + 1) & (ix->cap - 1);
+			ix->keys[i] = ix->items[j];
+			ix->values[i] = j;
+		}
+	}
+	uint64_t i = l4d__hash(key) & (ix->cap - 1);
+	for (; ix->keys[i] != NULL; i = (i + 1) & (ix->cap - 1)) {
+		if (ix->keys[i] == key) return ix->values[i];
+	}
+	ix->keys[i] = key;
+	ix->values[i] = ix->n;
+	ix->items[ix->n] = key;
+	return ix->n++;
+}
+
+static void l4d__index_free(struct l4d__index* ix)
+{
+	free(ix->keys);
+	free(ix->values);
+	free(ix->items);
+}
+
+struct l4d__writer {
+	FILE* f;
+	uint64_t offset;
+	uint32_t crc; // of the current section
+	uint32_t table[256];
+	int err;
+};
+
+static void l4d__write(struct l4d__writer* w, const void* p, size_t n)
+{
+	if (n == 0) return;
+	if (fwrite(p, 1, n, w->f) != n) w->err = 1;
+	w->crc = l4d__crc(w->table, w->crc, p, n);
+	w->offset += n;
+}
+
+static void l4d__write_align(struct l4d__writer* w)
+{
+	static const char zeros[L4D_FILE_ALIGN];
+	l4d__write(w, zeros, -w->offset & (L4D_FILE_ALIGN - 1));
+}
+
+static void l4d__section_begin(struct l4d__writer* w, struct l4d_file_section* s, int id)
+{
+	l4d__write_align(w);
+	s->id = id;
+	s->offset = w->offset;
+	w->crc = 0;
+}
+
+static void l4d__section_end(struct l4d__writer* w, struct l4d_file_section* s, uint32_t count)
+{
+	s->count = count;
+	s->size = w->offset - s->offset;
+	s->crc = w->crc;
+}
+
+enum l4d_file_status l4d_save(struct l4d_container* root, const char* path)
+{
+	// number every container and code reachable from root
+	struct l4d__index containers = { 0 };
+	struct l4d__index codes = { 0 };
+	l4d__index_get(&containers, root);
+	uint32_t n_nodes = 0;
+	uint32_t n_edges = 0;
+	for (int j = 0; j < containers.n; j++) {
+		struct l4d_container* c = (struct l4d_container*) containers.items[j];
+		l4d_container_check(c);
+		n_nodes += c->nodes_dy.n;
+		n_edges += c->edges_dy.n;
+		for (int i = 0; i < c->nodes_dy.n; i++) {
+			const struct l4d_node* n = &c->nodes[i];
+			if (n->type == L4D_NODE_CONTAINER && n->container != NULL) l4d__index_get(&containers, n->container);
+			if (n->type == L4D_NODE_CODE && n->code != NULL) l4d__index_get(&codes, n->code);
+		}
+	}
+
+	size_t path_len = strlen(path);
+	char* tmp_path = malloc(path_len + 5);
+	assert(tmp_path != NULL);
+	memcpy(tmp_path, path, path_len);
+	memcpy(tmp_path + path_len, ".tmp", 5);
+	struct l4d__writer w = { .f = fopen(tmp_path, "wb") };
+	if (w.f == NULL) {
+		free(tmp_path);
+		l4d__index_free(&containers);
+		l4d__index_free(&codes);
+		return L4D_FILE_IO;
+	}
+	l4d__crc_table(w.table);
+
+	struct l4d_file_header h = { 0 };
+	l4d__write(&w, &h, sizeof(h));
+	struct l4d_file_section sections[L4D_N_SECTIONS];
+	memset(sections, 0, sizeof(sections));
+	struct l4d_file_section* s = sections;
+
+	l4d__section_begin(&w, s, L4D_SECTION_CONTAINERS);
+	struct l4d_file_container fc = { 0 };
+	for (int j = 0; j < containers.n; j++) {
+		const struct l4d_container* c = containers.items[j];
+		fc.n_nodes = c->nodes_dy.n;
+		fc.n_edges = c->edges_dy.n;
+		l4d__write(&w, &fc, sizeof(fc));
+		fc.node_first += fc.n_nodes;
+		fc.edge_first += fc.n_edges;
+	}
+	l4d__section_end(&w, s++, containers.n);
+
+	// nodes go through a small buffer where references become indices
+	l4d__section_begin(&w, s, L4D_SECTION_NODES);
+	uint32_t n_refs = 0;
+	struct l4d_node chunk[256];
+	for (int j = 0; j < containers.n; j++) {
+		const struct l4d_container* c = containers.items[j];
+		for (int i0 = 0; i0 < c->nodes_dy.n; i0 += 256) {
+			int k = c->nodes_dy.n - i0 < 256 ? c->nodes_dy.n - i0 : 256;
+			memcpy(chunk, c->nodes + i0, k * sizeof(*chunk));
+			for (int i = 0; i < k; i++) {
+				struct l4d_node* n = &chunk[i];
+				if (!l4d__is_ref(n)) continue;
+				uint64_t ref = L4D_FILE_NIL;
+				if (n->type == L4D_NODE_CONTAINER && n->container != NULL) ref = l4d__index_get(&containers, n->container);
+				if (n->type == L4D_NODE_CODE && n->code != NULL) ref = l4d__index_get(&codes, n->code);
+				memcpy(&n->container, &ref, sizeof(ref));
+				n_refs++;
+			}
+			l4d__write(&w, chunk, k * sizeof(*chunk));
+		}
+	}
+	l4d__section_end(&w, s++, n_nodes);
+
+	l4d__section_begin(&w, s, L4D_SECTION_EDGES);
+	for (int j = 0; j < containers.n; j++) {
+		const struct l4d_container* c = containers.items[j];
+		l4d__write(&w, c->edges, c->edges_dy.n * sizeof(*c->edges));
+	}
+	l4d__section_end(&w, s++, n_edges);
+
+	l4d__section_begin(&w, s, L4D_SECTION_CODES);
+	struct l4d_file_code fcode = { 0 };
+	for (int j = 0; j < codes.n; j++) {
+		const struct l4d_code* code = codes.items[j];
+		fcode.length = code->code != NULL ? strlen(code->code) : 0;
+		l4d__write(&w, &fcode, sizeof(fcode));
+		fcode.text += fcode.length + 1;
+	}
+	l4d__section_end(&w, s++, codes.n);
+
+	l4d__section_begin(&w, s, L4D_SECTION_TEXT);
+	for (int j = 0; j < codes.n; j++) {
+		const struct l4d_code* code = codes.items[j];
+		if (code->code != NULL) l4d__write(&w, code->code, strlen(code->code));
+		l4d__write(&w, "", 1);
+	}
+	l4d__section_end(&w, s, w.offset - s->offset);
+	s++;
+
+	l4d__section_begin(&w, s, L4D_SECTION_REFS);
+	uint32_t g = 0;
+	for (int j = 0; j < containers.n; j++) {
+		const struct l4d_container* c = containers.items[j];
+		for (int i = 0; i < c->nodes_dy.n; i++, g++) if (l4d__is_ref(&c->nodes[i])) l4d__write(&w, &g, sizeof(g));
+	}
+	l4d__section_end(&w, s++, n_refs);
+
+	l4d__write_align(&w);
+	memcpy(h.magic, L4D_FILE_MAGIC, sizeof(h.magic));
+	h.version = L4D_FILE_VERSION;
+	h.n_sections = L4D_N_SECTIONS;
+	h.directory = w.offset;
+	h.directory_crc = l4d__crc(w.table, 0, sections, sizeof(sections));
+	l4d__write(&w, sections, sizeof(sections));
+	if (fseek(w.f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, w.f) != 1) w.err = 1;
+	if (fclose(w.f) != 0) w.err = 1;
+	if (!w.err && rename(tmp_path, path) != 0) w.err = 1;
+	if (w.err) remove(tmp_path);
+
+	free(tmp_path);
+	l4d__index_free(&containers);
+	l4d__index_free(&codes);
+	return w.err ? L4D_FILE_IO : L4D_FILE_OK;
+}
+
+static void l4d__mapped_array(struct dynary* dy, void** ptr, void* at, uint32_t n)
+{
+	dy->n = n;
+	while (dynary_get_cap(dy) < n * dy->element_sz) dy->caplog++;
+	*ptr = n > 0 ? at : NULL;
+}
+
+// checks everything l4d_open() is going to follow before anything is built
+static enum l4d_file_status l4d__check(struct l4d_map* map, const struct l4d_file_section** sec, int flags)
+{
+	char* base = map->base;
+	uint32_t table[256];
+	l4d__crc_table(table);
+	const struct l4d_file_header* h = (void*)base;
+	if (map->size < sizeof(*h) || memcmp(h->magic, L4D_FILE_MAGIC, sizeof(h->magic)) != 0) return L4D_FILE_FORMAT;
+	if (h->version != L4D_FILE_VERSION) return L4D_FILE_FORMAT;
+	if (h->directory % L4D_FILE_ALIGN != 0 || h->directory > map->size) return L4D_FILE_FORMAT;
+	if ((map->size - h->directory) / sizeof(struct l4d_file_section) < h->n_sections) return L4D_FILE_FORMAT;
+	const struct l4d_file_section* dir = (void*)(base + h->directory);
+	if (l4d__crc(table, 0, dir, h->n_sections * sizeof(*dir)) != h->directory_crc) return L4D_FILE_CHECKSUM;
+
+	for (int i = 0; i < h->n_sections; i++) {
+		const struct l4d_file_section* s = &dir[i];
+		if (s->id < 1 || s->id > L4D_N_SECTIONS) continue;
+		if (s->offset % L4D_FILE_ALIGN != 0 || s->offset > map->size || map->size - s->offset < s->size) return L4D_FILE_FORMAT;
+		if ((uint64_t)s->count * l4d__section_element[s->id] != s->size) return L4D_FILE_FORMAT;
+		if ((flags & L4D_OPEN_VERIFY) && l4d__crc(table, 0, base + s->offset, s->size) != s->crc) return L4D_FILE_CHECKSUM;
+		sec[s->id] = s;
+	}
+	for (int id = 1; id <= L4D_N_SECTIONS; id++) if (sec[id] == NULL) return L4D_FILE_FORMAT;
+	if (sec[L4D_SECTION_CONTAINERS]->count == 0) return L4D_FILE_FORMAT;
+
+	const struct l4d_file_container* fcs = (void*)(base + sec[L4D_SECTION_CONTAINERS]->offset);
+	// in order and apart: containers write their nodes and edges in place
+	uint64_t nodes_end = 0, edges_end = 0;
+	for (uint32_t j = 0; j < sec[L4D_SECTION_CONTAINERS]->count; j++) {
+		if (fcs[j].node_first < nodes_end || fcs[j].edge_first < edges_end) return L4D_FILE_FORMAT;
+		nodes_end = (uint64_t)fcs[j].node_first + fcs[j].n_nodes;
+		edges_end = (uint64_t)fcs[j].edge_first + fcs[j].n_edges;
+		if (nodes_end > sec[L4D_SECTION_NODES]->count || edges_end > sec[L4D_SECTION_EDGES]->count) return L4D_FILE_FORMAT;
+	}
+	const char* text = base + sec[L4D_SECTION_TEXT]->offset;
+	uint64_t text_size = sec[L4D_SECTION_TEXT]->size;
+	const struct l4d_file_code* fcodes = (void*)(base + sec[L4D_SECTION_CODES]->offset);
+	for (uint32_t j = 0; j < sec[L4D_SECTION_CODES]->count; j++) {
+		if (fcodes[j].text >= text_size || text_size - fcodes[j].text <= fcodes[j].length) return L4D_FILE_FORMAT;
+		if (text[fcodes[j].text + fcodes[j].length] != 0) return L4D_FILE_FORMAT;
+	}
+	const struct l4d_node* nodes = (void*)(base + sec[L4D_SECTION_NODES]->offset);
+	const uint32_t* refs = (void*)(base + sec[L4D_SECTION_REFS]->offset);
+	for (uint32_t j = 0; j < sec[L4D_SECTION_REFS]->count; j++) {
+		if (refs[j] >= sec[L4D_SECTION_NODES]->count) return L4D_FILE_FORMAT;
+		const struct l4d_node* n = &nodes[refs[j]];
+		uint64_t ref;
+		memcpy(&ref, &n->container, sizeof(ref));
+		if (n->type == L4D_NODE_CONTAINER) {
+			if (ref != L4D_FILE_NIL && ref >= sec[L4D_SECTION_CONTAINERS]->count) return L4D_FILE_FORMAT;
+		} else if (n->type == L4D_NODE_CODE) {
+			if (ref != L4D_FILE_NIL && ref >= sec[L4D_SECTION_CODES]->count) return L4D_FILE_FORMAT;
+		} else {
+			return L4D_FILE_FORMAT;
+		}
+		// the same node twice would be patched twice
+		if (j > 0 && refs[j] <= refs[j-1]) return L4D_FILE_FORMAT;
+	}
+	if (!(flags & L4D_OPEN_VERIFY)) return L4D_FILE_OK;
+	// a node refs misses would keep an index for a pointer; without
+	// L4D_OPEN_VERIFY, l4d_container_check() clears it instead
+	uint32_t n_refs = 0;
+	for (uint32_t i = 0; i < sec[L4D_SECTION_NODES]->count; i++) n_refs += l4d__is_ref(&nodes[i]);
+	if (n_refs != sec[L4D_SECTION_REFS]->count) return L4D_FILE_FORMAT;
+	return L4D_FILE_OK;
+}
+
+void l4d_container_check(struct l4d_container* c)
+{
+	if (__atomic_load_n(&c->refs, __ATOMIC_ACQUIRE) == NULL) return;
+	if (__atomic_exchange_n(&c->checking, 1, __ATOMIC_ACQUIRE)) {
+		// another thread is at it
+		while (__atomic_load_n(&c->refs, __ATOMIC_ACQUIRE) != NULL) sched_yield();
+		return;
+	}
+	// both lists are in node order
+	uint32_t k = 0;
+	for (int i = 0; i < c->nodes_dy.n; i++) {
+		if (k < c->n_refs && c->refs[k] - c->node_first == (uint32_t)i) {
+			k++;
+		} else if (l4d__is_ref(&c->nodes[i])) {
+			c->nodes[i].container = NULL;
+		}
+	}
+	__atomic_store_n(&c->refs, NULL, __ATOMIC_RELEASE);
+}
+
+enum l4d_file_status l4d_open(struct l4d* d, const char* path, int flags)
 {
 	memset(d, 0, sizeof(*d));
-	d->root_container = new_container(d);
-	d->root_container->refcount++;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return L4D_FILE_IO;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return L4D_FILE_IO;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return L4D_FILE_FORMAT;
+	}
+	// private and writable: pages are copied when nodes are first written
+	void* base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return L4D_FILE_IO;
+	struct l4d_map* map = calloc(1, sizeof(*map));
+	assert(map != NULL);
+	map->base = base;
+	map->size = st.st_size;
+	map->refcount = 1;
+
+	const struct l4d_file_section* sec[L4D_N_SECTIONS + 1] = { 0 };
+	enum l4d_file_status status = l4d__check(map, sec, flags);
+	if (status != L4D_FILE_OK) {
+		l4d__map_release(map);
+		return status;
+	}
+
+	char* b = base;
+	uint32_t n_containers = sec[L4D_SECTION_CONTAINERS]->count;
+	uint32_t n_codes = sec[L4D_SECTION_CODES]->count;
+	const struct l4d_file_container* fcs = (void*)(b + sec[L4D_SECTION_CONTAINERS]->offset);
+	const struct l4d_file_code* fcodes = (void*)(b + sec[L4D_SECTION_CODES]->offset);
+	struct l4d_node* nodes = (void*)(b + sec[L4D_SECTION_NODES]->offset);
+	struct l4d_edge* edges = (void*)(b + sec[L4D_SECTION_EDGES]->offset);
+	char* text = b + sec[L4D_SECTION_TEXT]->offset;
+	const uint32_t* refs = (void*)(b + sec[L4D_SECTION_REFS]->offset);
+
+	struct l4d_container** containers = calloc(n_containers, sizeof(*containers));
+	struct l4d_code** codes = calloc(n_codes + 1, sizeof(*codes));
+	assert(containers != NULL && codes != NULL);
+	uint32_t n_refs = sec[L4D_SECTION_REFS]->count;
+	uint32_t k = 0;
+	for (uint32_t j = 0; j < n_containers; j++) {
+		struct l4d_container* c = l4d_container_new(NULL);
+		c->refcount = 0;
+		l4d__mapped_array(&c->nodes_dy, (void**) &c->nodes, nodes + fcs[j].node_first, fcs[j].n_nodes);
+		l4d__mapped_array(&c->edges_dy, (void**) &c->edges, edges + fcs[j].edge_first, fcs[j].n_edges);
+		if (!(flags & L4D_OPEN_VERIFY)) {
+			// its nodes are checked when first walked, against its share of refs
+			while (k < n_refs && refs[k] < fcs[j].node_first) k++;
+			c->refs = refs + k;
+			c->node_first = fcs[j].node_first;
+			while (k < n_refs && refs[k] - fcs[j].node_first < fcs[j].n_nodes) k++;
+			c->n_refs = refs + k - c->refs;
+		}
+		c->map = map;
+		__atomic_add_fetch(&map->refcount, 1, __ATOMIC_RELAXED);
+		containers[j] = c;
+	}
+	for (uint32_t j = 0; j < n_codes; j++) {
+		struct l4d_code* code = calloc(1, sizeof(*code));
+		assert(code != NULL);
+		dynary_init(&code->code_dy, (void**) &code->code, sizeof(*code->code));
+		code->code_dy.n = fcodes[j].length;
+		code->code = text + fcodes[j].text;
+		code->map = map;
+		__atomic_add_fetch(&map->refcount, 1, __ATOMIC_RELAXED);
+		codes[j] = code;
+	}
+	for (uint32_t j = 0; j < n_refs; j++) {
+		struct l4d_node* n = &nodes[refs[j]];
+		uint64_t ref;
+		memcpy(&ref, &n->container, sizeof(ref));
+		if (n->type == L4D_NODE_CONTAINER) {
+			n->container = ref == L4D_FILE_NIL ? NULL : containers[ref];
+		} else {
+			n->code = ref == L4D_FILE_NIL ? NULL : codes[ref];
+		}
+		l4d__node_use(n);
+	}
+
+	// d holds the root, and anything no node refers to
+	for (uint32_t j = n_containers; j-- > 0; ) {
+		struct l4d_container* c = containers[j];
+		if (j > 0 && c->refcount > 0) continue;
+		c->refcount++;
+		c->n_users++;
+		c->next = d->containers;
+		d->containers = c;
+	}
+	d->root_container = containers[0];
+	for (uint32_t j = 0; j < n_codes; j++) {
+		if (codes[j]->refcount > 0) continue;
+		codes[j]->refcount = 1;
+		codes[j]->next = d->codes;
+		d->codes = codes[j];
+	}
+
+	free(containers);
+	free(codes);
+	l4d__map_release(map);
+	return L4D_FILE_OK;
+}
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define OK "\e[32m\e[1mOK\e[0m "
+#define FAIL "\e[41m\e[33m\e[1m!!\e[0m "
+
+static int n_failed;
+
+// host node types, which l4d only carries
+enum {
+	TD_A = 1,
+	TD_B,
+	TD_C,
+};
+
+static int td_add_node(struct l4d_container* c, int type)
+{
+	int i = l4d_node_add(c);
+	c->nodes[i].type = type;
+	return i;
+}
+
+// whether dst is reachable from src, by search of every edge
+static int td_reaches(struct l4d_container* c, int src, int dst, char* seen, int* stack)
+{
+	int n = c->nodes_dy.n;
+	memset(seen, 0, n);
+	int n_stack = 0;
+	stack[n_stack++] = src;
+	seen[src] = 1;
+	while (n_stack > 0) {
+		int w = stack[--n_stack];
+		if (w == dst) return 1;
+		for (int i = 0; i < c->edges_dy.n; i++) {
+			int v = c->edges[i].dst;
+			if (c->edges[i].src == w && !seen[v]) {
+				seen[v] = 1;
+				stack[n_stack++] = v;
+			}
+		}
+	}
+	return 0;
+}
+
+// whether every edge goes forward in l4d_order()
+static int td_order_ok(struct l4d_container* c, int* pos)
+{
+	const int* order = l4d_order(c);
+	if (order == NULL) return 0;
+	int n = c->nodes_dy.n;
+	memset(pos, -1, n * sizeof(*pos));
+	for (int k = 0; k < n; k++) {
+		if (order[k] < 0 || order[k] >= n || pos[order[k]] >= 0) return 0;
+		pos[order[k]] = k;
+	}
+	for (int i = 0; i < c->edges_dy.n; i++) {
+		if (pos[c->edges[i].src] >= pos[c->edges[i].dst]) return 0;
+	}
+	return 1;
+}
+
+// random connects (refused exactly when they close a cycle), disconnects and
+// added nodes, across a copy on write, keep a valid order
+static void test_order()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	d.root_container = l4d_container_new(&d);
+	struct l4d_container* c = d.root_container;
+	srand(5);
+	const int n = 300;
+	const int n_ops = 4000;
+	for (int i = 0; i < n / 2; i++) l4d_node_add(c);
+	char* seen = malloc(2 * n);
+	int* stack = malloc(2 * n * sizeof(*stack));
+	assert(seen != NULL && stack != NULL);
+	int n_bad = 0;
+	int n_refused = 0;
+	struct l4d_container* snapshot = NULL;
+	int snapshot_edges = 0;
+	for (int op = 0; op < n_ops; op++) {
+		int n_nodes = c->nodes_dy.n;
+		if (op % 20 == 0 && n_nodes < n) {
+			l4d_node_add(c);
+		} else if (op % 7 == 0 && c->edges_dy.n > 0) {
+			l4d_disconnect(c, rand() % c->edges_dy.n);
+		} else {
+			int src = rand() % n_nodes;
+			int dst = rand() % n_nodes;
+			int cycle = td_reaches(c, dst, src, seen, stack);
+			int n_edges = c->edges_dy.n;
+			int edge = l4d_connect(c, src, 0, dst, 0);
+			if (cycle) n_refused++;
+			if (cycle != (edge == -1)) n_bad++;
+			if (edge == -1 && c->edges_dy.n != n_edges) n_bad++;
+		}
+		if (op == n_ops / 2) {
+			snapshot = l4d_snapshot(&d);
+			snapshot_edges = c->edges_dy.n;
+			c = l4d_mutable(&d, NULL, 0);
+		}
+		if (op % 50 == 0 && !td_order_ok(c, stack)) n_bad++;
+	}
+	if (!td_order_ok(c, stack)) n_bad++;
+	if (snapshot == c || snapshot->edges_dy.n != snapshot_edges) n_bad++;
+	l4d_container_release(snapshot);
+
+	// a cycle from a project file leaves no order, until it is broken
+	struct l4d_container* f = l4d_container_new(&d);
+	for (int i = 0; i < 3; i++) l4d_node_add(f);
+	*(struct l4d_edge*)dynary_append(&f->edges_dy) = (struct l4d_edge) { .src = 0, .dst = 1 };
+	*(struct l4d_edge*)dynary_append(&f->edges_dy) = (struct l4d_edge) { .src = 1, .dst = 0 };
+	if (l4d_order(f) != NULL) n_bad++;
+	if (l4d_connect(f, 1, 0, 2, 0) < 0 || l4d_connect(f, 2, 0, 0, 0) != -1) n_bad++;
+	l4d_disconnect(f, 1);
+	if (!td_order_ok(f, stack) || l4d_connect(f, 2, 0, 0, 0) != -1) n_bad++;
+
+	if (n_bad == 0) {
+		printf(OK "order: %d edits, %d edges, %d cycles refused\n", n_ops, c->edges_dy.n, n_refused);
+	} else {
+		printf(FAIL "order: %d of %d checks failed\n", n_bad, n_ops);
+		n_failed++;
+	}
+	free(stack);
+	free(seen);
+	l4d_free(&d);
+}
+
+static int td_cmp_edge(const void* a, const void* b)
+{
+	const int* x = a;
+	const int* y = b;
+	return x[0] != y[0] ? x[0] - y[0] : x[1] - y[1];
+}
+
+// drops the id pairs naming id; returns how many are left
+static int td_drop_id(int* pairs, int n, int id)
+{
+	int k = 0;
+	for (int j = 0; j < n; j++) {
+		if (pairs[2 * j] == id || pairs[2 * j + 1] == id) continue;
+		pairs[2 * k] = pairs[2 * j];
+		pairs[2 * k + 1] = pairs[2 * j + 1];
+		k++;
+	}
+	return k;
+}
+
+// removes, adds, connects and disconnects at random, every node tagged (in
+// iusr0) with an id: handles find the node with their id until it is
+// removed, edges keep the ids they were connected with, and the order stays
+// valid
+static void test_remove()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	d.root_container = l4d_container_new(&d);
+	struct l4d_container* c = d.root_container;
+	srand(11);
+	const int n_ops = 6000;
+	const int max_ids = n_ops;
+	struct l4d_handle* handles = calloc(max_ids, sizeof(*handles));
+	char* alive = calloc(max_ids, 1);
+	int* ids = malloc(2 * max_ids * sizeof(*ids)); // edges as id pairs
+	int* expected = malloc(2 * max_ids * sizeof(*expected));
+	char* seen = malloc(max_ids);
+	int* stack = malloc(max_ids * sizeof(*stack));
+	assert(handles != NULL && alive != NULL && ids != NULL && expected != NULL && seen != NULL && stack != NULL);
+	int n_ids = 0;
+	int n_expected = 0;
+	int n_bad = 0;
+	int n_removed = 0;
+	struct l4d_container* snapshot = NULL;
+	struct l4d_handle snapshot_handle = { 0, 0 };
+	int snapshot_id = -1;
+	for (int op = 0; op < n_ops; op++) {
+		int n_nodes = c->nodes_dy.n;
+		int r = rand() % 8;
+		if (n_nodes < 2 || r == 0 || r == 3) {
+			int node = l4d_node_add(c);
+			c->nodes[node].meta.iusr0 = n_ids;
+			handles[n_ids] = l4d_handle(c, node);
+			alive[n_ids++] = 1;
+		} else if (r == 1) {
+			int node = rand() % n_nodes;
+			int id = c->nodes[node].meta.iusr0;
+			l4d_node_remove(c, node);
+			alive[id] = 0;
+			n_removed++;
+			n_expected = td_drop_id(expected, n_expected, id);
+		} else if (r == 2 && c->edges_dy.n > 0) {
+			int edge = rand() % c->edges_dy.n;
+			int src = c->nodes[c->edges[edge].src].meta.iusr0;
+			int dst = c->nodes[c->edges[edge].dst].meta.iusr0;
+			l4d_disconnect(c, edge);
+			for (int j = 0; j < n_expected; j++) {
+				if (expected[2 * j] != src || expected[2 * j + 1] != dst) continue;
+				expected[2 * j] = expected[2 * (n_expected - 1)];
+				expected[2 * j + 1] = expected[2 * (n_expected - 1) + 1];
+				n_expected--;
+				break;
+			}
+		} else {
+			int src = rand() % n_nodes;
+			int dst = rand() % n_nodes;
+			int cycle = td_reaches(c, dst, src, seen, stack);
+			if ((l4d_connect(c, src, 0, dst, 0) == -1) != cycle) n_bad++;
+			if (!cycle) {
+				expected[2 * n_expected] = c->nodes[src].meta.iusr0;
+				expected[2 * n_expected + 1] = c->nodes[dst].meta.iusr0;
+				n_expected++;
+			}
+		}
+		if (op == n_ops / 2) {
+			// the snapshot keeps its nodes where they were
+			snapshot = l4d_snapshot(&d);
+			snapshot_handle = l4d_handle(snapshot, 0);
+			snapshot_id = snapshot->nodes[0].meta.iusr0;
+			c = l4d_mutable(&d, NULL, 0);
+			l4d_node_remove(c, l4d_node_of(c, snapshot_handle));
+			alive[snapshot_id] = 0;
+			n_expected = td_drop_id(expected, n_expected, snapshot_id);
+		}
+		if (op % 50 == 0 || op == n_ops - 1) {
+			if (!td_order_ok(c, stack)) n_bad++;
+			for (int id = 0; id < n_ids; id++) {
+				int node = l4d_node_of(c, handles[id]);
+				if (alive[id] ? node < 0 || c->nodes[node].meta.iusr0 != id : node != -1) n_bad++;
+			}
+			if (c->edges_dy.n != n_expected) {
+				n_bad++;
+				continue;
+			}
+			for (int j = 0; j < c->edges_dy.n; j++) {
+				ids[2 * j] = c->nodes[c->edges[j].src].meta.iusr0;
+				ids[2 * j + 1] = c->nodes[c->edges[j].dst].meta.iusr0;
+			}
+			qsort(ids, n_expected, 2 * sizeof(*ids), td_cmp_edge);
+			qsort(expected, n_expected, 2 * sizeof(*expected), td_cmp_edge);
+			if (memcmp(ids, expected, 2 * n_expected * sizeof(*ids)) != 0) n_bad++;
+		}
+	}
+	int node = l4d_node_of(snapshot, snapshot_handle);
+	if (node != 0 || snapshot->nodes[node].meta.iusr0 != snapshot_id || l4d_node_of(c, snapshot_handle) != -1) n_bad++;
+	l4d_container_release(snapshot);
+	// the zeroed handle names nothing
+	if (l4d_node_of(c, (struct l4d_handle) { 0, 0 }) != -1) n_bad++;
+
+	// cycles from a project file, through the node removed, and through the
+	// last node (3, on itself), which takes its place
+	struct l4d_container* f = l4d_container_new(&d);
+	for (int i = 0; i < 4; i++) l4d_node_add(f);
+	struct l4d_edge raw[] = { { 0, 0, 1, 0 }, { 1, 0, 0, 0 }, { 1, 0, 2, 0 }, { 3, 0, 3, 0 } };
+	for (int i = 0; i < 4; i++) *(struct l4d_edge*)dynary_append(&f->edges_dy) = raw[i];
+	if (l4d_order(f) != NULL) n_bad++;
+	l4d_node_remove(f, 0);
+	if (f->edges_dy.n != 2 || l4d_order(f) != NULL) n_bad++;
+	for (int i = 0; i < f->edges_dy.n; i++) {
+		struct l4d_edge* e = &f->edges[i];
+		if (!(e->src == 1 && e->dst == 2) && !(e->src == 0 && e->dst == 0)) n_bad++;
+	}
+	l4d_node_remove(f, 0);
+	if (f->edges_dy.n != 1 || !td_order_ok(f, stack)) n_bad++;
+
+	if (n_bad == 0) {
+		printf(OK "remove: %d removed, %d handles, %d nodes and %d edges left\n", n_removed, n_ids, c->nodes_dy.n, c->edges_dy.n);
+	} else {
+		printf(FAIL "remove: %d checks failed\n", n_bad);
+		n_failed++;
+	}
+	free(handles);
+	free(alive);
+	free(ids);
+	free(expected);
+	free(seen);
+	free(stack);
+	l4d_free(&d);
+}
+
+static int td_count_nodes(struct l4d_container* c)
+{
+	int n = c->nodes_dy.n;
+	for (int i = 0; i < c->nodes_dy.n; i++) {
+		if (c->nodes[i].type == L4D_NODE_CONTAINER) n += td_count_nodes(c->nodes[i].container);
+	}
+	return n;
+}
+
+// root: [container a, container b, A]; a: [A, B]
+static void test_snapshot()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* root = l4d_container_new(&d);
+	d.root_container = root;
+	for (int i = 0; i < 2; i++) l4d_node_set_container(root, l4d_node_add(root), l4d_container_new(NULL));
+	td_add_node(root, TD_A);
+	int path[] = { 0 };
+	struct l4d_container* a = l4d_mutable(&d, path, 1);
+	int src = td_add_node(a, TD_A);
+	l4d_connect(a, src, 0, td_add_node(a, TD_B), 0);
+	struct l4d_container* b = root->nodes[1].container;
+
+	// unshared: edits happen in place
+	int ok = l4d_mutable(&d, path, 1) == a && d.root_container == root;
+
+	struct l4d_container* snap = l4d_snapshot(&d);
+	struct l4d_container* a2 = l4d_mutable(&d, path, 1);
+	l4d_connect(a2, src, 0, td_add_node(a2, TD_C), 0);
+	a2->nodes[src].meta.x = 10;
+	// the path is copied, b is still shared, and the snapshot is as it was
+	ok &= a2 != a && d.root_container != root && snap == root;
+	ok &= d.root_container->nodes[1].container == b && b->refcount == 2;
+	ok &= td_count_nodes(snap) == 5 && td_count_nodes(d.root_container) == 6;
+	ok &= a->edges_dy.n == 1 && a->nodes[src].meta.x == 0 && a2->edges_dy.n == 2;
+	ok &= l4d_mutable(&d, path, 1) == a2;
+
+	l4d_container_release(snap);
+	ok &= b->refcount == 1;
+	if (ok) {
+		printf(OK "snapshot: path copied, rest shared\n");
+	} else {
+		printf(FAIL "snapshot\n");
+		n_failed++;
+	}
+	l4d_free(&d);
+}
+
+// root: [x, x, y]; y: [x]; x: [A]. x is instanced three times, and an
+// edit through any instance is seen by all of them
+static void test_instances()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* root = l4d_container_new(&d);
+	d.root_container = root;
+	struct l4d_container* x = l4d_container_new(NULL);
+	td_add_node(x, TD_A);
+	struct l4d_container* y = l4d_container_new(NULL);
+	l4d_node_set_container(root, l4d_node_add(root), x);
+	for (int i = 0; i < 2; i++) l4d_container_retain(x);
+	l4d_node_set_container(root, l4d_node_add(root), x);
+	l4d_node_set_container(y, l4d_node_add(y), x);
+	l4d_node_set_container(root, l4d_node_add(root), y);
+
+	// unshared: no copies, though x has three references
+	int path[] = { 1 };
+	int ok = l4d_mutable(&d, path, 1) == x && d.root_container == root && x->n_users == 3;
+	td_add_node(x, TD_C);
+
+	struct l4d_container* snap = l4d_snapshot(&d);
+	struct l4d_container* x2 = l4d_mutable(&d, path, 1);
+	td_add_node(x2, TD_B);
+	root = d.root_container;
+	struct l4d_container* y2 = root->nodes[2].container;
+	// one copy, for every instance; y is copied to point at it
+	ok &= x2 != x && root != snap && y2 != y && x2->n_users == 3;
+	ok &= root->nodes[0].container == x2 && root->nodes[1].container == x2 && y2->nodes[0].container == x2;
+	ok &= snap->nodes[0].container == x && snap->nodes[1].container == x && y->nodes[0].container == x;
+	ok &= x->frozen && y->frozen && x->nodes_dy.n == 2 && x2->nodes_dy.n == 3;
+	ok &= l4d_mutable(&d, path, 1) == x2;
+
+	l4d_container_release(snap);
+	ok &= x2->refcount == 3;
+	if (ok) {
+		printf(OK "instances: edited in place, copied once for a snapshot\n");
+	} else {
+		printf(FAIL "instances\n");
+		n_failed++;
+	}
+	l4d_free(&d);
+}
+
+// the UI edits (every node's meta.x is the node count) and publishes
+// snapshots that a reader checks and releases
+struct td_snapshot_thread {
+	struct l4d_container* slot;
+	int done;
+	int n_read, n_torn;
+};
+
+static void* td_snapshot_reader(void* usr)
+{
+	struct td_snapshot_thread* t = usr;
+	for (;;) {
+		int done = __atomic_load_n(&t->done, __ATOMIC_ACQUIRE);
+		struct l4d_container* c = __atomic_exchange_n(&t->slot, NULL, __ATOMIC_ACQ_REL);
+		if (c != NULL) {
+			struct l4d_container* a = c->nodes[0].container;
+			for (int i = 0; i < a->nodes_dy.n; i++) if (a->nodes[i].meta.x != a->nodes_dy.n) t->n_torn++;
+			t->n_read++;
+			l4d_container_release(c);
+		} else if (done) {
+			break;
+		} else {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static void test_snapshot_threads()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	d.root_container = l4d_container_new(&d);
+	l4d_node_set_container(d.root_container, l4d_node_add(d.root_container), l4d_container_new(NULL));
+	struct td_snapshot_thread t = { 0 };
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, td_snapshot_reader, &t);
+	assert(err == 0);
+
+	const int n = 2000;
+	int path[] = { 0 };
+	for (int i = 0; i < n; i++) {
+		struct l4d_container* a = l4d_mutable(&d, path, 1);
+		l4d_node_add(a);
+		for (int j = 0; j < a->nodes_dy.n; j++) a->nodes[j].meta.x = a->nodes_dy.n;
+		if (i % 3 == 0) {
+			struct l4d_container* old = __atomic_exchange_n(&t.slot, l4d_snapshot(&d), __ATOMIC_ACQ_REL);
+			if (old != NULL) l4d_container_release(old);
+		}
+	}
+	__atomic_store_n(&t.done, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+
+	if (t.n_read > 0 && t.n_torn == 0) {
+		printf(OK "snapshot thread: %d edits, %d snapshots read\n", n, t.n_read);
+	} else {
+		printf(FAIL "snapshot thread: %d snapshots read, %d torn nodes\n", t.n_read, t.n_torn);
+		n_failed++;
+	}
+	l4d_free(&d);
+}
+
+static void td_write_file(const char* path, const char* data, size_t size)
+{
+	FILE* f = fopen(path, "wb");
+	assert(f != NULL);
+	fwrite(data, 1, size, f);
+	fclose(f);
+}
+
+// recomputes the checksums of the file in data, so that damage gets past them
+static void td_reseal(char* data)
+{
+	uint32_t table[256];
+	l4d__crc_table(table);
+	struct l4d_file_header* h = (void*)data;
+	struct l4d_file_section* dir = (void*)(data + h->directory);
+	for (uint32_t i = 0; i < h->n_sections; i++) dir[i].crc = l4d__crc(table, 0, data + dir[i].offset, dir[i].size);
+	h->directory_crc = l4d__crc(table, 0, dir, h->n_sections * sizeof(*dir));
+}
+
+static char* td_read_file(const char* path, size_t* size)
+{
+	FILE* f = fopen(path, "rb");
+	assert(f != NULL);
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* data = malloc(*size + 1);
+	assert(data != NULL);
+	size_t n = fread(data, 1, *size, f);
+	assert(n == *size);
+	data[*size] = 0;
+	fclose(f);
+	return data;
 }
+
+// root: [a, a, code, A]; a: [A, B]
+static void test_file()
+{
+	char path[64], path2[64];
+	snprintf(path, sizeof(path), "/tmp/l4d-test-project-%d", (int)getpid());
+	snprintf(path2, sizeof(path2), "/tmp/l4d-test-project-%d-2", (int)getpid());
+	const char* text = "out = in * 2";
+
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* root = l4d_container_new(&d);
+	d.root_container = root;
+	struct l4d_container* a = l4d_container_new(NULL);
+	int src = td_add_node(a, TD_A);
+	l4d_connect(a, src, 0, td_add_node(a, TD_B), 0);
+	l4d_node_set_container(root, l4d_node_add(root), a);
+	l4d_container_retain(a);
+	l4d_node_set_container(root, l4d_node_add(root), a);
+	struct l4d_code* code = calloc(1, sizeof(*code));
+	code->code = strdup(text);
+	code->refcount = 1;
+	l4d_node_set_code(root, l4d_node_add(root), code);
+	root->nodes[td_add_node(root, TD_A)].meta.x = 7;
+	int ok = l4d_save(root, path) == L4D_FILE_OK;
+	l4d_free(&d);
+
+	struct l4d d2;
+	ok &= l4d_open(&d2, path, L4D_OPEN_VERIFY) == L4D_FILE_OK;
+	root = d2.root_container;
+	a = root->nodes[0].container;
+	ok &= root->map != NULL && root->nodes_dy.n == 4 && root->nodes[1].container == a && a->refcount == 2;
+	ok &= a->nodes_dy.n == 2 && a->edges_dy.n == 1 && a->edges[0].dst == 1;
+	ok &= root->nodes[2].type == L4D_NODE_CODE && strcmp(root->nodes[2].code->code, text) == 0;
+	ok &= root->nodes[3].meta.x == 7;
+
+	// the mapping is private, and arrays move out when they grow
+	root->nodes[3].meta.x = 8;
+	ok &= root->map != NULL;
+	struct l4d_container* snap = l4d_snapshot(&d2);
+	int path_a[] = { 0 };
+	struct l4d_container* a2 = l4d_mutable(&d2, path_a, 1);
+	td_add_node(a2, TD_C);
+	ok &= a2->map == NULL && a->map != NULL && snap->nodes[0].container->nodes_dy.n == 2;
+	l4d_container_release(snap);
+	root = d2.root_container;
+	td_add_node(root, TD_A);
+	// both instances of a moved to the copy
+	ok &= root->map == NULL && root->nodes[3].meta.x == 8 && root->nodes[1].container == a2;
+
+	// saving what was opened gives the same bytes back
+	ok &= l4d_save(d2.root_container, path) == L4D_FILE_OK;
+	struct l4d d3;
+	ok &= l4d_open(&d3, path, 0) == L4D_FILE_OK;
+	ok &= l4d_save(d3.root_container, path2) == L4D_FILE_OK;
+	l4d_free(&d3);
+	l4d_free(&d2);
+	size_t size, size2;
+	char* data = td_read_file(path, &size);
+	char* data2 = td_read_file(path2, &size2);
+	ok &= size == size2 && memcmp(data, data2, size) == 0;
+
+	// damage that only the checksums catch, and damage that is always caught
+	char* at = data;
+	while (at < data + size && strncmp(at, text, strlen(text)) != 0) at++;
+	assert(at < data + size);
+	*at = 'O';
+	td_write_file(path2, data, size);
+	ok &= l4d_open(&d3, path2, 0) == L4D_FILE_OK;
+	l4d_free(&d3);
+	ok &= l4d_open(&d3, path2, L4D_OPEN_VERIFY) == L4D_FILE_CHECKSUM;
+	l4d_free(&d3);
+	*at = text[0];
+	// a's nodes over the root's (root: 5 nodes, a: 3)
+	uint32_t fc_a[4] = { 5, 3, 0, 1 };
+	char* fc = data;
+	while (fc < data + size && memcmp(fc, fc_a, sizeof(fc_a)) != 0) fc += sizeof(fc_a);
+	assert(fc < data + size);
+	memcpy(fc, &(uint32_t){ 3 }, sizeof(uint32_t));
+	td_write_file(path2, data, size);
+	ok &= l4d_open(&d3, path2, 0) == L4D_FILE_FORMAT;
+	l4d_free(&d3);
+	memcpy(fc, fc_a, sizeof(fc_a));
+	// a node refs misses, with junk for a pointer
+	struct l4d_node* n = (void*) data;
+	while ((char*)(n + 1) <= data + size && !(n->type == TD_A && n->meta.x == 8)) n++;
+	assert((char*)(n + 1) <= data + size);
+	struct l4d_node saved = *n;
+	n->type = L4D_NODE_CONTAINER;
+	memcpy(&n->container, &(uint64_t){ 0x4141414141414141 }, sizeof(uint64_t));
+td_write_file(path2, data, size);
+	ok &= l4d_open(&d3, path2, L4D_OPEN_VERIFY) == L4D_FILE_CHECKSUM;
+	l4d_free(&d3);
+	// with the checksums made to match, the node scan of a verified open
+	td_reseal(data);
+	td_write_file(path2, data, size);
+	ok &= l4d_open(&d3, path2, L4D_OPEN_VERIFY) == L4D_FILE_FORMAT;
+	l4d_free(&d3);
+	// unverified, it is cleared when the root is first walked, or released
+	ok &= l4d_open(&d3, path2, 0) == L4D_FILE_OK && d3.root_container->refs != NULL;
+	l4d_container_check(d3.root_container);
+	struct l4d_node* m = &d3.root_container->nodes[3];
+	ok &= m->type == L4D_NODE_CONTAINER && m->container == NULL && m->meta.x == 8;
+	ok &= d3.root_container->refs == NULL && d3.root_container->nodes[0].container != NULL;
+	l4d_free(&d3);
+	ok &= l4d_open(&d3, path2, 0) == L4D_FILE_OK;
+	l4d_free(&d3);
+	*n = saved;
+	td_reseal(data);
+	td_write_file(path2, data, size / 2);
+	ok &= l4d_open(&d3, path2, 0) == L4D_FILE_FORMAT;
+	l4d_free(&d3);
+	data[0] = 'x';
+	td_write_file(path2, data, size);
+	ok &= l4d_open(&d3, path2, 0) == L4D_FILE_FORMAT;
+	l4d_free(&d3);
+	remove(path2);
+	ok &= l4d_open(&d3, path2, 0) == L4D_FILE_IO;
+	l4d_free(&d3);
+	remove(path);
+	free(data);
+	free(data2);
+
+	if (ok) {
+		printf(OK "project file of %zu bytes\n", size);
+	} else {
+		printf(FAIL "project file\n");
+		n_failed++;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	test_order();
+	test_remove();
+	test_snapshot();
+	test_instances();
+	test_snapshot_threads();
+	test_file();
+
+	if (n_failed) {
+		printf("\n %d TEST(S) FAILED\n", n_failed);
+		return EXIT_FAILURE;
+	} else {
+		printf("\n ALL TESTS PASSED\n");
+		return EXIT_SUCCESS;
+	}
+}
+
+#endif
@@ -1,5 +1,7 @@
 #ifndef LSL4D_H
 
+#include <stdint.h>
+
 #include "dynary.h"
 
 #if 0
@@ -9,22 +11,73 @@ struct l4d_deck {
 
 struct l4d_node;
 
+// a project file mapped by l4d_open(); whatever still points into it holds a
+// reference
+struct l4d_map;
+
+// edges by node, and a topological order; see l4d_connect()
+struct l4d_adjacency;
+
+// stable handles to nodes; see l4d_handle()
+struct l4d_slots;
+
 struct l4d_code {
 	struct dynary code_dy;
 	char* code;
+	struct l4d_map* map; // code is in the file if set
 
 	int refcount;
 	struct l4d_code* next;
 };
 
+// connects output port src_port of node src to input port dst_port of node
+// dst; nodes are indices into the container's nodes. an input port may have
+// several edges (their signals are summed), as may an output port
+struct l4d_edge {
+	int src, src_port;
+	int dst, dst_port;
+};
+
 struct l4d_container {
 	struct dynary nodes_dy;
 	struct l4d_node* nodes;
 
+	struct dynary edges_dy;
+	struct l4d_edge* edges;
+
+	// nodes and edges are read in place from a project file while set, and
+	// copied out the first time they are resized
+	struct l4d_map* map;
+	// the file's refs within the container (global node indices, from
+	// node_first), while its other nodes are unchecked; see l4d_open()
+	const uint32_t* refs;
+	uint32_t n_refs, node_first;
+	int checking;
+
+	struct l4d_adjacency* adj; // NULL until an edit needs it
+	struct l4d_slots* slots; // NULL until a node is removed
+
 	int refcount;
+	// references from d and from nodes of the current version (see versions
+	// below); once no current version uses a container it is frozen, and its
+	// own references stop counting. both are only touched by the editing thread
+	int n_users;
+	int frozen;
+	struct l4d_container* remap; // scratch for l4d_mutable()
 	struct l4d_container* next;
 };
 
+// node types l4d gives a meaning to; hosts use the others (>= 0)
+enum {
+	L4D_NODE_CODE = -1, // node.code is set
+	L4D_NODE_CONTAINER = -2, // node.container is set
+	// the ports of a container, as seen from inside: its k'th inlet (in node
+	// order) has one output, what goes into input port k of the container
+	// node; its k'th outlet has one input, output port k
+	L4D_NODE_INLET = -3,
+	L4D_NODE_OUTLET = -4,
+};
+
 struct l4d_nodemeta {
 	int x;
 	int y;
@@ -51,7 +104,140 @@ struct l4d {
 	struct l4d_container* root_container;
 };
 
+/*
+versions. containers and codes are refcounted: d holds a reference to every
+container it created, and a node holds one to its code or container. the
+references of the current version are a container's users; any reference
+beyond those belongs to an older version, so the container is shared and never
+changes again. l4d_snapshot() shares the root container, so taking a version is
+O(1), and readers (engine, autosave, renderer) keep it as long as they like
+without locks. to edit, l4d_mutable() walks from the root to a container and
+copies whatever is shared on the way (path copying); everything off the path
+stays shared. a container instanced by several nodes is edited in place, for
+all of them, unless a snapshot shares it; then every instance moves to the
+one copy, which costs a walk over the current version.
+
+snapshots are taken and edits made on one thread; references can be released
+on any
+*/
+
 void l4d_init(struct l4d* d);
+// releases d's references; snapshots stay valid
+void l4d_free(struct l4d* d);
+
+// with d NULL, the caller has the only reference (for a node to take)
+struct l4d_container* l4d_container_new(struct l4d* d);
+void l4d_container_retain(struct l4d_container* c);
+void l4d_container_release(struct l4d_container* c);
+void l4d_code_retain(struct l4d_code* code);
+void l4d_code_release(struct l4d_code* code);
+
+// the root container, retained; l4d_container_release() it when done
+struct l4d_container* l4d_snapshot(struct l4d* d);
+
+// the container at path (node indices of L4D_NODE_CONTAINER nodes, starting
+// at the root), made safe to edit
+struct l4d_container* l4d_mutable(struct l4d* d, const int* path, int depth);
+
+// the functions below edit c, which must not be shared
+
+// returns the index of the new (zeroed) node
+int l4d_node_add(struct l4d_container* c);
+
+// removes a node and its edges, in time proportional to its edges and the
+// last node's; the last node takes its index, and edges naming it follow. the
+// order stays as it is
+void l4d_node_remove(struct l4d_container* c, int node);
+
+/*
+handles. nodes stay dense, so removing one moves another; a handle names a
+node wherever it moves, and once it is removed never names anything again. a
+container keeps a slot per node, holding its index and a generation that
+removing bumps; the zeroed handle is never valid. until a node is first
+removed from c (or any of the containers it was copied from) the slots are
+not kept at all, as slot i is node i. project files do not keep them either
+*/
+
+struct l4d_handle {
+	int slot, gen;
+};
+
+struct l4d_handle l4d_handle(struct l4d_container* c, int node);
+// the index of the node, or -1 if it was removed
+int l4d_node_of(struct l4d_container* c, struct l4d_handle h);
+
+/*
+edges. c keeps them by node, in compressed rows (CSR) built now and then, with
+the edges connected since chained on top, and keeps its nodes in a
+topological order. connecting an edge that goes backwards in the order
+searches (Pearce-Kelly) only the nodes ordered between its ends, so a cycle is
+found, and the order repaired, in time proportional to that region rather
+than the graph. the rows and order are built on the first edit after a
+container is created or opened, in O(nodes + edges)
+*/
+
+// returns the index of the new edge, or -1 if it would close a cycle (and
+// then changes nothing)
+int l4d_connect(struct l4d_container* c, int src, int src_port, int dst, int dst_port);
+
+// removes an edge; the last edge takes its index. the order stays as it is
+void l4d_disconnect(struct l4d_container* c, int edge);
+
+// the nodes of c in topological order, or NULL if c has a cycle (only a
+// project file can give it one; connecting is then checked by a search of the
+// whole graph). valid until c is next edited
+const int* l4d_order(struct l4d_container* c);
+
+// makes node a L4D_NODE_CODE or L4D_NODE_CONTAINER node; the node takes over
+// the caller's reference to code or child
+void l4d_node_set_code(struct l4d_container* c, int node, struct l4d_code* code);
+void l4d_node_set_container(struct l4d_container* c, int node, struct l4d_container* child);
+
+/*
+project files. little-endian, versioned, made of flat sections found through
+a directory, each with a CRC-32:
+ containers: per container, its range of nodes and edges (container 0 is the
+  root)
+ nodes: struct l4d_node as is, but the code/container pointer of
+  L4D_NODE_CODE/L4D_NODE_CONTAINER nodes holds an index
+ edges: struct l4d_edge as is
+ codes, text: per code, its NUL terminated text
+ refs: every node (by global index) whose pointer holds an index
+l4d_open() maps the file privately and points containers at their nodes and
+edges in it; only the nodes in refs are read and written, so opening takes
+O(containers + refs) whatever the size of the graph. a node that claims a
+code or container but is not in refs still holds an index (or anything, in a
+damaged file); each container clears such nodes the first time its pointers
+are read, see l4d_container_check(). node pages are copied by the kernel the
+first time they are written, and the arrays are copied out when they first
+grow. everything opening follows (ranges, indices, refs) is always checked;
+L4D_OPEN_VERIFY adds the section checksums and checks every node up front.
+
+l4d_save() writes everything reachable from a root (a snapshot will do, on
+any thread), streaming the sections straight from the containers into a
+temporary file that is then renamed over path
+*/
+
+enum {
+	L4D_OPEN_VERIFY = 1,
+};
+
+enum l4d_file_status {
+	L4D_FILE_OK = 0,
+	L4D_FILE_IO,
+	L4D_FILE_FORMAT, // not a project file, another version, or out of bounds
+	L4D_FILE_CHECKSUM,
+};
+
+// initializes d (l4d_free() it in any case)
+enum l4d_file_status l4d_open(struct l4d* d, const char* path, int flags);
+enum l4d_file_status l4d_save(struct l4d_container* root, const char* path);
+
+// makes the code and container of c's nodes safe to read: after a project file
+// is opened without L4D_OPEN_VERIFY, call it for every container before its
+// nodes' pointers are read (l4d does, for everything it walks). O(nodes) the
+// first time, O(1) after; any thread
+void l4d_container_check(struct l4d_container* c);
 
 #define LSL4D_H
 #endif
@@ -0,0 +1,2074 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "l4e.h"
+
+// buffers start on their own cache line
+#define L4E_ALIGN (64)
+
+static void* l4e__align(void* p)
+{
+	return (void*)(((uintptr_t)p + L4E_ALIGN - 1) & ~(uintptr_t)(L4E_ALIGN - 1));
+}
+
+static size_t l4e__round(size_t n)
+{
+	return (n + L4E_ALIGN - 1) & ~(size_t)(L4E_ALIGN - 1);
+}
+
+static int l4e__cmp_i64(const void* a, const void* b)
+{
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/*
+nested containers are inlined into one flat graph: the nodes of c first,
+keeping their indices, then the nodes of every container node's instance,
+breadth first. every instance has nodes of its own, so state of its own.
+container nodes, inlets and outlets (port k of a container being its k'th
+inlet or outlet in node order) are boundaries only: an edge into a node is
+traced back through them to the nodes that really write it, so boundaries
+take no steps and copy nothing, and an inlet wired to an outlet is just a
+wire. an inlet of c itself reads zeros
+*/
+struct l4e__inst {
+	struct l4d_node* node;
+	int parent; // container node whose instance it is in, or -1 in c
+	int root; // the node of c it is or is in, for errors
+	int child_base; // container nodes: where their instance starts, else -1
+	int io; // container nodes: where their inlets, then outlets, are in ios
+	int n_inlets, n_outlets;
+	int port; // inlets and outlets
+};
+
+struct l4e__flat {
+	struct dynary insts_dy;
+	struct l4e__inst* insts;
+	struct dynary ios_dy;
+	int* ios;
+	struct dynary raw_dy; // edges of every instance, between flat nodes
+	struct l4d_edge* raw;
+	int n_c_edges; // the first raw edges are c's own
+	int* raw_base; // raw edges into node i are raw_in[raw_base[i] .. raw_base[i+1])
+	int* raw_in;
+	struct dynary edges_dy; // between steps
+	struct l4d_edge* edges;
+
+	// every container instanced so far, hashed
+	struct l4d_container** seen;
+	int n_seen, seen_cap;
+};
+
+static int l4e__is_step(struct l4d_node* node)
+{
+	return node->type != L4D_NODE_CONTAINER && node->type != L4D_NODE_INLET && node->type != L4D_NODE_OUTLET;
+}
+
+static int l4e__inst_add(struct l4e__flat* f, struct l4d_node* node, int parent, int root)
+{
+	struct l4e__inst* in = dynary_append(&f->insts_dy);
+	in->node = node;
+	in->parent = parent;
+	in->root = root;
+	in->child_base = -1;
+	return f->insts_dy.n - 1;
+}
+
+static void l4e__flat_free(struct l4e__flat* f)
+{
+	free(f->insts);
+	free(f->ios);
+	free(f->raw);
+	free(f->raw_base);
+	free(f->raw_in);
+	free(f->edges);
+	free(f->seen);
+}
+
+static uint64_t l4e__hash(const void* p)
+{
+	uint64_t h = (uintptr_t)p;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// adds c to the seen set; returns whether it was there
+static int l4e__seen(struct l4e__flat* f, struct l4d_container* c)
+{
+	if (2 * (f->n_seen + 1) > f->seen_cap) {
+		struct l4d_container** old = f->seen;
+		int old_cap = f->seen_cap;
+		f->seen_cap = old_cap ? old_cap * 2 : 64;
+		f->seen = calloc(f->seen_cap, sizeof(*f->seen));
+		assert(f->seen != NULL);
+		f->n_seen = 0;
+		for (int j = 0; j < old_cap; j++) if (old[j] != NULL) l4e__seen(f, old[j]);
+		free(old);
+	}
+	int mask = f->seen_cap - 1;
+	int i = l4e__hash(c) & mask;
+	for (; f->seen[i] != NULL; i = (i + 1) & mask) if (f->seen[i] == c) return 1;
+	f->seen[i] = c;
+	f->n_seen++;
+	return 0;
+}
+
+static enum l4e_status l4e__flatten(struct l4e__flat* f, struct l4d_container* c, struct l4e_plan* plan)
+{
+	memset(f, 0, sizeof(*f));
+	dynary_init(&f->insts_dy, (void**) &f->insts, sizeof(*f->insts));
+	dynary_init(&f->ios_dy, (void**) &f->ios, sizeof(*f->ios));
+	dynary_init(&f->raw_dy, (void**) &f->raw, sizeof(*f->raw));
+	dynary_init(&f->edges_dy, (void**) &f->edges, sizeof(*f->edges));
+
+	l4d_container_check(c);
+	for (int i = 0; i < c->nodes_dy.n; i++) l4e__inst_add(f, &c->nodes[i], -1, i);
+	for (int i = 0; i < c->edges_dy.n; i++) {
+		struct l4d_edge* e = &c->edges[i];
+		if (e->src < 0 || e->src >= c->nodes_dy.n || e->dst < 0 || e->dst >= c->nodes_dy.n) {
+			plan->err_edge = i;
+			return L4E_BAD_EDGE;
+		}
+		*(struct l4d_edge*)dynary_append(&f->raw_dy) = *e;
+	}
+	f->n_c_edges = c->edges_dy.n;
+
+	for (int i = 0; i < f->insts_dy.n; i++) {
+		if (f->insts[i].node->type != L4D_NODE_CONTAINER) continue;
+		struct l4d_container* child = f->insts[i].node->container;
+		int root = f->insts[i].root;
+		int base = f->insts_dy.n;
+		f->insts[i].child_base = base;
+		f->insts[i].io = f->ios_dy.n;
+		if (child == NULL) continue;
+		// a container in itself would never end; only one instanced before
+		// can be its own ancestor
+		int loop = child == c;
+		if (l4e__seen(f, child)) {
+			for (int p = f->insts[i].parent; p >= 0; p = f->insts[p].parent) loop |= f->insts[p].node->container == child;
+		}
+		if (loop) {
+			plan->err_node = root;
+			return L4E_CYCLE;
+		}
+		l4d_container_check(child);
+		int n_inlets = 0, n_outlets = 0;
+		for (int j = 0; j < child->nodes_dy.n; j++) {
+			int k = l4e__inst_add(f, &child->nodes[j], i, root);
+			if (child->nodes[j].type == L4D_NODE_INLET) f->insts[k].port = n_inlets++;
+			if (child->nodes[j].type == L4D_NODE_OUTLET) f->insts[k].port = n_outlets++;
+		}
+		f->insts[i].n_inlets = n_inlets;
+		f->insts[i].n_outlets = n_outlets;
+		for (int type = L4D_NODE_INLET; type >= L4D_NODE_OUTLET; type--) {
+			for (int j = 0; j < child->nodes_dy.n; j++) {
+				if (child->nodes[j].type == type) *(int*)dynary_append(&f->ios_dy) = base + j;
+			}
+		}
+		for (int j = 0; j < child->edges_dy.n; j++) {
+			struct l4d_edge e = child->edges[j];
+			if (e.src < 0 || e.src >= child->nodes_dy.n || e.dst < 0 || e.dst >= child->nodes_dy.n) {
+				plan->err_node = root;
+				return L4E_BAD_EDGE;
+			}
+			e.src += base;
+			e.dst += base;
+			*(struct l4d_edge*)dynary_append(&f->raw_dy) = e;
+		}
+	}
+	return L4E_OK;
+}
+
+// ports each flat node has, as far as edges go
+static int l4e__flat_ports(struct l4e__flat* f, struct l4e_proc* procs, int node, int out)
+{
+	struct l4e__inst* in = &f->insts[node];
+	switch (in->node->type) {
+	case L4D_NODE_CONTAINER: return out ? in->n_outlets : in->n_inlets;
+	case L4D_NODE_INLET: return out;
+	case L4D_NODE_OUTLET: return !out;
+	}
+	return out ? procs[node].n_out : procs[node].n_in;
+}
+
+// adds an edge to (dst, dst_port) from every step output that (src,
+// src_port) stands for. depth bounds a trace that loops through boundaries
+static int l4e__trace(struct l4e__flat* f, int src, int src_port, int dst, int dst_port, int depth)
+{
+	if (depth > f->raw_dy.n) return -1;
+	struct l4e__inst* in = &f->insts[src];
+	int via = -1, via_port = 0;
+	if (in->node->type == L4D_NODE_CONTAINER) {
+		via = f->ios[in->io + in->n_inlets + src_port];
+	} else if (in->node->type == L4D_NODE_INLET) {
+		via = in->parent;
+		via_port = in->port;
+		if (via < 0) return 0;
+	} else {
+		*(struct l4d_edge*)dynary_append(&f->edges_dy) = (struct l4d_edge) { .src = src, .src_port = src_port, .dst = dst, .dst_port = dst_port };
+		return 0;
+	}
+	for (int j = f->raw_base[via]; j < f->raw_base[via + 1]; j++) {
+		struct l4d_edge* e = &f->raw[f->raw_in[j]];
+		if (e->dst_port != via_port) continue;
+		if (l4e__trace(f, e->src, e->src_port, dst, dst_port, depth + 1) < 0) return -1;
+	}
+	return 0;
+}
+
+// checks ports and traces every edge into a step
+static enum l4e_status l4e__wire(struct l4e__flat* f, struct l4e_proc* procs, struct l4e_plan* plan)
+{
+	int n_nodes = f->insts_dy.n;
+	int n_raw = f->raw_dy.n;
+	for (int i = 0; i < n_raw; i++) {
+		struct l4d_edge* e = &f->raw[i];
+		if (e->src_port < 0 || e->src_port >= l4e__flat_ports(f, procs, e->src, 1)
+			|| e->dst_port < 0 || e->dst_port >= l4e__flat_ports(f, procs, e->dst, 0))
+		{
+			if (i < f->n_c_edges) {
+				plan->err_edge = i;
+			} else {
+				plan->err_node = f->insts[e->dst].root;
+			}
+			return L4E_BAD_EDGE;
+		}
+	}
+	f->raw_base = calloc(n_nodes + 2, sizeof(*f->raw_base));
+	f->raw_in = calloc(n_raw + 1, sizeof(*f->raw_in));
+	assert(f->raw_base != NULL && f->raw_in != NULL);
+	for (int i = 0; i < n_raw; i++) f->raw_base[f->raw[i].dst + 2]++;
+	for (int i = 0; i < n_nodes; i++) f->raw_base[i + 2] += f->raw_base[i + 1];
+	for (int i = 0; i < n_raw; i++) f->raw_in[f->raw_base[f->raw[i].dst + 1]++] = i;
+	for (int i = 0; i < n_raw; i++) {
+		struct l4d_edge* e = &f->raw[i];
+		if (!l4e__is_step(f->insts[e->dst].node)) continue;
+		if (l4e__trace(f, e->src, e->src_port, e->dst, e->dst_port, 0) < 0) {
+			plan->err_node = f->insts[e->dst].root;
+			return L4E_CYCLE;
+		}
+	}
+	return L4E_OK;
+}
+
+// the key of a node, from its container node's key and its handle there
+static uint64_t l4e__key(uint64_t up, struct l4d_handle h)
+{
+	uint64_t k = up * 0x9e3779b97f4a7c15ULL ^ ((uint64_t)(uint32_t)h.slot << 32 | (uint32_t)h.gen);
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+enum l4e_status l4e_compile(struct l4e_plan* plan, struct l4d_container* c, struct l4e_host* host, int block_size)
+{
+	memset(plan, 0, sizeof(*plan));
+	plan->block_size = block_size;
+	plan->err_node = -1;
+	plan->err_edge = -1;
+
+	struct l4e__flat flat;
+	enum l4e_status status = l4e__flatten(&flat, c, plan);
+	int n_nodes = flat.insts_dy.n;
+
+	struct l4e_proc* procs = calloc(n_nodes + 1, sizeof(*procs));
+	int* in_base = calloc(n_nodes + 1, sizeof(*in_base));
+	int* out_base = calloc(n_nodes + 1, sizeof(*out_base));
+	assert(procs != NULL && in_base != NULL && out_base != NULL);
+	size_t states_size = 0;
+	for (int i = 0; status == L4E_OK && i < n_nodes; i++) {
+		if (l4e__is_step(flat.insts[i].node)) {
+			if (host->resolve(host->usr, flat.insts[i].node, &procs[i]) != 0) {
+				plan->err_node = flat.insts[i].root;
+				status = L4E_UNRESOLVED;
+				break;
+			}
+			assert(procs[i].n_in >= 0 && procs[i].n_out >= 0 && procs[i].process != NULL);
+		}
+		in_base[i+1] = in_base[i] + procs[i].n_in;
+		out_base[i+1] = out_base[i] + procs[i].n_out;
+		states_size += l4e__round(procs[i].state_size);
+	}
+	if (status == L4E_OK) status = l4e__wire(&flat, procs, plan);
+	int n_ins = in_base[n_nodes];
+	int n_outs = out_base[n_nodes];
+	int n_edges = flat.edges_dy.n;
+	struct l4d_edge* edges = flat.edges;
+
+	// sources per input port, and successors per node (CSR, by edge)
+	int* n_srcs = calloc(n_ins + 1, sizeof(*n_srcs));
+	int* succ_base = calloc(n_nodes + 1, sizeof(*succ_base));
+	int* succs = calloc(n_edges + 1, sizeof(*succs));
+	int* indegree = calloc(n_nodes + 1, sizeof(*indegree));
+	assert(n_srcs != NULL && succ_base != NULL && succs != NULL && indegree != NULL);
+	for (int i = 0; status == L4E_OK && i < n_edges; i++) {
+		struct l4d_edge* e = &edges[i];
+		n_srcs[in_base[e->dst] + e->dst_port]++;
+		succ_base[e->src + 1]++;
+		indegree[e->dst]++;
+	}
+	if (status == L4E_OK) {
+		for (int i = 0; i < n_nodes; i++) succ_base[i+1] += succ_base[i];
+		int* fill = calloc(n_nodes + 1, sizeof(*fill));
+		assert(fill != NULL);
+		for (int i = 0; i < n_edges; i++) {
+			int src = edges[i].src;
+			succs[succ_base[src] + fill[src]++] = edges[i].dst;
+		}
+		free(fill);
+	}
+
+	// Kahn's algorithm over the steps; ready nodes are taken in index order
+	int n_steps = 0;
+	for (int i = 0; i < n_nodes; i++) n_steps += l4e__is_step(flat.insts[i].node);
+	plan->n_nodes = n_nodes;
+	plan->steps = calloc(n_steps + 1, sizeof(*plan->steps));
+	plan->step_of_node = calloc(n_nodes + 1, sizeof(*plan->step_of_node));
+	plan->child_base = calloc(n_nodes + 1, sizeof(*plan->child_base));
+	assert(plan->steps != NULL && plan->step_of_node != NULL && plan->child_base != NULL);
+	for (int i = 0; i < n_nodes; i++) {
+		plan->step_of_node[i] = -1;
+		plan->child_base[i] = flat.insts[i].child_base;
+	}
+	if (status == L4E_OK) {
+		int* order = calloc(n_steps + 1, sizeof(*order));
+		assert(order != NULL);
+		int n = 0;
+		for (int i = 0; i < n_nodes; i++) if (indegree[i] == 0 && l4e__is_step(flat.insts[i].node)) order[n++] = i;
+		for (int head = 0; head < n; head++) {
+			int i = order[head];
+			for (int j = succ_base[i]; j < succ_base[i+1]; j++) {
+				if (--indegree[succs[j]] == 0) order[n++] = succs[j];
+			}
+		}
+		if (n < n_steps) {
+			// the nodes left over are on a cycle or downstream of one; walk
+			// back through predecessors left over until one repeats, which
+			// is on the cycle
+			int* pred_base = calloc(n_nodes + 1, sizeof(*pred_base));
+			int* preds = calloc(n_edges + 1, sizeof(*preds));
+			int* seen = calloc(n_nodes + 1, sizeof(*seen));
+			assert(pred_base != NULL && preds != NULL && seen != NULL);
+			for (int i = 0; i < n_edges; i++) pred_base[edges[i].dst + 1]++;
+			for (int i = 0; i < n_nodes; i++) pred_base[i+1] += pred_base[i];
+			for (int i = 0; i < n_edges; i++) {
+				int dst = edges[i].dst;
+				preds[pred_base[dst] + seen[dst]++] = edges[i].src;
+			}
+			memset(seen, 0, (n_nodes + 1) * sizeof(*seen));
+			int x = 0;
+			while (indegree[x] == 0) x++;
+			while (!seen[x]) {
+				seen[x] = 1;
+				int j = pred_base[x];
+				while (j < pred_base[x+1] && indegree[preds[j]] == 0) j++;
+				if (j == pred_base[x+1]) break;
+				x = preds[j];
+			}
+			plan->err_node = flat.insts[x].root;
+			free(pred_base);
+			free(preds);
+			free(seen);
+			status = L4E_CYCLE;
+		}
+		for (int s = 0; s < n; s++) {
+			plan->steps[s].node = order[s];
+			plan->step_of_node[order[s]] = s;
+		}
+		free(order);
+	}
+
+	if (status != L4E_OK) goto out;
+
+	// buffers: zeros, then one per output port, then one per mixed input
+	int n_mixes = 0;
+	int n_mix_srcs = 0;
+	for (int i = 0; i < n_ins; i++) {
+		if (n_srcs[i] > 1) {
+			n_mixes++;
+			n_mix_srcs += n_srcs[i];
+		}
+	}
+	plan->stride = l4e__round(block_size * sizeof(float)) / sizeof(float);
+	size_t n_buffers = 1 + n_outs + n_mixes;
+	plan->buffers = calloc(1, n_buffers * plan->stride * sizeof(float) + L4E_ALIGN);
+	plan->states = calloc(1, states_size + L4E_ALIGN);
+	plan->ins = calloc(n_ins + 1, sizeof(*plan->ins));
+	plan->outs = calloc(n_outs + 1, sizeof(*plan->outs));
+	plan->mixes = calloc(n_mixes + 1, sizeof(*plan->mixes));
+	plan->mix_srcs = calloc(n_mix_srcs + 1, sizeof(*plan->mix_srcs));
+	assert(plan->buffers != NULL && plan->states != NULL && plan->ins != NULL && plan->outs != NULL);
+	assert(plan->mixes != NULL && plan->mix_srcs != NULL);
+
+	float* buffers = l4e__align(plan->buffers);
+	float* zeros = buffers;
+	for (int i = 0; i < n_outs; i++) plan->outs[i] = buffers + (1 + i) * plan->stride;
+	for (int i = 0; i < n_ins; i++) plan->ins[i] = zeros;
+
+	// mixes and their sources, grouped by the step that reads them
+	int* mix_of_in = calloc(n_ins + 1, sizeof(*mix_of_in));
+	assert(mix_of_in != NULL);
+	float* mix_buffer = buffers + (1 + n_outs) * plan->stride;
+	int mix = 0;
+	int mix_src = 0;
+	char* state = l4e__align(plan->states);
+	for (int s = 0; s < n_steps; s++) {
+		struct l4e_step* st = &plan->steps[s];
+		int i = st->node;
+		st->proc = procs[i];
+		st->in = plan->ins + in_base[i];
+		st->out = plan->outs + out_base[i];
+		st->state = state;
+		state += l4e__round(procs[i].state_size);
+		st->mix = mix;
+		for (int p = 0; p < procs[i].n_in; p++) {
+			int in = in_base[i] + p;
+			if (n_srcs[in] < 2) continue;
+			mix_of_in[in] = mix;
+			plan->mixes[mix].dst = mix_buffer;
+			plan->mixes[mix].src = mix_src;
+			plan->ins[in] = mix_buffer;
+			mix_buffer += plan->stride;
+			mix_src += n_srcs[in];
+			mix++;
+		}
+		st->n_mix = mix - st->mix;
+	}
+	for (int i = 0; i < n_edges; i++) {
+		struct l4d_edge* e = &edges[i];
+		int in = in_base[e->dst] + e->dst_port;
+		const float* src = plan->outs[out_base[e->src] + e->src_port];
+		if (n_srcs[in] == 1) {
+			plan->ins[in] = src;
+		} else {
+			struct l4e_mix* m = &plan->mixes[mix_of_in[in]];
+			plan->mix_srcs[m->src + m->n_src++] = src;
+		}
+	}
+	plan->n_steps = n_steps;
+	free(mix_of_in);
+
+	// the same successors by step, for the pool
+	plan->succ_base = calloc(n_steps + 1, sizeof(*plan->succ_base));
+	plan->succs = calloc(n_edges + 1, sizeof(*plan->succs));
+	plan->n_preds = calloc(n_steps + 1, sizeof(*plan->n_preds));
+	plan->pending = calloc(n_steps + 1, sizeof(*plan->pending));
+	plan->prio = calloc(n_steps + 1, sizeof(*plan->prio));
+	plan->roots = calloc(n_steps + 1, sizeof(*plan->roots));
+	plan->roots_by_prio = calloc(n_steps + 1, sizeof(*plan->roots_by_prio));
+	assert(plan->succ_base != NULL && plan->succs != NULL && plan->n_preds != NULL && plan->pending != NULL);
+	assert(plan->prio != NULL && plan->roots != NULL && plan->roots_by_prio != NULL);
+	for (int s = 0; s < n_steps; s++) {
+		int i = plan->steps[s].node;
+		int n = succ_base[i+1] - succ_base[i];
+		plan->succ_base[s+1] = plan->succ_base[s] + n;
+		for (int j = 0; j < n; j++) {
+			int t = plan->step_of_node[succs[succ_base[i] + j]];
+			plan->succs[plan->succ_base[s] + j] = t;
+			plan->n_preds[t]++;
+		}
+	}
+	for (int s = n_steps - 1; s >= 0; s--) {
+		int prio = 0;
+		for (int j = plan->succ_base[s]; j < plan->succ_base[s+1]; j++) {
+			if (plan->prio[plan->succs[j]] > prio) prio = plan->prio[plan->succs[j]];
+		}
+		plan->prio[s] = prio + 1;
+	}
+	for (int s = 0; s < n_steps; s++) {
+		plan->pending[s] = plan->n_preds[s];
+		if (plan->n_preds[s] == 0) plan->roots[plan->n_roots++] = s;
+	}
+	// node keys: the handle of every node in its container, down from c
+	uint64_t* node_keys = calloc(n_nodes + 1, sizeof(*node_keys));
+	plan->keys = calloc(n_steps + 1, sizeof(*plan->keys));
+	int table_size = 16;
+	while (table_size < 2 * n_steps) table_size <<= 1;
+	plan->keys_table = calloc(table_size, sizeof(*plan->keys_table));
+	plan->keys_mask = table_size - 1;
+	assert(node_keys != NULL && plan->keys != NULL && plan->keys_table != NULL);
+	for (int i = 0; i < n_nodes; i++) {
+		struct l4e__inst* in = &flat.insts[i];
+		struct l4d_container* owner = in->parent < 0 ? c : flat.insts[in->parent].node->container;
+		struct l4d_handle h = l4d_handle(owner, in->node - owner->nodes);
+		node_keys[i] = l4e__key(in->parent < 0 ? 0 : node_keys[in->parent], h);
+	}
+	for (int s = 0; s < n_steps; s++) {
+		uint64_t key = node_keys[plan->steps[s].node];
+		plan->keys[s] = key;
+		int j = key & plan->keys_mask;
+		while (plan->keys_table[j] != 0) j = (j + 1) & plan->keys_mask;
+		plan->keys_table[j] = s + 1;
+	}
+	free(node_keys);
+
+	// by priority, then step
+	int64_t* keys = calloc(plan->n_roots + 1, sizeof(*keys));
+	assert(keys != NULL);
+	for (int j = 0; j < plan->n_roots; j++) keys[j] = ((int64_t)plan->prio[plan->roots[j]] << 32) | plan->roots[j];
+	qsort(keys, plan->n_roots, sizeof(*keys), l4e__cmp_i64);
+	for (int j = 0; j < plan->n_roots; j++) plan->roots_by_prio[j] = (int)(keys[j] & 0xffffffff);
+	free(keys);
+
+out:
+	free(procs);
+	free(in_base);
+	free(out_base);
+	free(n_srcs);
+	free(succ_base);
+	free(succs);
+	free(indegree);
+	l4e__flat_free(&flat);
+	if (status != L4E_OK) {
+		int err_node = plan->err_node;
+		int err_edge = plan->err_edge;
+		l4e_free(plan);
+		plan->err_node = err_node;
+		plan->err_edge = err_edge;
+	}
+	return status;
+}
+
+void l4e_free(struct l4e_plan* plan)
+{
+	free(plan->steps);
+	free(plan->step_of_node);
+	free(plan->child_base);
+	free(plan->ins);
+	free(plan->outs);
+	free(plan->mixes);
+	free(plan->mix_srcs);
+	free(plan->buffers);
+	free(plan->states);
+	free(plan->succ_base);
+	free(plan->succs);
+	free(plan->n_preds);
+	free(plan->pending);
+	free(plan->prio);
+	free(plan->roots);
+	free(plan->roots_by_prio);
+	free(plan->keys);
+	free(plan->keys_table);
+	memset(plan, 0, sizeof(*plan));
+}
+
+static void l4e__mix(struct l4e_plan* plan, struct l4e_mix* m)
+{
+	int n = plan->block_size;
+	const float* a = plan->mix_srcs[m->src];
+	for (int k = 0; k < n; k++) m->dst[k] = a[k];
+	for (int j = 1; j < m->n_src; j++) {
+		const float* b = plan->mix_srcs[m->src + j];
+		for (int k = 0; k < n; k++) m->dst[k] += b[k];
+	}
+}
+
+static void l4e__run_step(struct l4e_plan* plan, struct l4e_step* st)
+{
+	for (int j = 0; j < st->n_mix; j++) l4e__mix(plan, &plan->mixes[st->mix + j]);
+	st->proc.process(st->state, st->in, st->out, plan->block_size, st->proc.usr);
+}
+
+void l4e_process(struct l4e_plan* plan)
+{
+	for (int s = 0; s < plan->n_steps; s++) l4e__run_step(plan, &plan->steps[s]);
+}
+
+const float* l4e_output(struct l4e_plan* plan, int node, int port)
+{
+	assert(node >= 0 && node < plan->n_nodes && plan->step_of_node[node] >= 0);
+	struct l4e_step* st = &plan->steps[plan->step_of_node[node]];
+	assert(port >= 0 && port < st->proc.n_out);
+	return st->out[port];
+}
+
+int l4e_node_at(struct l4e_plan* plan, const int* path, int depth)
+{
+	assert(depth > 0);
+	int node = path[0];
+	for (int k = 1; k < depth; k++) {
+		assert(node >= 0 && node < plan->n_nodes && plan->child_base[node] >= 0);
+		node = plan->child_base[node] + path[k];
+	}
+	assert(node >= 0 && node < plan->n_nodes);
+	return node;
+}
+
+static int l4e__step_of_key(const struct l4e_plan* plan, uint64_t key)
+{
+	for (int j = key & plan->keys_mask; plan->keys_table[j] != 0; j = (j + 1) & plan->keys_mask) {
+		int s = plan->keys_table[j] - 1;
+		if (plan->keys[s] == key) return s;
+	}
+	return -1;
+}
+
+void l4e_carry(struct l4e_plan* to, const struct l4e_plan* from)
+{
+	if (to->keys_table == NULL) return;
+	for (int s = 0; s < from->n_steps; s++) {
+		int t = l4e__step_of_key(to, from->keys[s]);
+		if (t < 0) continue;
+		const struct l4e_step* a = &from->steps[s];
+		struct l4e_step* b = &to->steps[t];
+		if (a->proc.process != b->proc.process || a->proc.state_size != b->proc.state_size) continue;
+		memcpy(b->state, a->state, a->proc.state_size);
+	}
+}
+
+// idle rounds before a worker yields its cpu, and before it sleeps until the
+// next block
+#define L4E_YIELD (1 << 6)
+#define L4E_SPIN (1 << 14)
+
+static void l4e__pause()
+{
+	#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+	#endif
+}
+
+static void l4e__backoff(int* spin)
+{
+	if (++*spin % L4E_YIELD == 0) {
+		sched_yield();
+	} else {
+		l4e__pause();
+	}
+}
+
+// only the owner pushes and takes
+static void l4e__deque_push(struct l4e_deque* q, int s)
+{
+	long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+	__atomic_store_n(&q->items[b & q->mask], s, __ATOMIC_RELAXED);
+	__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+static int l4e__deque_take(struct l4e_deque* q)
+{
+	long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+	if (t > b) {
+		__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	int s = __atomic_load_n(&q->items[b & q->mask], __ATOMIC_RELAXED);
+	if (t == b) {
+		// last one; race the thieves for it
+		if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) s = -1;
+		__atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return s;
+}
+
+// -1 if empty, or if another thief won
+static int l4e__deque_steal(struct l4e_deque* q)
+{
+	long t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b) return -1;
+	int s = __atomic_load_n(&q->items[t & q->mask], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return -1;
+	return s;
+}
+
+static int l4e__steal(struct l4e_pool* pool, struct l4e_worker* w)
+{
+	int n = pool->n_workers;
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 17;
+	w->rng ^= w->rng << 5;
+	int v = w->rng % n;
+	for (int k = 0; k < n; k++, v = (v + 1) % n) {
+		if (v == w->index) continue;
+		int s = l4e__deque_steal(&pool->workers[v].deque);
+		if (s >= 0) return s;
+	}
+	return -1;
+}
+
+// runs step s and queues the successors it made ready, except one which is
+// returned to be run next (-1 if none)
+static int l4e__pool_step(struct l4e_pool* pool, struct l4e_worker* w, int s)
+{
+	struct l4e_plan* plan = pool->plan;
+	l4e__run_step(plan, &plan->steps[s]);
+	// nothing else counts this one down again before the next block
+	__atomic_store_n(&plan->pending[s], plan->n_preds[s], __ATOMIC_RELAXED);
+	int critical = pool->flags & L4E_POOL_CRITICAL_PATH;
+	int next = -1;
+	for (int j = plan->succ_base[s]; j < plan->succ_base[s+1]; j++) {
+		int t = plan->succs[j];
+		if (__atomic_sub_fetch(&plan->pending[t], 1, __ATOMIC_ACQ_REL) != 0) continue;
+		if (next < 0) {
+			next = t;
+			continue;
+		}
+		if (critical && plan->prio[t] > plan->prio[next]) {
+			int tmp = next;
+			next = t;
+			t = tmp;
+		}
+		l4e__deque_push(&w->deque, t);
+	}
+	__atomic_sub_fetch(&pool->remaining, 1, __ATOMIC_SEQ_CST);
+	return next;
+}
+
+static void l4e__pool_work(struct l4e_pool* pool, struct l4e_worker* w)
+{
+	int spin = 0;
+	// seq_cst, so a worker that saw steps left is seen in n_active by worker
+	// 0 once it has seen none (see l4e__pool_settle())
+	while (__atomic_load_n(&pool->remaining, __ATOMIC_SEQ_CST) > 0) {
+		int s = l4e__deque_take(&w->deque);
+		if (s < 0) s = l4e__steal(pool, w);
+		if (s < 0) {
+			l4e__backoff(&spin);
+			continue;
+		}
+		spin = 0;
+		while (s >= 0) s = l4e__pool_step(pool, w, s);
+	}
+}
+
+static void l4e__futex_wait(unsigned* addr, unsigned val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void l4e__futex_wake(unsigned* addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void* l4e__pool_thread(void* usr)
+{
+	struct l4e_worker* w = usr;
+	struct l4e_pool* pool = w->pool;
+	unsigned gen = 0;
+	for (;;) {
+		int spin = 0;
+		unsigned now;
+		while ((now = __atomic_load_n(&pool->gen, __ATOMIC_SEQ_CST)) == gen) {
+			if (spin < L4E_SPIN) {
+				l4e__backoff(&spin);
+				continue;
+			}
+			// the kernel only sleeps if gen is still what was seen, and
+			// l4e__pool_signal() wakes whoever counted themselves in first
+			__atomic_add_fetch(&pool->n_sleeping, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&pool->gen, __ATOMIC_SEQ_CST) == gen) l4e__futex_wait(&pool->gen, gen);
+			__atomic_sub_fetch(&pool->n_sleeping, 1, __ATOMIC_SEQ_CST);
+		}
+		// a worker woken late joins whatever block is on, if any
+		gen = now;
+		if (__atomic_load_n(&pool->quit, __ATOMIC_ACQUIRE)) break;
+		__atomic_add_fetch(&pool->n_active, 1, __ATOMIC_SEQ_CST);
+		l4e__pool_work(pool, w);
+		__atomic_sub_fetch(&pool->n_active, 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+// no lock, and a system call only if a worker went to sleep
+static void l4e__pool_signal(struct l4e_pool* pool)
+{
+	__atomic_add_fetch(&pool->gen, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->n_sleeping, __ATOMIC_SEQ_CST) > 0) l4e__futex_wake(&pool->gen);
+}
+
+// waits for workers still in the last block (after its last step, so they
+// are only on their way out) before the deques are touched again. a worker
+// that comes in later sees no steps left, or the next block's, all queued
+static void l4e__pool_settle(struct l4e_pool* pool)
+{
+	int spin = 0;
+	while (__atomic_load_n(&pool->n_active, __ATOMIC_SEQ_CST) > 0) l4e__backoff(&spin);
+}
+
+static int* l4e__deques_new(int n_workers, long capacity)
+{
+	void* items = NULL;
+	int err = posix_memalign(&items, L4E_ALIGN, n_workers * capacity * sizeof(int));
+	assert(err == 0);
+	memset(items, 0, n_workers * capacity * sizeof(int));
+	return items;
+}
+
+static long l4e__deque_capacity(int n_steps)
+{
+	long capacity = 16;
+	while (capacity < n_steps) capacity <<= 1;
+	return capacity;
+}
+
+// puts the deques in items, between blocks; returns the old ones
+static int* l4e__pool_adopt(struct l4e_pool* pool, int* items, long capacity)
+{
+	l4e__pool_settle(pool);
+	int* old = pool->items;
+	pool->items = items;
+	pool->capacity = capacity;
+	for (int i = 0; i < pool->n_workers; i++) {
+		struct l4e_deque* q = &pool->workers[i].deque;
+		q->items = items + i * capacity;
+		q->mask = capacity - 1;
+		q->top = q->bottom = 0;
+	}
+	return old;
+}
+
+void l4e_pool_init(struct l4e_pool* pool, int n_threads, int flags)
+{
+	assert(n_threads >= 1);
+	memset(pool, 0, sizeof(*pool));
+	pool->n_workers = n_threads;
+	pool->flags = flags;
+	void* workers = NULL;
+	int err = posix_memalign(&workers, L4E_ALIGN, n_threads * sizeof(*pool->workers));
+	assert(err == 0);
+	memset(workers, 0, n_threads * sizeof(*pool->workers));
+	pool->workers = workers;
+	for (int i = 0; i < n_threads; i++) {
+		struct l4e_worker* w = &pool->workers[i];
+		w->pool = pool;
+		w->index = i;
+		w->rng = 0x9e3779b9u * (i + 1);
+	}
+	for (int i = 1; i < n_threads; i++) {
+		struct l4e_worker* w = &pool->workers[i];
+		err = pthread_create(&w->thread, NULL, l4e__pool_thread, w);
+		assert(err == 0);
+	}
+}
+
+void l4e_pool_free(struct l4e_pool* pool)
+{
+	__atomic_store_n(&pool->quit, 1, __ATOMIC_RELEASE);
+	l4e__pool_signal(pool);
+	for (int i = 1; i < pool->n_workers; i++) pthread_join(pool->workers[i].thread, NULL);
+	free(pool->items);
+	free(pool->workers);
+	memset(pool, 0, sizeof(*pool));
+}
+
+void l4e_pool_reserve(struct l4e_pool* pool, int n_steps)
+{
+	if (n_steps <= pool->capacity) return;
+	long capacity = l4e__deque_capacity(n_steps);
+	free(l4e__pool_adopt(pool, l4e__deques_new(pool->n_workers, capacity), capacity));
+}
+
+void l4e_pool_process(struct l4e_pool* pool, struct l4e_plan* plan)
+{
+	int n = pool->n_workers;
+	// alone, plan order is as good as any and costs no atomics. it also
+	// interleaves independent chains, where a worker following successors
+	// would run one chain of latency bound steps back to back
+	if (n == 1) {
+		l4e_process(plan);
+		return;
+	}
+	l4e_pool_reserve(pool, plan->n_steps);
+	l4e__pool_settle(pool);
+	pool->plan = plan;
+	const int* roots = pool->flags & L4E_POOL_CRITICAL_PATH ? plan->roots_by_prio : plan->roots;
+	for (int j = 0; j < plan->n_roots; j++) l4e__deque_push(&pool->workers[j % n].deque, roots[j]);
+	// published after the roots, so whoever sees steps left finds them
+	__atomic_store_n(&pool->remaining, plan->n_steps, __ATOMIC_SEQ_CST);
+
+	l4e__pool_signal(pool);
+	l4e__pool_work(pool, &pool->workers[0]);
+	// every step has run once remaining is 0; workers still on their way
+	// out of the block are left to l4e__pool_settle()
+}
+
+void l4e_ring_init(struct l4e_ring* ring, int capacity)
+{
+	memset(ring, 0, sizeof(*ring));
+	unsigned n = 1;
+	while (n < capacity) n <<= 1;
+	ring->mask = n - 1;
+	ring->cmds = calloc(n, sizeof(*ring->cmds));
+	assert(ring->cmds != NULL);
+}
+
+void l4e_ring_free(struct l4e_ring* ring)
+{
+	free(ring->cmds);
+	memset(ring, 0, sizeof(*ring));
+}
+
+int l4e_ring_push(struct l4e_ring* ring, const struct l4e_cmd* cmd)
+{
+	unsigned head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail > ring->mask) return -1;
+	ring->cmds[head & ring->mask] = *cmd;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int l4e_ring_pop(struct l4e_ring* ring, struct l4e_cmd* cmd)
+{
+	unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (tail == head) return 0;
+	*cmd = ring->cmds[tail & ring->mask];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int l4e__ring_full(struct l4e_ring* ring)
+{
+	unsigned head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	return head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask;
+}
+
+static int l4e__ring_peek(struct l4e_ring* ring, struct l4e_cmd* cmd)
+{
+	unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) return 0;
+	*cmd = ring->cmds[tail & ring->mask];
+	return 1;
+}
+
+void l4e_engine_init(struct l4e_engine* e, int capacity, struct l4e_pool* pool)
+{
+	memset(e, 0, sizeof(*e));
+	l4e_ring_init(&e->commands, capacity);
+	l4e_ring_init(&e->retired, capacity);
+	e->pool = pool;
+	if (pool != NULL) e->capacity = pool->capacity;
+}
+
+static void l4e__plan_delete(struct l4e_plan* plan)
+{
+	if (plan == NULL) return;
+	l4e_free(plan);
+	free(plan);
+}
+
+// frees what a command owns; returns 1 for a plan
+static int l4e__cmd_delete(struct l4e_cmd* cmd)
+{
+	if (cmd->type == L4E_CMD_GROW) free(cmd->items);
+	if (cmd->type != L4E_CMD_PLAN) return 0;
+	l4e__plan_delete(cmd->plan);
+	return 1;
+}
+
+void l4e_engine_free(struct l4e_engine* e)
+{
+	struct l4e_cmd cmd;
+	while (l4e_ring_pop(&e->commands, &cmd)) l4e__cmd_delete(&cmd);
+	l4e_engine_collect(e);
+	l4e__plan_delete(e->plan);
+	l4e_ring_free(&e->commands);
+	l4e_ring_free(&e->retired);
+	memset(e, 0, sizeof(*e));
+}
+
+int l4e_engine_send(struct l4e_engine* e, const struct l4e_cmd* cmd)
+{
+	struct l4e_pool* pool = e->pool;
+	if (cmd->type != L4E_CMD_PLAN || pool == NULL || pool->n_workers == 1 || cmd->plan->n_steps <= e->capacity) {
+		return l4e_ring_push(&e->commands, cmd);
+	}
+	// the deques go first, so the plan runs on the pool from its first block
+	struct l4e_ring* ring = &e->commands;
+	unsigned head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) + 2 > ring->mask + 1) return -1;
+	long capacity = l4e__deque_capacity(cmd->plan->n_steps);
+	struct l4e_cmd grow = { .type = L4E_CMD_GROW, .items = l4e__deques_new(pool->n_workers, capacity), .capacity = capacity };
+	l4e_ring_push(ring, &grow);
+	l4e_ring_push(ring, cmd);
+	e->capacity = capacity;
+	return 0;
+}
+
+int l4e_engine_collect(struct l4e_engine* e)
+{
+	int n = 0;
+	struct l4e_cmd cmd;
+	while (l4e_ring_pop(&e->retired, &cmd)) n += l4e__cmd_delete(&cmd);
+	return n;
+}
+
+static void l4e__engine_set(struct l4e_engine* e, struct l4e_cmd* cmd)
+{
+	struct l4e_plan* plan = e->plan;
+	// commands for nodes the plan doesn't have were meant for another plan
+	if (plan == NULL || cmd->node < 0 || cmd->node >= plan->n_nodes || plan->step_of_node[cmd->node] < 0) return;
+	struct l4e_step* st = &plan->steps[plan->step_of_node[cmd->node]];
+	if (st->proc.set != NULL) st->proc.set(st->state, cmd->param, cmd->value, st->proc.usr);
+}
+
+int l4e_engine_process(struct l4e_engine* e)
+{
+	struct l4e_cmd cmd;
+	while (l4e__ring_peek(&e->commands, &cmd)) {
+		if (cmd.type == L4E_CMD_PLAN) {
+			if (e->plan != NULL) {
+				if (l4e__ring_full(&e->retired)) break;
+				l4e_carry(cmd.plan, e->plan);
+				struct l4e_cmd retire = { .type = L4E_CMD_PLAN, .plan = e->plan };
+				l4e_ring_push(&e->retired, &retire);
+			}
+			e->plan = cmd.plan;
+		} else if (cmd.type == L4E_CMD_GROW) {
+			if (l4e__ring_full(&e->retired)) break;
+			struct l4e_cmd retire = { .type = L4E_CMD_GROW };
+			retire.items = l4e__pool_adopt(e->pool, cmd.items, cmd.capacity);
+			l4e_ring_push(&e->retired, &retire);
+		} else if (cmd.type == L4E_CMD_SET) {
+			l4e__engine_set(e, &cmd);
+		}
+		l4e_ring_pop(&e->commands, &cmd);
+	}
+
+	if (e->plan == NULL) return 0;
+	if (e->pool != NULL && e->pool->capacity >= e->plan->n_steps) {
+		l4e_pool_process(e->pool, e->plan);
+	} else {
+		l4e_process(e->plan);
+	}
+	e->n_blocks++;
+	return 1;
+}
+
+
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+
+#define OK "\e[32m\e[1mOK\e[0m "
+#define FAIL "\e[41m\e[33m\e[1m!!\e[0m "
+
+static int n_failed;
+
+/*
+test nodes; node.type picks one:
+ ramp: out = phase, phase+1, ... (phase kept in state)
+ gain: out = in * 2
+ add: out = in0 + in1
+ sink: state = sum of everything in (and in is passed to out)
+ const: out = param 0 (kept in state)
+*/
+enum {
+	TN_RAMP = 1,
+	TN_GAIN,
+	TN_ADD,
+	TN_SINK,
+	TN_CONST,
+};
+
+static void tn_ramp(void* state, const float** in, float** out, int n, void* usr)
+{
+	float* phase = state;
+	for (int i = 0; i < n; i++) out[0][i] = (*phase)++;
+}
+
+static void tn_gain(void* state, const float** in, float** out, int n, void* usr)
+{
+	for (int i = 0; i < n; i++) out[0][i] = in[0][i] * 2;
+}
+
+static void tn_add(void* state, const float** in, float** out, int n, void* usr)
+{
+	for (int i = 0; i < n; i++) out[0][i] = in[0][i] + in[1][i];
+}
+
+static void tn_sink(void* state, const float** in, float** out, int n, void* usr)
+{
+	double* sum = state;
+	for (int i = 0; i < n; i++) {
+		*sum += in[0][i];
+		out[0][i] = in[0][i];
+	}
+}
+
+static void tn_const(void* state, const float** in, float** out, int n, void* usr)
+{
+	for (int i = 0; i < n; i++) out[0][i] = *(float*)state;
+}
+
+static void tn_const_set(void* state, int param, float value, void* usr)
+{
+	if (param == 0) *(float*)state = value;
+}
+
+static int tn_resolve(void* usr, struct l4d_node* node, struct l4e_proc* proc)
+{
+	switch (node->type) {
+	case TN_RAMP: *proc = (struct l4e_proc) { .n_out = 1, .state_size = sizeof(float), .process = tn_ramp }; return 0;
+	case TN_GAIN: *proc = (struct l4e_proc) { .n_in = 1, .n_out = 1, .process = tn_gain }; return 0;
+	case TN_ADD: *proc = (struct l4e_proc) { .n_in = 2, .n_out = 1, .process = tn_add }; return 0;
+	case TN_SINK: *proc = (struct l4e_proc) { .n_in = 1, .n_out = 1, .state_size = sizeof(double), .process = tn_sink }; return 0;
+	case TN_CONST: *proc = (struct l4e_proc) { .n_out = 1, .state_size = sizeof(float), .process = tn_const, .set = tn_const_set }; return 0;
+	}
+	return -1;
+}
+
+static struct l4e_host tn_host = { .resolve = tn_resolve };
+
+static int tn_add_node(struct l4d_container* c, int type)
+{
+	int i = l4d_node_add(c);
+	c->nodes[i].type = type;
+	return i;
+}
+
+static void test_compile_status(const char* name, struct l4d_container* c, enum l4e_status expected, int expected_where)
+{
+	struct l4e_plan plan;
+	enum l4e_status status = l4e_compile(&plan, c, &tn_host, 16);
+	int where = status == L4E_BAD_EDGE ? plan.err_edge : plan.err_node;
+	if (status == expected && where == expected_where) {
+		printf(OK "%s: status %d at %d\n", name, status, where);
+	} else {
+		printf(FAIL "%s: status %d at %d, expected %d at %d\n", name, status, where, expected, expected_where);
+		n_failed++;
+	}
+	l4e_free(&plan);
+}
+
+static void test_graph()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+
+	// added out of order, so the plan has to reorder them:
+	// sink <- add(gain(ramp), ramp + ramp); unconnected add input reads 0
+	int sink = tn_add_node(c, TN_SINK);
+	int add = tn_add_node(c, TN_ADD);
+	int gain = tn_add_node(c, TN_GAIN);
+	int ramp = tn_add_node(c, TN_RAMP);
+	int add2 = tn_add_node(c, TN_ADD);
+	l4d_connect(c, add, 0, sink, 0);
+	l4d_connect(c, gain, 0, add, 0);
+	l4d_connect(c, ramp, 0, gain, 0);
+	l4d_connect(c, ramp, 0, add, 1);
+	l4d_connect(c, ramp, 0, add, 1);
+
+	struct l4e_plan plan;
+	const int block = 7;
+	enum l4e_status status = l4e_compile(&plan, c, &tn_host, block);
+	assert(status == L4E_OK);
+	// out = 2t + 2t for t = 0, 1, ...; 3 blocks
+	double expected = 0;
+	for (int t = 0; t < block * 3; t++) expected += 4 * t;
+	for (int i = 0; i < 3; i++) l4e_process(&plan);
+	double sum = *(double*)plan.steps[plan.step_of_node[sink]].state;
+	const float* out = l4e_output(&plan, sink, 0);
+	const float* out2 = l4e_output(&plan, add2, 0);
+	if (sum == expected && out[block - 1] == 4 * (block * 3 - 1) && out2[0] == 0) {
+		printf(OK "graph of %d nodes: sum %g over 3 blocks\n", c->nodes_dy.n, sum);
+	} else {
+		printf(FAIL "graph of %d nodes: sum %g, last %g, expected %g and %d\n", c->nodes_dy.n, sum, out[block - 1], expected, 4 * (block * 3 - 1));
+		n_failed++;
+	}
+	l4e_free(&plan);
+
+	test_compile_status("ok", c, L4E_OK, -1);
+	int bad = l4d_connect(c, ramp, 0, gain, 5);
+	test_compile_status("bad port", c, L4E_BAD_EDGE, bad);
+	l4d_disconnect(c, bad);
+	if (l4d_connect(c, sink, 0, gain, 0) != -1) {
+		printf(FAIL "cycle: connected\n");
+		n_failed++;
+	}
+	// a project file can still have one
+	*(struct l4d_edge*)dynary_append(&c->edges_dy) = (struct l4d_edge) { .src = sink, .dst = gain };
+	test_compile_status("cycle", c, L4E_CYCLE, 0);
+	c->edges_dy.n--;
+	// sink, the first node left over, is only downstream of this one
+	*(struct l4d_edge*)dynary_append(&c->edges_dy) = (struct l4d_edge) { .src = add, .dst = gain };
+	test_compile_status("cycle upstream", c, L4E_CYCLE, add);
+	c->edges_dy.n--;
+	tn_add_node(c, 0);
+	test_compile_status("unresolved", c, L4E_UNRESOLVED, 5);
+
+	l4d_free(&d);
+}
+
+// a long chain of gains must come out in order whatever order it was added in
+static void test_chain()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	const int n = 1000;
+	int ramp = tn_add_node(c, TN_RAMP);
+	int prev = ramp;
+	for (int i = 0; i < 10; i++) tn_add_node(c, TN_GAIN);
+	for (int i = 0; i < 10; i++) {
+		int next = 10 - i;
+		l4d_connect(c, prev, 0, next, 0);
+		prev = next;
+	}
+	for (int i = 10; i < n; i++) {
+		int g = tn_add_node(c, TN_ADD);
+		l4d_connect(c, prev, 0, g, 0);
+		prev = g;
+	}
+	struct l4e_plan plan;
+	enum l4e_status status = l4e_compile(&plan, c, &tn_host, 4);
+	assert(status == L4E_OK);
+	l4e_process(&plan);
+	l4e_process(&plan);
+	const float* out = l4e_output(&plan, prev, 0);
+	if (out[3] == 7 * 1024) {
+		printf(OK "chain of %d nodes\n", n);
+	} else {
+		printf(FAIL "chain of %d nodes gave %g, expected %d\n", n, out[3], 7 * 1024);
+		n_failed++;
+	}
+	l4e_free(&plan);
+	l4d_free(&d);
+}
+
+// inlet -> add(., ramp) -> outlet, a ramp of its own per instance
+static struct l4d_container* tn_voice()
+{
+	struct l4d_container* v = l4d_container_new(NULL);
+	int in = tn_add_node(v, L4D_NODE_INLET);
+	int ramp = tn_add_node(v, TN_RAMP);
+	int add = tn_add_node(v, TN_ADD);
+	int out = tn_add_node(v, L4D_NODE_OUTLET);
+	l4d_connect(v, in, 0, add, 0);
+	l4d_connect(v, ramp, 0, add, 1);
+	l4d_connect(v, add, 0, out, 0);
+	return v;
+}
+
+// inlet -> child -> outlet, around whatever child holds
+static struct l4d_container* tn_wrap(struct l4d_container* child)
+{
+	struct l4d_container* w = l4d_container_new(NULL);
+	int in = tn_add_node(w, L4D_NODE_INLET);
+	int node = l4d_node_add(w);
+	l4d_node_set_container(w, node, child);
+	int out = tn_add_node(w, L4D_NODE_OUTLET);
+	l4d_connect(w, in, 0, node, 0);
+	l4d_connect(w, node, 0, out, 0);
+	return w;
+}
+
+// nested containers run as one flat schedule: an instance per container
+// node, no steps for boundaries, errors on the node of the root
+static void test_nested()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	int ok = 1;
+
+	// ramp -> voice -> voice -> sink, one voice container used twice, and
+	// the second one 8 wrappers deep
+	struct l4d_container* voice = tn_voice();
+	int ramp = tn_add_node(c, TN_RAMP);
+	int a = l4d_node_add(c);
+	l4d_container_retain(voice);
+	l4d_node_set_container(c, a, voice);
+	struct l4d_container* deep = voice;
+	const int depth = 8;
+	for (int i = 0; i < depth; i++) deep = tn_wrap(deep);
+	int b = l4d_node_add(c);
+	l4d_node_set_container(c, b, deep);
+	int sink = tn_add_node(c, TN_SINK);
+	l4d_connect(c, ramp, 0, a, 0);
+	l4d_connect(c, a, 0, b, 0);
+	l4d_connect(c, b, 0, sink, 0);
+
+	struct l4e_plan plan;
+	const int block = 8;
+	enum l4e_status status = l4e_compile(&plan, c, &tn_host, block);
+	assert(status == L4E_OK);
+	// the ramp, two ramps and adds, the sink
+	ok &= plan.n_steps == 6;
+	// ramp + (ramp + ramp): if the voices shared state, their ramps would
+	// count twice as fast
+	for (int i = 0; i < 3; i++) l4e_process(&plan);
+	const float* out = l4e_output(&plan, sink, 0);
+	for (int k = 0; k < block; k++) ok &= out[k] == 3 * (2 * block + k);
+	// the inner add of the deep voice
+	int path[16] = { b };
+	for (int i = 0; i < depth; i++) path[1 + i] = 1;
+	path[1 + depth] = 2;
+	int add = l4e_node_at(&plan, path, depth + 2);
+	ok &= plan.step_of_node[add] >= 0 && l4e_output(&plan, add, 0)[block - 1] == out[block - 1];
+	l4e_free(&plan);
+
+	// an inlet wired straight to an outlet is just a wire
+	struct l4d_container* wire = l4d_container_new(NULL);
+	int in = tn_add_node(wire, L4D_NODE_INLET);
+	int outlet = tn_add_node(wire, L4D_NODE_OUTLET);
+	l4d_connect(wire, in, 0, outlet, 0);
+	int w = l4d_node_add(c);
+	l4d_node_set_container(c, w, wire);
+	int gain = tn_add_node(c, TN_GAIN);
+	l4d_connect(c, ramp, 0, w, 0);
+	l4d_connect(c, w, 0, gain, 0);
+	status = l4e_compile(&plan, c, &tn_host, block);
+	assert(status == L4E_OK);
+	ok &= plan.n_steps == 7;
+	l4e_process(&plan);
+	for (int k = 0; k < block; k++) ok &= l4e_output(&plan, gain, 0)[k] == 2 * k;
+	l4e_free(&plan);
+
+	if (ok) {
+		printf(OK "nested: %d levels deep in one flat schedule\n", depth);
+	} else {
+		printf(FAIL "nested: wrong steps or output\n");
+		n_failed++;
+	}
+
+	// a loop through the wire, a bad port inside, a container in itself
+	*(struct l4d_edge*)dynary_append(&c->edges_dy) = (struct l4d_edge) { .src = gain, .dst = w };
+	test_compile_status("cycle through a wire", c, L4E_CYCLE, gain);
+	c->edges_dy.n--;
+	struct l4d_container* bad = tn_voice();
+	l4d_connect(bad, 2, 3, 3, 0);
+	int x = l4d_node_add(c);
+	l4d_node_set_container(c, x, bad);
+	test_compile_status("bad port inside", c, L4E_BAD_EDGE, -1);
+	l4d_disconnect(bad, bad->edges_dy.n - 1);
+	test_compile_status("bad port removed", c, L4E_OK, -1);
+	int self = l4d_node_add(bad);
+	l4d_node_set_container(bad, self, bad);
+	l4d_container_retain(bad);
+	test_compile_status("container in itself", c, L4E_CYCLE, x);
+	// break the loop of references, so bad is freed
+	bad->nodes[self].type = TN_GAIN;
+	l4d_container_release(bad);
+
+	l4d_free(&d);
+}
+
+// a random dag of every test node type, with some inputs left unconnected and
+// some mixed
+static void tn_random_graph(struct l4d_container* c, int n, unsigned seed)
+{
+	srand(seed);
+	for (int i = 0; i < n; i++) {
+		int type = i < 16 ? TN_RAMP : TN_GAIN + rand() % 3;
+		tn_add_node(c, type);
+		int n_in = type == TN_ADD ? 2 : type == TN_RAMP ? 0 : 1;
+		for (int p = 0; p < n_in; p++) {
+			int n_src = rand() % 4 == 0 ? 2 : 1;
+			if (rand() % 16 == 0) n_src = 0;
+			for (int k = 0; k < n_src; k++) {
+				// mostly recent nodes, so there are long paths as well as wide ones
+				int span = rand() % 2 ? 32 : i;
+				if (span > i) span = i;
+				l4d_connect(c, i - 1 - rand() % span, 0, i, p);
+			}
+		}
+	}
+}
+
+// every output and state of plan, after n_blocks
+static char* tn_snapshot(struct l4e_plan* plan, size_t* size)
+{
+	size_t block = plan->block_size * sizeof(float);
+	int n_outs = 0;
+	for (int s = 0; s < plan->n_steps; s++) n_outs += plan->steps[s].proc.n_out;
+	*size = n_outs * block + plan->n_steps * sizeof(double);
+	char* snap = calloc(1, *size);
+	assert(snap != NULL);
+	char* p = snap;
+	for (int s = 0; s < plan->n_steps; s++) {
+		struct l4e_step* st = &plan->steps[s];
+		for (int k = 0; k < st->proc.n_out; k++, p += block) memcpy(p, st->out[k], block);
+		memcpy(p, st->state, st->proc.state_size);
+		p += sizeof(double);
+	}
+	return snap;
+}
+
+static void test_pool()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	const int n_nodes = 3000;
+	const int n_blocks = 5;
+	tn_random_graph(c, n_nodes, 4);
+	struct l4d_container* small_c = l4d_container_new(&d);
+	tn_random_graph(small_c, 20, 5);
+
+	struct l4e_plan plan;
+	enum l4e_status status = l4e_compile(&plan, c, &tn_host, 16);
+	assert(status == L4E_OK);
+	for (int i = 0; i < n_blocks; i++) l4e_process(&plan);
+	size_t size;
+	char* expected = tn_snapshot(&plan, &size);
+	l4e_free(&plan);
+
+	static const int threads[] = { 1, 2, 3, 8 };
+	for (int flags = 0; flags <= L4E_POOL_CRITICAL_PATH; flags++) {
+		for (int i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+			struct l4e_pool pool;
+			l4e_pool_init(&pool, threads[i], flags);
+			// a small plan first, so the deques have to grow for the big one
+			struct l4e_plan small;
+			status = l4e_compile(&small, small_c, &tn_host, 16);
+			assert(status == L4E_OK);
+			l4e_pool_process(&pool, &small);
+			l4e_free(&small);
+
+			status = l4e_compile(&plan, c, &tn_host, 16);
+			assert(status == L4E_OK);
+			for (int b = 0; b < n_blocks; b++) l4e_pool_process(&pool, &plan);
+			size_t got_size;
+			char* got = tn_snapshot(&plan, &got_size);
+			if (got_size == size && memcmp(got, expected, size) == 0) {
+				printf(OK "pool of %d thread(s), flags %d: %d nodes match l4e_process()\n", threads[i], flags, n_nodes);
+			} else {
+				printf(FAIL "pool of %d thread(s), flags %d: %d nodes differ from l4e_process()\n", threads[i], flags, n_nodes);
+				n_failed++;
+			}
+			free(got);
+			l4e_free(&plan);
+			l4e_pool_free(&pool);
+		}
+	}
+	free(expected);
+	l4d_free(&d);
+}
+
+// const -> gain; the engine outputs twice the last value set
+static struct l4e_plan* tn_engine_plan(struct l4d_container* c)
+{
+	struct l4e_plan* plan = malloc(sizeof(*plan));
+	assert(plan != NULL);
+	enum l4e_status status = l4e_compile(plan, c, &tn_host, 8);
+	assert(status == L4E_OK);
+	return plan;
+}
+
+static float tn_engine_out(struct l4e_engine* e)
+{
+	return l4e_output(e->plan, 1, 0)[7];
+}
+
+static void test_engine_ring()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	int node = tn_add_node(c, TN_CONST);
+	l4d_connect(c, node, 0, tn_add_node(c, TN_GAIN), 0);
+
+	struct l4e_engine e;
+	l4e_engine_init(&e, 4, NULL);
+	int ok = l4e_engine_process(&e) == 0;
+
+	struct l4e_cmd cmd = { .type = L4E_CMD_PLAN, .plan = tn_engine_plan(c) };
+	ok &= l4e_engine_send(&e, &cmd) == 0;
+	cmd = (struct l4e_cmd) { .type = L4E_CMD_SET, .node = 0, .value = 3 };
+	ok &= l4e_engine_send(&e, &cmd) == 0;
+	ok &= l4e_engine_process(&e) == 1 && tn_engine_out(&e) == 6;
+
+	// full after 4 commands; none of them reach a node that can't take them
+	int n_sent = 0;
+	for (int i = 0; i < 5; i++) {
+		cmd = (struct l4e_cmd) { .type = L4E_CMD_SET, .node = i % 3, .value = 10 + i };
+		if (l4e_engine_send(&e, &cmd) == 0) n_sent++;
+	}
+	ok &= n_sent == 4;
+	l4e_engine_process(&e);
+	ok &= tn_engine_out(&e) == 2 * 13;
+
+	// a new plan keeps what was set, and the old one comes back
+	cmd = (struct l4e_cmd) { .type = L4E_CMD_PLAN, .plan = tn_engine_plan(c) };
+	l4e_engine_send(&e, &cmd);
+	ok &= l4e_engine_collect(&e) == 0;
+	l4e_engine_process(&e);
+	ok &= tn_engine_out(&e) == 2 * 13 && l4e_engine_collect(&e) == 1;
+
+	if (ok) {
+		printf(OK "engine commands over %d blocks\n", e.n_blocks);
+	} else {
+		printf(FAIL "engine commands\n");
+		n_failed++;
+	}
+	l4e_engine_free(&e);
+	l4d_free(&d);
+}
+
+// state follows nodes into a plan of an edited container, nested ones too,
+// though removing a node moves another to its index
+static void test_carry()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	d.root_container = l4d_container_new(&d);
+	struct l4d_container* c = d.root_container;
+	int gone = tn_add_node(c, TN_RAMP);
+	int ramp = tn_add_node(c, TN_RAMP);
+	int cnst = tn_add_node(c, TN_CONST);
+	int voice = l4d_node_add(c);
+	l4d_node_set_container(c, voice, tn_voice());
+	l4d_connect(c, cnst, 0, voice, 0);
+	struct l4d_handle h_ramp = l4d_handle(c, ramp);
+	struct l4d_handle h_cnst = l4d_handle(c, cnst);
+	struct l4d_handle h_voice = l4d_handle(c, voice);
+
+	struct l4d_container* snap = l4d_snapshot(&d);
+	struct l4e_plan a;
+	enum l4e_status status = l4e_compile(&a, snap, &tn_host, 8);
+	assert(status == L4E_OK);
+	struct l4e_step* st = &a.steps[a.step_of_node[cnst]];
+	st->proc.set(st->state, 0, 5, st->proc.usr);
+	for (int i = 0; i < 3; i++) l4e_process(&a);
+
+	c = l4d_mutable(&d, NULL, 0);
+	l4d_node_remove(c, gone);
+	tn_add_node(c, TN_RAMP);
+	struct l4d_container* snap2 = l4d_snapshot(&d);
+	struct l4e_plan b;
+	status = l4e_compile(&b, snap2, &tn_host, 8);
+	assert(status == L4E_OK);
+	l4e_carry(&b, &a);
+	l4e_process(&b);
+
+	// blocks 0-2 ran before, so block 3 is 24 on; the voice adds its own ramp
+	int n_ramp = l4d_node_of(snap2, h_ramp);
+	int n_cnst = l4d_node_of(snap2, h_cnst);
+	int n_voice = l4d_node_of(snap2, h_voice);
+	int ok = n_ramp != ramp || n_cnst != cnst || n_voice != voice;
+	ok &= l4e_output(&b, n_ramp, 0)[0] == 24;
+	ok &= l4e_output(&b, n_cnst, 0)[0] == 5;
+	const int path[] = { n_voice, 2 };
+	ok &= l4e_output(&b, l4e_node_at(&b, path, 2), 0)[0] == 5 + 24;
+	// the new node starts from zero
+	ok &= l4e_output(&b, snap2->nodes_dy.n - 1, 0)[0] == 0;
+
+	if (ok) {
+		printf(OK "state carried over to a plan of the edited container\n");
+	} else {
+		printf(FAIL "state carried over to a plan of the edited container\n");
+		n_failed++;
+	}
+	l4e_free(&a);
+	l4e_free(&b);
+	l4d_container_release(snap);
+	l4d_container_release(snap2);
+	l4d_free(&d);
+}
+
+struct tn_engine_thread {
+	struct l4e_engine* e;
+	int done, finished;
+};
+
+static void* tn_engine_thread(void* usr)
+{
+	struct tn_engine_thread* t = usr;
+	struct l4e_engine* e = t->e;
+	for (;;) {
+		int done = __atomic_load_n(&t->done, __ATOMIC_ACQUIRE);
+		l4e_engine_process(e);
+		if (done && __atomic_load_n(&e->commands.head, __ATOMIC_ACQUIRE) == e->commands.tail) break;
+	}
+	__atomic_store_n(&t->finished, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+// the UI swaps plans and sets values while the engine runs blocks
+static void test_engine_threads()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	int node = tn_add_node(c, TN_CONST);
+	l4d_connect(c, node, 0, tn_add_node(c, TN_GAIN), 0);
+
+	struct l4e_pool pool;
+	// grown by the first plan sent
+	l4e_pool_init(&pool, 2, 0);
+	struct l4e_engine e;
+	l4e_engine_init(&e, 8, &pool);
+	struct tn_engine_thread t = { .e = &e };
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, tn_engine_thread, &t);
+	assert(err == 0);
+
+	const int n = 500;
+	int n_collected = 0;
+	for (int i = 0; i < n; i++) {
+		struct l4e_cmd cmds[] = {
+			{ .type = L4E_CMD_PLAN, .plan = tn_engine_plan(c) },
+			{ .type = L4E_CMD_SET, .node = 0, .value = i },
+		};
+		for (int j = 0; j < 2; j++) {
+			while (l4e_engine_send(&e, &cmds[j]) != 0) {
+				n_collected += l4e_engine_collect(&e);
+				sched_yield();
+			}
+		}
+	}
+	__atomic_store_n(&t.done, 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&t.finished, __ATOMIC_ACQUIRE)) {
+		n_collected += l4e_engine_collect(&e);
+		sched_yield();
+	}
+	pthread_join(thread, NULL);
+	n_collected += l4e_engine_collect(&e);
+
+	if (n_collected == n - 1 && tn_engine_out(&e) == 2 * (n - 1) && pool.capacity >= c->nodes_dy.n) {
+		printf(OK "engine thread: %d plans, %d retired, %d blocks\n", n, n_collected, e.n_blocks);
+	} else {
+		printf(FAIL "engine thread: %d plans, %d retired, out %g\n", n, n_collected, tn_engine_out(&e));
+		n_failed++;
+	}
+	l4e_engine_free(&e);
+	l4e_pool_free(&pool);
+	l4d_free(&d);
+}
+
+// root: [a]; a: [ramp, sink]. the engine runs a snapshot while the document
+// moves on
+static void test_snapshot()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* root = l4d_container_new(&d);
+	d.root_container = root;
+	struct l4d_container* a = l4d_container_new(NULL);
+	int ramp = tn_add_node(a, TN_RAMP);
+	l4d_connect(a, ramp, 0, tn_add_node(a, TN_SINK), 0);
+	l4d_node_set_container(root, l4d_node_add(root), a);
+
+	struct l4d_container* snap = l4d_snapshot(&d);
+	int path[] = { 0 };
+	struct l4d_container* a2 = l4d_mutable(&d, path, 1);
+	l4d_connect(a2, ramp, 0, tn_add_node(a2, TN_GAIN), 0);
+	struct l4e_plan plan;
+	int ok = l4e_compile(&plan, snap->nodes[0].container, &tn_host, 4) == L4E_OK && plan.n_steps == 2;
+	l4e_free(&plan);
+	ok &= l4e_compile(&plan, a2, &tn_host, 4) == L4E_OK && plan.n_steps == 3;
+	l4e_free(&plan);
+
+	l4d_container_release(snap);
+	if (ok) {
+		printf(OK "snapshot compiled while edited\n");
+	} else {
+		printf(FAIL "snapshot\n");
+		n_failed++;
+	}
+	l4d_free(&d);
+}
+
+// root: [a]; a: [ramp, sink], run in place from a project file opened without
+// L4D_OPEN_VERIFY, and again once an edit copies it out
+static void test_file()
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/l4e-test-project-%d", (int)getpid());
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* root = l4d_container_new(&d);
+	d.root_container = root;
+	struct l4d_container* a = l4d_container_new(NULL);
+	int ramp = tn_add_node(a, TN_RAMP);
+	l4d_connect(a, ramp, 0, tn_add_node(a, TN_SINK), 0);
+	l4d_node_set_container(root, l4d_node_add(root), a);
+	int ok = l4d_save(root, path) == L4D_FILE_OK;
+	l4d_free(&d);
+
+	ok &= l4d_open(&d, path, 0) == L4D_FILE_OK;
+	remove(path);
+	struct l4e_plan plan;
+	ok &= l4e_compile(&plan, d.root_container, &tn_host, 4) == L4E_OK && plan.n_steps == 2;
+	l4e_process(&plan);
+	ok &= *(double*)plan.steps[plan.step_of_node[2]].state == 0 + 1 + 2 + 3;
+	l4e_free(&plan);
+
+	int path_a[] = { 0 };
+	a = l4d_mutable(&d, path_a, 1);
+	tn_add_node(a, TN_GAIN);
+	ok &= a->map == NULL && l4e_compile(&plan, a, &tn_host, 4) == L4E_OK && plan.n_steps == 3;
+	l4e_process(&plan);
+	ok &= *(double*)plan.steps[plan.step_of_node[1]].state == 0 + 1 + 2 + 3;
+	l4e_free(&plan);
+	l4d_free(&d);
+
+	if (ok) {
+		printf(OK "project file compiled in place and copied out\n");
+	} else {
+		printf(FAIL "project file\n");
+		n_failed++;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	test_graph();
+	test_chain();
+	test_nested();
+	test_pool();
+	test_engine_ring();
+	test_carry();
+	test_engine_threads();
+	test_snapshot();
+	test_file();
+
+	if (n_failed) {
+		printf("\n %d TEST(S) FAILED\n", n_failed);
+		return EXIT_FAILURE;
+	} else {
+		printf("\n ALL TESTS PASSED\n");
+		return EXIT_SUCCESS;
+	}
+}
+
+#endif
+
+
+
+#ifdef BENCH
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+engine throughput benchmark; runs graphs of width parallel chains of depth
+nodes each (a fan-in sums them at the end) and reports time per block and
+per node, with l4e_process() (threads 0) and with pools of 1, 2, 4, ... up to
+max_threads. prints one JSON object per line
+
+usage: l4e_bench [max_nodes] [max_threads]
+*/
+
+#define BENCH_MIN_SECONDS (0.25)
+#define BENCH_BLOCK (64)
+
+static double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a one-pole lowpass; enough arithmetic per sample to not be all overhead
+static void bn_lowpass(void* state, const float** in, float** out, int n, void* usr)
+{
+	float* z = state;
+	float y = *z;
+	for (int i = 0; i < n; i++) {
+		y += (in[0][i] - y) * 0.25f;
+		out[0][i] = y;
+	}
+	*z = y;
+}
+
+static void bn_osc(void* state, const float** in, float** out, int n, void* usr)
+{
+	float* phase = state;
+	for (int i = 0; i < n; i++) {
+		*phase += 0.01f;
+		if (*phase > 1) *phase -= 2;
+		out[0][i] = *phase;
+	}
+}
+
+static void bn_sink(void* state, const float** in, float** out, int n, void* usr)
+{
+	for (int i = 0; i < n; i++) out[0][i] = in[0][i];
+}
+
+static int bn_resolve(void* usr, struct l4d_node* node, struct l4e_proc* proc)
+{
+	static const struct l4e_proc procs[] = {
+		{ .n_out = 1, .state_size = sizeof(float), .process = bn_osc },
+		{ .n_in = 1, .n_out = 1, .state_size = sizeof(float), .process = bn_lowpass },
+		{ .n_in = 1, .n_out = 1, .process = bn_sink },
+	};
+	*proc = procs[node->type];
+	return 0;
+}
+
+static void bench_graph(int width, int depth, int threads)
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	int sink = l4d_node_add(c);
+	c->nodes[sink].type = 2;
+	for (int w = 0; w < width; w++) {
+		int prev = l4d_node_add(c);
+		for (int i = 0; i < depth; i++) {
+			int n = l4d_node_add(c);
+			c->nodes[n].type = 1;
+			l4d_connect(c, prev, 0, n, 0);
+			prev = n;
+		}
+		l4d_connect(c, prev, 0, sink, 0);
+	}
+
+	struct l4e_host host = { .resolve = bn_resolve };
+	struct l4e_plan plan;
+	double t0 = bench_now();
+	enum l4e_status status = l4e_compile(&plan, c, &host, BENCH_BLOCK);
+	assert(status == L4E_OK);
+	double compile_s = bench_now() - t0;
+
+	struct l4e_pool pool;
+	if (threads > 0) l4e_pool_init(&pool, threads, L4E_POOL_CRITICAL_PATH);
+	int n_blocks = 0;
+	double dt;
+	t0 = bench_now();
+	do {
+		if (threads > 0) {
+			l4e_pool_process(&pool, &plan);
+		} else {
+			l4e_process(&plan);
+		}
+		n_blocks++;
+		dt = bench_now() - t0;
+	} while (dt < BENCH_MIN_SECONDS);
+	if (threads > 0) l4e_pool_free(&pool);
+
+	int n_nodes = c->nodes_dy.n;
+	printf("{\"width\":%d,\"depth\":%d,\"nodes\":%d,\"threads\":%d,\"block\":%d,\"compile_ms\":%.3f,\"blocks\":%d,"
+		"\"us_per_block\":%.3f,\"ns_per_node\":%.2f,\"realtime_x\":%.1f}\n",
+		width, depth, n_nodes, threads, BENCH_BLOCK, compile_s * 1e3, n_blocks,
+		dt / n_blocks * 1e6, dt / n_blocks / n_nodes * 1e9,
+		n_blocks * BENCH_BLOCK / 48000.0 / dt);
+	fflush(stdout);
+
+	l4e_free(&plan);
+	l4d_free(&d);
+}
+
+// project files: save, and open with and without L4D_OPEN_VERIFY, a chain of
+// n nodes spread over containers of 1024
+static void bench_file(int n)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/l4e-bench-project-%d", (int)getpid());
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* root = l4d_container_new(&d);
+	d.root_container = root;
+	for (int i = 0; i < n; i += 1024) {
+		struct l4d_container* c = l4d_container_new(NULL);
+		for (int j = 0; j < 1024 && i + j < n; j++) {
+			int k = l4d_node_add(c);
+			c->nodes[k].type = 1;
+			c->nodes[k].meta.x = j;
+			if (k > 0) l4d_connect(c, k - 1, 0, k, 0);
+		}
+		l4d_node_set_container(root, l4d_node_add(root), c);
+	}
+	double t0 = bench_now();
+	enum l4d_file_status status = l4d_save(root, path);
+	assert(status == L4D_FILE_OK);
+	double save_s = bench_now() - t0;
+	l4d_free(&d);
+
+	double open_s[2];
+	for (int verify = 0; verify < 2; verify++) {
+		t0 = bench_now();
+		status = l4d_open(&d, path, verify ? L4D_OPEN_VERIFY : 0);
+		assert(status == L4D_FILE_OK);
+		open_s[verify] = bench_now() - t0;
+		l4d_free(&d);
+	}
+	remove(path);
+	printf("{\"file_nodes\":%d,\"save_ms\":%.3f,\"open_ms\":%.3f,\"open_verify_ms\":%.3f}\n",
+		n, save_s * 1e3, open_s[0] * 1e3, open_s[1] * 1e3);
+	fflush(stdout);
+}
+
+/*
+a hierarchy depth containers deep, each an inlet -> lowpass -> the next
+container -> outlet (the innermost is inlet -> lowpass -> outlet), against
+the flat chain of depth lowpasses it is the same as
+*/
+static void bench_nested(int depth)
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4e_host host = { .resolve = bn_resolve };
+	double us_per_block[2], compile_ms[2];
+	int n_steps[2];
+	for (int nested = 0; nested < 2; nested++) {
+		struct l4d_container* c = l4d_container_new(&d);
+		int osc = l4d_node_add(c);
+		int sink = l4d_node_add(c);
+		c->nodes[sink].type = 2;
+		if (nested) {
+			struct l4d_container* inner = NULL;
+			for (int i = 0; i < depth; i++) {
+				struct l4d_container* level = l4d_container_new(NULL);
+				int in = l4d_node_add(level);
+				level->nodes[in].type = L4D_NODE_INLET;
+				int lp = l4d_node_add(level);
+				level->nodes[lp].type = 1;
+				int out = l4d_node_add(level);
+				level->nodes[out].type = L4D_NODE_OUTLET;
+				l4d_connect(level, in, 0, lp, 0);
+				int prev = lp;
+				if (inner != NULL) {
+					prev = l4d_node_add(level);
+					l4d_node_set_container(level, prev, inner);
+					l4d_connect(level, lp, 0, prev, 0);
+				}
+				l4d_connect(level, prev, 0, out, 0);
+				inner = level;
+			}
+			int top = l4d_node_add(c);
+			l4d_node_set_container(c, top, inner);
+			l4d_connect(c, osc, 0, top, 0);
+			l4d_connect(c, top, 0, sink, 0);
+		} else {
+			int prev = osc;
+			for (int i = 0; i < depth; i++) {
+				int n = l4d_node_add(c);
+				c->nodes[n].type = 1;
+				l4d_connect(c, prev, 0, n, 0);
+				prev = n;
+			}
+			l4d_connect(c, prev, 0, sink, 0);
+		}
+
+		struct l4e_plan plan;
+		double t0 = bench_now();
+		enum l4e_status status = l4e_compile(&plan, c, &host, BENCH_BLOCK);
+		assert(status == L4E_OK);
+		compile_ms[nested] = (bench_now() - t0) * 1e3;
+		n_steps[nested] = plan.n_steps;
+		int n_blocks = 0;
+		double dt;
+		t0 = bench_now();
+		do {
+			l4e_process(&plan);
+			n_blocks++;
+			dt = bench_now() - t0;
+		} while (dt < BENCH_MIN_SECONDS);
+		us_per_block[nested] = dt / n_blocks * 1e6;
+		l4e_free(&plan);
+	}
+	printf("{\"nested_depth\":%d,\"flat_steps\":%d,\"nested_steps\":%d,\"flat_compile_ms\":%.3f,\"nested_compile_ms\":%.3f,"
+		"\"flat_us_per_block\":%.3f,\"nested_us_per_block\":%.3f}\n",
+		depth, n_steps[0], n_steps[1], compile_ms[0], compile_ms[1], us_per_block[0], us_per_block[1]);
+	fflush(stdout);
+	l4d_free(&d);
+}
+
+/*
+wire drags on a graph of n nodes and 2n edges, each undone again: between
+nodes up to 64 apart in the order, either way (as in patching nearby nodes),
+and between any two nodes. against building the rows and order from scratch,
+which an edit would otherwise take
+*/
+static void bench_order(int n)
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	srand(3);
+	for (int i = 0; i < n; i++) l4d_node_add(c);
+	for (int i = 0; i < 2 * n; i++) {
+		// forward in index order, so nothing is refused; half of them short
+		int src = rand() % (n - 1);
+		int span = i % 2 ? n - 1 - src : 16;
+		int dst = src + 1 + rand() % (span < n - 1 - src ? span : n - 1 - src);
+		l4d_connect(c, src, 0, dst, 0);
+	}
+	const int n_drags = 20000;
+	double drag_s[2];
+	int n_refused[2] = { 0, 0 };
+	for (int far = 0; far < 2; far++) {
+		double t0 = bench_now();
+		for (int i = 0; i < n_drags; i++) {
+			int src = rand() % n;
+			int dst = rand() % n;
+			if (!far) {
+				int k = rand() % n;
+				int k2 = k + rand() % 129 - 64;
+				k2 = k2 < 0 ? 0 : k2 >= n ? n - 1 : k2;
+				const int* order = l4d_order(c);
+				src = order[k];
+				dst = order[k2];
+			}
+			int edge = l4d_connect(c, src, 0, dst, 0);
+			if (edge < 0) {
+				n_refused[far]++;
+			} else {
+				l4d_disconnect(c, edge);
+			}
+		}
+		drag_s[far] = (bench_now() - t0) / n_drags;
+	}
+
+	// the same graph, as opened from a project file
+	struct l4d_container* f = l4d_container_new(&d);
+	for (int i = 0; i < n; i++) l4d_node_add(f);
+	for (int i = 0; i < c->edges_dy.n; i++) *(struct l4d_edge*)dynary_append(&f->edges_dy) = c->edges[i];
+	double t0 = bench_now();
+	const int* order = l4d_order(f);
+	double build_s = bench_now() - t0;
+	assert(order != NULL);
+	int n_edges = c->edges_dy.n;
+
+	// removing nodes (and their edges) keeps the order, and handles
+	const int n_removes = 256;
+	struct l4d_handle h = l4d_handle(c, n - 1);
+	t0 = bench_now();
+	for (int i = 0; i < n_removes; i++) {
+		int node = rand() % c->nodes_dy.n;
+		if (node != l4d_node_of(c, h)) l4d_node_remove(c, node);
+	}
+	double remove_s = (bench_now() - t0) / n_removes;
+	assert(l4d_node_of(c, h) >= 0 && l4d_order(c) != NULL);
+
+	printf("{\"order_nodes\":%d,\"edges\":%d,\"near_refused\":%d,\"us_per_near_drag\":%.3f,\"far_refused\":%d,\"us_per_far_drag\":%.3f,\"rebuild_us\":%.1f,\"us_per_remove\":%.3f}\n",
+		n, n_edges, n_refused[0], drag_s[0] * 1e6, n_refused[1], drag_s[1] * 1e6, build_s * 1e6, remove_s * 1e6);
+	fflush(stdout);
+	l4d_free(&d);
+}
+
+int main(int argc, char** argv)
+{
+	int max_nodes = argc > 1 ? atoi(argv[1]) : 1 << 20;
+	for (int depth = 16; depth <= 4096; depth <<= 4) bench_nested(depth);
+	for (int n = 1 << 10; n <= max_nodes; n <<= 4) bench_order(n);
+	for (int n = 1 << 10; n <= max_nodes; n <<= 4) bench_file(n);
+	int max_threads = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+	for (int n = 1 << 10; n <= max_nodes; n <<= 4) {
+		for (int t = 0; t <= max_threads; t = t ? t * 2 : 1) bench_graph(n / 16, 16, t);
+		for (int t = 0; t <= max_threads; t = t ? t * 2 : 1) bench_graph(16, n / 16, t);
+	}
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef L4E_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "l4d.h"
+
+/*
+dataflow engine for l4d containers. l4e_compile() turns a container into a
+plan: its nodes in topological order (along edges), each with the input and
+output buffers it reads and writes, and every buffer and node state
+allocated up front. l4e_process() then runs the plan for one block of
+block_size samples at a time and allocates nothing. there is no dependency
+on the UI, so tests and benchmarks can drive it directly.
+
+what a node does is up to the host: its resolve() callback is asked for a
+struct l4e_proc for every node in the container, except for container
+nodes, inlets and outlets. those are the engine's: every container node is
+replaced by an instance of its container, with state of its own, and wires
+are traced through inlets and outlets, so the plan is one flat schedule
+however deep containers nest, with no steps or copies at their boundaries.
+plan nodes are the nodes of c, at their indices, then the nodes of every
+instance (see l4e_node_at())
+*/
+
+struct l4e_proc {
+	int n_in, n_out;
+	size_t state_size; // zeroed by l4e_compile(), kept across blocks (see l4e_carry())
+
+	// in[] and out[] have n floats each. in[] are never NULL; unconnected
+	// inputs read zeros, and inputs with several edges read their sum
+	void (*process)(void* state, const float** in, float** out, int n, void* usr);
+	// may be NULL; called between blocks for L4E_CMD_SET
+	void (*set)(void* state, int param, float value, void* usr);
+	void* usr;
+};
+
+struct l4e_host {
+	// returns 0 and fills proc (which is zeroed) if the node can run
+	int (*resolve)(void* usr, struct l4d_node* node, struct l4e_proc* proc);
+	void* usr;
+};
+
+enum l4e_status {
+	L4E_OK = 0,
+	L4E_UNRESOLVED, // resolve() failed for err_node
+	L4E_BAD_EDGE, // edge err_edge refers to a missing node or port
+	L4E_CYCLE, // err_node is on a cycle
+};
+// errors inside a nested container are reported on the node of c it is in,
+// with err_edge -1
+
+// inputs with several edges are summed into dst before the step runs
+struct l4e_mix {
+	float* dst;
+	int src, n_src; // range in plan->mix_srcs
+};
+
+struct l4e_step {
+	struct l4e_proc proc;
+	void* state;
+	const float** in;
+	float** out;
+	int mix, n_mix; // range in plan->mixes
+	int node;
+};
+
+struct l4e_plan {
+	int block_size;
+	int n_steps;
+	struct l4e_step* steps; // in topological order
+	int n_nodes; // of c and of every instance
+	int* step_of_node; // indexed by node; -1 for containers, inlets and outlets
+	int* child_base; // indexed by node; where a container's instance starts, else -1
+
+	const float** ins;
+	float** outs;
+	struct l4e_mix* mixes;
+	const float** mix_srcs;
+
+	void* buffers; // every buffer, cache line aligned
+	size_t stride; // floats between buffers
+	void* states;
+
+	// step dependencies, for l4e_pool_process(). succs is CSR by step
+	// (one entry per edge), prio is the longest path to a sink in steps
+	int* succ_base;
+	int* succs;
+	int* n_preds;
+	int* pending; // counts down to 0 within a block, reset by each step
+	int* prio;
+	int n_roots;
+	int* roots; // steps without predecessors, in step order
+	int* roots_by_prio; // the same, lowest priority first
+
+	// by step, a hash of the handles from c down to its node, which names
+	// the node in any plan compiled from a later version of c; looked up
+	// through keys_table (steps + 1, 0 for none, keys_mask + 1 entries)
+	uint64_t* keys;
+	int* keys_table;
+	int keys_mask;
+
+	int err_node, err_edge;
+};
+
+enum l4e_status l4e_compile(struct l4e_plan* plan, struct l4d_container* c, struct l4e_host* host, int block_size);
+void l4e_free(struct l4e_plan* plan);
+
+// runs every step once
+void l4e_process(struct l4e_plan* plan);
+
+// buffer written by an output port in the last l4e_process()
+const float* l4e_output(struct l4e_plan* plan, int node, int port);
+
+// the plan node of the node at path: node indices from c down through
+// container nodes, as for l4d_mutable(), then the node itself
+int l4e_node_at(struct l4e_plan* plan, const int* path, int depth);
+
+// copies the state of every step of from to the step of the same node in to,
+// if it runs the same process() with the same state_size; so values set with
+// proc.set() and running state (phases, filters) live on in the next plan.
+// allocates nothing, and takes time in from's steps and state
+void l4e_carry(struct l4e_plan* to, const struct l4e_plan* from);
+
+/*
+parallel execution. a pool is a fixed set of worker threads; the thread
+calling l4e_pool_process() is worker 0 and the others are started by
+l4e_pool_init(). every worker has a lock-free deque of ready steps (Chase-Lev:
+the owner pushes and takes at the bottom, thieves steal at the top), and a
+step becomes ready when the atomic count of its unfinished predecessors hits
+zero. idle workers steal from a random victim.
+
+output is bit for bit the same as l4e_process() with any number of threads:
+every buffer has exactly one writer, a step only runs once all of its inputs
+are written, and mixes are summed in a fixed order by the step reading them.
+node state is only touched by its own step
+
+with L4E_POOL_CRITICAL_PATH a worker continues with the ready successor that
+has the longest path left, and roots are queued so the longest chains start
+first. between blocks, workers spin for a while and then sleep on a futex.
+starting a block takes no lock (a generation counter is bumped, and only
+sleeping workers cost a wake-up call), and worker 0 returns as soon as the
+last step has run; a worker still leaving the block is waited for by the
+next one, if at all
+*/
+
+enum {
+	L4E_POOL_CRITICAL_PATH = 1,
+};
+
+struct l4e_deque {
+	long top __attribute__((aligned(64)));
+	long bottom __attribute__((aligned(64)));
+	int* items;
+	long mask;
+};
+
+struct l4e_worker {
+	struct l4e_pool* pool;
+	int index;
+	unsigned rng;
+	pthread_t thread;
+	struct l4e_deque deque;
+} __attribute__((aligned(64)));
+
+struct l4e_pool {
+	int n_workers;
+	int flags;
+	struct l4e_worker* workers;
+	struct l4e_plan* plan;
+	long capacity; // of every deque
+
+	int* items; // of every deque, in one block
+
+	int remaining __attribute__((aligned(64))); // steps left in the block
+	unsigned gen; // bumped to start a block; a futex
+	int n_sleeping; // workers waiting on gen
+	int n_active; // workers (besides 0) in a block
+	int quit;
+};
+
+void l4e_pool_init(struct l4e_pool* pool, int n_threads, int flags);
+void l4e_pool_free(struct l4e_pool* pool);
+
+// makes room for plans of up to n_steps; not while a block is running. an
+// engine's pool grows through l4e_engine_send() instead
+void l4e_pool_reserve(struct l4e_pool* pool, int n_steps);
+
+// same as l4e_process(), on every worker. the only allocation is
+// l4e_pool_reserve(plan->n_steps)
+void l4e_pool_process(struct l4e_pool* pool, struct l4e_plan* plan);
+
+/*
+an engine owns the plan a real-time thread runs, and takes changes from one
+other thread (the UI) as commands on a single-producer single-consumer
+lock-free ring. the UI never touches the running plan: it compiles a new plan
+from its l4d document itself and sends it, and the engine swaps it in at the
+next block boundary. plans the engine is done with go back on a second ring,
+and the UI frees them. so the engine thread never blocks, allocates or frees,
+and the UI may edit its document (node meta included) whenever it likes.
+
+a plan takes over the state of the one before it (see l4e_carry()), so node
+indices may change between plans but nodes keep what was set on them. a pool
+too small for a plan is grown the same way: l4e_engine_send() sends the
+deques it needs ahead of the plan, and the old ones come back to be freed.
+
+if the retire ring is full the engine leaves plan commands queued until the
+UI has collected
+*/
+
+enum l4e_cmd_type {
+	L4E_CMD_PLAN = 1, // run plan from the next block on
+	L4E_CMD_SET, // proc.set(param, value) on (plan) node of the current plan
+	L4E_CMD_GROW, // use items for the pool's deques (sent by l4e_engine_send())
+};
+
+struct l4e_cmd {
+	enum l4e_cmd_type type;
+	int node, param;
+	float value;
+	struct l4e_plan* plan; // malloc()ed and compiled; the engine owns it
+	int* items; // L4E_CMD_GROW: capacity for every worker
+	long capacity;
+};
+
+struct l4e_ring {
+	unsigned head __attribute__((aligned(64))); // written by the producer
+	unsigned tail __attribute__((aligned(64))); // written by the consumer
+	unsigned mask;
+	struct l4e_cmd* cmds;
+};
+
+void l4e_ring_init(struct l4e_ring* ring, int capacity);
+void l4e_ring_free(struct l4e_ring* ring);
+// returns -1 if the ring is full
+int l4e_ring_push(struct l4e_ring* ring, const struct l4e_cmd* cmd);
+// returns 0 if the ring is empty
+int l4e_ring_pop(struct l4e_ring* ring, struct l4e_cmd* cmd);
+
+struct l4e_engine {
+	struct l4e_ring commands; // UI to engine
+	struct l4e_ring retired; // engine to UI, L4E_CMD_PLAN with plans to free
+
+	// engine thread only
+	struct l4e_plan* plan;
+	struct l4e_pool* pool; // may be NULL; plans it has no room for run alone
+	int n_blocks;
+
+	// UI thread only; the pool capacity sent so far
+	long capacity;
+};
+
+void l4e_engine_init(struct l4e_engine* e, int capacity, struct l4e_pool* pool);
+// frees every plan, once neither thread uses the engine any more
+void l4e_engine_free(struct l4e_engine* e);
+
+// UI thread. returns -1 if the command ring is full; try again later
+// (a plan the pool has no room for takes two entries)
+int l4e_engine_send(struct l4e_engine* e, const struct l4e_cmd* cmd);
+// UI thread. frees retired plans, returns how many
+int l4e_engine_collect(struct l4e_engine* e);
+
+// engine thread. applies pending commands, then runs one block; returns 0
+// if there is no plan yet
+int l4e_engine_process(struct l4e_engine* e);
+
+#define L4E_H
+#endif
@@ -0,0 +1,757 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "l4v.h"
+
+#define L4V_CELL_SIZE (1 << L4V_CELL_LOG2)
+
+static int64_t l4v__key(int cx, int cy)
+{
+	return (int64_t)(((uint64_t)(uint32_t)cy << 32) | (uint32_t)cx);
+}
+
+static uint64_t l4v__hash(int64_t key)
+{
+	uint64_t h = key;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static struct l4v_cell* l4v__cell_find(struct l4v_grid* g, int64_t key)
+{
+	if (g->cells_cap == 0) return NULL;
+	int mask = g->cells_cap - 1;
+	for (int i = l4v__hash(key) & mask; g->cells[i].entries != NULL; i = (i + 1) & mask) {
+		if (g->cells[i].key == key) return &g->cells[i];
+	}
+	return NULL;
+}
+
+static struct l4v_cell* l4v__cell_get(struct l4v_grid* g, int64_t key)
+{
+	struct l4v_cell* cell = l4v__cell_find(g, key);
+	if (cell != NULL) return cell;
+	if (2 * (g->n_cells + 1) > g->cells_cap) {
+		struct l4v_cell* old = g->cells;
+		int old_cap = g->cells_cap;
+		g->cells_cap = old_cap ? old_cap * 2 : 256;
+		g->cells = calloc(g->cells_cap, sizeof(*g->cells));
+		assert(g->cells != NULL);
+		for (int j = 0; j < old_cap; j++) {
+			if (old[j].entries == NULL) continue;
+			int i = l4v__hash(old[j].key) & (g->cells_cap - 1);
+			while (g->cells[i].entries != NULL) i = (i + 1) & (g->cells_cap - 1);
+			g->cells[i] = old[j];
+		}
+		free(old);
+	}
+	int i = l4v__hash(key) & (g->cells_cap - 1);
+	while (g->cells[i].entries != NULL) i = (i + 1) & (g->cells_cap - 1);
+	cell = &g->cells[i];
+	cell->key = key;
+	cell->cap = 4;
+	cell->entries = malloc(cell->cap * sizeof(*cell->entries));
+	assert(cell->entries != NULL);
+	g->n_cells++;
+	return cell;
+}
+
+static struct l4v_count* l4v__count_find(struct l4v_level* lv, int64_t key)
+{
+	if (lv->counts_cap == 0) return NULL;
+	int mask = lv->counts_cap - 1;
+	for (int i = l4v__hash(key) & mask; lv->counts[i].used; i = (i + 1) & mask) {
+		if (lv->counts[i].key == key) return &lv->counts[i];
+	}
+	return NULL;
+}
+
+static struct l4v_count* l4v__count_get(struct l4v_level* lv, int64_t key)
+{
+	struct l4v_count* count = l4v__count_find(lv, key);
+	if (count != NULL) return count;
+	if (2 * (lv->n_counts + 1) > lv->counts_cap) {
+		struct l4v_count* old = lv->counts;
+		int old_cap = lv->counts_cap;
+		lv->counts_cap = old_cap ? old_cap * 2 : 64;
+		lv->counts = calloc(lv->counts_cap, sizeof(*lv->counts));
+		assert(lv->counts != NULL);
+		for (int j = 0; j < old_cap; j++) {
+			if (!old[j].used) continue;
+			int i = l4v__hash(old[j].key) & (lv->counts_cap - 1);
+			while (lv->counts[i].used) i = (i + 1) & (lv->counts_cap - 1);
+			lv->counts[i] = old[j];
+		}
+		free(old);
+	}
+	int i = l4v__hash(key) & (lv->counts_cap - 1);
+	while (lv->counts[i].used) i = (i + 1) & (lv->counts_cap - 1);
+	count = &lv->counts[i];
+	count->key = key;
+	count->used = 1;
+	lv->n_counts++;
+	return count;
+}
+
+// moves a node from (ox, oy) to (x, y) in the levels above the cells; a tile
+// the node stays in, and every tile above it, is left alone
+static void l4v__count_move(struct l4v_grid* g, int ox, int oy, int x, int y)
+{
+	for (int l = 1; l <= L4V_LEVELS; l++) {
+		int shift = L4V_CELL_LOG2 + l;
+		if ((ox >> shift) == (x >> shift) && (oy >> shift) == (y >> shift)) break;
+		l4v__count_get(&g->levels[l - 1], l4v__key(ox >> shift, oy >> shift))->n--;
+		l4v__count_get(&g->levels[l - 1], l4v__key(x >> shift, y >> shift))->n++;
+	}
+}
+
+static void l4v__count_add(struct l4v_grid* g, int x, int y, int n)
+{
+	for (int l = 1; l <= L4V_LEVELS; l++) {
+		int shift = L4V_CELL_LOG2 + l;
+		l4v__count_get(&g->levels[l - 1], l4v__key(x >> shift, y >> shift))->n += n;
+	}
+}
+
+static void l4v__insert(struct l4v_grid* g, int node)
+{
+	struct l4v_cell* cell = l4v__cell_get(g, l4v__key(g->xs[node] >> L4V_CELL_LOG2, g->ys[node] >> L4V_CELL_LOG2));
+	if (cell->n == cell->cap) {
+		cell->cap *= 2;
+		cell->entries = realloc(cell->entries, cell->cap * sizeof(*cell->entries));
+		assert(cell->entries != NULL);
+	}
+	g->slots[node] = cell->n;
+	cell->entries[cell->n++] = (struct l4v_entry) { .node = node, .x = g->xs[node], .y = g->ys[node] };
+}
+
+static struct l4v_cell* l4v__cell_of(struct l4v_grid* g, int node)
+{
+	struct l4v_cell* cell = l4v__cell_find(g, l4v__key(g->xs[node] >> L4V_CELL_LOG2, g->ys[node] >> L4V_CELL_LOG2));
+	assert(cell != NULL && cell->entries[g->slots[node]].node == node);
+	return cell;
+}
+
+static void l4v__remove(struct l4v_grid* g, int node)
+{
+	struct l4v_cell* cell = l4v__cell_of(g, node);
+	struct l4v_entry last = cell->entries[--cell->n];
+	cell->entries[g->slots[node]] = last;
+	g->slots[last.node] = g->slots[node];
+}
+
+void l4v_grid_init(struct l4v_grid* g)
+{
+	memset(g, 0, sizeof(*g));
+	dynary_init(&g->result_dy, (void**) &g->result, sizeof(*g->result));
+	dynary_init(&g->items_dy, (void**) &g->items, sizeof(*g->items));
+}
+
+void l4v_grid_reset(struct l4v_grid* g)
+{
+	for (int j = 0; j < g->cells_cap; j++) free(g->cells[j].entries);
+	free(g->cells);
+	g->cells = NULL;
+	g->n_cells = g->cells_cap = 0;
+	for (int l = 0; l < L4V_LEVELS; l++) {
+		free(g->levels[l].counts);
+		memset(&g->levels[l], 0, sizeof(g->levels[l]));
+	}
+	g->n_nodes = 0;
+}
+
+void l4v_grid_free(struct l4v_grid* g)
+{
+	l4v_grid_reset(g);
+	free(g->xs);
+	free(g->ys);
+	free(g->slots);
+	free(g->result);
+	free(g->items);
+	memset(g, 0, sizeof(*g));
+}
+
+void l4v_grid_sync(struct l4v_grid* g, struct l4d_container* c)
+{
+	int n = c->nodes_dy.n;
+	if (n < g->n_nodes) l4v_grid_reset(g);
+	if (n > g->nodes_cap) {
+		while (g->nodes_cap < n) g->nodes_cap = g->nodes_cap ? g->nodes_cap * 2 : 64;
+		g->xs = realloc(g->xs, g->nodes_cap * sizeof(*g->xs));
+		g->ys = realloc(g->ys, g->nodes_cap * sizeof(*g->ys));
+		g->slots = realloc(g->slots, g->nodes_cap * sizeof(*g->slots));
+		assert(g->xs != NULL && g->ys != NULL && g->slots != NULL);
+	}
+	for (int i = g->n_nodes; i < n; i++) {
+		g->xs[i] = c->nodes[i].meta.x;
+		g->ys[i] = c->nodes[i].meta.y;
+		l4v__insert(g, i);
+		l4v__count_add(g, g->xs[i], g->ys[i], 1);
+	}
+	g->n_nodes = n;
+}
+
+void l4v_grid_move(struct l4v_grid* g, int node, int x, int y)
+{
+	assert(node >= 0 && node < g->n_nodes);
+	int same_cell = (x >> L4V_CELL_LOG2) == (g->xs[node] >> L4V_CELL_LOG2)
+		&& (y >> L4V_CELL_LOG2) == (g->ys[node] >> L4V_CELL_LOG2);
+	if (same_cell) {
+		struct l4v_entry* e = &l4v__cell_of(g, node)->entries[g->slots[node]];
+		e->x = x;
+		e->y = y;
+	} else {
+		l4v__remove(g, node);
+		l4v__count_move(g, g->xs[node], g->ys[node], x, y);
+	}
+	g->xs[node] = x;
+	g->ys[node] = y;
+	if (!same_cell) l4v__insert(g, node);
+}
+
+void l4v_grid_remove(struct l4v_grid* g, int node)
+{
+	assert(node >= 0 && node < g->n_nodes);
+	l4v__remove(g, node);
+	l4v__count_add(g, g->xs[node], g->ys[node], -1);
+	int last = --g->n_nodes;
+	if (last == node) return;
+	l4v__cell_of(g, last)->entries[g->slots[last]].node = node;
+	g->xs[node] = g->xs[last];
+	g->ys[node] = g->ys[last];
+	g->slots[node] = g->slots[last];
+}
+
+static int l4v__overlaps(struct l4v_entry* e, int x0, int y0, int x1, int y1)
+{
+	return e->x < x1 && e->x + L4V_NODE_W > x0 && e->y < y1 && e->y + L4V_NODE_H > y0;
+}
+
+static void l4v__query_cell(struct l4v_grid* g, struct l4v_cell* cell, int x0, int y0, int x1, int y1)
+{
+	for (int j = 0; j < cell->n; j++) {
+		struct l4v_entry* e = &cell->entries[j];
+		if (l4v__overlaps(e, x0, y0, x1, y1)) *(int*)dynary_append(&g->result_dy) = e->node;
+	}
+}
+
+static int l4v__cmp_int(const void* a, const void* b)
+{
+	int x = *(const int*)a;
+	int y = *(const int*)b;
+	return (x > y) - (x < y);
+}
+
+int l4v_grid_query(struct l4v_grid* g, int x0, int y0, int x1, int y1, int** nodes)
+{
+	g->result_dy.n = 0;
+	if (x0 < x1 && y0 < y1) {
+		// cells whose nodes can reach into the box
+		int cx0 = (x0 - L4V_NODE_W + 1) >> L4V_CELL_LOG2;
+		int cy0 = (y0 - L4V_NODE_H + 1) >> L4V_CELL_LOG2;
+		int cx1 = (x1 - 1) >> L4V_CELL_LOG2;
+		int cy1 = (y1 - 1) >> L4V_CELL_LOG2;
+		if ((int64_t)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) > g->n_cells) {
+			// a view of more cells than there are is cheaper to scan
+			for (int j = 0; j < g->cells_cap; j++) {
+				if (g->cells[j].entries != NULL) l4v__query_cell(g, &g->cells[j], x0, y0, x1, y1);
+			}
+		} else {
+			for (int cy = cy0; cy <= cy1; cy++) {
+				for (int cx = cx0; cx <= cx1; cx++) {
+					struct l4v_cell* cell = l4v__cell_find(g, l4v__key(cx, cy));
+					if (cell != NULL) l4v__query_cell(g, cell, x0, y0, x1, y1);
+				}
+			}
+		}
+	}
+	qsort(g->result, g->result_dy.n, sizeof(*g->result), l4v__cmp_int);
+	*nodes = g->result;
+	return g->result_dy.n;
+}
+
+int l4v_grid_hit(struct l4v_grid* g, int x, int y)
+{
+	int top = -1;
+	for (int cy = (y - L4V_NODE_H + 1) >> L4V_CELL_LOG2; cy <= y >> L4V_CELL_LOG2; cy++) {
+		for (int cx = (x - L4V_NODE_W + 1) >> L4V_CELL_LOG2; cx <= x >> L4V_CELL_LOG2; cx++) {
+			struct l4v_cell* cell = l4v__cell_find(g, l4v__key(cx, cy));
+			if (cell == NULL) continue;
+			for (int j = 0; j < cell->n; j++) {
+				struct l4v_entry* e = &cell->entries[j];
+				if (e->node > top && l4v__overlaps(e, x, y, x + 1, y + 1)) top = e->node;
+			}
+		}
+	}
+	return top;
+}
+
+static int l4v__tile_count(struct l4v_grid* g, int level, int tx, int ty)
+{
+	if (level == 0) {
+		struct l4v_cell* cell = l4v__cell_find(g, l4v__key(tx, ty));
+		return cell != NULL ? cell->n : 0;
+	}
+	struct l4v_count* count = l4v__count_find(&g->levels[level - 1], l4v__key(tx, ty));
+	return count != NULL ? count->n : 0;
+}
+
+static void l4v__item_add(struct l4v_grid* g, struct l4v_item item)
+{
+	*(struct l4v_item*)dynary_append(&g->items_dy) = item;
+}
+
+// every node of a tile that is in the view, by way of the non-empty tiles
+// below it
+static void l4v__view_nodes(struct l4v_grid* g, int level, int tx, int ty, int n, int x0, int y0, int x1, int y1)
+{
+	if (level == 0) {
+		struct l4v_cell* cell = l4v__cell_find(g, l4v__key(tx, ty));
+		if (cell == NULL) return;
+		for (int j = 0; j < cell->n; j++) {
+			struct l4v_entry* e = &cell->entries[j];
+			if (l4v__overlaps(e, x0, y0, x1, y1)) *(int*)dynary_append(&g->result_dy) = e->node;
+		}
+		return;
+	}
+	// stop once the tiles seen hold all n nodes
+	for (int i = 0; i < 4 && n > 0; i++) {
+		int cx = 2 * tx + (i & 1);
+		int cy = 2 * ty + (i >> 1);
+		int cn = l4v__tile_count(g, level - 1, cx, cy);
+		if (cn > 0) l4v__view_nodes(g, level - 1, cx, cy, cn, x0, y0, x1, y1);
+		n -= cn;
+	}
+}
+
+static void l4v__view_tile(struct l4v_grid* g, int level, int tx, int ty, int n, int budget, int x0, int y0, int x1, int y1)
+{
+	if (n <= 0) return;
+	if (n <= budget) {
+		l4v__view_nodes(g, level, tx, ty, n, x0, y0, x1, y1);
+	} else {
+		int shift = L4V_CELL_LOG2 + level;
+		l4v__item_add(g, (struct l4v_item) { .node = -1, .x = tx * (1 << shift), .y = ty * (1 << shift), .w = 1 << shift, .h = 1 << shift, .n = n });
+	}
+}
+
+int l4v_grid_view(struct l4v_grid* g, int x0, int y0, int x1, int y1, float scale, struct l4v_item** items)
+{
+	assert(scale > 0);
+	// tiles go straight to the items, nodes are sorted before they follow
+	g->items_dy.n = 0;
+	g->result_dy.n = 0;
+	if (x0 < x1 && y0 < y1) {
+		int level = 0;
+		while (level < L4V_LEVELS && (double)(L4V_CELL_SIZE << level) * scale < L4V_TILE_PX) level++;
+		int shift = L4V_CELL_LOG2 + level;
+		double tile_px = (double)(1 << shift) * scale;
+		double budget = tile_px * tile_px / L4V_NODE_AREA;
+		int ibudget = budget < 1 ? 1 : budget > 1 << 30 ? 1 << 30 : (int)budget;
+		// nodes under a pixel wide are tiles whatever their number
+		if (L4V_NODE_W * scale < 1) ibudget = 0;
+
+		int tx0 = (x0 - L4V_NODE_W + 1) >> shift;
+		int ty0 = (y0 - L4V_NODE_H + 1) >> shift;
+		int tx1 = (x1 - 1) >> shift;
+		int ty1 = (y1 - 1) >> shift;
+		int n_tiles = level == 0 ? g->n_cells : g->levels[level - 1].n_counts;
+		if ((int64_t)(tx1 - tx0 + 1) * (ty1 - ty0 + 1) > n_tiles) {
+			// as in l4v_grid_query(), few tiles are cheaper to scan
+			for (int j = 0; level == 0 && j < g->cells_cap; j++) {
+				struct l4v_cell* cell = &g->cells[j];
+				if (cell->entries == NULL) continue;
+				int tx = (int32_t)(uint32_t)cell->key;
+				int ty = (int32_t)(cell->key >> 32);
+				if (tx < tx0 || tx > tx1 || ty < ty0 || ty > ty1) continue;
+				l4v__view_tile(g, 0, tx, ty, cell->n, ibudget, x0, y0, x1, y1);
+			}
+			struct l4v_level* lv = level > 0 ? &g->levels[level - 1] : NULL;
+			for (int j = 0; lv != NULL && j < lv->counts_cap; j++) {
+				struct l4v_count* count = &lv->counts[j];
+				if (!count->used) continue;
+				int tx = (int32_t)(uint32_t)count->key;
+				int ty = (int32_t)(count->key >> 32);
+				if (tx < tx0 || tx > tx1 || ty < ty0 || ty > ty1) continue;
+				l4v__view_tile(g, level, tx, ty, count->n, ibudget, x0, y0, x1, y1);
+			}
+		} else {
+			for (int ty = ty0; ty <= ty1; ty++) {
+				for (int tx = tx0; tx <= tx1; tx++) {
+					l4v__view_tile(g, level, tx, ty, l4v__tile_count(g, level, tx, ty), ibudget, x0, y0, x1, y1);
+				}
+			}
+		}
+	}
+	qsort(g->result, g->result_dy.n, sizeof(*g->result), l4v__cmp_int);
+	for (int j = 0; j < g->result_dy.n; j++) {
+		int node = g->result[j];
+		l4v__item_add(g, (struct l4v_item) { .node = node, .x = g->xs[node], .y = g->ys[node], .w = L4V_NODE_W, .h = L4V_NODE_H, .n = 1 });
+	}
+	*items = g->items;
+	return g->items_dy.n;
+}
+
+
+
+#ifdef TEST
+
+#include <stdio.h>
+
+#define OK "\e[32m\e[1mOK\e[0m "
+#define FAIL "\e[41m\e[33m\e[1m!!\e[0m "
+
+static int n_failed;
+
+static int brute_query(struct l4d_container* c, int x0, int y0, int x1, int y1, int* out)
+{
+	int n = 0;
+	for (int i = 0; i < c->nodes_dy.n; i++) {
+		struct l4d_nodemeta* m = &c->nodes[i].meta;
+		if (m->x < x1 && m->x + L4V_NODE_W > x0 && m->y < y1 && m->y + L4V_NODE_H > y0) out[n++] = i;
+	}
+	return n;
+}
+
+static int brute_hit(struct l4d_container* c, int x, int y)
+{
+	int top = -1;
+	for (int i = 0; i < c->nodes_dy.n; i++) {
+		struct l4d_nodemeta* m = &c->nodes[i].meta;
+		if (m->x <= x && x < m->x + L4V_NODE_W && m->y <= y && y < m->y + L4V_NODE_H) top = i;
+	}
+	return top;
+}
+
+// random nodes (some far out, some negative), moved about and removed,
+// checked against brute force
+static void test_grid()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	struct l4v_grid g;
+	l4v_grid_init(&g);
+	srand(7);
+	const int n = 20000;
+	const int span = 20000;
+	int* expected = malloc(n * sizeof(*expected));
+	assert(expected != NULL);
+	int n_checked = 0;
+	int n_bad = 0;
+	for (int round = 0; round < 4; round++) {
+		for (int i = 0; i < n / 4; i++) {
+			int node = l4d_node_add(c);
+			struct l4d_nodemeta* m = &c->nodes[node].meta;
+			m->x = rand() % span - span / 2;
+			m->y = rand() % span - span / 2;
+			if (i == 0) m->x = 1 << 28;
+		}
+		l4v_grid_sync(&g, c);
+		for (int i = 0; i < n / 8; i++) {
+			int node = rand() % c->nodes_dy.n;
+			struct l4d_nodemeta* m = &c->nodes[node].meta;
+			m->x += rand() % 600 - 300;
+			m->y += rand() % 600 - 300;
+			l4v_grid_move(&g, node, m->x, m->y);
+		}
+		for (int i = 0; i < n / 32; i++) {
+			int node = rand() % c->nodes_dy.n;
+			l4d_node_remove(c, node);
+			l4v_grid_remove(&g, node);
+		}
+		for (int q = 0; q < 200; q++) {
+			int x0 = rand() % span - span / 2;
+			int y0 = rand() % span - span / 2;
+			int w = q == 0 ? 2 * span : 1 + rand() % 2000;
+			int h = q == 0 ? 2 * span : 1 + rand() % 1000;
+			if (q == 0) x0 = y0 = -span;
+			int* got;
+			int n_got = l4v_grid_query(&g, x0, y0, x0 + w, y0 + h, &got);
+			int n_expected = brute_query(c, x0, y0, x0 + w, y0 + h, expected);
+			if (n_got != n_expected || memcmp(got, expected, n_got * sizeof(*got)) != 0) n_bad++;
+			n_checked++;
+		}
+		for (int q = 0; q < 2000; q++) {
+			// aim near nodes, so there are hits and overlaps
+			struct l4d_nodemeta* m = &c->nodes[rand() % c->nodes_dy.n].meta;
+			int x = m->x + rand() % 60 - 10;
+			int y = m->y + rand() % 30 - 5;
+			if (l4v_grid_hit(&g, x, y) != brute_hit(c, x, y)) n_bad++;
+			n_checked++;
+		}
+	}
+	// and the pyramid counts what is left
+	struct l4v_item* items;
+	int n_items = l4v_grid_view(&g, -span, -span, 1 << 29, span, 1.0f / (1 << 20), &items);
+	int n_counted = 0;
+	for (int i = 0; i < n_items; i++) n_counted += items[i].node < 0 ? items[i].n : 1;
+	if (n_counted != c->nodes_dy.n) n_bad++;
+	n_checked++;
+	int n_cells = g.n_cells;
+	// fewer nodes than indexed starts over
+	c->nodes_dy.n = 10;
+	l4v_grid_sync(&g, c);
+	int* got;
+	if (l4v_grid_query(&g, -span, -span, span, span, &got) != brute_query(c, -span, -span, span, span, expected)) n_bad++;
+	if (n_bad == 0) {
+		printf(OK "grid of %d nodes in %d cells: %d queries match\n", n, n_cells, n_checked);
+	} else {
+		printf(FAIL "grid: %d of %d queries differ\n", n_bad, n_checked);
+		n_failed++;
+	}
+	free(expected);
+	l4v_grid_free(&g);
+	l4d_free(&d);
+}
+
+static int cmp_tile(const void* a, const void* b)
+{
+	const struct l4v_item* x = a;
+	const struct l4v_item* y = b;
+	if (x->y != y->y) return (x->y > y->y) - (x->y < y->y);
+	return (x->x > y->x) - (x->x < y->x);
+}
+
+static int find_tile(struct l4v_item* tiles, int n_tiles, int x, int y)
+{
+	int lo = 0, hi = n_tiles;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		struct l4v_item* t = &tiles[mid];
+		if (t->y < y || (t->y == y && t->x < x)) lo = mid + 1; else hi = mid;
+	}
+	return lo < n_tiles && tiles[lo].x == x && tiles[lo].y == y ? lo : -1;
+}
+
+static int floor_div(int a, int b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/*
+views at scales from zoomed in to the whole container in a few pixels: nodes
+come in drawing order, every visible node is drawn or counted in a tile, the
+tile counts are right after moves, and the item count stays within what the
+screen can show
+*/
+static void test_view()
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	struct l4v_grid g;
+	l4v_grid_init(&g);
+	srand(11);
+	const int n = 20000;
+	const int span = 40000;
+	for (int i = 0; i < n; i++) {
+		int node = l4d_node_add(c);
+		struct l4d_nodemeta* m = &c->nodes[node].meta;
+		// a dense clump and a sparse spread
+		int r = i % 4 == 0 ? span : 2000;
+		m->x = rand() % r - r / 2;
+		m->y = rand() % r - r / 2;
+	}
+	l4v_grid_sync(&g, c);
+	int* expected = malloc(n * sizeof(*expected));
+	char* drawn = malloc(n);
+	int* counts = malloc(n * sizeof(*counts));
+	assert(expected != NULL && drawn != NULL && counts != NULL);
+
+	const float scales[] = { 4, 1, 0.5f, 0.1f, 1.0f / 64, 1.0f / 1024, 1e-6f };
+	int n_checked = 0;
+	int n_bad = 0;
+	int max_items = 0;
+	for (int q = 0; q < 140; q++) {
+		for (int i = 0; i < 50; i++) {
+			int node = rand() % n;
+			struct l4d_nodemeta* m = &c->nodes[node].meta;
+			m->x += rand() % 4000 - 2000;
+			m->y += rand() % 4000 - 2000;
+			l4v_grid_move(&g, node, m->x, m->y);
+		}
+		float scale = scales[q % (sizeof(scales) / sizeof(scales[0]))];
+		// a 1280x720 screen somewhere near the middle
+		int w = 1 + (int)(1280 / scale);
+		int h = 1 + (int)(720 / scale);
+		if (w > 4 * span) w = 4 * span;
+		if (h > 4 * span) h = 4 * span;
+		int x0 = rand() % 4000 - 2000 - w / 2;
+		int y0 = rand() % 4000 - 2000 - h / 2;
+
+		struct l4v_item* items;
+		int n_items = l4v_grid_view(&g, x0, y0, x0 + w, y0 + h, scale, &items);
+		int n_tiles = 0;
+		while (n_tiles < n_items && items[n_tiles].node < 0) n_tiles++;
+		struct l4v_item* tiles = items;
+		qsort(tiles, n_tiles, sizeof(*tiles), cmp_tile);
+		int ok = 1;
+
+		memset(drawn, 0, n);
+		for (int j = n_tiles; j < n_items; j++) {
+			struct l4v_item* it = &items[j];
+			struct l4d_nodemeta* m = &c->nodes[it->node].meta;
+			if (j > n_tiles && it->node <= items[j - 1].node) ok = 0;
+			if (it->x != m->x || it->y != m->y) ok = 0;
+			drawn[it->node] = 1;
+		}
+		int tile_w = n_tiles ? tiles[0].w : 0;
+		memset(counts, 0, n * sizeof(*counts));
+		for (int i = 0; n_tiles && i < n; i++) {
+			struct l4d_nodemeta* m = &c->nodes[i].meta;
+			int t = find_tile(tiles, n_tiles, floor_div(m->x, tile_w) * tile_w, floor_div(m->y, tile_w) * tile_w);
+			if (t >= 0) counts[t]++;
+		}
+		for (int t = 0; t < n_tiles; t++) {
+			if (tiles[t].w != tile_w || tiles[t].n != counts[t]) ok = 0;
+		}
+		int n_expected = brute_query(c, x0, y0, x0 + w, y0 + h, expected);
+		int n_drawn = 0;
+		for (int i = 0; i < n_expected; i++) {
+			struct l4d_nodemeta* m = &c->nodes[expected[i]].meta;
+			if (drawn[expected[i]]) {
+				n_drawn++;
+			} else if (n_tiles == 0 || find_tile(tiles, n_tiles, floor_div(m->x, tile_w) * tile_w, floor_div(m->y, tile_w) * tile_w) < 0) {
+				ok = 0;
+			}
+		}
+		if (n_drawn != n_items - n_tiles) ok = 0;
+
+		// no more than a node per L4V_NODE_AREA pixels, or a tile per
+		// L4V_TILE_PX square, give or take the tiles on the border
+		double px = 1280 + 2 * L4V_TILE_PX, py = 720 + 2 * L4V_TILE_PX;
+		double bound = px * py / (L4V_NODE_AREA < L4V_TILE_PX * L4V_TILE_PX ? L4V_NODE_AREA : L4V_TILE_PX * L4V_TILE_PX);
+		if (scale >= 1.0f / 1024 && n_items > bound) ok = 0;
+		if (n_items > max_items && scale < 1) max_items = n_items;
+
+		if (!ok) n_bad++;
+		n_checked++;
+	}
+	if (n_bad == 0) {
+		printf(OK "view of %d nodes: %d views match, at most %d items zoomed out\n", n, n_checked, max_items);
+	} else {
+		printf(FAIL "view: %d of %d views wrong\n", n_bad, n_checked);
+		n_failed++;
+	}
+	free(counts);
+	free(drawn);
+	free(expected);
+	l4v_grid_free(&g);
+	l4d_free(&d);
+}
+
+int main(int argc, char** argv)
+{
+	test_grid();
+	test_view();
+
+	if (n_failed) {
+		printf("\n %d TEST(S) FAILED\n", n_failed);
+		return EXIT_FAILURE;
+	} else {
+		printf("\n ALL TESTS PASSED\n");
+		return EXIT_SUCCESS;
+	}
+}
+
+#endif
+
+
+
+#ifdef BENCH
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+/*
+view benchmark: a 1920x1080 view panned across containers of 20 up to 1M
+nodes (about 400 of them per screen), culled with the grid and by scanning
+every node, and the whole container zoomed out to fit. prints one JSON
+object per line
+*/
+
+#define BENCH_FRAMES (200)
+
+static double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_view(int n)
+{
+	struct l4d d;
+	memset(&d, 0, sizeof(d));
+	struct l4d_container* c = l4d_container_new(&d);
+	srand(1);
+	// about 400 nodes per screen
+	int span = 1 + (int)(sqrt(n / 400.0) * 1920);
+	for (int i = 0; i < n; i++) {
+		int node = l4d_node_add(c);
+		struct l4d_nodemeta* m = &c->nodes[node].meta;
+		m->x = rand() % span;
+		m->y = rand() % span;
+	}
+	struct l4v_grid g;
+	l4v_grid_init(&g);
+	double t0 = bench_now();
+	l4v_grid_sync(&g, c);
+	double index_s = bench_now() - t0;
+
+	long n_visible = 0;
+	t0 = bench_now();
+	for (int f = 0; f < BENCH_FRAMES; f++) {
+		int x = (f * 37) % span;
+		int y = (f * 53) % span;
+		int* nodes;
+		n_visible += l4v_grid_query(&g, x, y, x + 1920, y + 1080, &nodes);
+		// and the hit test under the mouse
+		n_visible += l4v_grid_hit(&g, x + 960, y + 540) >= 0;
+	}
+	double grid_s = (bench_now() - t0) / BENCH_FRAMES;
+
+	// what the view did before: every node, every frame
+	long n_scan = 0;
+	t0 = bench_now();
+	for (int f = 0; f < BENCH_FRAMES; f++) {
+		int x = (f * 37) % span;
+		int y = (f * 53) % span;
+		for (int i = 0; i < n; i++) {
+			struct l4d_nodemeta* m = &c->nodes[i].meta;
+			n_scan += m->x < x + 1920 && m->x + L4V_NODE_W > x && m->y < y + 1080 && m->y + L4V_NODE_H > y;
+		}
+	}
+	double scan_s = (bench_now() - t0) / BENCH_FRAMES;
+
+	// zoomed out to the whole container
+	float scale = 1080.0f / span;
+	long n_items = 0;
+	t0 = bench_now();
+	for (int f = 0; f < BENCH_FRAMES; f++) {
+		struct l4v_item* items;
+		n_items += l4v_grid_view(&g, 0, 0, span, span, scale, &items);
+	}
+	double lod_s = (bench_now() - t0) / BENCH_FRAMES;
+
+	printf("{\"nodes\":%d,\"index_ms\":%.3f,\"visible\":%ld,\"scanned_visible\":%ld,\"grid_us_per_frame\":%.2f,\"scan_us_per_frame\":%.2f,\"zoomed_out_items\":%ld,\"zoomed_out_us_per_frame\":%.2f}\n",
+		n, index_s * 1e3, n_visible / BENCH_FRAMES, n_scan / BENCH_FRAMES, grid_s * 1e6, scan_s * 1e6, n_items / BENCH_FRAMES, lod_s * 1e6);
+	fflush(stdout);
+	l4v_grid_free(&g);
+	l4d_free(&d);
+}
+
+int main(int argc, char** argv)
+{
+	int max_nodes = argc > 1 ? atoi(argv[1]) : 1 << 20;
+	bench_view(20);
+	for (int n = 1 << 10; n <= max_nodes; n <<= 2) bench_view(n);
+	return EXIT_SUCCESS;
+}
+
+#endif
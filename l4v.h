@@ -0,0 +1,121 @@
+#ifndef L4V_H
+
+#include <stdint.h>
+
+#include "dynary.h"
+#include "l4d.h"
+
+/*
+graph view support, kept apart from the window code so it can be tested
+without a display.
+
+nodes are drawn as L4V_NODE_W x L4V_NODE_H boxes at (meta.x, meta.y), in
+index order, so a node covers every node before it
+*/
+
+#define L4V_NODE_W (40)
+#define L4V_NODE_H (20)
+
+/*
+a uniform grid over node positions, for culling and hit testing in time
+proportional to what is on screen. a node is in the one cell holding its top
+left corner; cells are larger than nodes, so a node only reaches into the
+cells right and below of its own. cells live in a hash table, so positions
+are unbounded. the index follows a container by node index: l4v_grid_sync()
+picks up added nodes, and whoever moves or removes a node calls
+l4v_grid_move() or l4v_grid_remove()
+*/
+
+#define L4V_CELL_LOG2 (8)
+
+// positions are kept next to the node, so a query reads cells front to back
+struct l4v_entry {
+	int node, x, y;
+};
+
+struct l4v_cell {
+	int64_t key;
+	int n, cap;
+	struct l4v_entry* entries; // NULL if the table slot was never used
+};
+
+/*
+a count pyramid over the grid, for drawing views too far out to draw every
+node. a tile of level l covers 2^l x 2^l cells (level 0 is the cells
+themselves) and counts the nodes with their top left corner in it
+*/
+
+#define L4V_LEVELS (12)
+
+struct l4v_count {
+	int64_t key;
+	int used, n;
+};
+
+struct l4v_level {
+	struct l4v_count* counts;
+	int n_counts, counts_cap;
+};
+
+// one thing for the view to draw: a node, or a tile standing in for the n
+// nodes in it. positions are in container space
+struct l4v_item {
+	int node; // -1 for a tile
+	int x, y, w, h;
+	int n;
+};
+
+struct l4v_grid {
+	int n_nodes, nodes_cap;
+	int* xs; // positions as indexed
+	int* ys;
+	int* slots; // where each node is in its cell's entries
+
+	struct l4v_cell* cells;
+	int n_cells, cells_cap;
+
+	struct l4v_level levels[L4V_LEVELS]; // levels[l - 1] is level l
+
+	struct dynary result_dy;
+	int* result;
+
+	struct dynary items_dy;
+	struct l4v_item* items;
+};
+
+void l4v_grid_init(struct l4v_grid* g);
+void l4v_grid_free(struct l4v_grid* g);
+
+// indexes the nodes of c past g->n_nodes. if c has fewer nodes than are
+// indexed (or after l4v_grid_reset()), everything is indexed again
+void l4v_grid_sync(struct l4v_grid* g, struct l4d_container* c);
+void l4v_grid_reset(struct l4v_grid* g);
+
+void l4v_grid_move(struct l4v_grid* g, int node, int x, int y);
+// after l4d_node_remove(): the last node takes the index of node
+void l4v_grid_remove(struct l4v_grid* g, int node);
+
+// nodes overlapping [x0,x1) x [y0,y1), in drawing order. *nodes is valid
+// until the next query
+int l4v_grid_query(struct l4v_grid* g, int x0, int y0, int x1, int y1, int** nodes);
+
+// the topmost node containing (x, y), or -1
+int l4v_grid_hit(struct l4v_grid* g, int x, int y);
+
+/*
+level of detail. tiles are drawn at least L4V_TILE_PX pixels wide; the view
+picks the finest level where they are, and draws the nodes of a tile only if
+it has no more than one per L4V_NODE_AREA square pixels, so the number of
+items is bounded by the screen size rather than the node count
+*/
+
+#define L4V_TILE_PX (8)
+#define L4V_NODE_AREA (64)
+
+// what to draw of [x0,x1) x [y0,y1) at scale pixels per unit: tiles first,
+// in no particular order, then nodes in drawing order. *items is valid until
+// the next call
+int l4v_grid_view(struct l4v_grid* g, int x0, int y0, int x1, int y1, float scale, struct l4v_item** items);
+
+#define L4V_H
+#endif